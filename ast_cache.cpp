@@ -0,0 +1,334 @@
+#include "ast_cache.h"
+#include "compact_ast.h"
+#include "intern.h"
+#include "token_stream.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef AST_CACHE_DEBUG
+#define DEBUG_PRINT(...) fprintf(stderr, __VA_ARGS__)
+#else
+#define DEBUG_PRINT(...)
+#endif
+
+#define AST_CACHE_MAGIC "SEAST\0\0\0"
+#define AST_CACHE_ALIGNMENT 8
+
+#define FNV64_BASIS 14695981039346656037ull
+#define FNV64_PRIME 1099511628211ull
+
+enum class AstCacheSection : uint32_t {
+  TOKEN_TYPES,
+  TOKEN_OFFSETS,
+  TOKEN_LENGTHS,
+  TOKEN_LONG_LENGTHS,
+  // One token per distinct identifier, in the order of the ids stored in IDENTIFIERS
+  NAMES,
+  IDENTIFIERS,
+  TYPES,
+  QUALIFIERS,
+  DECLARATIONS,
+  STATEMENTS,
+  BLOCK_TAGS,
+  BLOCKS,
+  EXPRS,
+  PARAMS,
+  FUNCTIONS,
+  STRUCTS,
+  ENUMS,
+  PRIMARY_TAGS,
+  COUNT,
+};
+
+// Also catches a layout change that forgot to bump the version
+const uint32_t ast_cache_item_sizes[] = {
+  sizeof(uint8_t),
+  sizeof(uint32_t),
+  sizeof(uint16_t),
+  sizeof(TokenLongLength),
+  sizeof(TokenIndex),
+  sizeof(CompactIdentifier),
+  sizeof(CompactType),
+  sizeof(ASTType),
+  sizeof(CompactDeclaration),
+  sizeof(CompactStatement),
+  sizeof(CompactTag),
+  sizeof(CompactBlock),
+  sizeof(CompactExpr),
+  sizeof(CompactParam),
+  sizeof(CompactFunction),
+  sizeof(CompactStruct),
+  sizeof(CompactEnum),
+  sizeof(CompactTag),
+};
+
+static_assert(sizeof(ast_cache_item_sizes) / sizeof(uint32_t) == (size_t) AstCacheSection::COUNT,
+    "ast_cache_item_sizes must cover every section");
+
+struct AstCacheSectionHeader {
+  uint64_t offset;
+  uint32_t count;
+  uint32_t item_size;
+};
+
+struct AstCacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t section_count;
+  uint64_t file_size;
+  uint64_t source_size;
+  uint64_t source_hash;
+  CompactAstStats stats;
+  AstCacheSectionHeader sections[(size_t) AstCacheSection::COUNT];
+};
+
+// FNV-1a over 8 byte words, folding the high half down after each step
+uint64_t astCacheHash(const char* source, size_t size) {
+  uint64_t hash = FNV64_BASIS ^ size;
+  size_t i = 0;
+
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    memcpy(&word, source + i, 8);
+    hash = (hash ^ word) * FNV64_PRIME;
+    hash ^= hash >> 32;
+  }
+  for (; i < size; i++) {
+    hash = (hash ^ (unsigned char) source[i]) * FNV64_PRIME;
+  }
+
+  return hash;
+}
+
+struct CacheWriter {
+  FILE* file;
+  uint64_t offset;
+  AstCacheHeader header;
+  bool failed;
+};
+
+void writeBytes(CacheWriter* writer, const void* data, size_t size) {
+  if (size == 0) return;
+  if (fwrite(data, 1, size, writer->file) != size) writer->failed = true;
+  writer->offset += size;
+}
+
+void writeSection(CacheWriter* writer, AstCacheSection section, const void* items, uint32_t count) {
+  static const char zeros[AST_CACHE_ALIGNMENT] = {};
+  writeBytes(writer, zeros, (AST_CACHE_ALIGNMENT - writer->offset % AST_CACHE_ALIGNMENT) % AST_CACHE_ALIGNMENT);
+
+  uint32_t item_size = ast_cache_item_sizes[(size_t) section];
+  writer->header.sections[(size_t) section] = {writer->offset, count, item_size};
+  writeBytes(writer, items, (size_t) count * item_size);
+}
+
+template <typename T>
+void writeNodes(CacheWriter* writer, AstCacheSection section, const NodeArray<T>& array) {
+  writeSection(writer, section, array.items, array.count);
+}
+
+/*
+ * Intern ids are only meaningful in the process that handed them out. The
+ * file numbers the distinct identifiers from 1 in order of first use and keeps
+ * a token of each, loading interns them in that order. A fresh intern pool
+ * hands out the same numbers, so the stored ids are used as they are.
+ */
+bool astCacheWrite(const char* path, const CompactAst* ast, size_t source_size) {
+  const TokenStream* stream = ast->stream;
+
+  uint32_t intern_count = internCount();
+  InternId* local_ids = (InternId*) calloc(intern_count + 1, sizeof(InternId));
+  TokenIndex* names = (TokenIndex*) malloc((ast->identifiers.count + 1) * sizeof(TokenIndex));
+  CompactIdentifier* identifiers = (CompactIdentifier*) malloc((ast->identifiers.count + 1) * sizeof(CompactIdentifier));
+  assert(local_ids != nullptr && names != nullptr && identifiers != nullptr && "astCacheWrite out of memory");
+
+  uint32_t name_count = 0;
+  for (uint32_t i = 0; i < ast->identifiers.count; i++) {
+    CompactIdentifier identifier = ast->identifiers.items[i];
+    if (local_ids[identifier.id] == INTERN_NONE) {
+      local_ids[identifier.id] = ++name_count;
+      names[name_count - 1] = identifier.token;
+    }
+
+    identifier.id = local_ids[identifier.id];
+    identifiers[i] = identifier;
+  }
+
+  // Written next to the cache and renamed over it, a reader never sees half a file
+  size_t path_length = strlen(path);
+  char* temp_path = (char*) malloc(path_length + 5);
+  memcpy(temp_path, path, path_length);
+  memcpy(temp_path + path_length, ".tmp", 5);
+
+  CacheWriter writer = {};
+  writer.file = fopen(temp_path, "wb");
+
+  if (writer.file != nullptr) {
+    AstCacheHeader& header = writer.header;
+    memcpy(header.magic, AST_CACHE_MAGIC, sizeof(header.magic));
+    header.version = AST_CACHE_VERSION;
+    header.section_count = (uint32_t) AstCacheSection::COUNT;
+    header.source_size = source_size;
+    header.source_hash = astCacheHash(stream->source, source_size);
+    header.stats = ast->stats;
+
+    // Filled in once the sections are written
+    writeBytes(&writer, &header, sizeof(header));
+
+    writeSection(&writer, AstCacheSection::TOKEN_TYPES, stream->types, stream->count);
+    writeSection(&writer, AstCacheSection::TOKEN_OFFSETS, stream->offsets, stream->count);
+    writeSection(&writer, AstCacheSection::TOKEN_LENGTHS, stream->lengths, stream->count);
+    writeSection(&writer, AstCacheSection::TOKEN_LONG_LENGTHS, stream->long_lengths, stream->long_length_count);
+    writeSection(&writer, AstCacheSection::NAMES, names, name_count);
+    writeSection(&writer, AstCacheSection::IDENTIFIERS, identifiers, ast->identifiers.count);
+    writeNodes(&writer, AstCacheSection::TYPES, ast->types);
+    writeNodes(&writer, AstCacheSection::QUALIFIERS, ast->qualifiers);
+    writeNodes(&writer, AstCacheSection::DECLARATIONS, ast->declarations);
+    writeNodes(&writer, AstCacheSection::STATEMENTS, ast->statements);
+    writeNodes(&writer, AstCacheSection::BLOCK_TAGS, ast->block_tags);
+    writeNodes(&writer, AstCacheSection::BLOCKS, ast->blocks);
+    writeNodes(&writer, AstCacheSection::EXPRS, ast->exprs);
+    writeNodes(&writer, AstCacheSection::PARAMS, ast->params);
+    writeNodes(&writer, AstCacheSection::FUNCTIONS, ast->functions);
+    writeNodes(&writer, AstCacheSection::STRUCTS, ast->structs);
+    writeNodes(&writer, AstCacheSection::ENUMS, ast->enums);
+    writeNodes(&writer, AstCacheSection::PRIMARY_TAGS, ast->primary_tags);
+
+    header.file_size = writer.offset;
+    if (fseek(writer.file, 0, SEEK_SET) != 0) writer.failed = true;
+    writeBytes(&writer, &header, sizeof(header));
+
+    if (fclose(writer.file) != 0) writer.failed = true;
+    if (!writer.failed && rename(temp_path, path) != 0) writer.failed = true;
+    if (writer.failed) unlink(temp_path);
+  }
+
+  DEBUG_PRINT("astCacheWrite: %s names = %u size = %lu failed = %i\n",
+      path, name_count, (unsigned long) writer.offset, writer.file == nullptr || writer.failed);
+
+  bool written = writer.file != nullptr && !writer.failed;
+  free(temp_path);
+  free(identifiers);
+  free(names);
+  free(local_ids);
+  return written;
+}
+
+bool headerValid(const AstCacheHeader* header, size_t file_size, const char* source, size_t source_size) {
+  if (memcmp(header->magic, AST_CACHE_MAGIC, sizeof(header->magic)) != 0) return false;
+  if (header->version != AST_CACHE_VERSION) return false;
+  if (header->section_count != (uint32_t) AstCacheSection::COUNT) return false;
+  if (header->file_size != file_size) return false;
+
+  for (size_t i = 0; i < (size_t) AstCacheSection::COUNT; i++) {
+    const AstCacheSectionHeader& section = header->sections[i];
+    if (section.item_size != ast_cache_item_sizes[i]) return false;
+    if (section.offset % AST_CACHE_ALIGNMENT != 0) return false;
+    if (section.offset > file_size || (uint64_t) section.count * section.item_size > file_size - section.offset) return false;
+  }
+
+  if (header->source_size != source_size) return false;
+  return header->source_hash == astCacheHash(source, source_size);
+}
+
+template <typename T>
+T* sectionItems(AstCache* cache, const AstCacheHeader* header, AstCacheSection section) {
+  return (T*) ((uint8_t*) cache->mapping + header->sections[(size_t) section].offset);
+}
+
+template <typename T>
+NodeArray<T> sectionNodes(AstCache* cache, const AstCacheHeader* header, AstCacheSection section) {
+  uint32_t count = header->sections[(size_t) section].count;
+  return {sectionItems<T>(cache, header, section), count, count};
+}
+
+AstCache* astCacheOpen(const char* path, const char* source, size_t source_size) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return nullptr;
+
+  struct stat info;
+  if (fstat(fd, &info) != 0 || (size_t) info.st_size < sizeof(AstCacheHeader)) {
+    close(fd);
+    return nullptr;
+  }
+
+  // Private and writable so identifier ids can be rewritten in place if needed
+  size_t file_size = info.st_size;
+  void* mapping = mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) return nullptr;
+
+  const AstCacheHeader* header = (const AstCacheHeader*) mapping;
+  if (!headerValid(header, file_size, source, source_size)) {
+    DEBUG_PRINT("astCacheOpen: %s is stale\n", path);
+    munmap(mapping, file_size);
+    return nullptr;
+  }
+
+  AstCache* cache = (AstCache*) calloc(1, sizeof(AstCache));
+  assert(cache != nullptr && "astCacheOpen out of memory");
+  cache->mapping = mapping;
+  cache->mapping_size = file_size;
+
+  // Owned by the mapping, the stream must not be edited or destroyed
+  TokenStream& stream = cache->stream;
+  stream.source = source;
+  stream.types = sectionItems<uint8_t>(cache, header, AstCacheSection::TOKEN_TYPES);
+  stream.offsets = sectionItems<uint32_t>(cache, header, AstCacheSection::TOKEN_OFFSETS);
+  stream.lengths = sectionItems<uint16_t>(cache, header, AstCacheSection::TOKEN_LENGTHS);
+  stream.count = stream.capacity = header->sections[(size_t) AstCacheSection::TOKEN_TYPES].count;
+  stream.long_lengths = sectionItems<TokenLongLength>(cache, header, AstCacheSection::TOKEN_LONG_LENGTHS);
+  stream.long_length_count = stream.long_length_capacity
+    = header->sections[(size_t) AstCacheSection::TOKEN_LONG_LENGTHS].count;
+
+  CompactAst& ast = cache->ast;
+  ast.stream = &cache->stream;
+  ast.stats = header->stats;
+  ast.identifiers = sectionNodes<CompactIdentifier>(cache, header, AstCacheSection::IDENTIFIERS);
+  ast.types = sectionNodes<CompactType>(cache, header, AstCacheSection::TYPES);
+  ast.qualifiers = sectionNodes<ASTType>(cache, header, AstCacheSection::QUALIFIERS);
+  ast.declarations = sectionNodes<CompactDeclaration>(cache, header, AstCacheSection::DECLARATIONS);
+  ast.statements = sectionNodes<CompactStatement>(cache, header, AstCacheSection::STATEMENTS);
+  ast.block_tags = sectionNodes<CompactTag>(cache, header, AstCacheSection::BLOCK_TAGS);
+  ast.blocks = sectionNodes<CompactBlock>(cache, header, AstCacheSection::BLOCKS);
+  ast.exprs = sectionNodes<CompactExpr>(cache, header, AstCacheSection::EXPRS);
+  ast.params = sectionNodes<CompactParam>(cache, header, AstCacheSection::PARAMS);
+  ast.functions = sectionNodes<CompactFunction>(cache, header, AstCacheSection::FUNCTIONS);
+  ast.structs = sectionNodes<CompactStruct>(cache, header, AstCacheSection::STRUCTS);
+  ast.enums = sectionNodes<CompactEnum>(cache, header, AstCacheSection::ENUMS);
+  ast.primary_tags = sectionNodes<CompactTag>(cache, header, AstCacheSection::PRIMARY_TAGS);
+
+  NodeArray<TokenIndex> names = sectionNodes<TokenIndex>(cache, header, AstCacheSection::NAMES);
+  InternId* ids = (InternId*) malloc((names.count + 1) * sizeof(InternId));
+  assert(ids != nullptr && "astCacheOpen out of memory");
+
+  bool remap = false;
+  for (uint32_t i = 0; i < names.count; i++) {
+    const char* start = tokenStart(&stream, names[i]);
+    ids[i + 1] = internGet(start, start + tokenLength(&stream, names[i]));
+    remap |= ids[i + 1] != i + 1;
+  }
+
+  // The pool already held other identifiers, only identifiers carry ids
+  if (remap) {
+    for (uint32_t i = 0; i < ast.identifiers.count; i++) {
+      ast.identifiers[i].id = ids[ast.identifiers[i].id];
+    }
+  }
+  free(ids);
+
+  DEBUG_PRINT("astCacheOpen: %s names = %u remap = %i\n", path, names.count, remap);
+  return cache;
+}
+
+void astCacheClose(AstCache* cache) {
+  munmap(cache->mapping, cache->mapping_size);
+  free(cache);
+}
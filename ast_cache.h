@@ -0,0 +1,37 @@
+#pragma once
+
+#include "compact_ast.h"
+#include "token_stream.h"
+
+#include <cstddef>
+#include <cstdint>
+
+/* On disk cache of a CompactAst and its TokenStream.
+ * Nodes already refer to each other by index, so the file is the node arrays
+ * written one after another behind a header of offsets. Loading maps the file
+ * and points the arrays into the mapping, nodes are never visited. The header
+ * holds a version and a hash of the source, a cache built from other source
+ * or by another version is not loaded.
+ */
+
+// Bump on any change to the compact node structs, ASTType or TokenType
+#define AST_CACHE_VERSION 1
+
+struct AstCache {
+  CompactAst ast;
+  TokenStream stream;
+
+  void* mapping;
+  size_t mapping_size;
+};
+
+uint64_t astCacheHash(const char* source, size_t size);
+
+// source is the buffer ast->stream was lexed from. Returns false if the file can not be written.
+bool astCacheWrite(const char* path, const CompactAst* ast, size_t source_size);
+
+// Returns nullptr if the file is missing, from another version or built from
+// different source. The tree refers to source, which must outlive the cache.
+// Identifiers are interned on load.
+AstCache* astCacheOpen(const char* path, const char* source, size_t source_size);
+void astCacheClose(AstCache* cache);
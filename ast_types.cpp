@@ -113,3 +113,23 @@ void printASTNode(void* node) {
   }
 }
 
+
+TokenIndex astStartIndex(void* node, const Token* tokens) {
+  return ((ASTNode*) node)->start - tokens;
+}
+
+TokenIndex astEndIndex(void* node, const Token* tokens) {
+  return ((ASTNode*) node)->end - tokens;
+}
+
+void printASTNode(void* node, const Token* tokens, const TokenStream* stream) {
+  ASTNode* n = (ASTNode*) node;
+  assert(n != nullptr);
+  assert(n->type != ASTType::NONE);
+
+  TokenIndex end = astEndIndex(node, tokens);
+  printf("%s: \n", ASTTypes[static_cast<std::underlying_type<ASTType>::type>(n->type)]);
+  for (TokenIndex i = astStartIndex(node, tokens); i < end; i++) {
+    printToken(stream, i);
+  }
+}
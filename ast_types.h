@@ -1,16 +1,24 @@
 #pragma once 
 
+#include <atomic>
 #include <cstdint>
 #include "lex.h"
+#include "token_stream.h"
 
 extern const char * ASTTypes[];
 void printASTNode(void* node);
 
-enum class ASTType;
+// Token index i of the array a tree was parsed from is index i of the
+// TokenStream built from that array.
+TokenIndex astStartIndex(void* node, const Token* tokens);
+TokenIndex astEndIndex(void* node, const Token* tokens);
+void printASTNode(void* node, const Token* tokens, const TokenStream* stream);
+
+enum class ASTType : uint8_t;
 extern const int binary_operator_precidence[];
 int getBinaryPrecidence(ASTType type);
 
-enum class ASTType {
+enum class ASTType : uint8_t {
   NONE,
   TYPE_SIMPLE,
   TYPE_ID,
@@ -233,7 +241,7 @@ struct Literal {
   Token* end;
   union {
     char* string_;
-    int int_;
+    uint32_t int_;
     float float_;
     bool bool_;
   };
@@ -296,6 +304,14 @@ struct FunctionHeader {
   bool export_;
 };
 
+// PENDING while a lazily parsed body is only a token range, see functionBody
+enum class BodyState : uint8_t {
+  PARSED,
+  PENDING,
+  PARSING,
+  FAILED,
+};
+
 struct Function {
   ASTType type;
   Token* start;
@@ -303,6 +319,10 @@ struct Function {
   FunctionHeader* header;
   Expr* expr;
   Block* block;
+  // From '{' to after the matching '}'
+  Token* body_start;
+  Token* body_end;
+  std::atomic<BodyState> body_state;
 };
 
 struct Struct {
@@ -0,0 +1,562 @@
+#pragma once
+
+#include "ast_types.h"
+#include "parser.h"
+#include "scratch_list.h"
+#include "stack.h"
+
+#include <cassert>
+#include <type_traits>
+
+/* Statically dispatched walk of the pointer tree shared by the passes.
+ * A pass derives from ASTVisitor<Pass> and defines the node functions it
+ * needs with the same names, the walk always calls through Derived so there is
+ * no virtual dispatch and overrides can be inlined into it. The default for a
+ * node with a type switches on it, the default for any other node visits its
+ * children in source order. pre and post run around every default visit and
+ * around every node expr and block walk, a pass defining its own has to bring
+ * the rest in with using ASTVisitor<Pass>::pre.
+ *
+ * expr and block walk nested nodes with an explicit stack of frames instead
+ * of recursing, so how deep a tree can nest is limited by memory rather than
+ * by the thread stack. Node functions below them do not walk their children:
+ * unary, binary and call get the values their operands walked to, callee runs
+ * before the arguments of a call. expr returns whatever call, unary, binary,
+ * identifierValue and literal return. A block walks to what blockEnter
+ * returns, conditional and while_ are resumed after each block they return,
+ * see conditional.
+ */
+
+// Stands in for the value of a node function returning void
+struct WalkNone {};
+
+template <typename T>
+using WalkValue = std::conditional_t<std::is_void_v<T>, WalkNone, T>;
+
+template <typename F>
+WalkValue<std::invoke_result_t<F>> walkValue(F f) {
+  if constexpr (std::is_void_v<std::invoke_result_t<F>>) {
+    f();
+    return {};
+  }
+  else {
+    return f();
+  }
+}
+
+// Frames of the walks in progress, the passes run on one thread. A frame
+// stays at the same address until it is popped.
+inline Stack* walkStack() {
+  static Stack* stack = stackCreate();
+  return stack;
+}
+
+template <typename Derived>
+struct ASTVisitor {
+  // post runs when the default returns, after the value it returns is built
+  template <typename Node>
+  struct Visit {
+    Derived& visitor;
+    Node* node;
+
+    Visit(Derived& visitor, Node* node) : visitor(visitor), node(node) {
+      visitor.pre(node);
+    }
+
+    ~Visit() {
+      visitor.post(node);
+    }
+  };
+
+  Derived& self() {
+    return *static_cast<Derived*>(this);
+  }
+
+  template <typename Node>
+  void pre(Node*) {}
+
+  template <typename Node>
+  void post(Node*) {}
+
+  // Kept in the frame of a conditional or while for the pass, a pass can
+  // define its own. Zeroed when the frame is pushed.
+  struct WalkState {};
+
+  template <typename Callee>
+  struct ExprFrame {
+    Expr* node;
+    // Operands walked so far
+    int next;
+    Callee callee;
+  };
+
+  template <typename Value>
+  struct BlockFrame {
+    // A Block, BlockTag, Statement, Conditional or While, told apart by type
+    ASTNode* node;
+    int step;
+    // For a block what blockEnter returned, for a conditional or while the
+    // value of the block walked last
+    Value value;
+    typename Derived::WalkState state;
+  };
+
+  // Calls f with node cast to the struct its type belongs to
+  template <typename F>
+  void frameNode(ASTNode* node, F f) {
+    switch (node->type) {
+      case ASTType::BLOCK:
+        f((Block*) node);
+        break;
+      case ASTType::BLOCK_TAG_BLOCK:
+      case ASTType::BLOCK_TAG_STATEMENT:
+        f((BlockTag*) node);
+        break;
+      case ASTType::CONDITIONAL:
+        f((Conditional*) node);
+        break;
+      case ASTType::WHILE:
+        f((While*) node);
+        break;
+      default:
+        f((Statement*) node);
+    }
+  }
+
+  void simpleType(SimpleType* node) {
+    Visit<SimpleType> visit(self(), node);
+  }
+
+  void identifier(Identifier* node) {
+    Visit<Identifier> visit(self(), node);
+
+    if (node->next != nullptr) {
+      self().identifier(node->next);
+    }
+  }
+
+  // An identifier read as a value in an expression
+  auto identifierValue(Identifier* node) {
+    return self().identifier(node);
+  }
+
+  void type(Type* node) {
+    Visit<Type> visit(self(), node);
+
+    switch (node->type) {
+      case ASTType::TYPE_SIMPLE:
+        self().simpleType(node->simple_type);
+        break;
+      case ASTType::TYPE_ID:
+        self().identifier(node->identifier);
+        break;
+      default:
+        assert(false && "Type");
+    }
+  }
+
+  void qualifier(Qualifier* node) {
+    Visit<Qualifier> visit(self(), node);
+  }
+
+  void declaration(Declaration* node) {
+    Visit<Declaration> visit(self(), node);
+
+    self().identifier(node->identifier);
+    self().type(node->decl_type);
+
+    for (int i = 0; i < node->qualifiers_count; i++) {
+      self().qualifier(node->qualifiers[i]);
+    }
+
+    if (node->expr != nullptr) {
+      self().expr(node->expr);
+    }
+  }
+
+  void assignment(Assignment* node) {
+    Visit<Assignment> visit(self(), node);
+
+    self().identifier(node->identifier);
+    self().expr(node->expr);
+  }
+
+  /* Called with step 0, then again after each block it returns is walked
+   * with the value of that block, until it returns nullptr. state is kept for
+   * it in the frame of node.
+   */
+  template <typename State, typename Value>
+  Block* conditional(Conditional* node, int step, [[maybe_unused]] State& state, [[maybe_unused]] Value walked) {
+    switch (step) {
+      case 0:
+        self().expr(node->condition);
+        return node->block;
+      case 1:
+        return node->other;
+      default:
+        return nullptr;
+    }
+  }
+
+  template <typename State, typename Value>
+  Block* while_(While* node, int step, [[maybe_unused]] State& state, [[maybe_unused]] Value walked) {
+    if (step == 0) {
+      self().expr(node->condition);
+      return node->block;
+    }
+    return nullptr;
+  }
+
+  void break_(Break* node) {
+    Visit<Break> visit(self(), node);
+  }
+
+  void continue_(Continue* node) {
+    Visit<Continue> visit(self(), node);
+  }
+
+  void return_(Return* node) {
+    Visit<Return> visit(self(), node);
+
+    if (node->expr != nullptr) {
+      self().expr(node->expr);
+    }
+  }
+
+  // Runs a statement without nested blocks, returns false for the others
+  bool statementLeaf(Statement* node) {
+    switch (node->type) {
+      case ASTType::STATEMENT_CONDITION:
+      case ASTType::STATEMENT_WHILE:
+        return false;
+      case ASTType::STATEMENT_BREAK:
+        self().break_(node->break_);
+        break;
+      case ASTType::STATEMENT_CONTINUE:
+        self().continue_(node->continue_);
+        break;
+      case ASTType::STATEMENT_RETURN:
+        self().return_(node->return_);
+        break;
+      case ASTType::STATEMENT_ASSIGN:
+        self().assignment(node->assignment);
+        break;
+      case ASTType::STATEMENT_EXPR:
+        self().expr(node->expr);
+        break;
+      default:
+        assert(false && "Statement");
+    }
+    return true;
+  }
+
+  auto blockEnter(Block* node) {
+    if (node->namespace_ != nullptr) {
+      self().identifier(node->namespace_);
+    }
+  }
+
+  void blockLeave(Block*) {}
+
+  // Returns the next child of the frame to walk, nullptr once it is done
+  template <typename Frame>
+  ASTNode* blockStep(Frame* frame) {
+    int step = frame->step++;
+
+    switch (frame->node->type) {
+      case ASTType::BLOCK: {
+        // Step 0 walks the statement, step 1 runs the declarations, which do
+        // not nest blocks, and every step from 1 on walks the next block tag
+        Block* node = (Block*) frame->node;
+        if (step == 0) {
+          if (node->statement != nullptr) return (ASTNode*) node->statement;
+          step = frame->step++;
+        }
+
+        if (step == 1) {
+          for (int i = 0; i < node->declarations_count; i++) {
+            self().declaration(node->declarations[i]);
+          }
+        }
+
+        if (step - 1 < node->block_tags_count) return (ASTNode*) node->block_tags[step - 1];
+
+        self().blockLeave(node);
+        return nullptr;
+      }
+
+      case ASTType::BLOCK_TAG_BLOCK:
+        return step == 0 ? (ASTNode*) ((BlockTag*) frame->node)->block : nullptr;
+
+      case ASTType::BLOCK_TAG_STATEMENT:
+        return step == 0 ? (ASTNode*) ((BlockTag*) frame->node)->statement : nullptr;
+
+      case ASTType::CONDITIONAL:
+        return (ASTNode*) self().conditional((Conditional*) frame->node, step, frame->state, frame->value);
+
+      case ASTType::WHILE:
+        return (ASTNode*) self().while_((While*) frame->node, step, frame->state, frame->value);
+
+      default: {
+        Statement* node = (Statement*) frame->node;
+        if (step != 0 || statementLeaf(node)) return nullptr;
+        if (node->type == ASTType::STATEMENT_CONDITION) return (ASTNode*) node->conditional;
+        return (ASTNode*) node->while_;
+      }
+    }
+  }
+
+  auto block(Block* root) {
+    using Value = WalkValue<decltype(self().blockEnter(root))>;
+    using Frame = BlockFrame<Value>;
+
+    Stack* stack = walkStack();
+    void* base = stack->current;
+    ASTNode* node = (ASTNode*) root;
+    Value output;
+
+    while (true) {
+      if (node != nullptr) {
+        Frame* frame = (Frame*) stackPush(stack, sizeof(Frame));
+        frame->node = node;
+        frame->step = 0;
+        frame->state = {};
+        frameNode(node, [&](auto* typed) { self().pre(typed); });
+        if (node->type == ASTType::BLOCK) {
+          frame->value = walkValue([&] { return self().blockEnter((Block*) node); });
+        }
+      }
+
+      Frame* frame = (Frame*) stack->current - 1;
+      node = blockStep(frame);
+      if (node != nullptr) continue;
+
+      Value value = frame->value;
+      bool is_block = frame->node->type == ASTType::BLOCK;
+      frameNode(frame->node, [&](auto* typed) { self().post(typed); });
+      stackPop(stack, sizeof(Frame));
+
+      if (stack->current == base) {
+        output = value;
+        break;
+      }
+
+      // The block of a conditional or while, blocks in a block tag are not kept
+      Frame* parent = (Frame*) stack->current - 1;
+      if (is_block && parent->node->type != ASTType::BLOCK_TAG_BLOCK) parent->value = value;
+    }
+
+    if constexpr (!std::is_void_v<decltype(self().blockEnter(root))>) {
+      return output;
+    }
+  }
+
+  void literal(Literal* node) {
+    Visit<Literal> visit(self(), node);
+  }
+
+  auto callee(Call* node) {
+    return self().identifier(node->identifier);
+  }
+
+  template <typename Callee, typename Value>
+  void call(Call*, Callee, Value*) {}
+
+  template <typename Value>
+  void unary(Unary*, Value) {}
+
+  template <typename Value>
+  void binary(Binary*, Value, Value) {}
+
+  template <typename Frame, typename Value>
+  Value exprCombine(Frame* frame, Value* operands) {
+    Expr* node = frame->node;
+    switch (node->type) {
+      case ASTType::EXPRESSION_CALL:
+        return walkValue([&] { return self().call(node->call, frame->callee, operands); });
+
+      case ASTType::EXPRESSION_UNARY:
+        return walkValue([&] { return self().unary(node->unary, operands[0]); });
+
+      default:
+        return walkValue([&] { return self().binary(node->binary, operands[0], operands[1]); });
+    }
+  }
+
+  auto expr(Expr* root) {
+    using Value = WalkValue<decltype(self().literal(root->literal))>;
+    using Callee = WalkValue<decltype(self().callee(root->call))>;
+    using Frame = ExprFrame<Callee>;
+
+    Stack* stack = walkStack();
+    void* base = stack->current;
+    // Values of the operands walked so far, the operands of a frame are last
+    ScratchList<Value, 16> values;
+    Expr* node = root;
+
+    while (true) {
+      if (node != nullptr) {
+        self().pre(node);
+
+        switch (node->type) {
+          case ASTType::EXPRESSION_CALL:
+          case ASTType::EXPRESSION_UNARY:
+          case ASTType::EXPRESSION_BINARY: {
+            Frame* frame = (Frame*) stackPush(stack, sizeof(Frame));
+            frame->node = node;
+            frame->next = 0;
+
+            if (node->type == ASTType::EXPRESSION_CALL) {
+              self().pre(node->call);
+              frame->callee = walkValue([&] { return self().callee(node->call); });
+            }
+            else if (node->type == ASTType::EXPRESSION_UNARY) {
+              self().pre(node->unary);
+            }
+            else {
+              self().pre(node->binary);
+            }
+            break;
+          }
+
+          case ASTType::EXPRESSION_IDENTIFIER:
+            values.push(walkValue([&] { return self().identifierValue(node->identifier); }));
+            self().post(node);
+            break;
+
+          case ASTType::EXPRESSION_LITERAL:
+            values.push(walkValue([&] { return self().literal(node->literal); }));
+            self().post(node);
+            break;
+
+          default:
+            assert(false && "Expr");
+        }
+      }
+
+      if (stack->current == base) break;
+
+      Frame* frame = (Frame*) stack->current - 1;
+      Expr* current = frame->node;
+      int count;
+      switch (current->type) {
+        case ASTType::EXPRESSION_CALL:
+          count = current->call->arguments_count;
+          node = frame->next < count ? current->call->arguments[frame->next] : nullptr;
+          break;
+        case ASTType::EXPRESSION_UNARY:
+          count = 1;
+          node = frame->next < count ? current->unary->expr : nullptr;
+          break;
+        default:
+          count = 2;
+          node = frame->next == 0 ? current->binary->first : frame->next == 1 ? current->binary->second : nullptr;
+      }
+
+      if (node != nullptr) {
+        frame->next++;
+        continue;
+      }
+
+      Value value = exprCombine(frame, values.data + values.size - count);
+      values.size -= count;
+      values.push(value);
+
+      if (current->type == ASTType::EXPRESSION_CALL) {
+        self().post(current->call);
+      }
+      else if (current->type == ASTType::EXPRESSION_UNARY) {
+        self().post(current->unary);
+      }
+      else {
+        self().post(current->binary);
+      }
+      self().post(current);
+      stackPop(stack, sizeof(Frame));
+
+      if (stack->current == base) break;
+    }
+
+    if constexpr (!std::is_void_v<decltype(self().literal(root->literal))>) {
+      return values[0];
+    }
+  }
+
+  void functionParam(FunctionParam* node) {
+    Visit<FunctionParam> visit(self(), node);
+
+    self().identifier(node->identifier);
+    self().type(node->decl_type);
+  }
+
+  void functionHeader(FunctionHeader* node) {
+    Visit<FunctionHeader> visit(self(), node);
+
+    self().identifier(node->identifier);
+    self().type(node->return_type);
+
+    for (int i = 0; i < node->parameter_count; i++) {
+      self().functionParam(node->parameter_list[i]);
+    }
+  }
+
+  void function(Function* node) {
+    Visit<Function> visit(self(), node);
+
+    self().functionHeader(node->header);
+
+    if (node->expr != nullptr) {
+      self().expr(node->expr);
+    }
+
+    Block* body = functionBody(node);
+    if (body != nullptr) {
+      self().block(body);
+    }
+  }
+
+  void struct_(Struct* node) {
+    Visit<Struct> visit(self(), node);
+
+    self().identifier(node->identifier);
+
+    for (int i = 0; i < node->declarations_count; i++) {
+      self().declaration(node->declarations[i]);
+    }
+  }
+
+  void enum_(Enum* node) {
+    Visit<Enum> visit(self(), node);
+
+    self().identifier(node->identifier);
+  }
+
+  void primaryTag(PrimaryTag* node) {
+    Visit<PrimaryTag> visit(self(), node);
+
+    switch (node->type) {
+      case ASTType::PRIMARY_TAG_DECL:
+        self().declaration(node->decl);
+        break;
+      case ASTType::PRIMARY_TAG_ENUM:
+        self().enum_(node->enum_);
+        break;
+      case ASTType::PRIMARY_TAG_FUNC:
+        self().function(node->func);
+        break;
+      case ASTType::PRIMARY_TAG_STRUCT:
+        self().struct_(node->struct_);
+        break;
+      default:
+        assert(false && "Primary Tag");
+    }
+  }
+
+  void primary(Primary* node) {
+    Visit<Primary> visit(self(), node);
+
+    for (int i = 0; i < node->primary_tags_count; i++) {
+      self().primaryTag(node->primary_tags[i]);
+    }
+  }
+};
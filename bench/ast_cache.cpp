@@ -0,0 +1,94 @@
+/* Checks that loading the compact AST from its cache file is at least 10x
+ * faster than lexing and parsing the source it was built from. Exits with 1
+ * if it is not. The cache file is written to the path given as the first
+ * argument, or to bench_ast_cache.bin in the working directory, and removed
+ * afterwards.
+ *
+ * g++ -std=c++17 -O2 -DNDEBUG -I. -I$(llvm-config --includedir) bench/ast_cache.cpp ast_cache.cpp \
+ *   ast_types.cpp compact_ast.cpp hash_table.cpp intern.cpp lex.cpp lex_scan.cpp parser.cpp stack.cpp \
+ *   token_stream.cpp -pthread -o bench_ast_cache
+ */
+
+#include "ast_cache.h"
+#include "bench.h"
+#include "compact_ast.h"
+#include "lex.h"
+#include "parser.h"
+#include "token_stream.h"
+
+#include <cstdio>
+#include <string>
+
+#define BENCH_RUNS 7
+#define BENCH_MIN_SPEEDUP 10.0
+
+int main(int argc, char** argv) {
+  const char* path = argc > 1 ? argv[1] : "bench_ast_cache.bin";
+
+  // About 50k lines
+  std::string input = benchProgram(1600, 22);
+  size_t size = input.size();
+  benchPad(input);
+
+  Token* tokens = nullptr;
+  Primary* primary = nullptr;
+  double parse_time = benchBest(BENCH_RUNS, [&]() {
+    if (tokens != nullptr) {
+      parse_destroy();
+      lex_destroy(tokens);
+    }
+    tokens = lex(input.data());
+    primary = parse(tokens);
+  });
+  if (primary == nullptr) {
+    fprintf(stderr, "generated program does not parse\n");
+    return 1;
+  }
+
+  TokenStream* stream = nullptr;
+  CompactAst* ast = nullptr;
+  double lower_time = benchBest(BENCH_RUNS, [&]() {
+    if (ast != nullptr) {
+      compactAstDestroy(ast);
+      tokenStreamDestroy(stream);
+    }
+    stream = tokenStreamCreate(input.data(), tokens);
+    ast = compactAstCreate(primary, tokens, stream);
+  });
+
+  if (!astCacheWrite(path, ast, size)) {
+    fprintf(stderr, "can not write %s\n", path);
+    return 1;
+  }
+
+  uint32_t nodes = compactAstStats(ast).nodes;
+  bool loaded = true;
+  double load_time = benchBest(BENCH_RUNS, [&]() {
+    AstCache* cache = astCacheOpen(path, input.data(), size);
+    loaded &= cache != nullptr && compactAstStats(&cache->ast).nodes == nodes;
+    if (cache != nullptr) astCacheClose(cache);
+  });
+  remove(path);
+
+  if (!loaded) {
+    fprintf(stderr, "cache does not load back the same tree\n");
+    return 1;
+  }
+
+  double speedup = parse_time / load_time;
+  printf("%zu lines, %zu bytes of source\n", benchLines(input), size);
+  printf("lex + parse:         %8.3f ms\n", parse_time * 1e3);
+  printf("tokens + compact:    %8.3f ms\n", lower_time * 1e3);
+  printf("cache hit:           %8.3f ms (%.0fx faster than lex + parse)\n", load_time * 1e3, speedup);
+
+  compactAstDestroy(ast);
+  tokenStreamDestroy(stream);
+  parse_destroy();
+  lex_destroy(tokens);
+
+  if (speedup < BENCH_MIN_SPEEDUP) {
+    fprintf(stderr, "cache hit is less than %.0fx faster than lex + parse\n", BENCH_MIN_SPEEDUP);
+    return 1;
+  }
+  return 0;
+}
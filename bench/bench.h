@@ -0,0 +1,106 @@
+#pragma once
+
+#include "source.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+/* Shared helpers for the standalone benchmarks in bench/.
+ * Every benchmark is one main() built against the compiler sources with
+ * -O2 -DNDEBUG, which turns off the token and trace prints. Inputs are
+ * generated in memory and padded with zero bytes like a Source, since the
+ * lexer reads past the end of tokens.
+ */
+
+inline double benchSeconds() {
+  using Clock = std::chrono::steady_clock;
+  return std::chrono::duration<double>(Clock::now().time_since_epoch()).count();
+}
+
+// Best wall time of runs calls to f, in seconds
+template <typename F>
+double benchBest(int runs, F f) {
+  double best = 1e30;
+  for (int i = 0; i < runs; i++) {
+    double start = benchSeconds();
+    f();
+    double time = benchSeconds() - start;
+    if (time < best) best = time;
+  }
+  return best;
+}
+
+inline void benchPad(std::string& input) {
+  input.append(SOURCE_PADDING, '\0');
+}
+
+// Number of lines of a generated input, not counting the padding
+inline size_t benchLines(const std::string& input) {
+  size_t lines = 0;
+  for (char c : input) lines += c == '\n';
+  return lines;
+}
+
+// A reproducible operator and operand sequence, the same for every run
+struct BenchRandom {
+  uint32_t state = 12345;
+
+  uint32_t next(uint32_t bound) {
+    state = state * 1103515245 + 12345;
+    return (state >> 16) % bound;
+  }
+};
+
+/* One function made of statements like test/binary/chain.se, each an
+ * assignment of a chain of operand_count operands joined by + - * /.
+ */
+inline std::string benchChainProgram(int statement_count, int operand_count) {
+  const char* operands[] = {"a", "b", "y", "z", "h", "3", "7"};
+  const char* operators[] = {" + ", " - ", " * ", " / "};
+  BenchRandom random;
+
+  std::string input = "func chain (y : u32, z : u32, h : u32) : u32 {\n  a : u32 = 1;\n  b : u32 = 10;\n\n";
+  for (int i = 0; i < statement_count; i++) {
+    input += i % 2 == 0 ? "  a = " : "  b = ";
+    for (int j = 0; j < operand_count; j++) {
+      if (j > 0) input += operators[random.next(4)];
+      input += operands[random.next(7)];
+    }
+    input += ";\n";
+  }
+  input += "\n  return a;\n}\n";
+  return input;
+}
+
+/* An enum, a struct and function_count functions of statement_count
+ * statements each, one per line, of arithmetic on parameters and locals.
+ * Defref does not type struct fields yet and codegen can not lower ifs,
+ * loops, globals or call results, so none are generated. Every function
+ * passes defref and codegen.
+ */
+inline std::string benchProgram(int function_count, int statement_count) {
+  std::string input = "enum E {\n  NONE,\n  ONE,\n  TWO\n};\n\nstruct P {\n  x : u32;\n  y : u32;\n};\n";
+
+  char line[256];
+  for (int i = 0; i < function_count; i++) {
+    snprintf(line, sizeof(line),
+        "\nfunc step%i (a : u32, b : u32) : u32 {\n  e : E;\n  p : P;\n  c : u32 = a * %i + b;\n  d : u32 = c;\n",
+        i, i % 97 + 1);
+    input += line;
+
+    for (int j = 0; j < statement_count; j++) {
+      switch (j % 3) {
+        case 0: snprintf(line, sizeof(line), "  c = c + a * %i - b / 3;\n", j + 2); break;
+        case 1: snprintf(line, sizeof(line), "  d = c - %i * d + a;\n", j); break;
+        case 2: snprintf(line, sizeof(line), "  d = d / %i + c * b;\n", j + 1); break;
+      }
+      input += line;
+    }
+
+    input += "\n  return c + d;\n}\n";
+  }
+
+  return input;
+}
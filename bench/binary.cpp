@@ -0,0 +1,78 @@
+/* Parse time of long arithmetic chains with the Pratt binaryExpr().
+ * Times parse() alone, the tokens are lexed once, on the predictive and the
+ * backtracking paths. Run from the repository root to include
+ * test/binary/chain.se.
+ *
+ * g++ -std=c++17 -O2 -DNDEBUG -I. bench/binary.cpp ast_types.cpp hash_table.cpp intern.cpp \
+ *   lex.cpp lex_scan.cpp parser.cpp source.cpp stack.cpp token_stream.cpp -pthread -o bench_binary
+ */
+
+#include "bench.h"
+#include "lex.h"
+#include "parser.h"
+#include "source.h"
+
+#include <cstdio>
+#include <string>
+
+#define BENCH_RUNS 12
+
+void benchParse(const char* name, const char* input, size_t operand_count) {
+  Token* tokens = lex(input);
+  if (tokens == nullptr) {
+    fprintf(stderr, "%s does not lex\n", name);
+    return;
+  }
+
+  for (bool predictive : {true, false}) {
+    parserSetPredictive(predictive);
+
+    bool parsed = true;
+    double time = benchBest(BENCH_RUNS, [&]() {
+      parsed &= parse(tokens) != nullptr;
+      parse_destroy();
+    });
+    if (!parsed) {
+      fprintf(stderr, "%s does not parse\n", name);
+      break;
+    }
+
+    printf("%-28s %-12s %10.2f us %8.2f ns per operand\n", name, predictive ? "predictive" : "backtracking",
+        time * 1e6, time * 1e9 / operand_count);
+  }
+
+  parserSetPredictive(true);
+  lex_destroy(tokens);
+}
+
+size_t countOperands(const char* input) {
+  Token* tokens = lex(input);
+  if (tokens == nullptr) return 1;
+
+  size_t count = 0;
+  for (Token* token = tokens; token->type != TokenType::END; token++) {
+    count += token->type == TokenType::IDENTIFIER || token->type == TokenType::INT_LITERAL;
+  }
+  lex_destroy(tokens);
+  return count;
+}
+
+int main() {
+  Source* chain = sourceOpen("test/binary/chain.se");
+  if (chain != nullptr) {
+    benchParse("test/binary/chain.se", chain->data, countOperands(chain->data));
+    sourceClose(chain);
+  }
+
+  struct { int statements; int operands; } shapes[] = {{200, 60}, {20, 600}, {2, 6000}};
+  for (auto shape : shapes) {
+    std::string input = benchChainProgram(shape.statements, shape.operands);
+    benchPad(input);
+
+    char name[64];
+    snprintf(name, sizeof(name), "%i x %i operands", shape.statements, shape.operands);
+    benchParse(name, input.data(), (size_t) shape.statements * shape.operands);
+  }
+
+  return 0;
+}
@@ -0,0 +1,65 @@
+/* Memory per node and traversal speed of the tree and the compact AST.
+ * Sizes come from compactAstStats. Traversal is a full visitDefRef over each
+ * form of the same generated program.
+ *
+ * g++ -std=c++17 -O2 -DNDEBUG -I. -I$(llvm-config --includedir) bench/compact_ast.cpp ast_types.cpp \
+ *   compact_ast.cpp defref.cpp hash_table.cpp intern.cpp lex.cpp lex_scan.cpp line_index.cpp parser.cpp \
+ *   scope.cpp stack.cpp symbol.cpp token_stream.cpp vector.cpp -pthread -o bench_compact_ast
+ */
+
+#include "bench.h"
+#include "compact_ast.h"
+#include "defref.h"
+#include "lex.h"
+#include "parser.h"
+#include "token_stream.h"
+
+#include <cstdio>
+#include <string>
+
+#define BENCH_RUNS 7
+
+int main() {
+  // About 50k lines
+  std::string input = benchProgram(1600, 22);
+  benchPad(input);
+
+  Token* tokens = lex(input.data());
+  Primary* primary = tokens != nullptr ? parse(tokens) : nullptr;
+  if (primary == nullptr) {
+    fprintf(stderr, "generated program does not parse\n");
+    return 1;
+  }
+  TokenStream* stream = tokenStreamCreate(input.data(), tokens);
+
+  CompactAst* ast = nullptr;
+  double lower_time = benchBest(BENCH_RUNS, [&]() {
+    if (ast != nullptr) compactAstDestroy(ast);
+    ast = compactAstCreate(primary, tokens, stream);
+  });
+
+  CompactAstStats stats = compactAstStats(ast);
+  printf("%zu lines, %zu bytes of source\n", benchLines(input), input.size() - SOURCE_PADDING);
+  printf("tree:    %8u nodes %10zu bytes %6.1f bytes per node\n", stats.tree_nodes, stats.tree_bytes,
+      (double) stats.tree_bytes / stats.tree_nodes);
+  printf("compact: %8u nodes %10zu bytes %6.1f bytes per node (%.1fx smaller)\n", stats.nodes, stats.bytes,
+      (double) stats.bytes / stats.nodes, (double) stats.tree_bytes / stats.bytes);
+  printf("compactAstCreate: %8.2f ms\n", lower_time * 1e3);
+
+  double tree_time = benchBest(BENCH_RUNS, [&]() {
+    visitDefRef(primary);
+    defref_destroy();
+  });
+  double compact_time = benchBest(BENCH_RUNS, [&]() {
+    visitDefRef(ast);
+    defref_destroy();
+  });
+  printf("visitDefRef tree:    %8.2f ms\n", tree_time * 1e3);
+  printf("visitDefRef compact: %8.2f ms (%.2fx)\n", compact_time * 1e3, tree_time / compact_time);
+
+  compactAstDestroy(ast);
+  tokenStreamDestroy(stream);
+  parse_destroy();
+  lex_destroy(tokens);
+  return 0;
+}
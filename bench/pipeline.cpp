@@ -0,0 +1,91 @@
+/* Time and peak memory of compilePipelined against whole file compilation
+ * on a generated input of 1M lines, or of the line count given as the first
+ * argument. Each mode runs in its own child process so its peak RSS can be
+ * read with wait4. The printed IR goes to /dev/null. Both peaks include the
+ * generated source, which the children share with the parent.
+ *
+ * g++ -std=c++17 -O2 -DNDEBUG -I. -I$(llvm-config --includedir) bench/pipeline.cpp ast_types.cpp \
+ *   codegen.cpp defref.cpp hash_table.cpp intern.cpp lex.cpp lex_scan.cpp line_index.cpp parser.cpp \
+ *   pipeline.cpp scope.cpp stack.cpp symbol.cpp token_stream.cpp vector.cpp \
+ *   $(llvm-config --ldflags --libs core analysis) -pthread -o bench_pipeline
+ */
+
+#include "bench.h"
+#include "codegen.h"
+#include "defref.h"
+#include "lex.h"
+#include "parser.h"
+#include "pipeline.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Lines of one generated function with this many statements
+#define BENCH_STATEMENTS 22
+#define BENCH_FUNCTION_LINES (BENCH_STATEMENTS + 9)
+
+bool compileWhole(const char* input) {
+  Token* tokens = lex(input);
+  if (tokens == nullptr) return false;
+
+  Primary* primary = parse(tokens);
+  if (primary == nullptr) return false;
+
+  visitDefRef(primary);
+  visitCodeGen(primary);
+  return true;
+}
+
+bool compileStreaming(const char* input) {
+  Token* tokens = lex(input);
+  if (tokens == nullptr) return false;
+
+  return compilePipelined(tokens);
+}
+
+void benchMode(const char* name, bool (*compile)(const char*), const std::string& input) {
+  fflush(stdout);
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    if (freopen("/dev/null", "w", stderr) == nullptr) _exit(1);
+
+    double start = benchSeconds();
+    bool compiled = compile(input.data());
+    double time = benchSeconds() - start;
+
+    printf("%-10s %8.2f s", name, time);
+    fflush(stdout);
+    _exit(compiled ? 0 : 1);
+  }
+
+  int status = 0;
+  struct rusage usage = {};
+  if (pid < 0 || wait4(pid, &status, 0, &usage) != pid) {
+    fprintf(stderr, "%s: can not run the child process\n", name);
+    return;
+  }
+
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    printf("%-10s failed\n", name);
+    return;
+  }
+  // ru_maxrss is in kilobytes on Linux
+  printf(" %8.1f MB peak RSS\n", usage.ru_maxrss / 1024.0);
+}
+
+int main(int argc, char** argv) {
+  long lines = argc > 1 ? atol(argv[1]) : 1000000;
+
+  std::string input = benchProgram(lines / BENCH_FUNCTION_LINES, BENCH_STATEMENTS);
+  benchPad(input);
+  printf("%zu lines, %.1f MB of source\n", benchLines(input), (input.size() - SOURCE_PADDING) / 1e6);
+
+  benchMode("whole", compileWhole, input);
+  benchMode("pipelined", compileStreaming, input);
+  return 0;
+}
@@ -1,6 +1,12 @@
 #include "codegen.h"
 #include "ast_types.h"
+#include "ast_visitor.h"
+#include "compact_ast.h"
+#include "compact_visitor.h"
+#include "defref.h"
+#include "parser.h"
 #include "scope.h"
+#include "scratch_list.h"
 #include "symbol.h"
 
 #include <cassert>
@@ -15,7 +21,9 @@
 #include <stack>
 #include <string>
 
+#ifndef NDEBUG
 #define CODEGEN_DEBUG_SCOPES
+#endif
 
 #ifdef CODEGEN_DEBUG
 
@@ -38,6 +46,8 @@ Scope* current_scope = nullptr;
 LLVMValueRef* current_func;
 LLVMBasicBlockRef* while_check;
 LLVMBasicBlockRef* while_end;
+// Module the body visitCodeGenFunction lowers goes into, nullptr otherwise
+LLVMModuleRef body_module = nullptr;
 
 struct LLVMTypedValue {
   LLVMTypeRef type;
@@ -61,25 +71,132 @@ void popScope() {
   stack.pop();
 }
 
-Symbol* identifierDef(Identifier* node) {
-  // TODO: it seems like this might need to do more but im not sure
-  Symbol* symbol = scopeResolve(current_scope, node->identifier->start, node->identifier->end);
-  for (auto i = node->identifier->start; i != node->identifier->end; i++) {
-    fprintf(stderr, "%c", *i);
+// Names point into the read only source, LLVM needs a '\0' terminated copy
+std::string symbolName(Symbol* symbol) {
+  return {symbol->start, symbol->end};
+}
+
+// Adds function to body_module with the same name, type, linkage, calling convention and attributes
+LLVMValueRef functionCopy(LLVMValueRef function) {
+  size_t length = 0;
+  const char* name = LLVMGetValueName2(function, &length);
+  LLVMValueRef copy = LLVMAddFunction(body_module, name, LLVMGlobalGetValueType(function));
+  LLVMSetLinkage(copy, LLVMGetLinkage(function));
+  LLVMSetFunctionCallConv(copy, LLVMGetFunctionCallConv(function));
+
+  // The function, its return value, then each parameter
+  for (int index = -1; index <= (int) LLVMCountParams(function); index++) {
+    LLVMAttributeIndex at = index == -1 ? (LLVMAttributeIndex) LLVMAttributeFunctionIndex : (LLVMAttributeIndex) index;
+    ScratchList<LLVMAttributeRef, 8> attributes;
+    unsigned count = LLVMGetAttributeCountAtIndex(function, at);
+    for (unsigned i = 0; i < count; i++) attributes.push(nullptr);
+    LLVMGetAttributesAtIndex(function, at, attributes.data);
+    for (unsigned i = 0; i < count; i++) LLVMAddAttributeAtIndex(copy, at, attributes[i]);
+  }
+  return copy;
+}
+
+// The function a call calls, in a pipelined body a declaration in the module of the body
+LLVMValueRef calleeValue(Symbol* symbol) {
+  if (body_module == nullptr) return symbol->llvm_value;
+
+  size_t length = 0;
+  LLVMValueRef function = LLVMGetNamedFunction(body_module, LLVMGetValueName2(symbol->llvm_value, &length));
+  return function != nullptr ? function : functionCopy(symbol->llvm_value);
+}
+
+LLVMTypeRef simpleType(ASTType type) {
+  switch (type) {
+    case ASTType::SIMPLE_TYPE_I8:
+    case ASTType::SIMPLE_TYPE_U8:
+      return LLVMInt8Type();
+    case ASTType::SIMPLE_TYPE_I32:
+    case ASTType::SIMPLE_TYPE_U32:
+      return LLVMInt32Type();
+    case ASTType::SIMPLE_TYPE_F32:
+      return LLVMFloatType();
+    default:
+      assert(false && "Type not simple as advertised");
+  }
+}
+
+LLVMValueRef unaryOp(ASTType type, LLVMValueRef value) {
+  // TODO: this needs to be more type aware
+  // LLVMBuildFNeg exists
+  switch (type) {
+    case ASTType::UNARY_NOT:
+      return LLVMBuildNot(builder, value, "");
+      break;
+    case ASTType::UNARY_PLUS:
+      return value;
+      break;
+    case ASTType::UNARY_MINUS:
+      return LLVMBuildNeg(builder, value, "");
+    default:
+      assert(false && "Unary");
   }
-  fprintf(stderr, "\n");
-  assert(symbol != nullptr);
-  return symbol;
 }
 
-LLVMTypedValue identifierRef(Identifier* node) {
-  Symbol* symbol = scopeResolve(current_scope, node->identifier->start, node->identifier->end);
-  Token* next_id;
-  LLVMValueRef indices[64];
+LLVMValueRef binaryOp(ASTType type, LLVMValueRef lhs, LLVMValueRef rhs) {
+  // TODO: this needs to know if the types are signed or unsigned 
+  // as well as float or int
+  switch (type) {
+    case ASTType::BINARY_ADD:
+      return LLVMBuildAdd(builder, lhs, rhs, "");
+
+    case ASTType::BINARY_SUB:
+      return LLVMBuildSub(builder, lhs, rhs, "");
+
+    case ASTType::BINARY_MUL:
+      return LLVMBuildMul(builder, lhs, rhs, "");
+
+    case ASTType::BINARY_DIV:
+      return LLVMBuildUDiv(builder, lhs, rhs, "");
+
+    case ASTType::BINARY_MOD:
+      return LLVMBuildSub(builder, lhs, rhs, "");
+
+    case ASTType::BINARY_LT:
+      return LLVMBuildICmp(builder, LLVMIntULT, lhs, rhs, "");
+
+    case ASTType::BINARY_GT:
+      return LLVMBuildICmp(builder, LLVMIntUGT, lhs, rhs, "");
+
+    case ASTType::BINARY_LE:
+      return LLVMBuildICmp(builder, LLVMIntULE, lhs, rhs, "");
+
+    case ASTType::BINARY_GE:
+      return LLVMBuildICmp(builder, LLVMIntUGE, lhs, rhs, "");
+
+    case ASTType::BINARY_EQ:
+      return LLVMBuildICmp(builder, LLVMIntEQ, lhs, rhs, "");
+
+    case ASTType::BINARY_NE:
+      return LLVMBuildICmp(builder, LLVMIntNE, lhs, rhs, "");
+
+    case ASTType::BINARY_AND:
+      return LLVMBuildAnd(builder, lhs, rhs, "");
+
+    case ASTType::BINARY_OR:
+      return LLVMBuildOr(builder, lhs, rhs, "");
+
+    case ASTType::BINARY_XOR:
+      return LLVMBuildXor(builder, lhs, rhs, "");
+
+    default:
+      assert(false && "Binary");
+  }
+}
+
+/*
+ * Values of the nodes that lower the same in both forms. members are the ids
+ * after the first part of a dotted name, symbol is what the first part
+ * resolved to.
+ */
+LLVMTypedValue symbolRef(Symbol* symbol, const InternId* members, int members_count) {
+  ScratchList<LLVMValueRef, 8> indices;
   Symbol* child_sym;
-  LLVMTypeRef struct_type = symbol->llvm_type;
   LLVMValueRef output = symbol->llvm_value;
-  int i = 0;
   switch (symbol->type) {
     case SymbolType::BOOL:
     case SymbolType::I8:
@@ -91,21 +208,18 @@ LLVMTypedValue identifierRef(Identifier* node) {
       return {symbol->llvm_type, symbol->llvm_value};
     // TODO handle pointers and strings
     case SymbolType::STRUCT_INSTANCE:
-      if (node->next == nullptr) {
+      if (members_count == 0) {
         return {symbol->llvm_type, symbol->llvm_value};
       }
 
-      indices[0] = LLVMConstInt(LLVMInt32Type(), 0, false);
+      indices.push(LLVMConstInt(LLVMInt32Type(), 0, false));
       child_sym = symbol;
-      for (; node->next != nullptr; i++) {
-        next_id = node->next->identifier;
-        child_sym = symbolGetStructChild(child_sym->struct_instance.struct_decl, next_id->start, next_id->end);
-        
-        indices[i] = child_sym->llvm_value;
-        node = node->next;
+      for (int i = 0; i < members_count; i++) {
+        child_sym = symbolGetStructChild(child_sym->struct_instance.struct_decl, members[i]);
+        indices.push(child_sym->llvm_value);
       }
 
-      output = LLVMBuildGEP2(builder, symbol->llvm_type, symbol->llvm_value, indices, i, "");
+      output = LLVMBuildGEP2(builder, symbol->llvm_type, symbol->llvm_value, indices.data, indices.size, "");
 
     default:
       assert(false && "Value refing incorrect type"); 
@@ -114,15 +228,11 @@ LLVMTypedValue identifierRef(Identifier* node) {
   return {child_sym->llvm_type, output};
 }
 
-LLVMValueRef identifierValue(Identifier* node) {
-  Symbol* symbol = scopeResolve(current_scope, node->identifier->start, node->identifier->end);
-  Token* next_id;
+LLVMValueRef symbolValue(Symbol* symbol, const InternId* members, int members_count) {
   unsigned long enum_value;
   Symbol* child_sym;
-  LLVMTypeRef struct_type = symbol->llvm_type;
   LLVMValueRef output = symbol->llvm_value;
-  LLVMValueRef indices[64];
-  int i = 0;
+  ScratchList<LLVMValueRef, 8> indices;
   switch (symbol->type) {
     case SymbolType::BOOL:
     case SymbolType::I8:
@@ -135,26 +245,22 @@ LLVMValueRef identifierValue(Identifier* node) {
     // TODO handle pointers and strings
 
     case SymbolType::ENUM:
-      next_id = node->next->identifier;
-      enum_value = symbolGetEnumChild(symbol, next_id->start, next_id->end);
+      enum_value = symbolGetEnumChild(symbol, members[0]);
       return LLVMConstInt(LLVMInt32Type(), enum_value, false);
 
     case SymbolType::STRUCT_INSTANCE:
-      if (node->next == nullptr) {
+      if (members_count == 0) {
         return LLVMBuildLoad2(builder, symbol->llvm_type, symbol->llvm_value, "");
       }
 
-      indices[0] = LLVMConstInt(LLVMInt32Type(), 0, false);
+      indices.push(LLVMConstInt(LLVMInt32Type(), 0, false));
       child_sym = symbol;
-      for (; node->next != nullptr; i++) {
-        next_id = node->next->identifier;
-        child_sym = symbolGetStructChild(child_sym->struct_instance.struct_decl, next_id->start, next_id->end);
-        
-        indices[i] = child_sym->llvm_value;
-        node = node->next;
+      for (int i = 0; i < members_count; i++) {
+        child_sym = symbolGetStructChild(child_sym->struct_instance.struct_decl, members[i]);
+        indices.push(child_sym->llvm_value);
       }
 
-      output = LLVMBuildGEP2(builder, symbol->llvm_type, symbol->llvm_value, indices, i, "");
+      output = LLVMBuildGEP2(builder, symbol->llvm_type, symbol->llvm_value, indices.data, indices.size, "");
       return LLVMBuildLoad2(builder, child_sym->llvm_type, output, "");
 
     default:
@@ -162,465 +268,749 @@ LLVMValueRef identifierValue(Identifier* node) {
   }
 }
 
-LLVMTypeRef type(Type* node) {
-  Symbol* symbol;
-  if (node->type == ASTType::TYPE_SIMPLE) {
-
-    switch (node->simple_type->type) {
-      case ASTType::SIMPLE_TYPE_I8:
-      case ASTType::SIMPLE_TYPE_U8:
-        return LLVMInt8Type();
-      case ASTType::SIMPLE_TYPE_I32:
-      case ASTType::SIMPLE_TYPE_U32:
-        return LLVMInt32Type();
-      case ASTType::SIMPLE_TYPE_F32:
-        return LLVMFloatType();
-      default:
-        assert(false && "Type not simple as advertised");
-    }
-  }
-  else if (node->type == ASTType::TYPE_ID) {
-    symbol = identifierDef(node->identifier);
-    switch (symbol->type) {
-      case SymbolType::ENUM:
-        return LLVMInt32Type();
-      case SymbolType::STRUCT:
-        return symbol->llvm_type;
-      default:
-        assert(false && "Type isn't a instantiable type");
-    }
-  }
-  else {
-    assert(false && "Type");
-  }
-}
+// Node is a Literal or CompactExpr, only the value member matching type is read. token is where the literal starts
+template <typename Node>
+LLVMValueRef literalValue(ASTType type, const Token& token, const Node& node) {
+  switch (type) {
+    case ASTType::LITERAL_STRING:
+      return LLVMConstString(token.start, token.end - token.end, false);
 
-void qualifier(Qualifier* node) {
-  switch (node->type) {
-    case ASTType::QUALIFIER_CONST:
-      break;
-    case ASTType::QUALIFIER_EXPORT:
-      break;
-    case ASTType::QUALIFIER_MUT:
-      break;
-    default:
-      assert(false && "Qualifier");
-  }
-}
+    case ASTType::LITERAL_INT:
+      return LLVMConstInt(LLVMInt32Type(), node.int_, false);
 
-LLVMValueRef expr(Expr* node);
-LLVMBasicBlockRef block(Block* node);
+    case ASTType::LITERAL_FLOAT:
+      return LLVMConstReal(LLVMFloatType(), node.float_);
 
-void declaration(Declaration* node) {
-  Symbol* symbol = identifierDef(node->identifier);
-  LLVMTypeRef llvm_type = type(node->decl_type);
+    case ASTType::LITERAL_BOOL:
+      return LLVMConstInt(LLVMInt8Type(), node.bool_, false);
 
-  // TODO this probably doesn't need to do anything
-  // maybe for export though?
-  for (int i = 0; i < node->qualifiers_count; i++) {
-    qualifier(node->qualifiers[i]);
+    default:
+      assert(false && "Literal");
   }
+}
 
-  // TODO: maybe this should insert the alloca at the top of the function
-
-  symbol->llvm_type = llvm_type;
-  symbol->llvm_value = LLVMBuildAlloca(builder, llvm_type, "");
-
-  if (node->expr != nullptr) {
-    LLVMValueRef value = expr(node->expr);
-    LLVMBuildStore(builder, value, symbol->llvm_value);
-  }
+// Ids of the parts after the first of a dotted name
+void memberIds(Identifier* node, ScratchList<InternId, 8>& members) {
+  for (Identifier* part = node->next; part != nullptr; part = part->next) members.push(part->identifier->id);
 }
 
-void assignment(Assignment* node) {
-  LLVMValueRef rhs = expr(node->expr);
-  LLVMTypedValue lhs = identifierRef(node->identifier);
-  LLVMBuildStore(builder, rhs, lhs.value);
+LLVMValueRef literalValue(Literal* node) {
+  return literalValue(node->type, *node->start, *node);
 }
 
-void conditional(Conditional* node) {
-  LLVMBasicBlockRef current = LLVMGetInsertBlock(builder);
-  LLVMBasicBlockRef iftrue = block(node->block);
+// Kept in the walk frame of a conditional or while while its blocks are lowered
+struct LoweringState {
+  LLVMBasicBlockRef current;
+  LLVMBasicBlockRef iftrue;
+  LLVMBasicBlockRef check;
+  LLVMBasicBlockRef end;
+  LLVMBasicBlockRef* outer_check;
+  LLVMBasicBlockRef* outer_end;
+};
+
+// Control flow of a pass whose blocks walk to the basic block they start and
+// whose condition returns the value of a condition. Child is a block of either
+// form and none stands for a missing one.
+template <typename Pass, typename Condition, typename Child>
+Child lowerConditional(Pass& pass, Condition condition_node, Child block, Child other, Child none, int step,
+    LoweringState& state, LLVMBasicBlockRef walked) {
   LLVMBasicBlockRef iffalse;
   LLVMBasicBlockRef end;
   LLVMValueRef condition;
 
-  if (node->other != nullptr) {
-    iffalse = block(node->other);
-  }
-  else {
-    iffalse = LLVMAppendBasicBlock(*current_func, "");
+  switch (step) {
+    case 0:
+      state.current = LLVMGetInsertBlock(builder);
+      return block;
+
+    case 1:
+      state.iftrue = walked;
+      if (other != none) return other;
+      iffalse = LLVMAppendBasicBlock(*current_func, "");
+      break;
+
+    default:
+      iffalse = walked;
   }
 
   end = LLVMAppendBasicBlock(*current_func, "");
 
-  LLVMPositionBuilderAtEnd(builder, iftrue);
+  LLVMPositionBuilderAtEnd(builder, state.iftrue);
   LLVMBuildBr(builder, end);
 
   LLVMPositionBuilderAtEnd(builder, iffalse);
   LLVMBuildBr(builder, end);
   
-  LLVMPositionBuilderAtEnd(builder, current);
+  LLVMPositionBuilderAtEnd(builder, state.current);
 
-  condition = expr(node->condition);
-  LLVMBuildCondBr(builder, condition, iftrue, iffalse);
+  condition = pass.condition(condition_node);
+  LLVMBuildCondBr(builder, condition, state.iftrue, iffalse);
 
   LLVMPositionBuilderAtEnd(builder, end);
+  return none;
 }
 
+template <typename Pass, typename Condition, typename Child>
+Child lowerWhile(Pass& pass, Condition condition_node, Child block, Child none, int step, LoweringState& state,
+    LLVMBasicBlockRef walked) {
+  if (step == 0) {
+    state.current = LLVMGetInsertBlock(builder);
+    state.check = LLVMAppendBasicBlock(*current_func, "");
+    state.outer_check = while_check;
+    state.outer_end = while_end;
 
+    while_check = &state.check;
+    // TODO: &end is curently nullptr and will be when block is visited
+    while_end = &state.end;
 
-void while_(While* node) {
-  LLVMBasicBlockRef current = LLVMGetInsertBlock(builder);
-  LLVMBasicBlockRef check = LLVMAppendBasicBlock(*current_func, "");
-  LLVMBasicBlockRef loop;
-  LLVMBasicBlockRef end;
-  LLVMBasicBlockRef* current_while_check = while_check;
-  LLVMBasicBlockRef* current_while_end = while_end;
-
-  while_check = &check;
-  // TODO: &end is curently nullptr and will be when block is visited
-  while_end = &end;
+    return block;
+  }
 
-  loop = block(node->block);
-  LLVMBuildBr(builder, check);
+  LLVMBasicBlockRef loop = walked;
+  LLVMBuildBr(builder, state.check);
 
-  LLVMPositionBuilderAtEnd(builder, current);
-  LLVMBuildBr(builder, check);
+  LLVMPositionBuilderAtEnd(builder, state.current);
+  LLVMBuildBr(builder, state.check);
 
-  LLVMPositionBuilderAtEnd(builder, check);
-  LLVMValueRef condition = expr(node->condition);
+  LLVMPositionBuilderAtEnd(builder, state.check);
+  LLVMValueRef condition = pass.condition(condition_node);
   LLVMValueRef cond_value = LLVMBuildICmp(builder, LLVMIntEQ, LLVMConstInt(LLVMInt8Type(), 0, false), condition, "");
-  LLVMBuildCondBr(builder, cond_value, end, loop);
+  LLVMBuildCondBr(builder, cond_value, state.end, loop);
 
-  LLVMPositionBuilderAtEnd(builder, end);
+  LLVMPositionBuilderAtEnd(builder, state.end);
 
-  while_check = current_while_check;
-  while_end = current_while_end;
+  while_check = state.outer_check;
+  while_end = state.outer_end;
+  return none;
 }
 
-void break_(Break* node) {
+/*
+ * Statements, block tags, expressions and primary tags use the switches of
+ * ASTVisitor, every other node is lowered here.
+ */
+struct CodeGen : ASTVisitor<CodeGen> {
+  typedef LoweringState WalkState;
+
+  Symbol* identifierDef(Identifier* node) {
+    // TODO: it seems like this might need to do more but im not sure
+    Symbol* symbol = scopeResolve(current_scope, node->identifier->id);
+    for (auto i = node->identifier->start; i != node->identifier->end; i++) {
+      fprintf(stderr, "%c", *i);
+    }
+    fprintf(stderr, "\n");
+    assert(symbol != nullptr);
+    return symbol;
+  }
 
-}
+  LLVMTypedValue identifierRef(Identifier* node) {
+    ScratchList<InternId, 8> members;
+    memberIds(node, members);
+    return symbolRef(scopeResolve(current_scope, node->identifier->id), members.data, members.size);
+  }
 
-void continue_(Continue* node) {
-  LLVMBuildBr(builder, *while_check);
-}
+  LLVMValueRef identifierValue(Identifier* node) {
+    ScratchList<InternId, 8> members;
+    memberIds(node, members);
+    return symbolValue(scopeResolve(current_scope, node->identifier->id), members.data, members.size);
+  }
 
-void return_(Return* node) {
-  if (node->expr != nullptr) {
-    LLVMValueRef value = expr(node->expr);
-    LLVMBuildRet(builder, value);
-    return;
+  LLVMTypeRef type(Type* node) {
+    Symbol* symbol;
+    if (node->type == ASTType::TYPE_SIMPLE) {
+      return codegen::simpleType(node->simple_type->type);
+    }
+    else if (node->type == ASTType::TYPE_ID) {
+      symbol = identifierDef(node->identifier);
+      switch (symbol->type) {
+        case SymbolType::ENUM:
+          return LLVMInt32Type();
+        case SymbolType::STRUCT:
+          return symbol->llvm_type;
+        default:
+          assert(false && "Type isn't a instantiable type");
+      }
+    }
+    else {
+      assert(false && "Type");
+    }
   }
-  LLVMBuildRetVoid(builder);
-}
 
-void statement(Statement* node) {
-  switch (node->type) {
-    case ASTType::STATEMENT_CONDITION:
-      conditional(node->conditional);
-      break;
-    case ASTType::STATEMENT_WHILE:
-      while_(node->while_);
-      break;
-    case ASTType::STATEMENT_BREAK:
-      break_(node->break_);
-      break;
-    case ASTType::STATEMENT_CONTINUE:
-      continue_(node->continue_);
-      break;
-    case ASTType::STATEMENT_RETURN:
-      return_(node->return_);
-      break;
-    case ASTType::STATEMENT_ASSIGN:
-      assignment(node->assignment);
-      break;
-    case ASTType::STATEMENT_EXPR:
+  void qualifier(Qualifier* node) {
+    switch (node->type) {
+      case ASTType::QUALIFIER_CONST:
+        break;
+      case ASTType::QUALIFIER_EXPORT:
+        break;
+      case ASTType::QUALIFIER_MUT:
+        break;
+      default:
+        assert(false && "Qualifier");
+    }
+  }
+
+
+  void declaration(Declaration* node) {
+    Symbol* symbol = identifierDef(node->identifier);
+    LLVMTypeRef llvm_type = type(node->decl_type);
+
+    // TODO this probably doesn't need to do anything
+    // maybe for export though?
+    for (int i = 0; i < node->qualifiers_count; i++) {
+      qualifier(node->qualifiers[i]);
+    }
+
+    // TODO: maybe this should insert the alloca at the top of the function
+
+    symbol->llvm_type = llvm_type;
+    symbol->llvm_value = LLVMBuildAlloca(builder, llvm_type, "");
+
+    if (node->expr != nullptr) {
+      LLVMValueRef value = expr(node->expr);
+      LLVMBuildStore(builder, value, symbol->llvm_value);
+    }
+  }
+
+  void assignment(Assignment* node) {
+    LLVMValueRef rhs = expr(node->expr);
+    LLVMTypedValue lhs = identifierRef(node->identifier);
+    LLVMBuildStore(builder, rhs, lhs.value);
+  }
+
+  LLVMValueRef condition(Expr* node) {
+    return expr(node);
+  }
+
+  Block* conditional(Conditional* node, int step, WalkState& state, LLVMBasicBlockRef walked) {
+    return lowerConditional(*this, node->condition, node->block, node->other, (Block*) nullptr, step, state, walked);
+  }
+
+  Block* while_(While* node, int step, WalkState& state, LLVMBasicBlockRef walked) {
+    return lowerWhile(*this, node->condition, node->block, (Block*) nullptr, step, state, walked);
+  }
+
+  void continue_(Continue*) {
+    LLVMBuildBr(builder, *while_check);
+  }
+
+  void return_(Return* node) {
+    if (node->expr != nullptr) {
+      LLVMValueRef value = expr(node->expr);
+      LLVMBuildRet(builder, value);
+      return;
+    }
+    LLVMBuildRetVoid(builder);
+  }
+
+  LLVMBasicBlockRef blockEnter(Block* node) {
+    pushScope(node);
+
+    LLVMBasicBlockRef current = LLVMAppendBasicBlock(*current_func, "");
+    LLVMBuildBr(builder, current);
+    LLVMPositionBuilderAtEnd(builder, current);
+
+    // TODO: implement
+    if (node->namespace_ != nullptr) {
+      //identifierDef(node->namespace_);
+    }
+
+    return current;
+  }
+
+  void blockLeave(Block*) {
+    popScope();
+  }
+
+  LLVMValueRef literal(Literal* node) {
+    return literalValue(node);
+  }
+
+  Symbol* callee(Call* node) {
+    return identifierDef(node->identifier);
+  }
+
+  LLVMValueRef call(Call* node, Symbol* symbol, LLVMValueRef* args) {
+    return LLVMBuildCall2(builder, symbol->llvm_type, calleeValue(symbol), args, node->arguments_count, "");
+  }
+
+  LLVMValueRef unary(Unary* node, LLVMValueRef operand) {
+    return unaryOp(node->type, operand);
+  }
+
+  LLVMValueRef binary(Binary* node, LLVMValueRef lhs, LLVMValueRef rhs) {
+    return binaryOp(node->type, lhs, rhs);
+  }
+
+  // Adds the function to the module without a body
+  Symbol* functionDecl(Function* node) {
+    Symbol* symbol = identifierDef(node->header->identifier);
+    LLVMTypeRef return_type = type(node->header->return_type);
+    ScratchList<LLVMTypeRef, 8> param_types;
+
+    for (int i = 0; i < node->header->parameter_count; i++) {
+      param_types.push(type(node->header->parameter_list[i]->decl_type));
+    }
+
+
+    symbol->llvm_type = LLVMFunctionType(return_type, param_types.data, param_types.size, false);
+    symbol->llvm_value = LLVMAddFunction(module, symbolName(symbol).c_str(), symbol->llvm_type);
+    return symbol;
+  }
+
+  void functionDef(Function* node, Symbol* symbol) {
+    LLVMBasicBlockRef init_block = LLVMAppendBasicBlock(symbol->llvm_value, "");
+    LLVMPositionBuilderAtEnd(builder, init_block);
+
+    pushScope(node);
+
+    for (int j = 0; j < node->header->parameter_count; j++) {
+      Symbol* param_sym = identifierDef(node->header->parameter_list[j]->identifier);
+      LLVMValueRef param = LLVMGetParam(symbol->llvm_value, j);
+      param_sym->llvm_type = LLVMTypeOf(param);
+      param_sym->llvm_value = LLVMBuildAlloca(builder, param_sym->llvm_type, "");
+      LLVMBuildStore(builder, param, param_sym->llvm_value);
+    }
+
+    current_func = &symbol->llvm_value;
+  /* TODO : either implement or remove this
+    if (node->expr != nullptr) {
       expr(node->expr);
-      break;
-    default:
-      assert(false && "Statement");
+    }
+  */
+    Block* body = functionBody(node);
+    if (body != nullptr) {
+      block(body);
+    }
+
+    popScope();
+
+    current_func = nullptr;
   }
-}
 
-void blockTag(BlockTag* node) {
-  switch (node->type) {
-    case ASTType::BLOCK_TAG_BLOCK:
-      block(node->block);
-      break;
-    case ASTType::BLOCK_TAG_STATEMENT:
-      statement(node->statement);
-      break;
-    default:
-      assert(false && "Block Tag");
+  void function(Function* node) {
+    functionDef(node, functionDecl(node));
   }
-}
 
-LLVMBasicBlockRef block(Block* node) {
-  pushScope(node);
+  void struct_(Struct* node) {
+    Symbol* symbol = identifierDef(node->identifier);
+    ScratchList<LLVMTypeRef, 16> struct_types;
+
+    symbol->llvm_type = LLVMStructCreateNamed(LLVMGetGlobalContext(), symbolName(symbol).c_str());
+
+    pushScope(node);
+    for (int i = 0; i < node->declarations_count; i++) {
+      Symbol* child = identifierDef(node->declarations[i]->identifier);
+      child->llvm_value = LLVMConstInt(LLVMInt32Type(), i, false);
+      child->llvm_type = type(node->declarations[i]->decl_type);
+      struct_types.push(child->llvm_type);
+    }
 
-  LLVMBasicBlockRef current = LLVMAppendBasicBlock(*current_func, "");
-  LLVMBuildBr(builder, current);
-  LLVMPositionBuilderAtEnd(builder, current);
+    popScope();
 
-  // TODO: implement
-  if (node->namespace_ != nullptr) {
-    //identifierDef(node->namespace_);
+    LLVMStructSetBody(symbol->llvm_type, struct_types.data, struct_types.size, false);
   }
 
-  if (node->statement != nullptr) {
-    statement(node->statement);
+  void enum_(Enum*) {
+    /*
+    identifier(node->identifier);
+    
+    for (int i = 0; i < node->members_count; i++) {
+    }
+    */
   }
+};
 
-  for (int i = 0; i < node->declarations_count; i++) {
-    declaration(node->declarations[i]);
+struct CheckedValue {
+  Symbol symbol;
+  LLVMValueRef value;
+};
+
+/*
+ * Checks and lowers a function body in one walk, for bodies whose top level
+ * names visitDefRefDeclarations and visitCodeGenDeclarations already know.
+ * Each node is checked by the defref rule for it, then lowered from the symbol
+ * that rule resolved, so a name is looked up once and no scope is stored for
+ * a later walk to find. Expressions return their symbol and their value.
+ */
+struct FusedCodeGen : ASTVisitor<FusedCodeGen> {
+  typedef LoweringState WalkState;
+
+  Scope* scope;
+
+  LLVMTypeRef symbolType(Symbol type_sym) {
+    switch (type_sym.type) {
+      case SymbolType::I8:
+      case SymbolType::U8:
+        return LLVMInt8Type();
+      case SymbolType::I32:
+      case SymbolType::U32:
+        return LLVMInt32Type();
+      case SymbolType::F32:
+        return LLVMFloatType();
+      case SymbolType::ENUM:
+        return LLVMInt32Type();
+      case SymbolType::STRUCT:
+        return type_sym.llvm_type;
+      default:
+        assert(false && "Type isn't a instantiable type");
+    }
   }
 
-  for (int i = 0; i < node->block_tags_count; i++) {
-    blockTag(node->block_tags[i]);
+  CheckedValue identifierValue(Identifier* node) {
+    Symbol* symbol = defrefResolve(scope, node);
+    ScratchList<InternId, 8> members;
+    memberIds(node, members);
+    return {*symbol, symbolValue(symbol, members.data, members.size)};
   }
 
-  popScope();
+  void declaration(Declaration* node) {
+    Symbol type_sym = defrefType(scope, node->decl_type);
+    Symbol* symbol = defrefDeclaration(scope, node->identifier, type_sym);
 
-  return current;
-}
+    symbol->llvm_type = symbolType(type_sym);
+    symbol->llvm_value = LLVMBuildAlloca(builder, symbol->llvm_type, "");
 
-LLVMValueRef literal(Literal* node) {
-  switch (node->type) {
-    case ASTType::LITERAL_STRING:
-      return LLVMConstString(node->start->start, node->start->end - node->start->end, false);
+    if (node->expr != nullptr) {
+      CheckedValue value = expr(node->expr);
+      defrefAssignment(*node->start, symbol, value.symbol);
+      LLVMBuildStore(builder, value.value, symbol->llvm_value);
+    }
 
-    case ASTType::LITERAL_INT:
-      return LLVMConstInt(LLVMInt32Type(), std::stol(std::string {node->start->start, node->start->end}), false);
+    scopeDeclare(scope, symbol);
+  }
 
-    case ASTType::LITERAL_FLOAT:
-      return LLVMConstReal(LLVMFloatType(), std::stof(std::string {node->start->start, node->start->end}));
+  void assignment(Assignment* node) {
+    CheckedValue rhs = expr(node->expr);
+    Symbol* symbol = defrefResolve(scope, node->identifier);
+    defrefAssignment(*node->start, symbol, rhs.symbol);
+    ScratchList<InternId, 8> members;
+    memberIds(node->identifier, members);
+    LLVMTypedValue lhs = symbolRef(symbol, members.data, members.size);
+    LLVMBuildStore(builder, rhs.value, lhs.value);
+  }
 
-    case ASTType::LITERAL_BOOL:
-      return LLVMConstInt(LLVMInt8Type(), node->bool_, false);
+  LLVMValueRef condition(Expr* node) {
+    CheckedValue value = expr(node);
+    defrefCondition(*node->start, value.symbol);
+    return value.value;
+  }
 
-    default:
-      assert(false && "Literal");
+  Block* conditional(Conditional* node, int step, WalkState& state, LLVMBasicBlockRef walked) {
+    return lowerConditional(*this, node->condition, node->block, node->other, (Block*) nullptr, step, state, walked);
   }
-}
 
-LLVMValueRef call(Call* node) {
-  Symbol* symbol = identifierDef(node->identifier);
+  Block* while_(While* node, int step, WalkState& state, LLVMBasicBlockRef walked) {
+    return lowerWhile(*this, node->condition, node->block, (Block*) nullptr, step, state, walked);
+  }
 
-  LLVMValueRef args[64];
+  void continue_(Continue*) {
+    LLVMBuildBr(builder, *while_check);
+  }
 
-  int i = 0;
-  for (; i < node->arguments_count; i++) {
-    args[i] = expr(node->arguments[i]);
+  void return_(Return* node) {
+    if (node->expr != nullptr) {
+      LLVMBuildRet(builder, expr(node->expr).value);
+      return;
+    }
+    LLVMBuildRetVoid(builder);
   }
 
-  return LLVMBuildCall2(builder, symbol->llvm_type, symbol->llvm_value, args, i, "");
-}
+  LLVMBasicBlockRef blockEnter(Block* node) {
+    scope = scopeCreate(scope, node);
 
-LLVMValueRef unary(Unary* node) {
-  // TODO: this needs to be more type aware
-  // LLVMBuildFNeg exists
-  LLVMValueRef value = expr(node->expr);
-  switch (node->type) {
-    case ASTType::UNARY_NOT:
-      return LLVMBuildNot(builder, value, "");
-      break;
-    case ASTType::UNARY_PLUS:
-      return value;
-      break;
-    case ASTType::UNARY_MINUS:
-      return LLVMBuildNeg(builder, value, "");
-    default:
-      assert(false && "Unary");
+    LLVMBasicBlockRef current = LLVMAppendBasicBlock(*current_func, "");
+    LLVMBuildBr(builder, current);
+    LLVMPositionBuilderAtEnd(builder, current);
+    return current;
   }
-}
 
-LLVMValueRef binary(Binary* node) {
-  // TODO: this needs to know if the types are signed or unsigned 
-  // as well as float or int
-  LLVMValueRef lhs = expr(node->first);
-  LLVMValueRef rhs = expr(node->second);
+  void blockLeave(Block*) {
+    scope = scope->parent;
+  }
 
-  switch (node->type) {
-    case ASTType::BINARY_ADD:
-      return LLVMBuildAdd(builder, lhs, rhs, "");
+  CheckedValue literal(Literal* node) {
+    return {defrefLiteral(node->type), literalValue(node)};
+  }
 
-    case ASTType::BINARY_SUB:
-      return LLVMBuildSub(builder, lhs, rhs, "");
+  Symbol* callee(Call* node) {
+    return defrefResolve(scope, node->identifier);
+  }
 
-    case ASTType::BINARY_MUL:
-      return LLVMBuildMul(builder, lhs, rhs, "");
+  CheckedValue call(Call* node, Symbol* symbol, CheckedValue* arguments) {
+    ScratchList<Symbol, 8> argument_syms;
+    ScratchList<LLVMValueRef, 8> args;
 
-    case ASTType::BINARY_DIV:
-      return LLVMBuildUDiv(builder, lhs, rhs, "");
+    for (int i = 0; i < node->arguments_count; i++) {
+      argument_syms.push(arguments[i].symbol);
+      args.push(arguments[i].value);
+    }
 
-    case ASTType::BINARY_MOD:
-      return LLVMBuildSub(builder, lhs, rhs, "");
+    Symbol output = defrefCall(*node->start, symbol, argument_syms.data, argument_syms.size);
+    return {output, LLVMBuildCall2(builder, symbol->llvm_type, calleeValue(symbol), args.data, args.size, "")};
+  }
 
-    case ASTType::BINARY_LT:
-      return LLVMBuildICmp(builder, LLVMIntULT, lhs, rhs, "");
+  CheckedValue unary(Unary* node, CheckedValue operand) {
+    return {defrefUnary(*node->start, node->type, operand.symbol), unaryOp(node->type, operand.value)};
+  }
 
-    case ASTType::BINARY_GT:
-      return LLVMBuildICmp(builder, LLVMIntUGT, lhs, rhs, "");
+  CheckedValue binary(Binary* node, CheckedValue lhs, CheckedValue rhs) {
+    return {defrefBinary(*node->start, node->type, lhs.symbol, rhs.symbol), binaryOp(node->type, lhs.value, rhs.value)};
+  }
 
-    case ASTType::BINARY_LE:
-      return LLVMBuildICmp(builder, LLVMIntULE, lhs, rhs, "");
+  // The scope of the function and its parameters are the ones visitDefRefDeclarations made
+  void functionDef(Function* node, Symbol* symbol) {
+    LLVMBasicBlockRef init_block = LLVMAppendBasicBlock(symbol->llvm_value, "");
+    LLVMPositionBuilderAtEnd(builder, init_block);
 
-    case ASTType::BINARY_GE:
-      return LLVMBuildICmp(builder, LLVMIntUGE, lhs, rhs, "");
+    scope = symbol->function.scope;
 
-    case ASTType::BINARY_EQ:
-      return LLVMBuildICmp(builder, LLVMIntEQ, lhs, rhs, "");
+    for (int j = 0; j < node->header->parameter_count; j++) {
+      Symbol* param_sym = scopeResolve(scope, node->header->parameter_list[j]->identifier->identifier->id);
+      LLVMValueRef param = LLVMGetParam(symbol->llvm_value, j);
+      param_sym->llvm_type = LLVMTypeOf(param);
+      param_sym->llvm_value = LLVMBuildAlloca(builder, param_sym->llvm_type, "");
+      LLVMBuildStore(builder, param, param_sym->llvm_value);
+    }
 
-    case ASTType::BINARY_NE:
-      return LLVMBuildICmp(builder, LLVMIntNE, lhs, rhs, "");
+    current_func = &symbol->llvm_value;
 
-    case ASTType::BINARY_AND:
-      return LLVMBuildAnd(builder, lhs, rhs, "");
+    Block* body = functionBody(node);
+    if (body != nullptr) {
+      block(body);
+    }
 
-    case ASTType::BINARY_OR:
-      return LLVMBuildOr(builder, lhs, rhs, "");
+    current_func = nullptr;
+  }
+};
 
-    case ASTType::BINARY_XOR:
-      return LLVMBuildXor(builder, lhs, rhs, "");
+};
 
-    default:
-      assert(false && "Binary");
+/*
+ * Same lowering for the compact form, scopes are the ones defref created for
+ * the compact nodes. Statements, block tags and expressions use the walk of
+ * CompactVisitor.
+ */
+namespace codegen {
+namespace compact {
+
+struct CodeGen : CompactVisitor<CodeGen> {
+  typedef LoweringState WalkState;
+
+  std::string name(CompactIdentifier& node) {
+    return {compactTokenStart(ast, node.token), compactTokenLength(ast, node.token)};
   }
-}
 
-LLVMValueRef expr(Expr* node) {
-  switch (node->type) {
-    case ASTType::EXPRESSION_CALL:
-      return call(node->call);
+  Symbol* identifierDef(NodeIndex index) {
+    CompactIdentifier& node = ast->identifiers[index];
+    Symbol* symbol = scopeResolve(current_scope, node.id);
+    fprintf(stderr, "%s\n", name(node).c_str());
+    assert(symbol != nullptr);
+    return symbol;
+  }
 
-    case ASTType::EXPRESSION_UNARY:
-      return unary(node->unary);
+  void memberIds(NodeIndex index, ScratchList<InternId, 8>& members) {
+    for (uint32_t i = 1; i <= ast->identifiers[index].rest; i++) members.push(ast->identifiers[index + i].id);
+  }
 
-    case ASTType::EXPRESSION_BINARY:
-      return binary(node->binary);
-      
-    case ASTType::EXPRESSION_IDENTIFIER:
-      return identifierValue(node->identifier);
+  LLVMTypedValue identifierRef(NodeIndex index) {
+    ScratchList<InternId, 8> members;
+    memberIds(index, members);
+    return symbolRef(scopeResolve(current_scope, ast->identifiers[index].id), members.data, members.size);
+  }
 
-    case ASTType::EXPRESSION_LITERAL:
-      return literal(node->literal);
-      
-    default:
-      assert(false && "Expr");
+  LLVMValueRef identifierValue(NodeIndex index) {
+    ScratchList<InternId, 8> members;
+    memberIds(index, members);
+    return symbolValue(scopeResolve(current_scope, ast->identifiers[index].id), members.data, members.size);
+  }
+
+  LLVMTypeRef type(NodeIndex index) {
+    CompactType& node = ast->types[index];
+    Symbol* symbol;
+    if (node.type == ASTType::TYPE_SIMPLE) {
+      return simpleType(node.simple_type);
+    }
+    else if (node.type == ASTType::TYPE_ID) {
+      symbol = identifierDef(node.identifier);
+      switch (symbol->type) {
+        case SymbolType::ENUM:
+          return LLVMInt32Type();
+        case SymbolType::STRUCT:
+          return symbol->llvm_type;
+        default:
+          assert(false && "Type isn't a instantiable type");
+      }
+    }
+    else {
+      assert(false && "Type");
+    }
   }
-}
 
-void function(Function* node) {
-  Symbol* symbol = identifierDef(node->header->identifier);
-  LLVMTypeRef return_type = type(node->header->return_type);
-  LLVMTypeRef param_types[64];
+  void declaration(NodeIndex index) {
+    CompactDeclaration& node = ast->declarations[index];
+    Symbol* symbol = identifierDef(node.identifier);
+    LLVMTypeRef llvm_type = type(node.decl_type);
+
+    symbol->llvm_type = llvm_type;
+    symbol->llvm_value = LLVMBuildAlloca(builder, llvm_type, "");
+
+    if (node.expr != NODE_NONE) {
+      LLVMValueRef value = expr(node.expr);
+      LLVMBuildStore(builder, value, symbol->llvm_value);
+    }
+  }
 
-  int i = 0;
-  for (;i < node->header->parameter_count; i++) {
-    LLVMTypeRef param_type = type(node->header->parameter_list[i]->decl_type);
-    param_types[i] = param_type;
+  void assignment(CompactStatement& node) {
+    LLVMValueRef rhs = expr(node.expr);
+    LLVMTypedValue lhs = identifierRef(node.identifier);
+    LLVMBuildStore(builder, rhs, lhs.value);
   }
 
+  LLVMValueRef condition(NodeIndex index) {
+    return expr(index);
+  }
 
-  // TODO: this is so hacky
-  char c = *symbol->end;
-  *(char*)symbol->end = '\0';
-  symbol->llvm_type = LLVMFunctionType(return_type, param_types, i, false);
-  symbol->llvm_value = LLVMAddFunction(module, symbol->start, symbol->llvm_type);
-  *(char*)symbol->end = c;
+  NodeIndex conditional(CompactStatement& node, int step, WalkState& state, LLVMBasicBlockRef walked) {
+    return lowerConditional(*this, node.expr, node.block, node.other, NODE_NONE, step, state, walked);
+  }
 
-  LLVMBasicBlockRef init_block = LLVMAppendBasicBlock(symbol->llvm_value, "");
-  LLVMPositionBuilderAtEnd(builder, init_block);
+  NodeIndex while_(CompactStatement& node, int step, WalkState& state, LLVMBasicBlockRef walked) {
+    return lowerWhile(*this, node.expr, node.block, NODE_NONE, step, state, walked);
+  }
 
-  pushScope(node);
+  void continue_(CompactStatement&) {
+    LLVMBuildBr(builder, *while_check);
+  }
 
-  for (int j = 0; j < node->header->parameter_count; j++) {
-    Symbol* param_sym = identifierDef(node->header->parameter_list[j]->identifier);
-    param_sym->llvm_type = param_types[j];
-    param_sym->llvm_value = LLVMBuildAlloca(builder, param_types[j], "");
-    LLVMBuildStore(builder, LLVMGetParam(symbol->llvm_value, j), param_sym->llvm_value);
+  void return_(CompactStatement& node) {
+    if (node.expr != NODE_NONE) {
+      LLVMValueRef value = expr(node.expr);
+      LLVMBuildRet(builder, value);
+      return;
+    }
+    LLVMBuildRetVoid(builder);
   }
 
-  current_func = &symbol->llvm_value;
-/* TODO : either implement or remove this
-  if (node->expr != nullptr) {
-    expr(node->expr);
+  LLVMBasicBlockRef blockEnter(CompactBlock& node) {
+    pushScope(&node);
+
+    LLVMBasicBlockRef current = LLVMAppendBasicBlock(*current_func, "");
+    LLVMBuildBr(builder, current);
+    LLVMPositionBuilderAtEnd(builder, current);
+
+    return current;
   }
-*/
-  if (node->block != nullptr) {
-    block(node->block);
+
+  void blockLeave(CompactBlock&) {
+    popScope();
   }
 
-  popScope();
+  LLVMValueRef literal(CompactExpr& node) {
+    return literalValue(node.op, tokenGet(ast->stream, node.start), node);
+  }
 
-  current_func = nullptr;
-}
+  Symbol* callee(CompactExpr& node) {
+    return identifierDef(node.identifier);
+  }
 
-void struct_(Struct* node) {
-  Symbol* symbol = identifierDef(node->identifier);
-  LLVMTypeRef struct_types[64];
+  LLVMValueRef call(CompactExpr& node, Symbol* symbol, LLVMValueRef* args) {
+    return LLVMBuildCall2(builder, symbol->llvm_type, symbol->llvm_value, args, node.children.count, "");
+  }
 
-  // TODO: this is so hacky
-  char c = *symbol->end;
-  *(char*)symbol->end = '\0';
-  symbol->llvm_type = LLVMStructCreateNamed(LLVMGetGlobalContext(), symbol->start);
-  *(char*)symbol->end = c;
+  LLVMValueRef unary(CompactExpr& node, LLVMValueRef operand) {
+    return unaryOp(node.op, operand);
+  }
 
-  pushScope(node);
-  int i = 0;
-  for (; i < node->declarations_count; i++) {
-    Symbol* child = identifierDef(node->declarations[i]->identifier);
-    child->llvm_value = LLVMConstInt(LLVMInt32Type(), i, false);
-    child->llvm_type = type(node->declarations[i]->decl_type);
-    struct_types[i] = child->llvm_type;
+  LLVMValueRef binary(CompactExpr& node, LLVMValueRef lhs, LLVMValueRef rhs) {
+    return binaryOp(node.op, lhs, rhs);
   }
 
-  popScope();
+  void function(NodeIndex index) {
+    CompactFunction& node = ast->functions[index];
+    Symbol* symbol = identifierDef(node.identifier);
+    LLVMTypeRef return_type = type(node.return_type);
+    ScratchList<LLVMTypeRef, 8> param_types;
 
-  LLVMStructSetBody(symbol->llvm_type, struct_types, i, false);
-}
+    for (uint32_t i = 0; i < node.params.count; i++) {
+      param_types.push(type(ast->params[node.params.first + i].decl_type));
+    }
 
-void enum_(Enum* node) {
-  /*
-  identifier(node->identifier);
-  
-  for (int i = 0; i < node->members_count; i++) {
+    symbol->llvm_type = LLVMFunctionType(return_type, param_types.data, param_types.size, false);
+    symbol->llvm_value = LLVMAddFunction(module, symbolName(symbol).c_str(), symbol->llvm_type);
+
+    LLVMBasicBlockRef init_block = LLVMAppendBasicBlock(symbol->llvm_value, "");
+    LLVMPositionBuilderAtEnd(builder, init_block);
+
+    pushScope(&node);
+
+    for (uint32_t j = 0; j < node.params.count; j++) {
+      Symbol* param_sym = identifierDef(ast->params[node.params.first + j].identifier);
+      param_sym->llvm_type = param_types[j];
+      param_sym->llvm_value = LLVMBuildAlloca(builder, param_types[j], "");
+      LLVMBuildStore(builder, LLVMGetParam(symbol->llvm_value, j), param_sym->llvm_value);
+    }
+
+    current_func = &symbol->llvm_value;
+
+    if (node.block != NODE_NONE) {
+      block(node.block);
+    }
+
+    popScope();
+
+    current_func = nullptr;
   }
-  */
-}
 
-void primaryTag(PrimaryTag* node) {
-  switch (node->type) {
-    case ASTType::PRIMARY_TAG_DECL:
-      // TODO: build a global yourself
-      declaration(node->decl);
-      break;
-    case ASTType::PRIMARY_TAG_ENUM:
-      enum_(node->enum_);
-      break;
-    case ASTType::PRIMARY_TAG_FUNC:
-      function(node->func);
-      break;
-    case ASTType::PRIMARY_TAG_STRUCT:
-      struct_(node->struct_);
-      break;
-    default:
-      assert(false && "Primary Tag");
+  void struct_(NodeIndex index) {
+    CompactStruct& node = ast->structs[index];
+    Symbol* symbol = identifierDef(node.identifier);
+    ScratchList<LLVMTypeRef, 16> struct_types;
+
+    symbol->llvm_type = LLVMStructCreateNamed(LLVMGetGlobalContext(), symbolName(symbol).c_str());
+
+    pushScope(&node);
+    for (uint32_t i = 0; i < node.declarations.count; i++) {
+      CompactDeclaration& decl = ast->declarations[node.declarations.first + i];
+      Symbol* child = identifierDef(decl.identifier);
+      child->llvm_value = LLVMConstInt(LLVMInt32Type(), i, false);
+      child->llvm_type = type(decl.decl_type);
+      struct_types.push(child->llvm_type);
+    }
+
+    popScope();
+
+    LLVMStructSetBody(symbol->llvm_type, struct_types.data, struct_types.size, false);
   }
-}
 
-void primary(Primary* node) {
-  for (int i = 0; i < node->primary_tags_count; i++) {
-    primaryTag(node->primary_tags[i]);
+  void primaryTag(CompactTag& node) {
+    switch (node.type) {
+      case ASTType::PRIMARY_TAG_DECL:
+        // TODO: build a global yourself
+        declaration(node.child);
+        break;
+      case ASTType::PRIMARY_TAG_ENUM:
+        break;
+      case ASTType::PRIMARY_TAG_FUNC:
+        function(node.child);
+        break;
+      case ASTType::PRIMARY_TAG_STRUCT:
+        struct_(node.child);
+        break;
+      default:
+        assert(false && "Primary Tag");
+    }
   }
-}
 
+  void primary() {
+    for (uint32_t i = 0; i < ast->primary_tags.count; i++) {
+      primaryTag(ast->primary_tags[i]);
+    }
+  }
 };
 
-void visitCodeGen(Primary* node) {
-  char* error = nullptr;
+}
+}
+
+void moduleBegin() {
   module = LLVMModuleCreateWithName("main_module");
 
   builder = LLVMCreateBuilder();
@@ -628,8 +1018,10 @@ void visitCodeGen(Primary* node) {
   LLVMValueRef global = LLVMAddGlobal(module, LLVMInt32Type(), "name");
 
   codegen::scope_index = 0;
-  codegen::current_scope = scopeGet(node);
-  codegen::primary(node);
+}
+
+void moduleEnd() {
+  char* error = nullptr;
 
   LLVMVerifyModule(module, LLVMAbortProcessAction, &error);
   LLVMDisposeMessage(error);
@@ -639,7 +1031,122 @@ void visitCodeGen(Primary* node) {
   // TODO: LLVMPrintModuleToFile(LLVMModuleRef M, const char *Filename, char **ErrorMessage)
 
   LLVMDisposeBuilder(builder);
+}
+
+void visitCodeGen(Primary* node) {
+  moduleBegin();
+
+  codegen::current_scope = scopeGet(node);
+
+  codegen::CodeGen pass;
+  pass.primary(node);
+
+  moduleEnd();
+}
+
+void visitCodeGen(CompactAst* ast) {
+  moduleBegin();
+
+  codegen::current_scope = scopeGet(ast);
+  codegen::compact::CodeGen pass;
+  pass.ast = ast;
+  pass.primary();
+
+  moduleEnd();
+}
+
+/*
+ * Pipelined printing. The module the declarations are lowered into is printed
+ * first. Then each body is lowered into a module of its own, which only
+ * declares the functions the body calls, and that module is printed and freed.
+ * Everything is printed by LLVM's module printer, linked together the printed
+ * modules are the module visitCodeGen prints.
+ */
+namespace codegen {
+namespace pipelined {
+
+// The declaration of the function whose body is being lowered
+LLVMValueRef declaration;
+
+// Printed in one write, LLVMDumpModule writes to stderr unbuffered
+void modulePrint(LLVMModuleRef printed) {
+  char* text = LLVMPrintModuleToString(printed);
+  fputs(text, stderr);
+  LLVMDisposeMessage(text);
+}
+
+// Points symbol at a definition of it in a new module for its body
+void bodyBegin(Symbol* symbol) {
+  size_t length = 0;
+  const char* name = LLVMGetValueName2(symbol->llvm_value, &length);
+
+  body_module = LLVMModuleCreateWithName(name);
+  LLVMSetDataLayout(body_module, LLVMGetDataLayoutStr(module));
+  LLVMSetTarget(body_module, LLVMGetTarget(module));
+
+  declaration = symbol->llvm_value;
+  symbol->llvm_value = functionCopy(declaration);
+}
+
+// Verifies and prints the module of a lowered body then frees it
+void bodyEnd(Symbol* symbol) {
+  char* error = nullptr;
+  LLVMVerifyModule(body_module, LLVMAbortProcessAction, &error);
+  LLVMDisposeMessage(error);
 
+  modulePrint(body_module);
+  LLVMDisposeModule(body_module);
+  body_module = nullptr;
+  symbol->llvm_value = declaration;
+}
+
+}
+}
+
+void visitCodeGenDeclarations(Primary* node) {
+  moduleBegin();
+
+  codegen::current_scope = scopeGet(node);
+
+  codegen::CodeGen pass;
+
+  for (int i = 0; i < node->primary_tags_count; i++) {
+    PrimaryTag* tag = node->primary_tags[i];
+    if (tag->type == ASTType::PRIMARY_TAG_FUNC) {
+      pass.functionDecl(tag->func);
+      continue;
+    }
+
+    pass.primaryTag(tag);
+  }
+
+  char* error = nullptr;
+  LLVMVerifyModule(module, LLVMAbortProcessAction, &error);
+  LLVMDisposeMessage(error);
+
+  codegen::pipelined::modulePrint(module);
+}
+
+void visitCodeGenFunction(Function* node) {
+  Symbol* symbol = scopeResolve(codegen::current_scope, node->header->identifier->identifier->id);
+  assert(symbol != nullptr && symbol->type == SymbolType::FUNCTION && "visitCodeGenFunction: not declared");
+  codegen::pipelined::bodyBegin(symbol);
+  codegen::CodeGen pass;
+  pass.functionDef(node, symbol);
+  codegen::pipelined::bodyEnd(symbol);
+}
+
+void visitCodeGenFunctionFused(Function* node) {
+  Symbol* symbol = scopeResolve(codegen::current_scope, node->header->identifier->identifier->id);
+  assert(symbol != nullptr && symbol->type == SymbolType::FUNCTION && "visitCodeGenFunctionFused: not declared");
+  codegen::pipelined::bodyBegin(symbol);
+  codegen::FusedCodeGen pass;
+  pass.functionDef(node, symbol);
+  codegen::pipelined::bodyEnd(symbol);
+}
+
+void visitCodeGenEnd() {
+  LLVMDisposeBuilder(builder);
 }
 
 void codegen_destroy() {
@@ -1,9 +1,22 @@
 #pragma once
 #include "ast_types.h"
+#include "compact_ast.h"
 #include <llvm-c/Types.h>
 
 extern LLVMModuleRef module;
 
 void visitCodeGen(Primary* node);
+void visitCodeGen(CompactAst* ast);
+
+// Streaming form, after visitDefRefDeclarations. Types, globals and function
+// declarations are lowered and printed as one module first, then each body is
+// lowered into a module of its own, printed and freed. Linked together the
+// printed modules are the module visitCodeGen prints.
+void visitCodeGenDeclarations(Primary* node);
+void visitCodeGenFunction(Function* node);
+// Instead of visitDefRefFunction and visitCodeGenFunction, checks and lowers
+// the body in one walk
+void visitCodeGenFunctionFused(Function* node);
+void visitCodeGenEnd();
 void codegen_destroy();
 
@@ -0,0 +1,558 @@
+#include "compact_ast.h"
+#include "ast_types.h"
+#include "ast_visitor.h"
+#include "parser.h"
+#include "token_stream.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#define COMPACT_AST_INITIAL_CAPACITY 64
+
+template <typename T>
+NodeIndex nodeReserve(NodeArray<T>& array, uint32_t count) {
+  if (array.count + count > array.capacity) {
+    uint32_t capacity = array.capacity == 0 ? COMPACT_AST_INITIAL_CAPACITY : array.capacity;
+    while (capacity < array.count + count) capacity *= 2;
+
+    array.items = (T*) realloc(array.items, capacity * sizeof(T));
+    assert(array.items != nullptr && "compactAstCreate out of memory");
+    array.capacity = capacity;
+  }
+
+  // Zeroed so the padding of the nodes, which the cache writes out, is too
+  NodeIndex first = array.count;
+  memset(array.items + first, 0, count * sizeof(T));
+  array.count += count;
+  return first;
+}
+
+template <typename T>
+NodeIndex nodePush(NodeArray<T>& array, T node) {
+  NodeIndex index = nodeReserve(array, 1);
+  array[index] = node;
+  return index;
+}
+
+template <typename T>
+size_t nodeBytes(const NodeArray<T>& array) {
+  return array.count * sizeof(T);
+}
+
+template <typename T>
+void nodeFree(NodeArray<T>& array) {
+  free(array.items);
+}
+
+/*
+ * Lowering from the pointer tree. A node is stored after its children, except
+ * that the items of a list are reserved together before any of them is lowered
+ * so the list stays contiguous. Arrays may move while children are lowered, so
+ * nodes are built as values and stored once they are complete.
+ */
+namespace lower {
+
+CompactAst* ast;
+const Token* tokens;
+
+TokenIndex token(Token* position) {
+  return position - tokens;
+}
+
+void countTreeNode(size_t size) {
+  ast->stats.tree_nodes++;
+  ast->stats.tree_bytes += size;
+}
+
+NodeIndex identifier(Identifier* node) {
+  uint32_t parts = 0;
+  for (Identifier* part = node; part != nullptr; part = part->next) parts++;
+
+  NodeIndex first = nodeReserve(ast->identifiers, parts);
+  for (uint32_t i = 0; i < parts; i++, node = node->next) {
+    countTreeNode(sizeof(Identifier));
+    ast->identifiers[first + i] = {token(node->identifier), node->identifier->id, parts - i - 1};
+  }
+  return first;
+}
+
+NodeIndex type(Type* node) {
+  CompactType output = {node->type, ASTType::NONE, token(node->start), token(node->end), NODE_NONE};
+  countTreeNode(sizeof(Type));
+
+  switch (node->type) {
+    case ASTType::TYPE_SIMPLE:
+      countTreeNode(sizeof(SimpleType));
+      output.simple_type = node->simple_type->type;
+      break;
+    case ASTType::TYPE_ID:
+      output.identifier = identifier(node->identifier);
+      break;
+    default:
+      assert(false && "Type");
+  }
+  return nodePush(ast->types, output);
+}
+
+NodeIndex expr(Expr* node);
+
+CompactDeclaration declaration(Declaration* node) {
+  CompactDeclaration output;
+  countTreeNode(sizeof(Declaration) + node->qualifiers_count * sizeof(Qualifier*));
+
+  output.start = token(node->start);
+  output.end = token(node->end);
+
+  output.qualifiers = {nodeReserve(ast->qualifiers, node->qualifiers_count), (uint32_t) node->qualifiers_count};
+  for (int i = 0; i < node->qualifiers_count; i++) {
+    countTreeNode(sizeof(Qualifier));
+    ast->qualifiers[output.qualifiers.first + i] = node->qualifiers[i]->type;
+  }
+
+  output.identifier = identifier(node->identifier);
+  output.decl_type = type(node->decl_type);
+  output.expr = node->expr == nullptr ? NODE_NONE : expr(node->expr);
+  return output;
+}
+
+NodeRange declarations(Declaration** nodes, int count) {
+  NodeRange range = {nodeReserve(ast->declarations, count), (uint32_t) count};
+  for (int i = 0; i < count; i++) {
+    CompactDeclaration output = declaration(nodes[i]);
+    ast->declarations[range.first + i] = output;
+  }
+  return range;
+}
+
+/*
+ * Blocks and expressions are lowered with an explicit stack of frames on
+ * walkStack, in the order the nodes would be lowered by recursing, so how
+ * deep a tree can nest is limited by memory rather than by the thread stack.
+ * A frame holds the node it is building and stays at the same address until
+ * it is popped, so its children store their index into it.
+ */
+
+// A Block or a Statement whose nested blocks are being lowered
+struct BlockFrame {
+  ASTNode* node;
+  int step;
+  // Where the index of the node goes once it is stored
+  NodeIndex* result;
+  // Index of the child of the block tag lowered last
+  NodeIndex tag_child;
+  union {
+    CompactBlock block;
+    CompactStatement statement;
+  };
+};
+
+void blockStart(BlockFrame* frame) {
+  Block* node = (Block*) frame->node;
+  frame->block = {token(node->start), token(node->end), NODE_NONE, NODE_NONE, {}, {}};
+  countTreeNode(sizeof(Block) + (node->declarations_count + node->block_tags_count) * sizeof(void*));
+
+  if (node->namespace_ != nullptr) frame->block.namespace_ = identifier(node->namespace_);
+}
+
+void statementStart(BlockFrame* frame) {
+  Statement* node = (Statement*) frame->node;
+  frame->statement = {node->type, token(node->start), token(node->end), NODE_NONE, {NODE_NONE}, NODE_NONE};
+  countTreeNode(sizeof(Statement));
+}
+
+// Lowers a statement without nested blocks
+void statementLeaf(Statement* node, CompactStatement& output) {
+  switch (node->type) {
+    case ASTType::STATEMENT_BREAK:
+      countTreeNode(sizeof(Break));
+      break;
+    case ASTType::STATEMENT_CONTINUE:
+      countTreeNode(sizeof(Continue));
+      break;
+    case ASTType::STATEMENT_RETURN:
+      countTreeNode(sizeof(Return));
+      if (node->return_->expr != nullptr) output.expr = expr(node->return_->expr);
+      break;
+    case ASTType::STATEMENT_ASSIGN:
+      countTreeNode(sizeof(Assignment));
+      output.identifier = identifier(node->assignment->identifier);
+      output.expr = expr(node->assignment->expr);
+      break;
+    case ASTType::STATEMENT_EXPR:
+      output.expr = expr(node->expr);
+      break;
+    default:
+      assert(false && "Statement");
+  }
+}
+
+// Returns the next Block or Statement of the frame to lower and where its
+// index goes, nullptr once the node of the frame is complete
+ASTNode* blockStep(BlockFrame* frame, NodeIndex** result) {
+  int step = frame->step++;
+
+  if (frame->node->type == ASTType::BLOCK) {
+    // Step 0 lowers the statement, step 1 the declarations, which do not nest
+    // blocks, and every step from 1 on the child of the next block tag
+    Block* node = (Block*) frame->node;
+    CompactBlock& output = frame->block;
+    if (step == 0) {
+      if (node->statement != nullptr) {
+        *result = &output.statement;
+        return (ASTNode*) node->statement;
+      }
+      step = frame->step++;
+    }
+
+    if (step == 1) {
+      output.declarations = declarations(node->declarations, node->declarations_count);
+      output.block_tags = {nodeReserve(ast->block_tags, node->block_tags_count), (uint32_t) node->block_tags_count};
+    }
+    else {
+      ast->block_tags[output.block_tags.first + step - 2] = {node->block_tags[step - 2]->type, frame->tag_child};
+    }
+
+    if (step - 1 == node->block_tags_count) return nullptr;
+
+    BlockTag* tag = node->block_tags[step - 1];
+    countTreeNode(sizeof(BlockTag));
+    *result = &frame->tag_child;
+
+    switch (tag->type) {
+      case ASTType::BLOCK_TAG_BLOCK:
+        return (ASTNode*) tag->block;
+      case ASTType::BLOCK_TAG_STATEMENT:
+        return (ASTNode*) tag->statement;
+      default:
+        assert(false && "Block Tag");
+    }
+  }
+
+  Statement* node = (Statement*) frame->node;
+  CompactStatement& output = frame->statement;
+
+  switch (node->type) {
+    case ASTType::STATEMENT_CONDITION:
+      if (step == 0) {
+        countTreeNode(sizeof(Conditional));
+        output.expr = expr(node->conditional->condition);
+        *result = &output.block;
+        return (ASTNode*) node->conditional->block;
+      }
+      if (step == 1 && node->conditional->other != nullptr) {
+        *result = &output.other;
+        return (ASTNode*) node->conditional->other;
+      }
+      return nullptr;
+
+    case ASTType::STATEMENT_WHILE:
+      if (step == 0) {
+        countTreeNode(sizeof(While));
+        output.expr = expr(node->while_->condition);
+        *result = &output.block;
+        return (ASTNode*) node->while_->block;
+      }
+      return nullptr;
+
+    default:
+      statementLeaf(node, output);
+      return nullptr;
+  }
+}
+
+NodeIndex block(Block* root) {
+  Stack* stack = walkStack();
+  void* base = stack->current;
+  ASTNode* node = (ASTNode*) root;
+  NodeIndex output;
+  NodeIndex* result = &output;
+
+  while (true) {
+    if (node != nullptr) {
+      // Zeroed so the padding of the node it builds is
+      BlockFrame* frame = (BlockFrame*) stackPush(stack, sizeof(BlockFrame));
+      memset(frame, 0, sizeof(BlockFrame));
+      frame->node = node;
+      frame->step = 0;
+      frame->result = result;
+
+      if (node->type == ASTType::BLOCK) {
+        blockStart(frame);
+      }
+      else {
+        statementStart(frame);
+      }
+    }
+
+    BlockFrame* frame = (BlockFrame*) stack->current - 1;
+    node = blockStep(frame, &result);
+    if (node != nullptr) continue;
+
+    if (frame->node->type == ASTType::BLOCK) {
+      *frame->result = nodePush(ast->blocks, frame->block);
+    }
+    else {
+      *frame->result = nodePush(ast->statements, frame->statement);
+    }
+    stackPop(stack, sizeof(BlockFrame));
+
+    if (stack->current == base) return output;
+  }
+}
+
+// A call, unary or binary whose operands are being lowered, or a leaf
+struct ExprFrame {
+  Expr* node;
+  // Operands lowered so far
+  int next;
+  CompactExpr output;
+};
+
+// Lowers everything of node but its operands, the operand lists are reserved
+CompactExpr exprStart(Expr* node) {
+  CompactExpr output = {node->type, ASTType::NONE, token(node->start), token(node->end), {NODE_NONE}, {NODE_NONE, 0}};
+  countTreeNode(sizeof(Expr));
+
+  switch (node->type) {
+    case ASTType::EXPRESSION_CALL:
+      countTreeNode(sizeof(Call) + node->call->arguments_count * sizeof(Expr*));
+      output.identifier = identifier(node->call->identifier);
+      output.children = {nodeReserve(ast->exprs, node->call->arguments_count), (uint32_t) node->call->arguments_count};
+      break;
+
+    case ASTType::EXPRESSION_UNARY:
+      countTreeNode(sizeof(Unary));
+      output.op = node->unary->type;
+      break;
+
+    case ASTType::EXPRESSION_BINARY:
+      countTreeNode(sizeof(Binary));
+      output.op = node->binary->type;
+      output.children = {nodeReserve(ast->exprs, 2), 2};
+      break;
+
+    case ASTType::EXPRESSION_IDENTIFIER:
+      output.identifier = identifier(node->identifier);
+      break;
+
+    case ASTType::EXPRESSION_LITERAL:
+      countTreeNode(sizeof(Literal));
+      output.op = node->literal->type;
+      switch (node->literal->type) {
+        case ASTType::LITERAL_INT:
+          output.int_ = node->literal->int_;
+          break;
+        case ASTType::LITERAL_FLOAT:
+          output.float_ = node->literal->float_;
+          break;
+        case ASTType::LITERAL_BOOL:
+          output.bool_ = node->literal->bool_;
+          break;
+        default:
+          break;
+      }
+      break;
+
+    default:
+      assert(false && "Expr");
+  }
+  return output;
+}
+
+// Operand next of node, nullptr after the last one
+Expr* exprOperand(Expr* node, int next) {
+  switch (node->type) {
+    case ASTType::EXPRESSION_CALL:
+      return next < node->call->arguments_count ? node->call->arguments[next] : nullptr;
+    case ASTType::EXPRESSION_UNARY:
+      return next == 0 ? node->unary->expr : nullptr;
+    case ASTType::EXPRESSION_BINARY:
+      return next == 0 ? node->binary->first : next == 1 ? node->binary->second : nullptr;
+    default:
+      return nullptr;
+  }
+}
+
+CompactExpr exprValue(Expr* root) {
+  Stack* stack = walkStack();
+  void* base = stack->current;
+  Expr* node = root;
+
+  while (true) {
+    if (node != nullptr) {
+      ExprFrame* frame = (ExprFrame*) stackPush(stack, sizeof(ExprFrame));
+      memset(frame, 0, sizeof(ExprFrame));
+      frame->node = node;
+      frame->next = 0;
+      frame->output = exprStart(node);
+    }
+
+    ExprFrame* frame = (ExprFrame*) stack->current - 1;
+    node = exprOperand(frame->node, frame->next);
+    if (node != nullptr) {
+      frame->next++;
+      continue;
+    }
+
+    CompactExpr value = frame->output;
+    stackPop(stack, sizeof(ExprFrame));
+    if (stack->current == base) return value;
+
+    // A unary operand is stored on its own, call and binary operands into
+    // the range their parent reserved
+    ExprFrame* parent = (ExprFrame*) stack->current - 1;
+    if (parent->node->type == ASTType::EXPRESSION_UNARY) {
+      parent->output.operand = nodePush(ast->exprs, value);
+    }
+    else {
+      ast->exprs[parent->output.children.first + parent->next - 1] = value;
+    }
+  }
+}
+
+NodeIndex expr(Expr* node) {
+  CompactExpr output = exprValue(node);
+  return nodePush(ast->exprs, output);
+}
+
+NodeIndex function(Function* node) {
+  FunctionHeader* header = node->header;
+  CompactFunction output;
+  countTreeNode(sizeof(Function));
+  countTreeNode(sizeof(FunctionHeader) + header->parameter_count * sizeof(FunctionParam*));
+
+  output.type = node->type;
+  output.export_ = header->export_;
+  output.start = token(node->start);
+  output.end = token(node->end);
+  output.identifier = identifier(header->identifier);
+  output.return_type = type(header->return_type);
+
+  output.params = {nodeReserve(ast->params, header->parameter_count), (uint32_t) header->parameter_count};
+  for (int i = 0; i < header->parameter_count; i++) {
+    FunctionParam* param = header->parameter_list[i];
+    CompactParam param_output = {token(param->start), token(param->end), NODE_NONE, NODE_NONE};
+    countTreeNode(sizeof(FunctionParam));
+
+    if (param->identifier != nullptr) param_output.identifier = identifier(param->identifier);
+    param_output.decl_type = type(param->decl_type);
+    ast->params[output.params.first + i] = param_output;
+  }
+
+  Block* body = functionBody(node);
+  output.block = body == nullptr ? NODE_NONE : block(body);
+  return nodePush(ast->functions, output);
+}
+
+NodeIndex struct_(Struct* node) {
+  CompactStruct output;
+  countTreeNode(sizeof(Struct) + node->declarations_count * sizeof(Declaration*));
+
+  output.start = token(node->start);
+  output.end = token(node->end);
+  output.identifier = identifier(node->identifier);
+  output.declarations = declarations(node->declarations, node->declarations_count);
+  return nodePush(ast->structs, output);
+}
+
+NodeIndex enum_(Enum* node) {
+  CompactEnum output;
+  countTreeNode(sizeof(Enum) + node->members_count * sizeof(Token*));
+
+  output.start = token(node->start);
+  output.end = token(node->end);
+  output.identifier = identifier(node->identifier);
+
+  output.members = {nodeReserve(ast->identifiers, node->members_count), (uint32_t) node->members_count};
+  for (int i = 0; i < node->members_count; i++) {
+    ast->identifiers[output.members.first + i] = {token(node->members[i]), node->members[i]->id, 0};
+  }
+  return nodePush(ast->enums, output);
+}
+
+CompactTag primaryTag(PrimaryTag* node) {
+  countTreeNode(sizeof(PrimaryTag));
+
+  switch (node->type) {
+    case ASTType::PRIMARY_TAG_DECL: {
+      CompactDeclaration output = declaration(node->decl);
+      return {node->type, nodePush(ast->declarations, output)};
+    }
+    case ASTType::PRIMARY_TAG_ENUM:
+      return {node->type, enum_(node->enum_)};
+    case ASTType::PRIMARY_TAG_FUNC:
+      return {node->type, function(node->func)};
+    case ASTType::PRIMARY_TAG_STRUCT:
+      return {node->type, struct_(node->struct_)};
+    default:
+      assert(false && "Primary Tag");
+  }
+}
+
+void primary(Primary* node) {
+  countTreeNode(sizeof(Primary) + node->primary_tags_count * sizeof(PrimaryTag*));
+
+  NodeIndex first = nodeReserve(ast->primary_tags, node->primary_tags_count);
+  for (int i = 0; i < node->primary_tags_count; i++) {
+    CompactTag tag = primaryTag(node->primary_tags[i]);
+    ast->primary_tags[first + i] = tag;
+  }
+}
+
+}
+
+CompactAst* compactAstCreate(Primary* node, const Token* tokens, const TokenStream* stream) {
+  CompactAst* ast = (CompactAst*) calloc(1, sizeof(CompactAst));
+  assert(ast != nullptr && "compactAstCreate out of memory");
+  ast->stream = stream;
+
+  lower::ast = ast;
+  lower::tokens = tokens;
+  lower::primary(node);
+  lower::ast = nullptr;
+  lower::tokens = nullptr;
+
+  ast->stats.nodes = ast->identifiers.count + ast->types.count + ast->qualifiers.count
+    + ast->declarations.count + ast->statements.count + ast->block_tags.count + ast->blocks.count
+    + ast->exprs.count + ast->params.count + ast->functions.count + ast->structs.count
+    + ast->enums.count + ast->primary_tags.count;
+
+  ast->stats.bytes = nodeBytes(ast->identifiers) + nodeBytes(ast->types) + nodeBytes(ast->qualifiers)
+    + nodeBytes(ast->declarations) + nodeBytes(ast->statements) + nodeBytes(ast->block_tags)
+    + nodeBytes(ast->blocks) + nodeBytes(ast->exprs) + nodeBytes(ast->params)
+    + nodeBytes(ast->functions) + nodeBytes(ast->structs) + nodeBytes(ast->enums)
+    + nodeBytes(ast->primary_tags);
+
+  return ast;
+}
+
+void compactAstDestroy(CompactAst* ast) {
+  nodeFree(ast->identifiers);
+  nodeFree(ast->types);
+  nodeFree(ast->qualifiers);
+  nodeFree(ast->declarations);
+  nodeFree(ast->statements);
+  nodeFree(ast->block_tags);
+  nodeFree(ast->blocks);
+  nodeFree(ast->exprs);
+  nodeFree(ast->params);
+  nodeFree(ast->functions);
+  nodeFree(ast->structs);
+  nodeFree(ast->enums);
+  nodeFree(ast->primary_tags);
+  free(ast);
+}
+
+CompactAstStats compactAstStats(const CompactAst* ast) {
+  return ast->stats;
+}
+
+void printCompactAstStats(const CompactAst* ast) {
+  CompactAstStats stats = ast->stats;
+  fprintf(stderr, "Tree: %u nodes %lu bytes (%.1f per node)\n", stats.tree_nodes,
+      (unsigned long) stats.tree_bytes, stats.tree_nodes == 0 ? 0.0 : (double) stats.tree_bytes / stats.tree_nodes);
+  fprintf(stderr, "Compact: %u nodes %lu bytes (%.1f per node)\n", stats.nodes,
+      (unsigned long) stats.bytes, stats.nodes == 0 ? 0.0 : (double) stats.bytes / stats.nodes);
+}
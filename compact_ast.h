@@ -0,0 +1,202 @@
+#pragma once
+
+#include "ast_types.h"
+#include "intern.h"
+#include "lex.h"
+#include "token_stream.h"
+
+#include <cstddef>
+#include <cstdint>
+
+/* Compact struct of arrays form of a parsed tree.
+ * Nodes of each kind are stored in one flat array and refer to each other by
+ * 32 bit index. Token ranges are indices into the TokenStream built from the
+ * tokens the tree was parsed from. Wrapper nodes are folded into the node they
+ * wrap: a statement holds its conditional, while, return or assignment and an
+ * expression holds its call, binary, identifier or literal. Child lists are
+ * contiguous ranges of their array.
+ */
+
+typedef uint32_t NodeIndex;
+
+#define NODE_NONE UINT32_MAX
+
+struct NodeRange {
+  NodeIndex first;
+  uint32_t count;
+};
+
+template <typename T>
+struct NodeArray {
+  T* items;
+  uint32_t count;
+  uint32_t capacity;
+
+  T& operator[](NodeIndex index) {
+    return items[index];
+  }
+};
+
+// One part of a dotted name, the parts of a.b.c are contiguous
+struct CompactIdentifier {
+  TokenIndex token;
+  InternId id;
+  // Number of parts after this one
+  uint32_t rest;
+};
+
+struct CompactType {
+  ASTType type;
+  // SIMPLE_TYPE_* when type is TYPE_SIMPLE
+  ASTType simple_type;
+  TokenIndex start;
+  TokenIndex end;
+  // Set when type is TYPE_ID
+  NodeIndex identifier;
+};
+
+struct CompactDeclaration {
+  TokenIndex start;
+  TokenIndex end;
+  NodeIndex identifier;
+  NodeIndex decl_type;
+  // NODE_NONE without an initial value
+  NodeIndex expr;
+  // Into qualifiers
+  NodeRange qualifiers;
+};
+
+struct CompactStatement {
+  // STATEMENT_*
+  ASTType type;
+  TokenIndex start;
+  TokenIndex end;
+  // Condition of an if or while, value of a return, assignment or expression statement
+  NodeIndex expr;
+  union {
+    // Body of an if or while
+    NodeIndex block;
+    // Target of an assignment
+    NodeIndex identifier;
+  };
+  // Else block of an if
+  NodeIndex other;
+};
+
+// A block tag or a primary tag, type selects the array child indexes
+struct CompactTag {
+  ASTType type;
+  NodeIndex child;
+};
+
+struct CompactBlock {
+  TokenIndex start;
+  TokenIndex end;
+  NodeIndex namespace_;
+  // Set for a block that is a single statement without braces
+  NodeIndex statement;
+  NodeRange declarations;
+  NodeRange block_tags;
+};
+
+struct CompactExpr {
+  // EXPRESSION_*
+  ASTType type;
+  // BINARY_*, UNARY_* or LITERAL_*
+  ASTType op;
+  TokenIndex start;
+  TokenIndex end;
+  union {
+    // Name of an identifier or the callee of a call
+    NodeIndex identifier;
+    NodeIndex operand;
+    uint32_t int_;
+    float float_;
+    bool bool_;
+  };
+  // Arguments of a call, the two operands of a binary
+  NodeRange children;
+};
+
+struct CompactParam {
+  TokenIndex start;
+  TokenIndex end;
+  NodeIndex identifier;
+  NodeIndex decl_type;
+};
+
+struct CompactFunction {
+  // FUNCTION or FUNC_FORWARD
+  ASTType type;
+  bool export_;
+  TokenIndex start;
+  TokenIndex end;
+  NodeIndex identifier;
+  NodeIndex return_type;
+  NodeRange params;
+  // NODE_NONE for a forward declaration
+  NodeIndex block;
+};
+
+struct CompactStruct {
+  TokenIndex start;
+  TokenIndex end;
+  NodeIndex identifier;
+  NodeRange declarations;
+};
+
+struct CompactEnum {
+  TokenIndex start;
+  TokenIndex end;
+  NodeIndex identifier;
+  // Into identifiers, one part each
+  NodeRange members;
+};
+
+struct CompactAstStats {
+  // Nodes of the tree the compact form was built from, Expr and Statement
+  // wrappers count as nodes of their own
+  uint32_t tree_nodes;
+  // Bytes of those nodes including their child pointer lists
+  size_t tree_bytes;
+  uint32_t nodes;
+  size_t bytes;
+};
+
+struct CompactAst {
+  const TokenStream* stream;
+
+  NodeArray<CompactIdentifier> identifiers;
+  NodeArray<CompactType> types;
+  // QUALIFIER_*
+  NodeArray<ASTType> qualifiers;
+  NodeArray<CompactDeclaration> declarations;
+  NodeArray<CompactStatement> statements;
+  NodeArray<CompactTag> block_tags;
+  NodeArray<CompactBlock> blocks;
+  NodeArray<CompactExpr> exprs;
+  NodeArray<CompactParam> params;
+  NodeArray<CompactFunction> functions;
+  NodeArray<CompactStruct> structs;
+  NodeArray<CompactEnum> enums;
+  // Top level items in source order
+  NodeArray<CompactTag> primary_tags;
+
+  CompactAstStats stats;
+};
+
+// tokens is the array node was parsed from and stream must be built from the
+// same tokens. The compact form does not refer to node or tokens afterwards.
+CompactAst* compactAstCreate(Primary* node, const Token* tokens, const TokenStream* stream);
+void compactAstDestroy(CompactAst* ast);
+
+CompactAstStats compactAstStats(const CompactAst* ast);
+void printCompactAstStats(const CompactAst* ast);
+
+inline const char* compactTokenStart(const CompactAst* ast, TokenIndex index) {
+  return tokenStart(ast->stream, index);
+}
+
+inline uint32_t compactTokenLength(const CompactAst* ast, TokenIndex index) {
+  return tokenLength(ast->stream, index);
+}
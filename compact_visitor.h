@@ -0,0 +1,372 @@
+#pragma once
+
+#include "ast_types.h"
+#include "ast_visitor.h"
+#include "compact_ast.h"
+#include "scratch_list.h"
+#include "stack.h"
+
+#include <cassert>
+#include <type_traits>
+#include <utility>
+
+/* The walk of ASTVisitor over the compact form. A pass derives from
+ * CompactVisitor<Pass>, sets ast and defines the node functions it needs with
+ * the same names, taking the compact node or its index. Only expressions and
+ * blocks are walked here, with the same kind of explicit stack of frames on
+ * walkStack, so how deep a compact tree can nest is limited by memory rather
+ * than by the thread stack. The pass visits the nodes that do not nest itself.
+ *
+ * pre and post run around every expression, block, block tag and statement
+ * the walks enter. unary, binary and call get the values their operands
+ * walked to, callee runs before the arguments of a call, expr returns whatever
+ * call, unary, binary, identifierValue and literal return. A block walks to
+ * what blockEnter returns, conditional and while_ are resumed after each block
+ * they return until they return NODE_NONE, as in ASTVisitor.
+ */
+template <typename Derived>
+struct CompactVisitor {
+  CompactAst* ast;
+
+  Derived& self() {
+    return *static_cast<Derived*>(this);
+  }
+
+  template <typename Node>
+  void pre(Node*) {}
+
+  template <typename Node>
+  void post(Node*) {}
+
+  // Kept in the frame of a conditional or while for the pass, a pass can
+  // define its own. Zeroed when the frame is pushed.
+  struct WalkState {};
+
+  template <typename Callee>
+  struct ExprFrame {
+    NodeIndex node;
+    // Operands walked so far
+    int next;
+    Callee callee;
+  };
+
+  template <typename Value>
+  struct BlockFrame {
+    // BLOCK, BLOCK_TAG_* or STATEMENT_*, selects the array node indexes
+    ASTType type;
+    NodeIndex node;
+    int step;
+    // For a block what blockEnter returned, for a conditional or while the
+    // value of the block walked last
+    Value value;
+    typename Derived::WalkState state;
+  };
+
+  // Calls f with a pointer to the node of the frame
+  template <typename Frame, typename F>
+  void frameNode(Frame* frame, F f) {
+    switch (frame->type) {
+      case ASTType::BLOCK:
+        f(&ast->blocks[frame->node]);
+        break;
+      case ASTType::BLOCK_TAG_BLOCK:
+      case ASTType::BLOCK_TAG_STATEMENT:
+        f(&ast->block_tags[frame->node]);
+        break;
+      default:
+        f(&ast->statements[frame->node]);
+    }
+  }
+
+  void declaration(NodeIndex index) {
+    CompactDeclaration& node = ast->declarations[index];
+    if (node.expr != NODE_NONE) {
+      self().expr(node.expr);
+    }
+  }
+
+  void assignment(CompactStatement& node) {
+    self().expr(node.expr);
+  }
+
+  /* Called with step 0, then again after each block it returns is walked
+   * with the value of that block, until it returns NODE_NONE. state is kept
+   * for it in the frame of node.
+   */
+  template <typename State, typename Value>
+  NodeIndex conditional(CompactStatement& node, int step, [[maybe_unused]] State& state,
+      [[maybe_unused]] Value walked) {
+    switch (step) {
+      case 0:
+        self().expr(node.expr);
+        return node.block;
+      case 1:
+        return node.other;
+      default:
+        return NODE_NONE;
+    }
+  }
+
+  template <typename State, typename Value>
+  NodeIndex while_(CompactStatement& node, int step, [[maybe_unused]] State& state, [[maybe_unused]] Value walked) {
+    if (step == 0) {
+      self().expr(node.expr);
+      return node.block;
+    }
+    return NODE_NONE;
+  }
+
+  void break_(CompactStatement&) {}
+
+  void continue_(CompactStatement&) {}
+
+  void return_(CompactStatement& node) {
+    if (node.expr != NODE_NONE) {
+      self().expr(node.expr);
+    }
+  }
+
+  // Runs a statement without nested blocks
+  void statementLeaf(CompactStatement& node) {
+    switch (node.type) {
+      case ASTType::STATEMENT_BREAK:
+        self().break_(node);
+        break;
+      case ASTType::STATEMENT_CONTINUE:
+        self().continue_(node);
+        break;
+      case ASTType::STATEMENT_RETURN:
+        self().return_(node);
+        break;
+      case ASTType::STATEMENT_ASSIGN:
+        self().assignment(node);
+        break;
+      case ASTType::STATEMENT_EXPR:
+        self().expr(node.expr);
+        break;
+      default:
+        assert(false && "Statement");
+    }
+  }
+
+  void blockEnter(CompactBlock&) {}
+
+  void blockLeave(CompactBlock&) {}
+
+  CompactTag statementChild(NodeIndex index) {
+    return {ast->statements[index].type, index};
+  }
+
+  // Returns the next child of the frame to walk, child is NODE_NONE once it is done
+  template <typename Frame>
+  CompactTag blockStep(Frame* frame) {
+    int step = frame->step++;
+
+    switch (frame->type) {
+      case ASTType::BLOCK: {
+        // Step 0 walks the statement, step 1 runs the declarations, which do
+        // not nest blocks, and every step from 1 on walks the next block tag
+        CompactBlock& node = ast->blocks[frame->node];
+        if (step == 0) {
+          if (node.statement != NODE_NONE) return statementChild(node.statement);
+          step = frame->step++;
+        }
+
+        if (step == 1) {
+          for (uint32_t i = 0; i < node.declarations.count; i++) {
+            self().declaration(node.declarations.first + i);
+          }
+        }
+
+        if ((uint32_t) step - 1 < node.block_tags.count) {
+          NodeIndex tag = node.block_tags.first + step - 1;
+          return {ast->block_tags[tag].type, tag};
+        }
+
+        self().blockLeave(node);
+        return {ASTType::NONE, NODE_NONE};
+      }
+
+      case ASTType::BLOCK_TAG_BLOCK: {
+        NodeIndex child = ast->block_tags[frame->node].child;
+        return {ASTType::BLOCK, step == 0 ? child : NODE_NONE};
+      }
+
+      case ASTType::BLOCK_TAG_STATEMENT:
+        if (step == 0) return statementChild(ast->block_tags[frame->node].child);
+        return {ASTType::NONE, NODE_NONE};
+
+      case ASTType::STATEMENT_CONDITION:
+        return {ASTType::BLOCK, self().conditional(ast->statements[frame->node], step, frame->state, frame->value)};
+
+      case ASTType::STATEMENT_WHILE:
+        return {ASTType::BLOCK, self().while_(ast->statements[frame->node], step, frame->state, frame->value)};
+
+      default:
+        if (step == 0) statementLeaf(ast->statements[frame->node]);
+        return {ASTType::NONE, NODE_NONE};
+    }
+  }
+
+  auto block(NodeIndex root) {
+    using Enter = decltype(self().blockEnter(std::declval<CompactBlock&>()));
+    using Value = WalkValue<Enter>;
+    using Frame = BlockFrame<Value>;
+
+    Stack* stack = walkStack();
+    void* base = stack->current;
+    CompactTag node = {ASTType::BLOCK, root};
+    Value output;
+
+    while (true) {
+      if (node.child != NODE_NONE) {
+        Frame* frame = (Frame*) stackPush(stack, sizeof(Frame));
+        frame->type = node.type;
+        frame->node = node.child;
+        frame->step = 0;
+        frame->state = {};
+        frameNode(frame, [&](auto* typed) { self().pre(typed); });
+        if (node.type == ASTType::BLOCK) {
+          frame->value = walkValue([&] { return self().blockEnter(ast->blocks[node.child]); });
+        }
+      }
+
+      Frame* frame = (Frame*) stack->current - 1;
+      node = blockStep(frame);
+      if (node.child != NODE_NONE) continue;
+
+      Value value = frame->value;
+      bool is_block = frame->type == ASTType::BLOCK;
+      frameNode(frame, [&](auto* typed) { self().post(typed); });
+      stackPop(stack, sizeof(Frame));
+
+      if (stack->current == base) {
+        output = value;
+        break;
+      }
+
+      // The block of a conditional or while, blocks in a block tag are not kept
+      Frame* parent = (Frame*) stack->current - 1;
+      if (is_block && parent->type != ASTType::BLOCK_TAG_BLOCK) parent->value = value;
+    }
+
+    if constexpr (!std::is_void_v<Enter>) {
+      return output;
+    }
+  }
+
+  // An identifier read as a value in an expression
+  void identifierValue(NodeIndex) {}
+
+  void literal(CompactExpr&) {}
+
+  void callee(CompactExpr&) {}
+
+  template <typename Callee, typename Value>
+  void call(CompactExpr&, Callee, Value*) {}
+
+  template <typename Value>
+  void unary(CompactExpr&, Value) {}
+
+  template <typename Value>
+  void binary(CompactExpr&, Value, Value) {}
+
+  template <typename Frame, typename Value>
+  Value exprCombine(Frame* frame, CompactExpr& node, Value* operands) {
+    switch (node.type) {
+      case ASTType::EXPRESSION_CALL:
+        return walkValue([&] { return self().call(node, frame->callee, operands); });
+
+      case ASTType::EXPRESSION_UNARY:
+        return walkValue([&] { return self().unary(node, operands[0]); });
+
+      default:
+        return walkValue([&] { return self().binary(node, operands[0], operands[1]); });
+    }
+  }
+
+  auto expr(NodeIndex root) {
+    using Result = decltype(self().literal(std::declval<CompactExpr&>()));
+    using Value = WalkValue<Result>;
+    using Callee = WalkValue<decltype(self().callee(std::declval<CompactExpr&>()))>;
+    using Frame = ExprFrame<Callee>;
+
+    Stack* stack = walkStack();
+    void* base = stack->current;
+    // Values of the operands walked so far, the operands of a frame are last
+    ScratchList<Value, 16> values;
+    NodeIndex node = root;
+
+    while (true) {
+      if (node != NODE_NONE) {
+        CompactExpr& current = ast->exprs[node];
+        self().pre(&current);
+
+        switch (current.type) {
+          case ASTType::EXPRESSION_CALL:
+          case ASTType::EXPRESSION_UNARY:
+          case ASTType::EXPRESSION_BINARY: {
+            Frame* frame = (Frame*) stackPush(stack, sizeof(Frame));
+            frame->node = node;
+            frame->next = 0;
+
+            if (current.type == ASTType::EXPRESSION_CALL) {
+              frame->callee = walkValue([&] { return self().callee(current); });
+            }
+            break;
+          }
+
+          case ASTType::EXPRESSION_IDENTIFIER:
+            values.push(walkValue([&] { return self().identifierValue(current.identifier); }));
+            self().post(&current);
+            break;
+
+          case ASTType::EXPRESSION_LITERAL:
+            values.push(walkValue([&] { return self().literal(current); }));
+            self().post(&current);
+            break;
+
+          default:
+            assert(false && "Expr");
+        }
+      }
+
+      if (stack->current == base) break;
+
+      Frame* frame = (Frame*) stack->current - 1;
+      CompactExpr& current = ast->exprs[frame->node];
+      int count;
+      switch (current.type) {
+        case ASTType::EXPRESSION_CALL:
+          count = current.children.count;
+          node = frame->next < count ? current.children.first + frame->next : NODE_NONE;
+          break;
+        case ASTType::EXPRESSION_UNARY:
+          count = 1;
+          node = frame->next < count ? current.operand : NODE_NONE;
+          break;
+        default:
+          count = 2;
+          node = frame->next < count ? current.children.first + frame->next : NODE_NONE;
+      }
+
+      if (node != NODE_NONE) {
+        frame->next++;
+        continue;
+      }
+
+      Value value = exprCombine(frame, current, values.data + values.size - count);
+      values.size -= count;
+      values.push(value);
+
+      self().post(&current);
+      stackPop(stack, sizeof(Frame));
+
+      if (stack->current == base) break;
+    }
+
+    if constexpr (!std::is_void_v<Result>) {
+      return values[0];
+    }
+  }
+};
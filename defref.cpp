@@ -1,13 +1,22 @@
 #include "defref.h"
 #include "ast_types.h"
+#include "ast_visitor.h"
+#include "compact_ast.h"
+#include "compact_visitor.h"
+#include "parser.h"
 #include "scope.h"
+#include "scratch_list.h"
 #include "symbol.h"
+#include "line_index.h"
 
 #include <cassert>
+#include <cstdio>
 #include <llvm-c/Core.h>
 #include <llvm-c/Types.h>
 
+#ifndef NDEBUG
 #define DEFREF_DEBUG
+#endif
 
 #ifdef DEFREF_DEBUG
 #define DEFREF_CALLSTACK_DEBUG
@@ -29,26 +38,43 @@
 #endif
 
 Scope* current_scope;
+// Only used to report where an error happened, may be nullptr
+LineIndex* line_index;
 
 struct Name {
   const char* start;
   const char* end;
+  InternId id;
 };
 
+// A value of type with every other member zeroed
+Symbol typeSymbol(SymbolType type) {
+  Symbol output = {};
+  output.type = type;
+  return output;
+}
+
 namespace defref {
 
+void reportPosition(const Token* token) {
+  if (line_index == nullptr) return;
+  SourcePosition position = lineIndexLookup(line_index, token);
+  fprintf(stderr, "DEFREF: Error at line %u column %u: %.*s\n", position.line, position.column,
+      (int) (token->end - token->start), token->start);
+}
+
 Symbol* createSymbol(Name name, Symbol type_sym) {
   switch (type_sym.type) {
     case SymbolType::STRUCT:
-      return symbolCreateStructInstance(name.start, name.end, &type_sym.struct_);
+      return symbolCreateStructInstance(name.start, name.end, name.id, &type_sym.struct_);
 
     case SymbolType::ENUM:
-      return symbolCreateEnumInstance(name.start, name.end, &type_sym.enum_);
+      return symbolCreateEnumInstance(name.start, name.end, name.id, &type_sym.enum_);
     
     // TODO: special case for pointer
 
     default:
-      return symbolCreateVariable(type_sym.type, name.start, name.end);
+      return symbolCreateVariable(type_sym.type, name.start, name.end, name.id);
   }
 }
 
@@ -97,365 +123,900 @@ bool matchCondition(Symbol expr_sym) {
   return true;
 }
 
-SymbolType simpleType(SimpleType* node) {
-  DEBUG_ENTRY();
-  switch (node->type) {
-    case ASTType::SIMPLE_TYPE_I8:
-      return SymbolType::I8;
+/*
+ * Statements, block tags, expressions and primary tags use the switches of
+ * ASTVisitor, every other node is checked here.
+ */
+struct DefRef : ASTVisitor<DefRef> {
+  SymbolType simpleType(SimpleType* node) {
+    DEBUG_ENTRY();
+    switch (node->type) {
+      case ASTType::SIMPLE_TYPE_I8:
+        return SymbolType::I8;
 
-    case ASTType::SIMPLE_TYPE_U8:
-      return SymbolType::U8;
+      case ASTType::SIMPLE_TYPE_U8:
+        return SymbolType::U8;
 
-    case ASTType::SIMPLE_TYPE_I32:
-      return SymbolType::I32;
+      case ASTType::SIMPLE_TYPE_I32:
+        return SymbolType::I32;
 
-    case ASTType::SIMPLE_TYPE_U32:
-      return SymbolType::U32;
+      case ASTType::SIMPLE_TYPE_U32:
+        return SymbolType::U32;
 
-    case ASTType::SIMPLE_TYPE_F32:
-      return SymbolType::F32;
+      case ASTType::SIMPLE_TYPE_F32:
+        return SymbolType::F32;
 
-    default:
-      assert(false && "Simple Type");
+      default:
+        assert(false && "Simple Type");
+    }
   }
-}
-    
-Symbol* identifierResolve(Identifier* node) {
-  DEBUG_ENTRY();
-  Symbol* symbol = scopeResolve(current_scope, node->identifier->start, node->identifier->end);
+      
+  Symbol* identifierResolve(Identifier* node) {
+    DEBUG_ENTRY();
+    Symbol* symbol = scopeResolve(current_scope, node->identifier->id);
 
-  if (symbol != nullptr) {
-    Identifier* current_id = node->next;
-    Symbol* current_sym = symbol;
+    if (symbol != nullptr) {
+      Identifier* current_id = node->next;
+      Symbol* current_sym = symbol;
 
-    if (current_id == nullptr) {
-      return symbol;
-    }
+      if (current_id == nullptr) {
+        return symbol;
+      }
 
-    while (current_id->next != nullptr) {
-      switch (current_sym->type) {
-        case SymbolType::ENUM:
-          if (current_id->next != nullptr) {
-            assert(false && "Enum member dot access");
-          }
-          // return get enum value from current_sym with current_id
+      while (current_id->next != nullptr) {
+        switch (current_sym->type) {
+          case SymbolType::ENUM:
+            if (current_id->next != nullptr) {
+              reportPosition(current_id->identifier);
+              assert(false && "Enum member dot access");
+            }
+            // return get enum value from current_sym with current_id
 
-        case SymbolType::STRUCT:
-          current_sym = scopeResolveMember(current_sym->struct_.members_table, 
-              current_id->identifier->start, current_id->identifier->end);
+          case SymbolType::STRUCT:
+            current_sym = scopeResolveMember(current_sym->struct_.members_table, current_id->identifier->id);
 
-          current_id = current_id->next;
+            current_id = current_id->next;
 
-          if (current_sym == nullptr) {
-            assert(false && "identifierResolve: Struct member resolution failed");
-          }
+            if (current_sym == nullptr) {
+              reportPosition(node->identifier);
+              assert(false && "identifierResolve: Struct member resolution failed");
+            }
 
-          break;
+            break;
 
-        default:
-          assert(false && "Dot access of not a struct or enum");
+          default:
+            reportPosition(current_id->identifier);
+            assert(false && "Dot access of not a struct or enum");
+        }
       }
+
+      return current_sym;
     }
 
-    return current_sym;
+    reportPosition(node->identifier);
+    assert(false && "Failed to resolve identifier");
   }
 
-  assert(false && "Failed to resolve identifier");
-}
+  Name identifierDecl(Identifier* node) {
+    DEBUG_ENTRY();
+    Symbol* symbol = scopeResolveMember(current_scope, node->identifier->id);
+    if (symbol != nullptr) {
+      reportPosition(node->identifier);
+      assert(false && "Redeclaration");
+    }
 
-Name identifierDecl(Identifier* node) {
-  DEBUG_ENTRY();
-  Symbol* symbol = scopeResolveMember(current_scope, node->identifier->start, node->identifier->end);
-  if (symbol != nullptr) {
-    assert(false && "Redeclaration");
+    if (node->next != nullptr) {
+      // TODO: maybe support this in the future
+      reportPosition(node->identifier);
+      assert(false && "Declaration of dotted identifier");
+    }
+    return {node->identifier->start, node->identifier->end, node->identifier->id};
+  }
+
+  Symbol* identifierType(Identifier* node) {
+    DEBUG_ENTRY();
+    Symbol* symbol = scopeResolve(current_scope, node->identifier->id);
+   
+    if (symbol == nullptr) {
+        reportPosition(node->identifier);
+        assert(false && "Failed to resolve type identifier");
+    }
+
+    if (node->next != nullptr) {
+      Identifier* current_id = node->next;
+      Symbol* current_sym = symbol;
+      
+      while (current_id != nullptr) {
+        switch (symbol->type) {
+          case SymbolType::STRUCT:
+            current_sym = scopeResolveMember(current_sym->struct_.members_table, current_id->identifier->id);
+
+            current_id = current_id->next;
+
+            if(current_sym == nullptr) {
+              reportPosition(node->identifier);
+              assert(false && "identifierType: Struct member resolution failed");
+            }
+            break;
+          default:
+            reportPosition(current_id->identifier);
+            assert(false && "Dot access of not a struct");
+        }
+      }
+
+      return current_sym;
+    }
+
+    return symbol;
   }
 
-  if (node->next != nullptr) {
-    // TODO: maybe support this in the future
-    assert(false && "Declaration of dotted identifier");
+  // An identifier in an expression is read as the symbol it resolves to
+  Symbol identifierValue(Identifier* node) {
+    return *identifierResolve(node);
   }
-  return {node->identifier->start, node->identifier->end};
-}
 
-Symbol* identifierType(Identifier* node) {
-  DEBUG_ENTRY();
-  Symbol* symbol = scopeResolve(current_scope, node->identifier->start, node->identifier->end);
- 
-  if (symbol == nullptr) {
-      assert(false && "Failed to resolve type identifier");
+  Symbol type(Type* node) {
+    DEBUG_ENTRY();
+    switch (node->type) {
+      case ASTType::TYPE_SIMPLE:
+        return typeSymbol(simpleType(node->simple_type));
+      
+      case ASTType::TYPE_ID:
+        return *identifierType(node->identifier);
+
+      default:
+        assert(false);
+    }
   }
 
-  if (node->next != nullptr) {
-    Identifier* current_id = node->next;
-    Symbol* current_sym = symbol;
-    
-    while (current_id != nullptr) {
-      switch (symbol->type) {
-        case SymbolType::STRUCT:
-          current_sym = scopeResolveMember(current_sym->struct_.members_table, 
-              current_id->identifier->start, current_id->identifier->end);
-
-          current_id = current_id->next;
-
-          if(current_sym == nullptr) {
-            assert(false && "identifierType: Struct member resolution failed");
-          }
-          break;
-        default:
-          assert(false && "Dot access of not a struct");
+  Symbol qualifier(Qualifier* node) {
+    DEBUG_ENTRY();
+    switch (node->type) {
+      case ASTType::QUALIFIER_CONST:
+        break;
+      case ASTType::QUALIFIER_EXPORT:
+        break;
+      case ASTType::QUALIFIER_MUT:
+        break;
+      default:
+        assert(false && "Qualifier");
+    }
+    return {};
+  }
+
+
+  Symbol* declaration(Declaration* node) {
+    DEBUG_ENTRY();
+    Name id = identifierDecl(node->identifier);
+    Symbol type_sym = type(node->decl_type);
+    Symbol* symbol = createSymbol(id, type_sym);
+    Symbol expr_sym;
+
+    // TODO: implement
+    for (int i = 0; i < node->qualifiers_count; i++) {
+      qualifier(node->qualifiers[i]);
+    }
+
+    // TODO: handle declarations of struct or enum instances
+
+    if (node->expr != nullptr) {
+      DEBUG_PRINT("Declaration expr exists");
+      expr_sym = expr(node->expr);
+      if (!matchAssignmentTypes(symbol, expr_sym)) {
+        reportPosition(node->start);
+        assert(false && "Declaration expr assignment type doesn't match");
       }
     }
 
-    return current_sym;
+    scopeDeclare(current_scope, symbol);
+
+    return symbol;
   }
 
-  return symbol;
-}
+  void assignment(Assignment* node) {
+    DEBUG_ENTRY();
+    Symbol* symbol = identifierResolve(node->identifier);
+    Symbol expr_sym = expr(node->expr);
 
-Symbol type(Type* node) {
-  DEBUG_ENTRY();
-  switch (node->type) {
-    case ASTType::TYPE_SIMPLE:
-      return {simpleType(node->simple_type)};
+    if (!matchAssignmentTypes(symbol, expr_sym)) {
+      reportPosition(node->start);
+      assert(false && "Assignment types don't match");
+    }
+  }
+
+  Block* conditional(Conditional* node, int step, WalkState&, WalkNone) {
+    switch (step) {
+      case 0: {
+        DEBUG_ENTRY();
+        Symbol expr_sym = expr(node->condition);
+
+        if (!matchCondition(expr_sym)) {
+          reportPosition(node->start);
+          assert(false && "Conditional condition is not bool");
+        }
+
+        return node->block;
+      }
+
+      case 1:
+        return node->other;
+
+      default:
+        return nullptr;
+    }
+  }
+
+  Block* while_(While* node, int step, WalkState&, WalkNone) {
+    if (step != 0) return nullptr;
+
+    DEBUG_ENTRY();
+    Symbol expr_sym = expr(node->condition);
     
-    case ASTType::TYPE_ID:
-      return *identifierType(node->identifier);
+    if (!matchCondition(expr_sym)) {
+      reportPosition(node->start);
+      assert(false && "While condition is not bool");
+    }
 
-    default:
-      assert(false);
+    return node->block;
   }
-}
 
-Symbol qualifier(Qualifier* node) {
-  DEBUG_ENTRY();
-  switch (node->type) {
-    case ASTType::QUALIFIER_CONST:
-      break;
-    case ASTType::QUALIFIER_EXPORT:
-      break;
-    case ASTType::QUALIFIER_MUT:
-      break;
-    default:
-      assert(false && "Qualifier");
+  void blockEnter(Block* node) {
+    DEBUG_ENTRY();
+    if (node->namespace_ != nullptr) {
+      // TODO: 
+      identifierDecl(node->namespace_);
+    }
+
+    current_scope = scopeCreate(current_scope, node);
+  }
+
+  void blockLeave(Block*) {
+    current_scope = current_scope->parent;
+  }
+
+  Symbol literal(Literal* node) {
+    DEBUG_ENTRY();
+    return defrefLiteral(node->type);
+  }
+
+  Symbol* callee(Call* node) {
+    DEBUG_ENTRY();
+    return identifierResolve(node->identifier);
+  }
+
+  Symbol call(Call* node, Symbol* func_sym, Symbol* arguments) {
+    return defrefCall(*node->start, func_sym, arguments, node->arguments_count);
+  }
+
+  Symbol unary(Unary* node, Symbol operand) {
+    DEBUG_ENTRY();
+    return defrefUnary(*node->start, node->type, operand);
+  }
+
+  Symbol binary(Binary* node, Symbol first, Symbol second) {
+    DEBUG_ENTRY();
+    return defrefBinary(*node->start, node->type, first, second);
+  }
+
+  Symbol* functionParam(FunctionParam* node) {
+    DEBUG_ENTRY();
+    Name id = identifierDecl(node->identifier);
+    Symbol type_sym = type(node->decl_type);
+    Symbol* symbol = createSymbol(id, type_sym);
+
+    return symbol;
+  }
+
+  // Creates the function symbol and its scope with the parameters, not declared yet
+  Symbol* functionDecl(Function* node) {
+    Name id = identifierDecl(node->header->identifier);
+    Symbol return_type = type(node->header->return_type);
+    Symbol* symbol = symbolCreateFunction(node, id.start, id.end, id.id, current_scope, return_type);
+
+    current_scope = symbol->function.scope;
+
+    for (int i = 0; i < node->header->parameter_count; i++) {
+      Symbol* param_sym = functionParam(node->header->parameter_list[i]);
+      symbolAddFunctionParamChild(symbol, param_sym->start, param_sym->end, param_sym);
+    }
+
+    current_scope = current_scope->parent;
+    return symbol;
+  }
+
+  void functionDef(Function* node) {
+    current_scope = scopeGet(node);
+
+    if (node->expr != nullptr) {
+      // TODO: does the type of this match return type?
+      expr(node->expr);
+    }
+
+    Block* body = functionBody(node);
+    if (body != nullptr) {
+      block(body);
+    }
+    else if (functionBodyFailed(node)) {
+      reportPosition(node->body_start);
+      assert(false && "Function body does not parse");
+    }
+
+    current_scope = current_scope->parent;
+  }
+
+  void function(Function* node) {
+    DEBUG_ENTRY();
+    Symbol* symbol = functionDecl(node);
+    functionDef(node);
+    scopeDeclare(current_scope, symbol);
+  }
+
+  void struct_(Struct* node) {
+    DEBUG_ENTRY();
+    Name id = identifierDecl(node->identifier);
+    Symbol* symbol = symbolCreateStruct(node, id.start, id.end, id.id, current_scope);
+
+    current_scope = symbol->struct_.members_table;
+
+    for (int i = 0; i < node->declarations_count; i++) {
+      Symbol* decl_sym = declaration(node->declarations[i]);
+      symbolAddStructChild(symbol, decl_sym->start, decl_sym->end, decl_sym);
+
+    }
+
+    current_scope = symbol->struct_.members_table->parent;
+    scopeDeclare(current_scope, symbol);
+  }
+
+  void enum_(Enum* node) {
+    DEBUG_ENTRY();
+    Name id = identifierDecl(node->identifier);
+    Symbol* symbol = symbolCreateEnum(id.start, id.end, id.id);
+
+    for (int i = 0; i < node->members_count; i++) {
+      symbolAddEnumChild(symbol, node->members[i]->id);
+    }
+
+    scopeDeclare(current_scope, symbol);
   }
-  return {};
+};
+
 }
 
-Symbol expr(Expr* node);
-void block(Block* node);
+/*
+ * Same checks on the compact form. Scopes are keyed by the address of the
+ * compact block, function or struct, and the root scope by the CompactAst.
+ * Statements, block tags and expressions use the walk of CompactVisitor.
+ */
+namespace defref {
+namespace compact {
 
-Symbol* declaration(Declaration* node) {
-  DEBUG_ENTRY();
-  Name id = identifierDecl(node->identifier);
-  Symbol type_sym = type(node->decl_type);
-  Symbol* symbol = createSymbol(id, type_sym);
-  Symbol expr_sym;
+struct DefRef : CompactVisitor<DefRef> {
+  Token position(TokenIndex token) {
+    return tokenGet(ast->stream, token);
+  }
+
+  void reportPosition(TokenIndex token) {
+    Token at = position(token);
+    defref::reportPosition(&at);
+  }
+
+  Name name(CompactIdentifier& node) {
+    const char* start = compactTokenStart(ast, node.token);
+    return {start, start + compactTokenLength(ast, node.token), node.id};
+  }
+
+  SymbolType simpleType(ASTType type) {
+    DEBUG_ENTRY();
+    switch (type) {
+      case ASTType::SIMPLE_TYPE_I8:
+        return SymbolType::I8;
+
+      case ASTType::SIMPLE_TYPE_U8:
+        return SymbolType::U8;
+
+      case ASTType::SIMPLE_TYPE_I32:
+        return SymbolType::I32;
+
+      case ASTType::SIMPLE_TYPE_U32:
+        return SymbolType::U32;
+
+      case ASTType::SIMPLE_TYPE_F32:
+        return SymbolType::F32;
 
-  // TODO: implement
-  for (int i = 0; i < node->qualifiers_count; i++) {
-    qualifier(node->qualifiers[i]);
+      default:
+        assert(false && "Simple Type");
+    }
   }
 
-  // TODO: handle declarations of struct or enum instances
+  Symbol* identifierResolve(NodeIndex index) {
+    DEBUG_ENTRY();
+    CompactIdentifier* node = &ast->identifiers[index];
+    Symbol* symbol = scopeResolve(current_scope, node->id);
+
+    if (symbol != nullptr) {
+      CompactIdentifier* current_id = node + 1;
+      Symbol* current_sym = symbol;
+
+      if (node->rest == 0) {
+        return symbol;
+      }
+
+      while (current_id->rest != 0) {
+        switch (current_sym->type) {
+          case SymbolType::ENUM:
+            reportPosition(current_id->token);
+            assert(false && "Enum member dot access");
+
+          case SymbolType::STRUCT:
+            current_sym = scopeResolveMember(current_sym->struct_.members_table, current_id->id);
+
+            current_id++;
+
+            if (current_sym == nullptr) {
+              reportPosition(node->token);
+              assert(false && "identifierResolve: Struct member resolution failed");
+            }
+
+            break;
+
+          default:
+            reportPosition(current_id->token);
+            assert(false && "Dot access of not a struct or enum");
+        }
+      }
+
+      return current_sym;
+    }
+
+    reportPosition(node->token);
+    assert(false && "Failed to resolve identifier");
+  }
+
+  Name identifierDecl(NodeIndex index) {
+    DEBUG_ENTRY();
+    CompactIdentifier& node = ast->identifiers[index];
+    Symbol* symbol = scopeResolveMember(current_scope, node.id);
+    if (symbol != nullptr) {
+      reportPosition(node.token);
+      assert(false && "Redeclaration");
+    }
+
+    if (node.rest != 0) {
+      // TODO: maybe support this in the future
+      reportPosition(node.token);
+      assert(false && "Declaration of dotted identifier");
+    }
+    return name(node);
+  }
+
+  Symbol* identifierType(NodeIndex index) {
+    DEBUG_ENTRY();
+    CompactIdentifier* node = &ast->identifiers[index];
+    Symbol* symbol = scopeResolve(current_scope, node->id);
+
+    if (symbol == nullptr) {
+        reportPosition(node->token);
+        assert(false && "Failed to resolve type identifier");
+    }
+
+    if (node->rest != 0) {
+      Symbol* current_sym = symbol;
+
+      for (CompactIdentifier* current_id = node + 1; current_id <= node + node->rest; current_id++) {
+        switch (symbol->type) {
+          case SymbolType::STRUCT:
+            current_sym = scopeResolveMember(current_sym->struct_.members_table, current_id->id);
+
+            if(current_sym == nullptr) {
+              reportPosition(node->token);
+              assert(false && "identifierType: Struct member resolution failed");
+            }
+            break;
+          default:
+            reportPosition(current_id->token);
+            assert(false && "Dot access of not a struct");
+        }
+      }
+
+      return current_sym;
+    }
+
+    return symbol;
+  }
+
+  Symbol type(NodeIndex index) {
+    DEBUG_ENTRY();
+    CompactType& node = ast->types[index];
+    switch (node.type) {
+      case ASTType::TYPE_SIMPLE:
+        return typeSymbol(simpleType(node.simple_type));
+
+      case ASTType::TYPE_ID:
+        return *identifierType(node.identifier);
+
+      default:
+        assert(false);
+    }
+  }
+
+  Symbol qualifier(ASTType type) {
+    DEBUG_ENTRY();
+    switch (type) {
+      case ASTType::QUALIFIER_CONST:
+        break;
+      case ASTType::QUALIFIER_EXPORT:
+        break;
+      case ASTType::QUALIFIER_MUT:
+        break;
+      default:
+        assert(false && "Qualifier");
+    }
+    return {};
+  }
+
+  Symbol* declaration(NodeIndex index) {
+    DEBUG_ENTRY();
+    CompactDeclaration& node = ast->declarations[index];
+    Name id = identifierDecl(node.identifier);
+    Symbol type_sym = type(node.decl_type);
+    Symbol* symbol = createSymbol(id, type_sym);
+    Symbol expr_sym;
+
+    // TODO: implement
+    for (uint32_t i = 0; i < node.qualifiers.count; i++) {
+      qualifier(ast->qualifiers[node.qualifiers.first + i]);
+    }
+
+    if (node.expr != NODE_NONE) {
+      DEBUG_PRINT("Declaration expr exists");
+      expr_sym = expr(node.expr);
+      if (!matchAssignmentTypes(symbol, expr_sym)) {
+        reportPosition(node.start);
+        assert(false && "Declaration expr assignment type doesn't match");
+      }
+    }
+
+    scopeDeclare(current_scope, symbol);
+
+    return symbol;
+  }
+
+  void assignment(CompactStatement& node) {
+    DEBUG_ENTRY();
+    Symbol* symbol = identifierResolve(node.identifier);
+    Symbol expr_sym = expr(node.expr);
 
-  if (node->expr != nullptr) {
-    DEBUG_PRINT("Declaration expr exists");
-    expr_sym = expr(node->expr);
     if (!matchAssignmentTypes(symbol, expr_sym)) {
-      assert(false && "Declaration expr assignment type doesn't match");
+      reportPosition(node.start);
+      assert(false && "Assignment types don't match");
     }
   }
 
-  scopeDeclare(current_scope, symbol);
+  NodeIndex conditional(CompactStatement& node, int step, WalkState&, WalkNone) {
+    switch (step) {
+      case 0: {
+        DEBUG_ENTRY();
+        Symbol expr_sym = expr(node.expr);
 
-  return symbol;
-}
+        if (!matchCondition(expr_sym)) {
+          reportPosition(node.start);
+          assert(false && "Conditional condition is not bool");
+        }
 
-void assignment(Assignment* node) {
-  DEBUG_ENTRY();
-  Symbol* symbol = identifierResolve(node->identifier);
-  Symbol expr_sym = expr(node->expr);
+        return node.block;
+      }
 
-  if (!matchAssignmentTypes(symbol, expr_sym)) {
-    assert(false && "Assignment types don't match");
+      case 1:
+        return node.other;
+
+      default:
+        return NODE_NONE;
+    }
   }
-}
 
-void conditional(Conditional* node) {
-  DEBUG_ENTRY();
-  Symbol expr_sym = expr(node->condition);
+  NodeIndex while_(CompactStatement& node, int step, WalkState&, WalkNone) {
+    if (step != 0) return NODE_NONE;
+
+    DEBUG_ENTRY();
+    Symbol expr_sym = expr(node.expr);
 
-  if (!matchCondition(expr_sym)) {
-    assert(false && "Conditional condition is not bool");
+    if (!matchCondition(expr_sym)) {
+      reportPosition(node.start);
+      assert(false && "While condition is not bool");
+    }
+
+    return node.block;
   }
 
-  block(node->block);
+  void break_(CompactStatement&) {
+    DEBUG_ENTRY();
+  }
 
-  if (node->other != nullptr) {
-    block(node->other);
+  void continue_(CompactStatement&) {
+    DEBUG_ENTRY();
   }
-}
 
-void while_(While* node) {
-  DEBUG_ENTRY();
-  Symbol expr_sym = expr(node->condition);
-  
-  if (!matchCondition(expr_sym)) {
-    assert(false && "While condition is not bool");
+  void return_(CompactStatement& node) {
+    DEBUG_ENTRY();
+    // TODO: we need to manage if we are currentlly in a function
+    if (node.expr != NODE_NONE) {
+      expr(node.expr);
+    }
   }
 
-  block(node->block);
-}
+  void blockEnter(CompactBlock& node) {
+    DEBUG_ENTRY();
+    if (node.namespace_ != NODE_NONE) {
+      // TODO:
+      identifierDecl(node.namespace_);
+    }
 
-void break_(Break* node) {
-  DEBUG_ENTRY();
-}
+    current_scope = scopeCreate(current_scope, &node);
+  }
 
-void continue_(Continue* node) {
-  DEBUG_ENTRY();
-}
+  void blockLeave(CompactBlock&) {
+    current_scope = current_scope->parent;
+  }
 
-void return_(Return* node) {
-  DEBUG_ENTRY();
-  // TODO: we need to manage if we are currentlly in a function
-  if (node->expr != nullptr) {
-    expr(node->expr);
+  Symbol identifierValue(NodeIndex index) {
+    return *identifierResolve(index);
   }
-  else {
 
+  Symbol literal(CompactExpr& node) {
+    DEBUG_ENTRY();
+    return defrefLiteral(node.op);
   }
-}
 
-void statement(Statement* node) {
-  DEBUG_ENTRY();
-  switch (node->type) {
-    case ASTType::STATEMENT_CONDITION:
-      conditional(node->conditional);
-      break;
-    case ASTType::STATEMENT_WHILE:
-      while_(node->while_);
-      break;
-    case ASTType::STATEMENT_BREAK:
-      break_(node->break_);
-      break;
-    case ASTType::STATEMENT_CONTINUE:
-      continue_(node->continue_);
-      break;
-    case ASTType::STATEMENT_RETURN:
-      return_(node->return_);
-      break;
-    case ASTType::STATEMENT_ASSIGN:
-      assignment(node->assignment);
-      break;
-    case ASTType::STATEMENT_EXPR:
-      expr(node->expr);
-      break;
-    default:
-      assert(false && "Statement");
+  Symbol* callee(CompactExpr& node) {
+    DEBUG_ENTRY();
+    return identifierResolve(node.identifier);
   }
-}
 
-void blockTag(BlockTag* node) {
-  DEBUG_ENTRY();
-  switch (node->type) {
-    case ASTType::BLOCK_TAG_BLOCK:
-      block(node->block);
-      break;
-    case ASTType::BLOCK_TAG_STATEMENT:
-      statement(node->statement);
-      break;
-    default:
-      assert(false && "Block Tag");
+  Symbol call(CompactExpr& node, Symbol* func_sym, Symbol* arguments) {
+    return defrefCall(position(node.start), func_sym, arguments, node.children.count);
   }
-}
 
-void block(Block* node) {
-  DEBUG_ENTRY();
-  if (node->namespace_ != nullptr) {
-    // TODO: 
-    identifierDecl(node->namespace_);
+  Symbol unary(CompactExpr& node, Symbol operand) {
+    DEBUG_ENTRY();
+    return defrefUnary(position(node.start), node.op, operand);
   }
 
-  current_scope = scopeCreate(current_scope, node);
+  Symbol binary(CompactExpr& node, Symbol first, Symbol second) {
+    DEBUG_ENTRY();
+    return defrefBinary(position(node.start), node.op, first, second);
+  }
 
-  if (node->statement != nullptr) {
-    statement(node->statement);
+  Symbol* functionParam(CompactParam& node) {
+    DEBUG_ENTRY();
+    Name id = identifierDecl(node.identifier);
+    Symbol type_sym = type(node.decl_type);
+    Symbol* symbol = createSymbol(id, type_sym);
+
+    return symbol;
+  }
+
+  void function(NodeIndex index) {
+    DEBUG_ENTRY();
+    CompactFunction& node = ast->functions[index];
+    Name id = identifierDecl(node.identifier);
+    Symbol return_type = type(node.return_type);
+    Symbol* symbol = symbolCreateFunction(&node, id.start, id.end, id.id, current_scope, return_type);
+
+    current_scope = symbol->function.scope;
+
+    for (uint32_t i = 0; i < node.params.count; i++) {
+      Symbol* param_sym = functionParam(ast->params[node.params.first + i]);
+      symbolAddFunctionParamChild(symbol, param_sym->start, param_sym->end, param_sym);
+    }
+
+    if (node.block != NODE_NONE) {
+      block(node.block);
+    }
+
+    current_scope = current_scope->parent;
+    scopeDeclare(current_scope, symbol);
+  }
+
+  void struct_(NodeIndex index) {
+    DEBUG_ENTRY();
+    CompactStruct& node = ast->structs[index];
+    Name id = identifierDecl(node.identifier);
+    Symbol* symbol = symbolCreateStruct(&node, id.start, id.end, id.id, current_scope);
+
+    current_scope = symbol->struct_.members_table;
+
+    for (uint32_t i = 0; i < node.declarations.count; i++) {
+      Symbol* decl_sym = declaration(node.declarations.first + i);
+      symbolAddStructChild(symbol, decl_sym->start, decl_sym->end, decl_sym);
+    }
+
+    current_scope = symbol->struct_.members_table->parent;
+    scopeDeclare(current_scope, symbol);
   }
 
-  for (int i = 0; i < node->declarations_count; i++) {
-    declaration(node->declarations[i]);
+  void enum_(NodeIndex index) {
+    DEBUG_ENTRY();
+    CompactEnum& node = ast->enums[index];
+    Name id = identifierDecl(node.identifier);
+    Symbol* symbol = symbolCreateEnum(id.start, id.end, id.id);
+
+    for (uint32_t i = 0; i < node.members.count; i++) {
+      symbolAddEnumChild(symbol, ast->identifiers[node.members.first + i].id);
+    }
+
+    scopeDeclare(current_scope, symbol);
   }
 
-  for (int i = 0; i < node->block_tags_count; i++) {
-    blockTag(node->block_tags[i]);
+  void primaryTag(CompactTag& node) {
+    DEBUG_ENTRY();
+    switch (node.type) {
+      case ASTType::PRIMARY_TAG_DECL:
+        declaration(node.child);
+        break;
+      case ASTType::PRIMARY_TAG_ENUM:
+        enum_(node.child);
+        break;
+      case ASTType::PRIMARY_TAG_FUNC:
+        function(node.child);
+        break;
+      case ASTType::PRIMARY_TAG_STRUCT:
+        struct_(node.child);
+        break;
+      default:
+        assert(false && "Primary Tag");
+    }
+  }
+
+  void primary() {
+    DEBUG_ENTRY();
+    for (uint32_t i = 0; i < ast->primary_tags.count; i++) {
+      primaryTag(ast->primary_tags[i]);
+    }
   }
+};
+
+}
+}
+
+void visitDefRef(Primary* node, LineIndex* lines) {
+  line_index = lines;
+  scopeStackCreate();
+  symbolStackCreate();
+
+  current_scope = scopeCreate(nullptr, node);
   
-  current_scope = current_scope->parent;
+  defref::DefRef pass;
+  pass.primary(node);
 }
 
-Symbol literal(Literal* node) {
+void visitDefRef(CompactAst* ast, LineIndex* lines) {
+  line_index = lines;
+  scopeStackCreate();
+  symbolStackCreate();
+
+  current_scope = scopeCreate(nullptr, ast);
+
+  defref::compact::DefRef pass;
+  pass.ast = ast;
+  pass.primary();
+}
+
+void visitDefRefDeclarations(Primary* node, LineIndex* lines) {
+  line_index = lines;
+  scopeStackCreate();
+  symbolStackCreate();
+
+  current_scope = scopeCreate(nullptr, node);
+
+  defref::DefRef pass;
+  for (int i = 0; i < node->primary_tags_count; i++) {
+    PrimaryTag* tag = node->primary_tags[i];
+    if (tag->type != ASTType::PRIMARY_TAG_FUNC) {
+      pass.primaryTag(tag);
+      continue;
+    }
+
+    DEBUG_ENTRY();
+    scopeDeclare(current_scope, pass.functionDecl(tag->func));
+  }
+}
+
+void visitDefRefFunction(Function* node) {
   DEBUG_ENTRY();
-  switch (node->type) {
+  defref::DefRef pass;
+  pass.functionDef(node);
+}
+
+Symbol* defrefResolve(Scope* scope, Identifier* node) {
+  current_scope = scope;
+  return defref::DefRef().identifierResolve(node);
+}
+
+Symbol defrefType(Scope* scope, Type* node) {
+  current_scope = scope;
+  return defref::DefRef().type(node);
+}
+
+Symbol* defrefDeclaration(Scope* scope, Identifier* node, Symbol type_sym) {
+  current_scope = scope;
+  Name id = defref::DefRef().identifierDecl(node);
+  return defref::createSymbol(id, type_sym);
+}
+
+void defrefAssignment(const Token& position, Symbol* symbol, Symbol value) {
+  if (!defref::matchAssignmentTypes(symbol, value)) {
+    defref::reportPosition(&position);
+    assert(false && "Assignment types don't match");
+  }
+}
+
+void defrefCondition(const Token& position, Symbol value) {
+  if (!defref::matchCondition(value)) {
+    defref::reportPosition(&position);
+    assert(false && "Condition is not bool");
+  }
+}
+
+Symbol defrefLiteral(ASTType type) {
+  switch (type) {
     case ASTType::LITERAL_STRING:
-      return {SymbolType::STRING};
+      return typeSymbol(SymbolType::STRING);
 
     case ASTType::LITERAL_INT:
-      return {SymbolType::U32};
+      return typeSymbol(SymbolType::U32);
 
     case ASTType::LITERAL_FLOAT:
-      return {SymbolType::F32};
+      return typeSymbol(SymbolType::F32);
 
     case ASTType::LITERAL_BOOL:
-      return {SymbolType::BOOL};
+      return typeSymbol(SymbolType::BOOL);
 
     default:
       assert(false && "Literal");
   }
 }
 
-Symbol call(Call* node) {
-  DEBUG_ENTRY();
-  Symbol* func_sym = identifierResolve(node->identifier);
-
-  if (func_sym->type != SymbolType::FUNCTION) {
+Symbol defrefCall(const Token& position, Symbol* callee, Symbol* arguments, int count) {
+  if (callee->type != SymbolType::FUNCTION) {
+    defref::reportPosition(&position);
     assert(false && "Calling a symbol which is not a function");
   }
   
-  for (int i = 0; i < node->arguments_count; i++) {
-    Symbol expr_sym = expr(node->arguments[i]);
-    if (func_sym->function.parameter_vector->size <= i ||
-      !matchAssignmentTypes((Symbol*)vecGet(func_sym->function.parameter_vector, i), expr_sym)) {
+  for (int i = 0; i < count; i++) {
+    if (callee->function.parameter_vector->size <= i ||
+      !defref::matchAssignmentTypes((Symbol*)vecGet(callee->function.parameter_vector, i), arguments[i])) {
+      defref::reportPosition(&position);
       assert(false && "Function call parameter types don't match definition");
     }
   }
 
-  if (func_sym->function.struct_return_type != nullptr) {
-    Symbol output = {SymbolType::STRUCT_INSTANCE};
-    output.struct_instance.struct_decl = func_sym->function.struct_return_type;
+  if (callee->function.struct_return_type != nullptr) {
+    Symbol output = typeSymbol(SymbolType::STRUCT_INSTANCE);
+    output.struct_instance.struct_decl = callee->function.struct_return_type;
     return output;
   }
   else {
-    return {func_sym->function.simple_return_type};
+    return typeSymbol(callee->function.simple_return_type);
   }
 }
 
-Symbol unary(Unary* node) {
-  DEBUG_ENTRY();
-  Symbol symbol = expr(node->expr);
-  switch (node->type) {
+Symbol defrefUnary(const Token& position, ASTType type, Symbol operand) {
+  switch (type) {
     case ASTType::UNARY_NOT:
-      if (symbol.type != SymbolType::BOOL) assert(false && "Can only not a bool");
-      return symbol;
+      if (operand.type != SymbolType::BOOL) assert(false && "Can only not a bool");
+      return operand;
     case ASTType::UNARY_PLUS:
     case ASTType::UNARY_MINUS:
-      switch (symbol.type) {
+      switch (operand.type) {
         case SymbolType::I8:
         case SymbolType::U8:
         case SymbolType::I32:
         case SymbolType::U32:
         case SymbolType::F32:
-          return symbol;
+          return operand;
         default:
+          defref::reportPosition(&position);
           assert(false && "Can only unary plus/minus int or float types");
       }
     default:
@@ -464,11 +1025,9 @@ Symbol unary(Unary* node) {
   // TODO: use some unary op table instead of this
 }
 
-Symbol binary(Binary* node) {
-  DEBUG_ENTRY();
-  Symbol first = expr(node->first);
-  Symbol second = expr(node->second);
+Symbol defrefBinary(const Token& position, ASTType type, Symbol first, Symbol second) {
   if (first.type != second.type) {
+    defref::reportPosition(&position);
     assert(false && "Binary expression has implicit cast");
   }
 
@@ -482,10 +1041,11 @@ Symbol binary(Binary* node) {
       break;
     // TOOD: handle pointers
     default:
+      defref::reportPosition(&position);
       assert(false && "Binary op on non-arithmetic types");
   }
 
-  switch (node->type) {
+  switch (type) {
     case ASTType::BINARY_MUL:
     case ASTType::BINARY_DIV:
     case ASTType::BINARY_MOD:
@@ -499,7 +1059,7 @@ Symbol binary(Binary* node) {
     case ASTType::BINARY_GE:
     case ASTType::BINARY_EQ:
     case ASTType::BINARY_NE:
-      return {SymbolType::BOOL};
+      return typeSymbol(SymbolType::BOOL);
 
     case ASTType::BINARY_AND:
     case ASTType::BINARY_OR:
@@ -514,131 +1074,6 @@ Symbol binary(Binary* node) {
   // TODO: use some binary op table instead of this
 }
 
-Symbol expr(Expr* node) {
-  DEBUG_ENTRY();
-  switch (node->type) {
-    case ASTType::EXPRESSION_CALL:
-      return call(node->call);
-
-    case ASTType::EXPRESSION_UNARY:
-      return unary(node->unary);
-
-    case ASTType::EXPRESSION_BINARY:
-      return binary(node->binary);
-
-    case ASTType::EXPRESSION_IDENTIFIER:
-      return *identifierResolve(node->identifier);
-
-    case ASTType::EXPRESSION_LITERAL:
-      return literal(node->literal);
-
-    default:
-      assert(false && "Expr");
-  }
-}
-
-Symbol* functionParam(FunctionParam* node) {
-  DEBUG_ENTRY();
-  Name id = identifierDecl(node->identifier);
-  Symbol type_sym = type(node->decl_type);
-  Symbol* symbol = createSymbol(id, type_sym);
-
-  return symbol;
-}
-
-void function(Function* node) {
-  DEBUG_ENTRY();
-  Name id = identifierDecl(node->header->identifier);
-  Symbol return_type = type(node->header->return_type);
-  Symbol* symbol = symbolCreateFunction(node, id.start, id.end, current_scope, return_type);
-
-  current_scope = symbol->function.scope;
-
-  for (int i = 0; i < node->header->parameter_count; i++) {
-    Symbol* param_sym = functionParam(node->header->parameter_list[i]);
-    symbolAddFunctionParamChild(symbol, param_sym->start, param_sym->end, param_sym);
-  }
-
-  if (node->expr != nullptr) {
-    // TODO: does the type of this match return type?
-    expr(node->expr);
-  }
-
-  if (node->block != nullptr) {
-    block(node->block);
-  }
-
-  current_scope = current_scope->parent;
-  scopeDeclare(current_scope, symbol);
-}
-
-void struct_(Struct* node) {
-  DEBUG_ENTRY();
-  Name id = identifierDecl(node->identifier);
-  Symbol* symbol = symbolCreateStruct(node, id.start, id.end, current_scope);
-
-  current_scope = symbol->struct_.members_table;
-
-  for (int i = 0; i < node->declarations_count; i++) {
-    Symbol* decl_sym = declaration(node->declarations[i]);
-    symbolAddStructChild(symbol, decl_sym->start, decl_sym->end, decl_sym);
-
-  }
-
-  current_scope = symbol->struct_.members_table->parent;
-  scopeDeclare(current_scope, symbol);
-}
-
-void enum_(Enum* node) {
-  DEBUG_ENTRY();
-  Name id = identifierDecl(node->identifier);
-  Symbol* symbol = symbolCreateEnum(id.start, id.end);
-
-  for (int i = 0; i < node->members_count; i++) {
-    symbolAddEnumChild(symbol, node->members[i]->start, node->members[i]->end);
-  }
-
-  scopeDeclare(current_scope, symbol);
-}
-
-void primaryTag(PrimaryTag* node) {
-  DEBUG_ENTRY();
-  switch (node->type) {
-    case ASTType::PRIMARY_TAG_DECL:
-      declaration(node->decl);
-      break;
-    case ASTType::PRIMARY_TAG_ENUM:
-      enum_(node->enum_);
-      break;
-    case ASTType::PRIMARY_TAG_FUNC:
-      function(node->func);
-      break;
-    case ASTType::PRIMARY_TAG_STRUCT:
-      struct_(node->struct_);
-      break;
-    default:
-      assert(false && "Primary Tag");
-  }
-}
-
-void primary(Primary* node) {
-  DEBUG_ENTRY();
-  for (int i = 0; i < node->primary_tags_count; i++) {
-    primaryTag(node->primary_tags[i]);
-  }
-}
-
-}
-
-void visitDefRef(Primary* node) {
-  scopeStackCreate();
-  symbolStackCreate();
-
-  current_scope = scopeCreate(nullptr, node);
-  
-  defref::primary(node);
-}
-
 void defref_destroy() {
   symbolStackDestroy();
   scopeStackDestroy();
@@ -1,9 +1,39 @@
 #pragma once
 #include "ast_types.h"
+#include "compact_ast.h"
+#include "line_index.h"
 
 /* DefRef creates and allocates the scope tree and its symbols
  * It also checks all defs and refs to make sure their types match up
  */
 
-void visitDefRef(Primary* node);
+// lines is optional and only used to report the position of errors
+void visitDefRef(Primary* node, LineIndex* lines = nullptr);
+void visitDefRef(CompactAst* ast, LineIndex* lines = nullptr);
+
+// Defines every top level name, functions without their bodies, so bodies can
+// then be checked one at a time in any order by visitDefRefFunction
+void visitDefRefDeclarations(Primary* node, LineIndex* lines = nullptr);
+void visitDefRefFunction(Function* node);
+
+struct Scope;
+struct Symbol;
+
+/* Checks of single nodes for passes that resolve names while doing other
+ * work, see visitCodeGenFunctionFused, and for both forms of visitDefRef.
+ * Operands are the symbols their expressions checked to, position is the
+ * token an error is reported at and names are looked up in scope. Errors are
+ * reported and asserted on like in visitDefRef.
+ */
+Symbol* defrefResolve(Scope* scope, Identifier* node);
+Symbol defrefType(Scope* scope, Type* node);
+// Checks the name is free in scope, the symbol is not declared yet
+Symbol* defrefDeclaration(Scope* scope, Identifier* node, Symbol type_sym);
+void defrefAssignment(const Token& position, Symbol* symbol, Symbol value);
+void defrefCondition(const Token& position, Symbol value);
+// type is the LITERAL_*, UNARY_* or BINARY_* of the node
+Symbol defrefLiteral(ASTType type);
+Symbol defrefCall(const Token& position, Symbol* callee, Symbol* arguments, int count);
+Symbol defrefUnary(const Token& position, ASTType type, Symbol operand);
+Symbol defrefBinary(const Token& position, ASTType type, Symbol first, Symbol second);
 void defref_destroy();
@@ -5,30 +5,6 @@
 #include <cstdlib>
 #include <cstring>
 
-bool cmpPtrStr(const char* s1_start, const char* s1_end, const char* s2) {
-  const char* p1 = s1_start;
-  const char* p2 = s2;
-
-  while (p1 != s1_end && *p2) {
-    if (*p1++ != *p2++) return false;
-  }
-
-  return p1 == s1_end && !*p2;
-}
-
-const char* dupPtrStr(const char* start, const char* end) {
-  char* output = (char*) malloc(end - start + 1);
-  const char* p = start;
-  char* p_out = output;
-
-  while(p != end) {
-    *p_out++ = *p++;
-  }
-  *p_out = '\0';
-
-  return output;
-}   
-
 const uint32_t FNV32_BASIS = 16777619;
 const uint32_t FNV32_PRIME = 2166136261;
 
@@ -42,14 +18,9 @@ uint32_t hashKey(const char* key_start, const char* key_end) {
   return hash;
 }
 
-uint32_t hashKey(const char* key) {
-  uint32_t hash = FNV32_BASIS;
-  for(const char* p = key; *p; p++) {
-    hash ^= (uint32_t)(unsigned char)(*p);
-    hash *= FNV32_PRIME;
-  }
-
-  return hash;
+// Ids are dense, multiplying by an odd constant spreads them over the low bits
+inline uint32_t hashId(uint32_t key) {
+  return key * 2654435769u;
 }
 
 HashTable* htCreate(int initial_capacity) {
@@ -70,20 +41,15 @@ HashTable* htCreate(int initial_capacity) {
 }
 
 void htDestroy(HashTable* table) {
-  for (int i = 0; i < table->capacity; i++) {
-    free((void*)table->entries[i].key);
-  }
-
   free(table->entries);
   free(table);
 }
 
-void* htGet(HashTable* table, const char* key_start, const char* key_end) {
-  uint32_t hash = hashKey(key_start, key_end);
-  int index = hash & (table->capacity - 1);
+void* htGet(HashTable* table, uint32_t key) {
+  int index = hashId(key) & (table->capacity - 1);
   
-  while(table->entries[index].key != nullptr) {
-    if (cmpPtrStr(key_start, key_end, table->entries[index].key)) {
+  while(table->entries[index].key != 0) {
+    if (table->entries[index].key == key) {
       return table->entries[index].value;
     }
 
@@ -96,42 +62,13 @@ void* htGet(HashTable* table, const char* key_start, const char* key_end) {
   return nullptr;
 }
 
-const char* htSetEntry(HashTable* table, const char* key_start, const char* key_end, void* value) {
-  uint32_t hash = hashKey(key_start, key_end);
-  int index = hash & (table->capacity - 1);
-  const char* key;
-
-  while (table->entries[index].key != nullptr) {
-    if (cmpPtrStr(key_start, key_end, table->entries[index].key)){
-      table->entries[index].value = value;
-      return table->entries[index].key;
-    }
-
-    index++;
-    if (index >= table->capacity) {
-      index = 0;
-    }
-  }
-
-  key = dupPtrStr(key_start, key_end);
-  // TODO: should this assert?
-  if (key == nullptr) return nullptr;
-
-  table->length++;
-  table->entries[index].key = key;
-  table->entries[index].value = value;
-  return key;
-}
-
-const char* htExpandSetEntry(HashTable* table, const char* key, void* value) {
-  uint32_t hash = hashKey(key);
-  int index = hash & (table->capacity - 1);
-  const char* new_key;
+void htSetEntry(HashTable* table, uint32_t key, void* value) {
+  int index = hashId(key) & (table->capacity - 1);
 
-  while (table->entries[index].key != nullptr) {
-    if (strcmp(key, table->entries[index].key) == 0){
+  while (table->entries[index].key != 0) {
+    if (table->entries[index].key == key) {
       table->entries[index].value = value;
-      return table->entries[index].key;
+      return;
     }
 
     index++;
@@ -143,7 +80,6 @@ const char* htExpandSetEntry(HashTable* table, const char* key, void* value) {
   table->length++;
   table->entries[index].key = key;
   table->entries[index].value = value;
-  return key;
 }
 
 void htExpand(HashTable* table) {
@@ -165,23 +101,19 @@ void htExpand(HashTable* table) {
 
   for (int i = 0; i < old_capacity; i++) {
     HashTableEntry entry = old_entries[i];
-    if (entry.key != nullptr) {
-      htExpandSetEntry(table, entry.key, entry.value);
+    if (entry.key != 0) {
+      htSetEntry(table, entry.key, entry.value);
     }
   }
 
   free(old_entries);
 }
 
-const char* htSet(HashTable* table, const char* key_start, const char* key_end, void* value) {
+void htSet(HashTable* table, uint32_t key, void* value) {
+  assert(key != 0 && "htSet key 0 is reserved for empty entries");
   if (table->length >= table->capacity / 2) {
     htExpand(table);
   }
 
-  return htSetEntry(table, key_start, key_end, value);
+  htSetEntry(table, key, value);
 }
-
-  
-
-  
-
@@ -1,7 +1,10 @@
 #pragma once
 
+#include <cstdint>
+
+// Keys are interned string ids, 0 marks an empty entry
 struct HashTableEntry {
-  const char* key;
+  uint32_t key;
   void* value;
 };
 
@@ -11,10 +14,10 @@ struct HashTable {
   int length;
 };
 
-
+uint32_t hashKey(const char* key_start, const char* key_end);
 
 HashTable* htCreate(int initial_capacity);
 void htDestroy(HashTable* table);
 
-void* htGet(HashTable* table, const char* key_start, const char* key_end);
-const char* htSet(HashTable* table, const char* key_start, const char* key_end, void* value);
+void* htGet(HashTable* table, uint32_t key);
+void htSet(HashTable* table, uint32_t key, void* value);
@@ -0,0 +1,134 @@
+#include "intern.h"
+#include "hash_table.h"
+
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+
+#define INTERN_INITIAL_CAPACITY 1024
+#define INTERN_INITIAL_STRINGS_CAPACITY 16384
+
+struct InternEntry {
+  uint32_t hash;
+  uint32_t offset;
+  uint32_t length;
+};
+
+struct InternPool {
+  // Indexed by id, entries[0] is unused
+  InternEntry* entries;
+  uint32_t count;
+  uint32_t capacity;
+
+  // Open addressed ids, 0 is empty
+  InternId* table;
+  uint32_t table_capacity;
+
+  char* strings;
+  uint32_t strings_size;
+  uint32_t strings_capacity;
+};
+
+InternPool intern_pool;
+
+InternId internLookup(uint32_t hash, const char* start, uint32_t length, uint32_t*& slot) {
+  uint32_t mask = intern_pool.table_capacity - 1;
+  uint32_t index = hash & mask;
+
+  while (intern_pool.table[index] != INTERN_NONE) {
+    InternId id = intern_pool.table[index];
+    InternEntry* entry = &intern_pool.entries[id];
+    if (entry->hash == hash && entry->length == length
+        && memcmp(intern_pool.strings + entry->offset, start, length) == 0) {
+      return id;
+    }
+    index = (index + 1) & mask;
+  }
+
+  slot = &intern_pool.table[index];
+  return INTERN_NONE;
+}
+
+void internGrowTable() {
+  uint32_t capacity = intern_pool.table_capacity == 0 ? 2 * INTERN_INITIAL_CAPACITY : 2 * intern_pool.table_capacity;
+  free(intern_pool.table);
+  intern_pool.table = (InternId*) calloc(capacity, sizeof(InternId));
+  assert(intern_pool.table != nullptr && "internGrowTable out of memory");
+  intern_pool.table_capacity = capacity;
+
+  uint32_t mask = capacity - 1;
+  for (InternId id = 1; id < intern_pool.count; id++) {
+    uint32_t index = intern_pool.entries[id].hash & mask;
+    while (intern_pool.table[index] != INTERN_NONE) index = (index + 1) & mask;
+    intern_pool.table[index] = id;
+  }
+}
+
+InternId internGet(const char* start, const char* end) {
+  uint32_t length = end - start;
+  uint32_t hash = hashKey(start, end);
+  uint32_t* slot = nullptr;
+
+  if (intern_pool.table != nullptr) {
+    InternId id = internLookup(hash, start, length, slot);
+    if (id != INTERN_NONE) return id;
+  }
+
+  if (intern_pool.count == 0) intern_pool.count = 1;
+
+  if (intern_pool.count >= intern_pool.table_capacity / 2) {
+    internGrowTable();
+    internLookup(hash, start, length, slot);
+  }
+
+  if (intern_pool.count >= intern_pool.capacity) {
+    intern_pool.capacity = intern_pool.capacity == 0 ? INTERN_INITIAL_CAPACITY : 2 * intern_pool.capacity;
+    intern_pool.entries = (InternEntry*) realloc(intern_pool.entries, intern_pool.capacity * sizeof(InternEntry));
+    assert(intern_pool.entries != nullptr && "internGet out of memory");
+  }
+
+  if (intern_pool.strings_size + length + 1 > intern_pool.strings_capacity) {
+    uint32_t capacity = intern_pool.strings_capacity == 0 ? INTERN_INITIAL_STRINGS_CAPACITY : intern_pool.strings_capacity;
+    while (intern_pool.strings_size + length + 1 > capacity) capacity *= 2;
+    intern_pool.strings = (char*) realloc(intern_pool.strings, capacity);
+    assert(intern_pool.strings != nullptr && "internGet out of memory");
+    intern_pool.strings_capacity = capacity;
+  }
+
+  InternId id = intern_pool.count++;
+  intern_pool.entries[id] = {hash, intern_pool.strings_size, length};
+  memcpy(intern_pool.strings + intern_pool.strings_size, start, length);
+  intern_pool.strings[intern_pool.strings_size + length] = '\0';
+  intern_pool.strings_size += length + 1;
+
+  *slot = id;
+  return id;
+}
+
+InternId internFind(const char* start, const char* end) {
+  if (intern_pool.table == nullptr) return INTERN_NONE;
+
+  uint32_t* slot;
+  return internLookup(hashKey(start, end), start, end - start, slot);
+}
+
+const char* internString(InternId id) {
+  assert(id != INTERN_NONE && id < intern_pool.count && "internString invalid id");
+  return intern_pool.strings + intern_pool.entries[id].offset;
+}
+
+uint32_t internLength(InternId id) {
+  assert(id != INTERN_NONE && id < intern_pool.count && "internLength invalid id");
+  return intern_pool.entries[id].length;
+}
+
+uint32_t internCount() {
+  return intern_pool.count == 0 ? 0 : intern_pool.count - 1;
+}
+
+void internPoolDestroy() {
+  free(intern_pool.entries);
+  free(intern_pool.table);
+  free(intern_pool.strings);
+  intern_pool = {};
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+
+/* Global pool of identifier strings.
+ * Every distinct string gets a dense id starting at 1, so symbol tables can
+ * key on ids and compare integers instead of text. The pool is not thread
+ * safe, interning happens on the thread that hands out tokens.
+ */
+
+typedef uint32_t InternId;
+
+// Never returned for a string
+#define INTERN_NONE 0
+
+InternId internGet(const char* start, const char* end);
+// Returns INTERN_NONE if the string was never interned
+InternId internFind(const char* start, const char* end);
+
+// '\0' terminated, valid until the next internGet
+const char* internString(InternId id);
+uint32_t internLength(InternId id);
+uint32_t internCount();
+
+void internPoolDestroy();
@@ -1,13 +1,17 @@
 #include "lex.h"
-#include "hash_table.h"
+#include "lex_scan.h"
 
+#include <charconv>
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <ctype.h>
 #include <stdio.h>
 #include <type_traits>
 
+#ifndef NDEBUG
 #define LEX_DEBUG
+#endif
 
 #ifdef LEX_DEBUG
 #define LEX_PRINT_TOKENS true
@@ -90,7 +94,7 @@ void printToken(const Token& token) {
   assert(token.end != nullptr);
   assert(token.start < token.end);
 
-  char* current = token.start;
+  const char* current = token.start;
   while (current != token.end) {
     printf("%c", *current++);
   }
@@ -109,8 +113,7 @@ struct KeywordPair {
   TokenType type;
 };
 
-HashTable* keyword_table = nullptr;
-KeywordPair keywords[] = {
+constexpr KeywordPair keywords[] = {
   {"i8", TokenType::I8},
   {"u8", TokenType::U8},
   {"i32", TokenType::I32},
@@ -135,59 +138,167 @@ KeywordPair keywords[] = {
   {"xor", TokenType::XOR},
 };
 
-HashTable* createKeywordsTable() {
-  assert(keyword_table == nullptr);
-  keyword_table = htCreate(64);
+/*
+ * Keywords are recognized with a perfect hash built at compile time. The hash
+ * only looks at the length and the first and last characters, every keyword
+ * fits in 8 bytes so a candidate is confirmed with a single 64 bit compare.
+ */
+
+#define KEYWORD_COUNT (sizeof(keywords) / sizeof(KeywordPair))
+#define KEYWORD_TABLE_BITS 6
+#define KEYWORD_TABLE_SIZE (1 << KEYWORD_TABLE_BITS)
+#define KEYWORD_MAX_LENGTH 8
+
+struct KeywordSlot {
+  uint64_t word;
+  uint32_t length;
+  TokenType type;
+};
+
+struct KeywordTable {
+  uint32_t seed;
+  KeywordSlot slots[KEYWORD_TABLE_SIZE];
+};
+
+constexpr uint32_t keywordHash(uint32_t seed, uint32_t length, char first, char last) {
+  uint32_t key = (uint32_t) (unsigned char) first << 16 | (uint32_t) (unsigned char) last << 8 | length;
+  return (key * seed) >> (32 - KEYWORD_TABLE_BITS);
+}
+
+constexpr uint32_t keywordLength(const char* keyword) {
+  uint32_t length = 0;
+  while (keyword[length] != '\0') length++;
+  return length;
+}
 
-  int size = sizeof(keywords) / sizeof(KeywordPair);
-  for (int i = 0; i < size; i++) {
-    const char* start = keywords[i].keyword;
-    const char* end = start + strlen(start);
-    htSet(keyword_table, start, end, &keywords[i].type);
+// Little endian packing, matches a memcpy of the source bytes
+constexpr uint64_t keywordWord(const char* keyword, uint32_t length) {
+  uint64_t word = 0;
+  for (uint32_t i = 0; i < length; i++) {
+    word |= (uint64_t) (unsigned char) keyword[i] << (8 * i);
   }
-  return keyword_table;
+  return word;
 }
 
-void destroyKeywordsTable() {
-  assert(keyword_table != nullptr);
+constexpr bool keywordTableTrySeed(KeywordTable& table, uint32_t seed) {
+  table = {};
+  table.seed = seed;
+  for (size_t i = 0; i < KEYWORD_COUNT; i++) {
+    uint32_t length = keywordLength(keywords[i].keyword);
+    uint32_t hash = keywordHash(seed, length, keywords[i].keyword[0], keywords[i].keyword[length - 1]);
+    if (table.slots[hash].length != 0) return false;
+
+    table.slots[hash] = {keywordWord(keywords[i].keyword, length), length, keywords[i].type};
+  }
+  return true;
+}
 
-  htDestroy(keyword_table);
-  keyword_table = nullptr;
+constexpr KeywordTable keywordTableCreate() {
+  KeywordTable table = {};
+  for (uint32_t seed = 0x9E3779B1; !keywordTableTrySeed(table, seed); seed += 2) {}
+  return table;
 }
 
+constexpr KeywordTable keyword_table = keywordTableCreate();
+
+static_assert(KEYWORD_COUNT <= KEYWORD_TABLE_SIZE, "keyword table too small");
+
 // end is a sentinel past string end
-Token nextKeyword(char* start, char* end) {
-  // check hashmap for word
-  TokenType* p = (TokenType*) htGet(keyword_table, start, end);
-  if (p != nullptr) {
-    return {*p, start, end};
+Token nextKeyword(const char* start, const char* end) {
+  uint32_t length = end - start;
+  if (length > KEYWORD_MAX_LENGTH) return {TokenType::NONE, start};
+
+  const KeywordSlot& slot = keyword_table.slots[keywordHash(keyword_table.seed, length, *start, *(end - 1))];
+  if (slot.length != length) return {TokenType::NONE, start};
+
+  uint64_t word = 0;
+  memcpy(&word, start, length);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  word = __builtin_bswap64(word);
+#endif
+
+  if (word != slot.word) return {TokenType::NONE, start};
+  return {slot.type, start, end};
+}
+
+/*
+ * Numeric literals are decoded while lexing so later passes never reparse them.
+ * Integers wrap modulo 2^32, the width of the int literal type.
+ */
+
+// Parses 8 ascii digits at once, see "SIMD within a register" digit parsing
+inline uint32_t parseEightDigits(const char* start) {
+  uint64_t chunk;
+  memcpy(&chunk, start, sizeof(chunk));
+  chunk -= 0x3030303030303030;
+  chunk = (chunk * 10) + (chunk >> 8);
+  chunk = (((chunk & 0x000000FF000000FF) * 0x000F424000000064) +
+      (((chunk >> 16) & 0x000000FF000000FF) * 0x0000271000000001)) >> 32;
+  return (uint32_t) chunk;
+}
+
+uint64_t parseDigits(const char* start, const char* end) {
+  uint64_t value = 0;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  while (end - start >= 8) {
+    value = value * 100000000 + parseEightDigits(start);
+    start += 8;
   }
-  /*
-  std::string_view view = {start, (size_t)(end - start)};
-  if (keyword_map.contains(view)) {
-    return {keyword_map[view], start, end};
+#endif
+  while (start != end) {
+    value = value * 10 + (*start++ - '0');
   }
-  */
-  return {TokenType::NONE, start};
+  return value;
 }
 
-Token nextAlnum(char*& input) {
+const float powers_of_ten[] = {
+  1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f,
+};
+
+/*
+ * Clinger's fast path in float: up to 7 digits fit in a float's 24 bit
+ * mantissa and powers of ten up to 1e10 are exact floats, so one float
+ * division of the two is correctly rounded. Anything else goes to from_chars,
+ * which stops at the token's end and ignores the locale.
+ */
+float decodeFloat(const char* start, const char* dot, const char* end) {
+  int integer_digits = dot - start;
+  int fraction_digits = end - dot - 1;
+
+  if (integer_digits + fraction_digits <= 7) {
+    uint32_t mantissa = (uint32_t) parseDigits(start, dot);
+    for (int i = 0; i < fraction_digits; i++) mantissa *= 10;
+    mantissa += (uint32_t) parseDigits(dot + 1, end);
+    return (float) mantissa / powers_of_ten[fraction_digits];
+  }
+
+  float value = 0;
+  std::from_chars(start, end, value);
+  return value;
+}
+
+Token nextAlnum(const char*& input) {
   if (*input == '\0') return {TokenType::END, NULL, NULL};
   if (!isalnum(*input)) return {TokenType::NONE, NULL, NULL};
 
-  char* start = input;
+  const char* start = input;
   if (isdigit(*input)) {
-    while (isdigit(*++input)) {}
-    if (!(*input == '.' && isdigit(*(input + 1)))) 
-      return {TokenType::INT_LITERAL, start, input}; 
+    input = lex_scanner.scanDigits(input + 1);
+    if (!(*input == '.' && isdigit(*(input + 1)))) {
+      Token token = {TokenType::INT_LITERAL, start, input};
+      token.int_value = (uint32_t) parseDigits(start, input);
+      return token;
+    }
 
-    input++;
-    while (isdigit(*++input)) {}
-    return {TokenType::FLOAT_LITERAL, start, input};
+    const char* dot = input;
+    input = lex_scanner.scanDigits(input + 2);
+    Token token = {TokenType::FLOAT_LITERAL, start, input};
+    token.float_value = decodeFloat(start, dot, input);
+    return token;
 
   }
   else {
-    while (isalnum(*++input)){}
+    input = lex_scanner.scanAlnum(input + 1);
 
     Token token = nextKeyword(start, input);
     if (token.type != TokenType::NONE) return token; 
@@ -197,30 +308,27 @@ Token nextAlnum(char*& input) {
 }
 
 // Moves input to the last character of token
-Token nextToken(char*& input) {
-  while (*input == ' ' || *input == '\n' || *input == '\t') {
-    if (*input == '\0') return {TokenType::END, NULL};
-    input++;
-  }
+Token nextToken(const char*& input) {
+  input = lex_scanner.skipWhitespace(input);
 
-  char* start = input;
+  const char* start = input;
   switch(*input) {
-    case '(': return {TokenType::LEFT_PAREN, input, ++input};
-    case ')': return {TokenType::RIGHT_PAREN, input, ++input};
-    case '{': return {TokenType::LEFT_BRACE, input, ++input};
-    case '}': return {TokenType::RIGHT_BRACE, input, ++input};
-    case '[': return {TokenType::LEFT_SQUARE, input, ++input};
-    case ']': return {TokenType::RIGHT_SQUARE, input, ++input};
-    case ':': return {TokenType::COLON, input, ++input};
-    case ';': return {TokenType::SEMI, input, ++input};
-    case ',': return {TokenType::COMMA, input, ++input};
-    case '.': return {TokenType::DOT, input, ++input};
-
-    case '+': return {TokenType::ADD, input, ++input}; 
-    case '-': return {TokenType::SUB, input, ++input};
-    case '*': return {TokenType::MUL, input, ++input};
-    case '/': return {TokenType::DIV, input, ++input};
-    case '%': return {TokenType::MOD, input, ++input};
+    case '(': return {TokenType::LEFT_PAREN, start, ++input};
+    case ')': return {TokenType::RIGHT_PAREN, start, ++input};
+    case '{': return {TokenType::LEFT_BRACE, start, ++input};
+    case '}': return {TokenType::RIGHT_BRACE, start, ++input};
+    case '[': return {TokenType::LEFT_SQUARE, start, ++input};
+    case ']': return {TokenType::RIGHT_SQUARE, start, ++input};
+    case ':': return {TokenType::COLON, start, ++input};
+    case ';': return {TokenType::SEMI, start, ++input};
+    case ',': return {TokenType::COMMA, start, ++input};
+    case '.': return {TokenType::DOT, start, ++input};
+
+    case '+': return {TokenType::ADD, start, ++input}; 
+    case '-': return {TokenType::SUB, start, ++input};
+    case '*': return {TokenType::MUL, start, ++input};
+    case '/': return {TokenType::DIV, start, ++input};
+    case '%': return {TokenType::MOD, start, ++input};
 
     case '=': 
       if (*++input != '=') return {TokenType::SET, start, input};
@@ -238,7 +346,7 @@ Token nextToken(char*& input) {
 
 
     case '"': 
-      while (*++input != '\0' && *input != '"'){}
+      input = lex_scanner.scanString(input + 1);
       return *input == '\0' ?
         Token {TokenType::NONE, NULL, NULL} :
         Token {TokenType::STRING_LITERAL, start, ++input};
@@ -248,33 +356,277 @@ Token nextToken(char*& input) {
   }
 }
 
-Token* lex(char* input, int max_token_count) {
-  Token* tokens = (Token*) malloc(max_token_count * sizeof(Token));
-  createKeywordsTable();
+/*
+ * Streaming lexer
+ *
+ * Tokens are produced on demand into fixed size chunks. Chunks the consumer
+ * has moved past are recycled, so only the chunks spanning the consumers
+ * lookahead are live. Input can be a whole buffer, pieces pushed with
+ * lexerFeed or pieces pulled from a LexerRead callback. Pieces are copied
+ * into segments owned by the lexer and tokens point into these segments. A
+ * segment is freed by lexerRelease once every token lexed from it was handed
+ * out, so the input kept only spans the tokens still in use.
+ */
+
+#define LEXER_READ_SIZE 65536
+
+struct LexerSegment {
+  LexerSegment* next;
+  // Tokens lexed before the next segment replaced this one, UINT64_MAX until then
+  uint64_t end_token;
+};
+
+Lexer* lexerAllocate() {
+  Lexer* lexer = (Lexer*) calloc(1, sizeof(Lexer));
+  assert(lexer != nullptr && "lexerCreate out of memory");
+  return lexer;
+}
+
+Lexer* lexerCreate(const char* input) {
+  Lexer* lexer = lexerAllocate();
+  lexer->input = input;
+  lexer->finished = true;
+  return lexer;
+}
+
+Lexer* lexerCreate(LexerRead read, void* user) {
+  Lexer* lexer = lexerAllocate();
+  lexer->read = read;
+  lexer->read_user = user;
+  return lexer;
+}
+
+Lexer* lexerCreate() {
+  return lexerAllocate();
+}
+
+void lexerDestroy(Lexer* lexer) {
+  TokenChunk* lists[] = {lexer->head, lexer->free_chunks};
+  for (TokenChunk* chunk : lists) {
+    while (chunk != nullptr) {
+      TokenChunk* next = chunk->next;
+      free(chunk);
+      chunk = next;
+    }
+  }
+
+  LexerSegment* segment = lexer->segments;
+  while (segment != nullptr) {
+    LexerSegment* next = segment->next;
+    free(segment);
+    segment = next;
+  }
+
+  free(lexer);
+}
+
+void lexerFeed(Lexer* lexer, const char* data, int length) {
+  assert(!lexer->finished && "lexerFeed after lexerFinish");
+
+  // Input fed earlier that is not lexed yet, starting with a token that may continue in data
+  const char* tail = lexer->pending != nullptr ? lexer->pending : lexer->input;
+  int tail_length = tail != nullptr ? lexer->segment_end - tail : 0;
+  LexerSegment* segment = (LexerSegment*) malloc(sizeof(LexerSegment) + tail_length + length + 1);
+  assert(segment != nullptr && "lexerFeed out of memory");
+
+  char* text = (char*) (segment + 1);
+  if (tail_length > 0) memcpy(text, tail, tail_length);
+  memcpy(text + tail_length, data, length);
+  text[tail_length + length] = '\0';
+
+  // Tokens lexed from now on point into the new segment, the unlexed tail was copied
+  segment->next = nullptr;
+  segment->end_token = UINT64_MAX;
+  if (lexer->last_segment != nullptr) {
+    lexer->last_segment->end_token = lexer->lexed;
+    lexer->last_segment->next = segment;
+  }
+  else {
+    lexer->segments = segment;
+  }
+  lexer->last_segment = segment;
+
+  lexer->input = text;
+  lexer->segment_end = text + tail_length + length;
+  lexer->pending = nullptr;
+}
+
+void lexerFinish(Lexer* lexer) {
+  static const char empty[1] = {'\0'};
+
+  lexer->finished = true;
+  if (lexer->pending != nullptr) {
+    lexer->input = lexer->pending;
+    lexer->pending = nullptr;
+  }
+  else if (lexer->input == nullptr) {
+    lexer->input = empty;
+  }
+}
+
+// Returns false if there is no more input to read
+bool lexerReadMore(Lexer* lexer) {
+  if (lexer->read == nullptr || lexer->finished) return false;
+
+  char buffer[LEXER_READ_SIZE];
+  int length = lexer->read(lexer->read_user, buffer, LEXER_READ_SIZE);
+  if (length > 0) {
+    lexerFeed(lexer, buffer, length);
+  }
+  else {
+    lexerFinish(lexer);
+  }
+  return true;
+}
+
+TokenChunk* lexerChunk(Lexer* lexer) {
+  if (lexer->tail != nullptr && lexer->tail->count < TOKEN_CHUNK_SIZE) return lexer->tail;
+
+  TokenChunk* chunk = lexer->free_chunks;
+  if (chunk != nullptr) {
+    lexer->free_chunks = chunk->next;
+  }
+  else {
+    chunk = (TokenChunk*) malloc(sizeof(TokenChunk));
+    assert(chunk != nullptr && "lexer chunk out of memory");
+    lexer->chunk_count++;
+  }
+
+  chunk->next = nullptr;
+  chunk->count = 0;
+
+  if (lexer->tail != nullptr) lexer->tail->next = chunk;
+  else lexer->head = chunk;
+  lexer->tail = chunk;
+
+  return chunk;
+}
+
+// Lexes tokens into the tail chunk until it is full, END is reached or more input is needed.
+// Returns false if no token was added.
+bool lexerFill(Lexer* lexer) {
+  int added = 0;
+
+  while (!lexer->done && !lexer->failed) {
+    if (lexer->input == nullptr && !lexerReadMore(lexer)) break;
+    if (lexer->input == nullptr) continue;
+
+    TokenChunk* chunk = lexerChunk(lexer);
+    if (added > 0 && chunk->count == 0) break;
+
+    const char* start = lex_scanner.skipWhitespace(lexer->input);
+    const char* input = start;
+    Token token = nextToken(input);
+
+    // A token that touches the end of an unfinished piece might continue in the next one
+    if (!lexer->finished) {
+      bool at_end = *start == '\0' || *input == '\0' || *(input + 1) == '\0';
+      bool open_string = token.type == TokenType::NONE && *start == '"';
+      if (at_end || open_string) {
+        lexer->pending = *start == '\0' ? nullptr : start;
+        lexer->input = nullptr;
+        continue;
+      }
+    }
+
+    if (token.type == TokenType::NONE) {
+      lexer->failed = true;
+      break;
+    }
 
+    // nextToken does not intern so it can run on any thread
+    if (token.type == TokenType::IDENTIFIER) token.id = internGet(token.start, token.end);
+
+    lexer->input = input;
+    chunk->tokens[chunk->count++] = token;
+    lexer->lexed++;
+    added++;
+
+    if (token.type == TokenType::END) lexer->done = true;
+  }
+
+  return added > 0;
+}
+
+Token* lexerPeek(Lexer* lexer, int offset) {
+  do {
+    TokenChunk* chunk = lexer->head;
+    int index = lexer->head_index + offset;
+
+    while (chunk != nullptr && index >= chunk->count && chunk->count == TOKEN_CHUNK_SIZE) {
+      index -= chunk->count;
+      chunk = chunk->next;
+    }
+
+    if (chunk != nullptr && index < chunk->count) return &chunk->tokens[index];
+  } while (lexerFill(lexer));
+
+  return nullptr;
+}
+
+Token* lexerNext(Lexer* lexer) {
+  // The previous token is handed out before its chunk is recycled
+  if (lexer->head_index == TOKEN_CHUNK_SIZE) {
+    TokenChunk* chunk = lexer->head;
+    lexer->head = chunk->next;
+    lexer->head_index = 0;
+    if (lexer->head == nullptr) lexer->tail = nullptr;
+
+    chunk->next = lexer->free_chunks;
+    lexer->free_chunks = chunk;
+  }
+
+  Token* token = lexerPeek(lexer, 0);
+  if (token != nullptr) {
+    lexer->head_index++;
+    lexer->consumed++;
+  }
+  return token;
+}
+
+void lexerRelease(Lexer* lexer) {
+  while (lexer->segments != nullptr && lexer->segments->end_token <= lexer->consumed) {
+    LexerSegment* segment = lexer->segments;
+    lexer->segments = segment->next;
+    free(segment);
+  }
+  if (lexer->segments == nullptr) lexer->last_segment = nullptr;
+}
+
+Token* lex(const char* input, int max_token_count) {
+  Lexer* lexer = lexerCreate(input);
+
+  int capacity = max_token_count > 0 ? max_token_count : TOKEN_CHUNK_SIZE;
   int i = 0;
-  Token token = nextToken(input);
-  while (token.type != TokenType::NONE && token.type != TokenType::END) {
-    tokens[i] = token;
-    token = nextToken(input);
-    i++;
+  Token* tokens = (Token*) malloc(capacity * sizeof(Token));
+
+  Token* token = lexerNext(lexer);
+  while (token != nullptr) {
+    if (i == capacity) {
+      capacity *= 2;
+      tokens = (Token*) realloc(tokens, capacity * sizeof(Token));
+      assert(tokens != nullptr && "lex out of memory");
+    }
+
+    tokens[i++] = *token;
+    if (token->type == TokenType::END) break;
+    token = lexerNext(lexer);
   }
 
-  if (token.type == TokenType::NONE) {
+  bool failed = lexer->failed;
+  lexerDestroy(lexer);
+
+  if (failed) {
     if (LEX_PRINT_TOKENS) {
       for(int j = 0; j < i; j++) {
         printToken(tokens[j]);
       }
     }
 
-    destroyKeywordsTable();
     free(tokens);
     return nullptr;
   }
 
-  tokens[i] = token;
-  destroyKeywordsTable();
-
   if (LEX_PRINT_TOKENS) {
     printTokens(tokens);
   }
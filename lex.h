@@ -1,8 +1,12 @@
 #pragma once
 
+#include "intern.h"
+
+#include <cstdint>
+
 extern const char * TokenTypes[];
 
-enum class TokenType {
+enum class TokenType : uint8_t {
   NONE,
   END,
 
@@ -65,15 +69,89 @@ enum class TokenType {
   
 };
 
+// The value shares the first 8 bytes with the type, a token is 24 bytes
 struct Token {
   TokenType type;
-  char* start;
-  char* end;
+  // Decoded by the lexer for INT_LITERAL and FLOAT_LITERAL, interned for IDENTIFIER
+  union {
+    uint32_t int_value;
+    float float_value;
+    InternId id;
+  };
+  const char* start;
+  const char* end;
+
+  Token() = default;
+  Token(TokenType type, const char* start = nullptr, const char* end = nullptr)
+    : type(type), int_value(0), start(start), end(end) {}
 };
 
+static_assert(sizeof(Token) == 24, "Token should stay 24 bytes");
+
 void printToken(const Token& token);
 
-Token nextToken(char*& input);
+Token nextToken(const char*& input);
 
-Token* lex(char* input, int max_token_count);
+// max_token_count is only the initial capacity, the token array grows as needed
+Token* lex(const char* input, int max_token_count = 0);
 void lex_destroy(Token* tokens);
+
+#define TOKEN_CHUNK_SIZE 1024
+
+struct TokenChunk {
+  TokenChunk* next;
+  int count;
+  Token tokens[TOKEN_CHUNK_SIZE];
+};
+
+struct LexerSegment;
+
+// Fills buffer with up to capacity bytes of input. Returns 0 at the end of input.
+typedef int (*LexerRead)(void* user, char* buffer, int capacity);
+
+struct Lexer {
+  // Chunks from the consumers position to the last lexed token
+  TokenChunk* head;
+  TokenChunk* tail;
+  TokenChunk* free_chunks;
+  int head_index;
+  int chunk_count;
+
+  const char* input;
+  const char* segment_end;
+  // Start of a token that may continue in the next piece of input
+  const char* pending;
+  // Oldest first, the last one holds input
+  LexerSegment* segments;
+  LexerSegment* last_segment;
+  // Tokens lexed and tokens handed out by lexerNext so far
+  uint64_t lexed;
+  uint64_t consumed;
+
+  LexerRead read;
+  void* read_user;
+
+  bool finished;
+  bool done;
+  bool failed;
+};
+
+// Lexes a whole '\0' terminated buffer without copying it
+Lexer* lexerCreate(const char* input);
+// Pulls pieces of input from read whenever more tokens are needed
+Lexer* lexerCreate(LexerRead read, void* user);
+// Input is pushed with lexerFeed and ended with lexerFinish
+Lexer* lexerCreate();
+void lexerDestroy(Lexer* lexer);
+
+void lexerFeed(Lexer* lexer, const char* data, int length);
+void lexerFinish(Lexer* lexer);
+
+// Both return nullptr if the token is not available yet, or lexing failed.
+// Tokens stay valid until the consumer has moved past the chunk holding them.
+Token* lexerPeek(Lexer* lexer, int offset = 0);
+Token* lexerNext(Lexer* lexer);
+
+// Frees the pieces of input that only tokens lexerNext handed out point into.
+// The text of those tokens is invalid afterwards.
+void lexerRelease(Lexer* lexer);
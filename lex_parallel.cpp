@@ -0,0 +1,196 @@
+#include "lex_parallel.h"
+#include "lex.h"
+#include "lex_scan.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#ifdef LEX_PARALLEL_DEBUG
+#define LEX_PARALLEL_VERIFY
+#include <cstdio>
+#define DEBUG_PRINT(...) fprintf(stderr, __VA_ARGS__)
+#else
+#define DEBUG_PRINT(...)
+#endif
+
+// Smaller buffers are not worth the thread start up
+#define LEX_PARALLEL_MIN_SEGMENT 65536
+
+struct LexSegment {
+  const char* start;
+  const char* end;
+  size_t quote_count;
+
+  TokenChunk* head;
+  TokenChunk* tail;
+  size_t token_count;
+  bool failed;
+};
+
+void segmentPush(LexSegment* segment, Token token) {
+  if (segment->tail == nullptr || segment->tail->count == TOKEN_CHUNK_SIZE) {
+    TokenChunk* chunk = (TokenChunk*) malloc(sizeof(TokenChunk));
+    assert(chunk != nullptr && "lexParallel out of memory");
+    chunk->next = nullptr;
+    chunk->count = 0;
+
+    if (segment->tail != nullptr) segment->tail->next = chunk;
+    else segment->head = chunk;
+    segment->tail = chunk;
+  }
+
+  segment->tail->tokens[segment->tail->count++] = token;
+  segment->token_count++;
+}
+
+void segmentDestroy(LexSegment* segment) {
+  TokenChunk* chunk = segment->head;
+  while (chunk != nullptr) {
+    TokenChunk* next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+}
+
+void segmentCountQuotes(LexSegment* segment) {
+  segment->quote_count = std::count(segment->start, segment->end, '"');
+}
+
+// Tokens starting at or after end belong to the next segment
+void segmentLex(LexSegment* segment) {
+  const char* input = segment->start;
+
+  while (true) {
+    input = lex_scanner.skipWhitespace(input);
+    if (input >= segment->end) break;
+
+    Token token = nextToken(input);
+    if (token.type == TokenType::END) break;
+    if (token.type == TokenType::NONE) {
+      segment->failed = true;
+      break;
+    }
+
+    segmentPush(segment, token);
+  }
+}
+
+/*
+ * Strings have no escapes and '"' appears nowhere else, so a position is
+ * inside a string literal exactly when an odd number of quotes precede it.
+ * The boundary is moved forward to just after the first newline outside of a
+ * string. Newlines are whitespace, so no token can cross a boundary.
+ */
+const char* findBoundary(const char* start, const char* end, bool in_string) {
+  for (const char* p = start; p < end; p++) {
+    if (*p == '"') in_string = !in_string;
+    else if (*p == '\n' && !in_string) return p + 1;
+  }
+  return end;
+}
+
+template <typename F>
+void runSegments(std::vector<LexSegment>& segments, F f) {
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < segments.size(); i++) {
+    threads.emplace_back(f, &segments[i]);
+  }
+  f(&segments[0]);
+
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+}
+
+Token* lexParallel(const char* input, int thread_count) {
+  if (thread_count <= 0) thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+  size_t size = strlen(input);
+  size_t segment_count = std::min<size_t>(thread_count, size / LEX_PARALLEL_MIN_SEGMENT);
+  if (segment_count <= 1) return lex(input);
+
+  const char* end = input + size;
+  std::vector<LexSegment> segments(segment_count);
+
+  // Quote parity prepass over even splits
+  for (size_t i = 0; i < segment_count; i++) {
+    segments[i] = {};
+    segments[i].start = input + size * i / segment_count;
+    segments[i].end = input + size * (i + 1) / segment_count;
+  }
+  runSegments(segments, segmentCountQuotes);
+
+  // An unterminated string fails lex(), no need to split
+  size_t quote_count = 0;
+  for (LexSegment& segment : segments) quote_count += segment.quote_count;
+  if (quote_count % 2 != 0) return nullptr;
+
+  quote_count = 0;
+  for (size_t i = 1; i < segment_count; i++) {
+    quote_count += segments[i - 1].quote_count;
+    segments[i].start = findBoundary(segments[i].start, end, quote_count % 2 != 0);
+  }
+  for (size_t i = 0; i + 1 < segment_count; i++) {
+    segments[i].end = segments[i + 1].start;
+  }
+  segments[segment_count - 1].end = end;
+
+  runSegments(segments, segmentLex);
+
+  bool failed = false;
+  bool overlap = false;
+  size_t token_count = 1;
+  const Token* last = nullptr;
+  for (LexSegment& segment : segments) {
+    failed |= segment.failed;
+    token_count += segment.token_count;
+
+    // Only a token that looks ahead over a newline can overlap the next segment
+    if (last != nullptr && segment.head != nullptr && last->end > segment.head->tokens[0].start) overlap = true;
+    if (segment.tail != nullptr) last = &segment.tail->tokens[segment.tail->count - 1];
+  }
+
+  Token* tokens = nullptr;
+  if (!failed && !overlap) {
+    tokens = (Token*) malloc(token_count * sizeof(Token));
+    assert(tokens != nullptr && "lexParallel out of memory");
+
+    Token* current = tokens;
+    for (LexSegment& segment : segments) {
+      for (TokenChunk* chunk = segment.head; chunk != nullptr; chunk = chunk->next) {
+        // The intern pool is not thread safe, identifiers are interned while stitching
+        for (int i = 0; i < chunk->count; i++) {
+          *current = chunk->tokens[i];
+          if (current->type == TokenType::IDENTIFIER) current->id = internGet(current->start, current->end);
+          current++;
+        }
+      }
+    }
+    *current = {TokenType::END, nullptr, nullptr};
+  }
+
+  for (LexSegment& segment : segments) segmentDestroy(&segment);
+
+  DEBUG_PRINT("lexParallel: segments = %zu tokens = %zu failed = %i overlap = %i\n",
+      segment_count, token_count, failed, overlap);
+
+  if (overlap) return lex(input);
+  if (failed) return nullptr;
+
+#ifdef LEX_PARALLEL_VERIFY
+  Token* serial = lex(input);
+  assert(serial != nullptr && "lexParallel succeeded where lex failed");
+  for (size_t i = 0; i < token_count; i++) {
+    assert(tokens[i].type == serial[i].type && "lexParallel token type differs from lex");
+    assert(tokens[i].start == serial[i].start && tokens[i].end == serial[i].end
+        && "lexParallel token range differs from lex");
+  }
+  lex_destroy(serial);
+#endif
+
+  return tokens;
+}
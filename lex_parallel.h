@@ -0,0 +1,12 @@
+#pragma once
+
+#include "lex.h"
+
+/* Parallel lexing of large buffers.
+ * The buffer is split into segments at newlines outside of string literals,
+ * each segment is lexed on its own thread and the results are stitched into
+ * one array identical to the output of lex().
+ */
+
+// thread_count <= 0 uses one thread per hardware thread
+Token* lexParallel(const char* input, int thread_count = 0);
@@ -0,0 +1,194 @@
+#include "lex_scan.h"
+
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define LEX_SCAN_X86
+#include <immintrin.h>
+#endif
+
+/*
+ * The vector scanners only ever load aligned blocks. An aligned block that
+ * contains at least one byte of the buffer can not cross a page boundary, so
+ * reading the bytes around the '\0' terminator never faults. Bytes before the
+ * scan position are shifted out of the match mask and bytes past the first
+ * match are ignored. The over-read is deliberate, so these scanners opt out
+ * of AddressSanitizer, which would report it against the malloc'd buffer.
+ */
+
+const char* skipWhitespaceScalar(const char* input) {
+  while (*input == ' ' || *input == '\n' || *input == '\t') input++;
+  return input;
+}
+
+inline bool isAlnumChar(char c) {
+  return (c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'z');
+}
+
+const char* scanAlnumScalar(const char* input) {
+  while (isAlnumChar(*input)) input++;
+  return input;
+}
+
+const char* scanDigitsScalar(const char* input) {
+  while (*input >= '0' && *input <= '9') input++;
+  return input;
+}
+
+const char* scanStringScalar(const char* input) {
+  while (*input != '\0' && *input != '"') input++;
+  return input;
+}
+
+#ifdef LEX_SCAN_X86
+
+// Byte range check with signed compares. Bytes >= 0x80 are negative and never match.
+#define SSE2_IN_RANGE(v, lo, hi) \
+  _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8((lo) - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8((hi) + 1)))
+
+#define AVX2_IN_RANGE(v, lo, hi) \
+  _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8((lo) - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8((hi) + 1), v))
+
+inline __m128i sse2Whitespace(__m128i v) {
+  __m128i space = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+  __m128i newline = _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'));
+  __m128i tab = _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'));
+  return _mm_or_si128(space, _mm_or_si128(newline, tab));
+}
+
+inline __m128i sse2Alnum(__m128i v) {
+  __m128i digit = SSE2_IN_RANGE(v, '0', '9');
+  __m128i alpha = SSE2_IN_RANGE(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z');
+  return _mm_or_si128(digit, alpha);
+}
+
+inline __m128i sse2Digits(__m128i v) {
+  return SSE2_IN_RANGE(v, '0', '9');
+}
+
+inline __m128i sse2StringEnd(__m128i v) {
+  __m128i quote = _mm_cmpeq_epi8(v, _mm_set1_epi8('"'));
+  __m128i zero = _mm_cmpeq_epi8(v, _mm_setzero_si128());
+  return _mm_or_si128(quote, zero);
+}
+
+// stop_on_match selects between scanning to the first match or the first non match
+template <__m128i (*classify)(__m128i), bool stop_on_match>
+__attribute__((no_sanitize_address))
+const char* sse2Scan(const char* input) {
+  uintptr_t offset = (uintptr_t) input & 15;
+  const __m128i* block = (const __m128i*) (input - offset);
+
+  uint32_t mask = _mm_movemask_epi8(classify(_mm_load_si128(block)));
+  if (!stop_on_match) mask = ~mask & 0xFFFF;
+  mask >>= offset;
+  if (mask != 0) return input + __builtin_ctz(mask);
+
+  while (true) {
+    block++;
+    mask = _mm_movemask_epi8(classify(_mm_load_si128(block)));
+    if (!stop_on_match) mask = ~mask & 0xFFFF;
+    if (mask != 0) return (const char*) block + __builtin_ctz(mask);
+  }
+}
+
+__attribute__((target("avx2")))
+inline __m256i avx2Whitespace(__m256i v) {
+  __m256i space = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+  __m256i newline = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'));
+  __m256i tab = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'));
+  return _mm256_or_si256(space, _mm256_or_si256(newline, tab));
+}
+
+__attribute__((target("avx2")))
+inline __m256i avx2Alnum(__m256i v) {
+  __m256i digit = AVX2_IN_RANGE(v, '0', '9');
+  __m256i alpha = AVX2_IN_RANGE(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), 'a', 'z');
+  return _mm256_or_si256(digit, alpha);
+}
+
+__attribute__((target("avx2")))
+inline __m256i avx2Digits(__m256i v) {
+  return AVX2_IN_RANGE(v, '0', '9');
+}
+
+__attribute__((target("avx2")))
+inline __m256i avx2StringEnd(__m256i v) {
+  __m256i quote = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'));
+  __m256i zero = _mm256_cmpeq_epi8(v, _mm256_setzero_si256());
+  return _mm256_or_si256(quote, zero);
+}
+
+template <__m256i (*classify)(__m256i), bool stop_on_match>
+__attribute__((target("avx2"), no_sanitize_address))
+const char* avx2Scan(const char* input) {
+  uintptr_t offset = (uintptr_t) input & 31;
+  const __m256i* block = (const __m256i*) (input - offset);
+
+  uint64_t mask = (uint32_t) _mm256_movemask_epi8(classify(_mm256_load_si256(block)));
+  if (!stop_on_match) mask = ~mask & 0xFFFFFFFF;
+  mask >>= offset;
+  if (mask != 0) return input + __builtin_ctzll(mask);
+
+  while (true) {
+    block++;
+    mask = (uint32_t) _mm256_movemask_epi8(classify(_mm256_load_si256(block)));
+    if (!stop_on_match) mask = ~mask & 0xFFFFFFFF;
+    if (mask != 0) return (const char*) block + __builtin_ctzll(mask);
+  }
+}
+
+#endif
+
+LexScanner lexScanner(LexScanMode mode) {
+#ifdef LEX_SCAN_X86
+  __builtin_cpu_init();
+
+  if (mode == LexScanMode::AUTO) {
+    mode = __builtin_cpu_supports("avx2") ? LexScanMode::AVX2 : LexScanMode::SSE2;
+  }
+
+  if (mode == LexScanMode::AVX2 && !__builtin_cpu_supports("avx2")) {
+    mode = LexScanMode::SCALAR;
+  }
+
+  switch (mode) {
+    case LexScanMode::SSE2:
+      return {
+        LexScanMode::SSE2,
+        sse2Scan<sse2Whitespace, false>,
+        sse2Scan<sse2Alnum, false>,
+        sse2Scan<sse2Digits, false>,
+        sse2Scan<sse2StringEnd, true>,
+      };
+
+    case LexScanMode::AVX2:
+      return {
+        LexScanMode::AVX2,
+        avx2Scan<avx2Whitespace, false>,
+        avx2Scan<avx2Alnum, false>,
+        avx2Scan<avx2Digits, false>,
+        avx2Scan<avx2StringEnd, true>,
+      };
+
+    default:
+      break;
+  }
+#endif
+
+  return {
+    LexScanMode::SCALAR,
+    skipWhitespaceScalar,
+    scanAlnumScalar,
+    scanDigitsScalar,
+    scanStringScalar,
+  };
+}
+
+// AUTO is resolved once during static initialization, before any lexer thread starts
+LexScanner lex_scanner = lexScanner(LexScanMode::AUTO);
+
+LexScanMode lexSetScanMode(LexScanMode mode) {
+  lex_scanner = lexScanner(mode);
+  return lex_scanner.mode;
+}
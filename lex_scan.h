@@ -0,0 +1,34 @@
+#pragma once
+
+/* Character class scanners used by the lexer.
+ * Each scanner takes a pointer into a '\0' terminated buffer and returns a
+ * pointer to the first character that is not part of the run. '\0' is never
+ * part of a run so scanners always stop at the end of the buffer.
+ */
+
+enum class LexScanMode {
+  AUTO,
+  SCALAR,
+  SSE2,
+  AVX2,
+};
+
+struct LexScanner {
+  LexScanMode mode;
+  // ' ', '\n' and '\t'
+  const char* (*skipWhitespace)(const char* input);
+  // [0-9A-Za-z]
+  const char* (*scanAlnum)(const char* input);
+  // [0-9]
+  const char* (*scanDigits)(const char* input);
+  // first '"' or '\0'
+  const char* (*scanString)(const char* input);
+};
+
+extern LexScanner lex_scanner;
+
+/* AUTO picks the widest mode the cpu supports. Unsupported modes fall back to SCALAR.
+ * lex_scanner starts out as AUTO resolved. Changing it while another thread is
+ * lexing is a data race.
+ */
+LexScanMode lexSetScanMode(LexScanMode mode);
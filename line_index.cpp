@@ -0,0 +1,103 @@
+#include "line_index.h"
+
+#include <cassert>
+#include <cstdlib>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define LINE_INDEX_SSE2
+#include <emmintrin.h>
+#endif
+
+LineIndex* lineIndexCreate(const char* source, size_t size) {
+  LineIndex* index = (LineIndex*) calloc(1, sizeof(LineIndex));
+  assert(index != nullptr && "lineIndexCreate out of memory");
+
+  index->source = source;
+  index->size = size;
+  return index;
+}
+
+void lineIndexDestroy(LineIndex* index) {
+  free(index->line_starts);
+  free(index);
+}
+
+// Calls f with the offset of every '\n'. Returns the number of newlines.
+template <typename F>
+uint32_t forEachNewline(const char* source, size_t size, F f) {
+  uint32_t count = 0;
+  size_t i = 0;
+
+#ifdef LINE_INDEX_SSE2
+  const __m128i newline = _mm_set1_epi8('\n');
+  for (; i + 16 <= size; i += 16) {
+    __m128i block = _mm_loadu_si128((const __m128i*) (source + i));
+    uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, newline));
+    while (mask != 0) {
+      f(i + __builtin_ctz(mask));
+      count++;
+      mask &= mask - 1;
+    }
+  }
+#endif
+
+  for (; i < size; i++) {
+    if (source[i] == '\n') {
+      f(i);
+      count++;
+    }
+  }
+  return count;
+}
+
+uint32_t countNewlines(const char* source, size_t size) {
+  uint32_t count = 0;
+  size_t i = 0;
+
+#ifdef LINE_INDEX_SSE2
+  const __m128i newline = _mm_set1_epi8('\n');
+  for (; i + 16 <= size; i += 16) {
+    __m128i block = _mm_loadu_si128((const __m128i*) (source + i));
+    count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(block, newline)));
+  }
+#endif
+
+  for (; i < size; i++) {
+    count += source[i] == '\n';
+  }
+  return count;
+}
+
+void lineIndexBuild(LineIndex* index) {
+  index->line_count = countNewlines(index->source, index->size) + 1;
+  index->line_starts = (uint32_t*) malloc(index->line_count * sizeof(uint32_t));
+  assert(index->line_starts != nullptr && "lineIndexBuild out of memory");
+
+  uint32_t* line_start = index->line_starts;
+  *line_start++ = 0;
+  forEachNewline(index->source, index->size, [&](size_t offset) {
+    *line_start++ = offset + 1;
+  });
+}
+
+SourcePosition lineIndexLookup(LineIndex* index, const char* position) {
+  if (index->line_starts == nullptr) lineIndexBuild(index);
+
+  assert(position >= index->source && position <= index->source + index->size);
+  uint32_t offset = position - index->source;
+
+  // Last line starting at or before offset
+  uint32_t low = 0;
+  uint32_t high = index->line_count;
+  while (high - low > 1) {
+    uint32_t middle = (low + high) / 2;
+    if (index->line_starts[middle] <= offset) low = middle;
+    else high = middle;
+  }
+
+  return {low + 1, offset - index->line_starts[low] + 1};
+}
+
+SourcePosition lineIndexLookup(LineIndex* index, const Token* token) {
+  return lineIndexLookup(index, token->start);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "lex.h"
+
+#include <cstddef>
+#include <cstdint>
+
+/* Maps source positions to line and column.
+ * Creating an index is free, the line table is only built by the first lookup.
+ */
+
+struct SourcePosition {
+  // Both start at 1
+  uint32_t line;
+  uint32_t column;
+};
+
+struct LineIndex {
+  const char* source;
+  size_t size;
+
+  // Offset of the first character of every line, nullptr until first lookup
+  uint32_t* line_starts;
+  uint32_t line_count;
+};
+
+LineIndex* lineIndexCreate(const char* source, size_t size);
+void lineIndexDestroy(LineIndex* index);
+
+SourcePosition lineIndexLookup(LineIndex* index, const char* position);
+SourcePosition lineIndexLookup(LineIndex* index, const Token* token);
@@ -1,12 +1,22 @@
 #include "parser.h"
 #include "lex.h"
 #include "ast_types.h"
+#include "scratch_list.h"
 #include "stack.h"
 
+#include <algorithm>
 #include <cassert>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
 
+#ifndef NDEBUG
 #define PARSER_DEBUG_TOKENS
+#endif
 
 #ifdef PARSER_DEBUG
 #define PARSER_DEBUG_TOKENS
@@ -23,33 +33,431 @@
 #define DEBUG(s, t, t2)
 #endif
 
-#define MAX_BUFFER_COUNT 64
+// Looser than every binary operator
+#define BINARY_PRECIDENCE_NONE INT_MAX
+
+// Per thread so top level items can be parsed concurrently, see parseParallel
+thread_local Stack* stack;
+
+/*
+ * Packrat memoization, off by default. Every rule result is stored by (rule,
+ * token index) so a rule runs at most once per position. Rolling back would
+ * pop memoized nodes, so the stack is never reset below the newest memoized
+ * node while memoization is on. Failed attempts stay on the stack as garbage.
+ */
+
+enum class ParserRule {
+  IDENTIFIER,
+  TYPE,
+  DECLARATION,
+  ASSIGNMENT,
+  STATEMENT,
+  BLOCK_TAG,
+  BLOCK,
+  LITERAL,
+  CALL,
+  UNARY,
+  BINARY,
+  EXPR,
+  EXPR_OPERAND,
+  FUNCTION_PARAM,
+  FUNCTION,
+  STRUCT,
+  ENUM,
+  // Profiled but never memoized
+  PRIMARY_TAG,
+  COUNT,
+};
+
+enum class MemoState : uint8_t {
+  UNKNOWN,
+  SUCCESS,
+  FAILURE,
+};
+
+struct MemoEntry {
+  // Entries from an older generation are UNKNOWN
+  uint32_t generation;
+  MemoState state;
+  void* node;
+  Token* end;
+};
+
+struct ParserMemo {
+  bool enabled;
+  Token* base;
+  // Rules starting past this are not memoized
+  Token* end;
+  MemoEntry* entries;
+  size_t capacity;
+  uint32_t generation;
+  // The stack is not reset below this
+  void* floor;
+  ParserMemoStats stats;
+};
+
+thread_local ParserMemo parser_memo;
+
+void parserSetMemoize(bool enabled) {
+  parser_memo.enabled = enabled;
+
+  // The table is kept between parses while enabled
+  if (!enabled) {
+    free(parser_memo.entries);
+    parser_memo.entries = nullptr;
+    parser_memo.capacity = 0;
+  }
+}
 
+ParserMemoStats parserMemoStats() {
+  return parser_memo.stats;
+}
 
-Stack* stack;
-Stack* buffer_pool;
+void printParserMemoStats() {
+  ParserMemoStats stats = parser_memo.stats;
+  double hit_rate = stats.lookups == 0 ? 0.0 : 100.0 * stats.hits / stats.lookups;
+  fprintf(stderr, "Parser memo: lookups = %lu hits = %lu (%.1f%%)\n",
+      (unsigned long) stats.lookups, (unsigned long) stats.hits, hit_rate);
+}
 
-void* resetStacks(void* stack_reset, void* buffer_pool_reset = nullptr) {
-  stackPop(stack, stack_reset);
-  stackPop(buffer_pool, buffer_pool_reset);
-  return nullptr;
+// Starts a new generation for the tokens from base up to and including end
+void memoReset(Token* base, Token* end) {
+  if (!parser_memo.enabled) return;
+
+  size_t capacity = (end - base + 1) * (size_t) ParserRule::COUNT;
+
+  if (capacity > parser_memo.capacity) {
+    free(parser_memo.entries);
+    parser_memo.entries = (MemoEntry*) calloc(capacity, sizeof(MemoEntry));
+    assert(parser_memo.entries != nullptr && "memoReset out of memory");
+    parser_memo.capacity = capacity;
+    parser_memo.generation = 0;
+  }
+
+  parser_memo.generation++;
+  parser_memo.base = base;
+  parser_memo.end = end;
+}
+
+// Starts a new generation for the END terminated tokens starting at base
+void memoReset(Token* base) {
+  if (!parser_memo.enabled) return;
+
+  Token* end = base;
+  while (end->type != TokenType::END) end++;
+  memoReset(base, end);
+}
+
+/*
+ * Per rule profile, compiled in with PARSER_PROFILE. Attempts and successes are
+ * counted around every rule, memo hits included. Rollbacks and the bytes they
+ * pop go to the innermost rule being parsed. Counters are per thread, workers
+ * of parseParallel are added to the calling thread.
+ */
+#ifdef PARSER_PROFILE
+
+struct RuleProfile {
+  uint64_t attempts;
+  uint64_t successes;
+  uint64_t rollbacks;
+  uint64_t discarded_bytes;
+};
+
+struct ParserProfile {
+  RuleProfile rules[(size_t) ParserRule::COUNT];
+  // COUNT outside of any rule
+  ParserRule current;
+};
+
+const char* parser_rule_names[] = {
+  "identifier",
+  "type",
+  "declaration",
+  "assignment",
+  "statement",
+  "block_tag",
+  "block",
+  "literal",
+  "call",
+  "unary",
+  "binary",
+  "expr",
+  "expr_operand",
+  "function_param",
+  "function",
+  "struct_",
+  "enum_",
+  "primary_tag",
+};
+
+static_assert(sizeof(parser_rule_names) / sizeof(const char*) == (size_t) ParserRule::COUNT,
+    "parser_rule_names must name every rule");
+
+thread_local ParserProfile parser_profile = {{}, ParserRule::COUNT};
+
+ParserRule profileEnter(ParserRule rule) {
+  ParserRule outer = parser_profile.current;
+  parser_profile.rules[(size_t) rule].attempts++;
+  parser_profile.current = rule;
+  return outer;
+}
+
+void profileExit(ParserRule rule, ParserRule outer, bool success) {
+  if (success) parser_profile.rules[(size_t) rule].successes++;
+  parser_profile.current = outer;
+}
+
+void profileRollback(size_t bytes) {
+  if (parser_profile.current == ParserRule::COUNT) return;
+
+  RuleProfile& profile = parser_profile.rules[(size_t) parser_profile.current];
+  profile.rollbacks++;
+  profile.discarded_bytes += bytes;
+}
+
+void profileAdd(const ParserProfile& other) {
+  for (size_t i = 0; i < (size_t) ParserRule::COUNT; i++) {
+    parser_profile.rules[i].attempts += other.rules[i].attempts;
+    parser_profile.rules[i].successes += other.rules[i].successes;
+    parser_profile.rules[i].rollbacks += other.rules[i].rollbacks;
+    parser_profile.rules[i].discarded_bytes += other.rules[i].discarded_bytes;
+  }
+}
+
+#define PROFILE_ENTER(rule) ParserRule profile_outer = profileEnter(rule)
+#define PROFILE_EXIT(rule, node) profileExit(rule, profile_outer, node != nullptr)
+#define PROFILE_ROLLBACK(bytes) profileRollback(bytes)
+// For nodes the iterative rules build without calling the rule
+#define PROFILE_ATTEMPT(rule) parser_profile.rules[(size_t) rule].attempts++
+#define PROFILE_SUCCESS(rule) parser_profile.rules[(size_t) rule].successes++
+#define PROFILE_RESET() parser_profile = {{}, ParserRule::COUNT}
+#else
+#define PROFILE_ENTER(rule)
+#define PROFILE_EXIT(rule, node)
+#define PROFILE_ROLLBACK(bytes)
+#define PROFILE_ATTEMPT(rule) ((void) 0)
+#define PROFILE_SUCCESS(rule) ((void) 0)
+#define PROFILE_RESET()
+#endif
+
+void printParserProfile(ParserProfileFormat format) {
+#ifdef PARSER_PROFILE
+  const RuleProfile* rules = parser_profile.rules;
+
+  if (format == ParserProfileFormat::JSON) {
+    fprintf(stderr, "{\"rules\": [");
+    for (size_t i = 0; i < (size_t) ParserRule::COUNT; i++) {
+      fprintf(stderr, "%s\n  {\"rule\": \"%s\", \"attempts\": %lu, \"successes\": %lu, "
+          "\"rollbacks\": %lu, \"discarded_bytes\": %lu}", i == 0 ? "" : ",", parser_rule_names[i],
+          (unsigned long) rules[i].attempts, (unsigned long) rules[i].successes,
+          (unsigned long) rules[i].rollbacks, (unsigned long) rules[i].discarded_bytes);
+    }
+    fprintf(stderr, "\n]}\n");
+    return;
+  }
+
+  fprintf(stderr, "%-16s %12s %12s %12s %16s\n", "Rule", "Attempts", "Successes", "Rollbacks", "Discarded bytes");
+  for (size_t i = 0; i < (size_t) ParserRule::COUNT; i++) {
+    fprintf(stderr, "%-16s %12lu %12lu %12lu %16lu\n", parser_rule_names[i],
+        (unsigned long) rules[i].attempts, (unsigned long) rules[i].successes,
+        (unsigned long) rules[i].rollbacks, (unsigned long) rules[i].discarded_bytes);
+  }
+#else
+  (void) format;
+  fprintf(stderr, "Parser profile: build with PARSER_PROFILE to count rules\n");
+#endif
+}
+
+template <typename T, typename F>
+T* memoizeRule(ParserRule rule, Token*& tokens, F parse_rule) {
+  if (!parser_memo.enabled || tokens > parser_memo.end) return parse_rule(tokens);
+
+  size_t index = (tokens - parser_memo.base) * (size_t) ParserRule::COUNT + (size_t) rule;
+  MemoEntry entry = parser_memo.entries[index];
+  parser_memo.stats.lookups++;
+
+  if (entry.generation == parser_memo.generation && entry.state == MemoState::SUCCESS) {
+    parser_memo.stats.hits++;
+    tokens = entry.end;
+    return (T*) entry.node;
+  }
+  if (entry.generation == parser_memo.generation && entry.state == MemoState::FAILURE) {
+    parser_memo.stats.hits++;
+    return nullptr;
+  }
+
+  T* node = parse_rule(tokens);
+  if (node == nullptr) {
+    parser_memo.entries[index] = {parser_memo.generation, MemoState::FAILURE, nullptr, nullptr};
+    return nullptr;
+  }
+
+  parser_memo.entries[index] = {parser_memo.generation, MemoState::SUCCESS, node, tokens};
+  parser_memo.floor = stack->current;
+  return node;
+}
+
+template <typename T, typename F>
+T* memoize(ParserRule rule, Token*& tokens, F parse_rule) {
+  PROFILE_ENTER(rule);
+  T* node = memoizeRule<T>(rule, tokens, parse_rule);
+  PROFILE_EXIT(rule, node);
+  return node;
+}
+
+/*
+ * Predictive parsing picks the production for primary tags, block tags,
+ * statements and expressions from the first tokens instead of trying every
+ * alternative. The backtracking path is kept for differential testing.
+ */
+bool parser_predictive = true;
+
+void parserSetPredictive(bool enabled) {
+  parser_predictive = enabled;
+}
+
+/*
+ * Lazy function bodies. The first thread to ask for a body claims it and
+ * parses it into its own body stack, threads asking meanwhile wait for it. A
+ * body stack belongs to one thread, goes back to a pool when the thread exits
+ * and keeps its bodies until parse_destroy. Bodies are dropped from the top
+ * of the stack of the thread that parsed them.
+ */
+bool parser_lazy_bodies = false;
+
+struct BodyStack {
+  Stack* stack;
+  // Functions whose bodies are on stack, in the order they were parsed
+  std::vector<Function*> bodies;
+};
+
+std::mutex parser_body_mutex;
+std::vector<BodyStack*> parser_body_stacks;
+std::vector<BodyStack*> parser_free_body_stacks;
+
+// Gives the body stack of a thread back to the pool when the thread exits
+struct BodyStackOwner {
+  BodyStack* body_stack = nullptr;
+
+  ~BodyStackOwner() {
+    if (body_stack == nullptr) return;
+    std::lock_guard<std::mutex> lock(parser_body_mutex);
+    parser_free_body_stacks.push_back(body_stack);
+  }
+};
+
+thread_local BodyStackOwner parser_body_stack;
+
+void parserSetLazyBodies(bool enabled) {
+  parser_lazy_bodies = enabled;
+}
+
+bool parser_huge_pages = false;
+ParserArenaStats parser_arena_stats = {};
+
+void parserSetHugePages(bool enabled) {
+  parser_huge_pages = enabled;
+}
+
+ParserArenaStats parserArenaStats() {
+  return parser_arena_stats;
+}
+
+/*
+ * The stack is kept between parses so small parses do not pay for mapping
+ * and faulting in fresh pages. Trees from earlier parses stay valid until
+ * parse_destroy, which clears it and gives back pages past the retained size.
+ */
+#define PARSER_RETAINED_BYTES (1 << 20)
+
+// Stacks of the threads parseParallel starts, kept like the main stack
+std::vector<Stack*> parser_worker_stacks;
+
+// Creates the stack if needed, or recreates it while empty if the page size changed
+Stack* prepareStack(Stack* stack) {
+  if (stack != nullptr && stack->huge_pages != parser_huge_pages && stackSize(stack) == 0) {
+    stackDestroy(stack);
+    stack = nullptr;
+  }
+
+  if (stack == nullptr) stack = stackCreate(STACK_DEFAULT_RESERVE, true, parser_huge_pages);
+  return stack;
+}
+
+void createStack() {
+  stack = prepareStack(stack);
+  parser_memo.floor = stack->current;
+}
+
+void recordArenaStats() {
+  parser_arena_stats.ast_size = stackSize(stack);
+  parser_arena_stats.ast_high_water = stackHighWater(stack);
+  parser_arena_stats.ast_committed = stackCommitted(stack);
+
+  for (Stack* worker : parser_worker_stacks) {
+    parser_arena_stats.ast_size += stackSize(worker);
+    parser_arena_stats.ast_high_water += stackHighWater(worker);
+    parser_arena_stats.ast_committed += stackCommitted(worker);
+  }
+}
+
+// Memoized nodes are never popped
+void popStack(void* stack_reset) {
+  if (parser_memo.enabled && stack_reset < parser_memo.floor) stack_reset = parser_memo.floor;
+  PROFILE_ROLLBACK(stack_reset < stack->current ? stack->current - (uint8_t*) stack_reset : 0);
+  if (stack_reset < stack->current) stackPop(stack, stack_reset);
 }
 
 void* resetStack(void* stack_reset) {
-  stackPop(stack, stack_reset);
+  popStack(stack_reset);
   return nullptr;
 }
 
-void* resetBufferPool(void* buffer_pool_reset) {
-  stackPop(buffer_pool, buffer_pool_reset);
-  return nullptr;
+// Copies count finished items onto the stack
+template <typename T>
+T* stackCopy(T* items, int count) {
+  unsigned byte_count = count * sizeof(T);
+  T* output = (T*) stackPush(stack, byte_count);
+  memcpy(output, items, byte_count);
+  return output;
+}
+
+template <typename T, int N>
+T* stackCopy(ScratchList<T, N>& list) {
+  return stackCopy(list.data, list.size);
 }
 
+Identifier* identifier(Token*& tokens);
+Type* type(Token*& tokens);
+Declaration* declaration(Token*& tokens);
+Assignment* assignment(Token*& tokens);
+Statement* statement(Token*& tokens);
+BlockTag* blockTag(Token*& tokens);
+Block* block(Token*& tokens);
+Literal* literal(Token*& tokens);
+Call* call(Token*& tokens);
+Unary* unary(Token*& tokens);
+Binary* binary(Token*& tokens);
+FunctionParam* functionParam(Token*& tokens);
+Function* function(Token*& tokens);
+Struct* struct_(Token*& tokens);
+Enum* enum_(Token*& tokens);
+Expr* expr(Token*& tokens, bool check_binary = true);
+
 bool check(Token* token, TokenType type) {
   if (token->type != type) return false;
   return true;
 }
 
+// Returns the token after a possibly dotted identifier, or tokens if there is none
+Token* skipIdentifier(Token* tokens) {
+  if (!check(tokens, TokenType::IDENTIFIER)) return tokens;
+
+  Token* current = tokens + 1;
+  while (check(current, TokenType::DOT) && check(current + 1, TokenType::IDENTIFIER)) current += 2;
+  return current;
+}
+
 SimpleType* simpleType(Token*& tokens) {
   SimpleType* node = (SimpleType*) stackPush(stack, sizeof(SimpleType));
   node->start = tokens;
@@ -79,7 +487,7 @@ SimpleType* simpleType(Token*& tokens) {
   return node;
 }
 
-Identifier* identifier(Token*& tokens) {
+Identifier* identifierRule(Token*& tokens) {
   Identifier* node = (Identifier*) stackPush(stack, sizeof(Identifier));
 
   Token* current = tokens;
@@ -100,7 +508,7 @@ Identifier* identifier(Token*& tokens) {
   return node;
 }
 
-Type* type(Token*& tokens) {
+Type* typeRule(Token*& tokens) {
   Type* node = (Type*) stackPush(stack, sizeof(Type));
   node->start = tokens;
   
@@ -147,31 +555,26 @@ Qualifier* qualifier(Token*& tokens) {
   return node;
 }
 
-Expr* expr(Token*& tokens, bool check_binary = true);
-Block* block(Token*& tokens);
-
-Declaration* declaration(Token*& tokens) {
+Declaration* declarationRule(Token*& tokens) {
   Declaration* node = (Declaration*) stackPush(stack, sizeof(Declaration));
   
-  unsigned byte_count;
-  Qualifier** qualifier_buffer = (Qualifier**) stackPush(buffer_pool, MAX_BUFFER_COUNT * sizeof(Qualifier*));
+  ScratchList<Qualifier*, 4> qualifiers;
 
   Token* current = tokens;
   node->start = tokens;
 
   DEBUG_PRINT("Try Decl");
-  qualifier_buffer[node->qualifiers_count] = qualifier(current);
-  while(qualifier_buffer[node->qualifiers_count] != nullptr) {
-    qualifier_buffer[++node->qualifiers_count] = qualifier(current);
+  for (Qualifier* item = qualifier(current); item != nullptr; item = qualifier(current)) {
+    qualifiers.push(item);
   }
 
   node->identifier = identifier(current);
-  if (node->identifier == nullptr) return (Declaration*) resetStacks(node, qualifier_buffer);
+  if (node->identifier == nullptr) return (Declaration*) resetStack(node);
 
-  if(!check(current++, TokenType::COLON)) return (Declaration*) resetStacks(node, qualifier_buffer);
+  if(!check(current++, TokenType::COLON)) return (Declaration*) resetStack(node);
 
   node->decl_type = type(current);
-  if (node->decl_type == nullptr) return (Declaration*) resetStacks(node, qualifier_buffer);
+  if (node->decl_type == nullptr) return (Declaration*) resetStack(node);
 
   DEBUG_PRINT("Try Decl SET");
 
@@ -179,19 +582,16 @@ Declaration* declaration(Token*& tokens) {
     DEBUG_PRINT("Start Decl SET");
     node->expr = expr(++current);
     DEBUG("Decl Expr", node->expr->start, node->expr->end);
-    if (node->expr == nullptr) return (Declaration*) resetStacks(node, qualifier_buffer);
+    if (node->expr == nullptr) return (Declaration*) resetStack(node);
     DEBUG_PRINT("End Decl SET");
   }
 
   DEBUG_PRINT("Try Decl SEMI");
-  if(!check(current++, TokenType::SEMI)) return (Declaration*) resetStacks(node, qualifier_buffer);
+  if(!check(current++, TokenType::SEMI)) return (Declaration*) resetStack(node);
   DEBUG_PRINT("SUCESS Decl SEMI");
 
-  byte_count = node->qualifiers_count * sizeof(Qualifier*);
-  node->qualifiers = (Qualifier**) stackPush(stack, byte_count); 
-  memcpy(node->qualifiers, qualifier_buffer, byte_count);
-
-  resetBufferPool(qualifier_buffer);
+  node->qualifiers_count = qualifiers.size;
+  node->qualifiers = stackCopy(qualifiers);
 
   tokens = current;
   node->type = ASTType::DECLARATION;
@@ -200,7 +600,7 @@ Declaration* declaration(Token*& tokens) {
   return node;
 }
 
-Assignment* assignment(Token*& tokens) {
+Assignment* assignmentRule(Token*& tokens) {
   Assignment* node = (Assignment*) stackPush(stack, sizeof(Assignment));
   Token* current = tokens;
   node->start = tokens;
@@ -315,7 +715,7 @@ Return* return_(Token*& tokens) {
   return node;
 }
 
-Statement* statement(Token*& tokens) {
+Statement* statementRule(Token*& tokens) {
   Statement* node = (Statement*) stackPush(stack, sizeof(Statement));
   Token* current = tokens;
 
@@ -369,13 +769,16 @@ Statement* statement(Token*& tokens) {
       return node;
 
     default:
-      node->type = ASTType::STATEMENT_ASSIGN;
-      node->assignment = assignment(current);
-      if (node->assignment != nullptr) {
-        tokens = current;
-        node->end = current;
-        DEBUG("Match Assignment Statement", node->start, node->end);
-        return node;
+      if (!parser_predictive || check(skipIdentifier(current), TokenType::SET)) {
+        node->type = ASTType::STATEMENT_ASSIGN;
+        node->assignment = assignment(current);
+        if (node->assignment != nullptr) {
+          tokens = current;
+          node->end = current;
+          DEBUG("Match Assignment Statement", node->start, node->end);
+          return node;
+        }
+        if (parser_predictive) return (Statement*) resetStack(node);
       }
 
       node->type = ASTType::STATEMENT_EXPR;
@@ -390,12 +793,15 @@ Statement* statement(Token*& tokens) {
   }
 }
 
-BlockTag* blockTag(Token*& tokens) {
+BlockTag* blockTagRule(Token*& tokens) {
   BlockTag* node = (BlockTag*) stackPush(stack, sizeof(BlockTag));
   Token* current = tokens;
   node->start = tokens;
 
-  node->statement = statement(current);
+  // A statement never starts with '{' and block() falls back to a statement otherwise
+  bool is_block = check(current, TokenType::LEFT_BRACE);
+
+  if (!parser_predictive || !is_block) node->statement = statement(current);
   if (node->statement != nullptr){
     tokens = current;
     node->type = ASTType::BLOCK_TAG_STATEMENT;
@@ -404,7 +810,7 @@ BlockTag* blockTag(Token*& tokens) {
     return node;
   }
 
-  node->block = block(current);
+  if (!parser_predictive || is_block) node->block = block(current);
   if (node->block != nullptr) {
     tokens = current;
     node->type = ASTType::BLOCK_TAG_BLOCK;
@@ -416,14 +822,15 @@ BlockTag* blockTag(Token*& tokens) {
   return (BlockTag*) resetStack(node);
 }
 
-Block* block(Token*& tokens) {
-  Block* node = (Block*) stackPush(stack, sizeof(Block));
+Block* blockPredictive(Token*& tokens);
 
-  unsigned byte_count_declarations;
-  Declaration** declarations_buffer = (Declaration**) stackPush(buffer_pool, MAX_BUFFER_COUNT * sizeof(Declaration*));
+Block* blockRule(Token*& tokens) {
+  if (parser_predictive) return blockPredictive(tokens);
+
+  Block* node = (Block*) stackPush(stack, sizeof(Block));
 
-  unsigned byte_count_tags;
-  BlockTag** block_tag_buffer = (BlockTag**) stackPush(buffer_pool, MAX_BUFFER_COUNT * sizeof(BlockTag*));
+  ScratchList<Declaration*, 8> declarations;
+  ScratchList<BlockTag*, 16> block_tags;
 
   Token* current = tokens;
   node->start = tokens;
@@ -431,7 +838,7 @@ Block* block(Token*& tokens) {
   DEBUG_PRINT("Try Block");
   if (!check(current, TokenType::LEFT_BRACE)){
     node->statement = statement(current);
-    if (node->statement == nullptr) return (Block*) resetStacks(node, declarations_buffer);
+    if (node->statement == nullptr) return (Block*) resetStack(node);
    
     tokens = current;
     node->type = ASTType::BLOCK;
@@ -444,35 +851,29 @@ Block* block(Token*& tokens) {
 
   if (check(current, TokenType::COLON)) {
     node->namespace_ = identifier(++current);
-    if (node->namespace_ == nullptr) return (Block*) resetStacks(node, declarations_buffer);
+    if (node->namespace_ == nullptr) return (Block*) resetStack(node);
     
-    if (!check(current, TokenType::SEMI)) return (Block*) resetStacks(node, declarations_buffer);
+    if (!check(current, TokenType::SEMI)) return (Block*) resetStack(node);
   }
 
   DEBUG_PRINT("Try Block Decls");
-  declarations_buffer[node->declarations_count] = declaration(current);
-  while (declarations_buffer[node->declarations_count] != nullptr) {
-    declarations_buffer[++node->declarations_count] = declaration(current);
+  for (Declaration* item = declaration(current); item != nullptr; item = declaration(current)) {
+    declarations.push(item);
   }
 
   DEBUG_PRINT("Try Block Tags");
-  block_tag_buffer[node->block_tags_count] = blockTag(current);
-  while (block_tag_buffer[node->block_tags_count] != nullptr) {
-    block_tag_buffer[++node->block_tags_count] = blockTag(current);
+  for (BlockTag* item = blockTag(current); item != nullptr; item = blockTag(current)) {
+    block_tags.push(item);
   }
 
   DEBUG_PRINT("Try Block Right Brace");
-  if (!check(current++, TokenType::RIGHT_BRACE)) return (Block*) resetStacks(node, declarations_buffer);
+  if (!check(current++, TokenType::RIGHT_BRACE)) return (Block*) resetStack(node);
 
-  byte_count_declarations = node->declarations_count * sizeof(Declaration*);
-  node->declarations = (Declaration**) stackPush(stack, byte_count_declarations); 
-  memcpy(node->declarations, declarations_buffer, byte_count_declarations);
+  node->declarations_count = declarations.size;
+  node->declarations = stackCopy(declarations);
 
-  byte_count_tags = node->block_tags_count * sizeof(BlockTag*);
-  node->block_tags = (BlockTag**) stackPush(stack, byte_count_tags); 
-  memcpy(node->block_tags, block_tag_buffer, byte_count_tags);
-
-  resetBufferPool(declarations_buffer);
+  node->block_tags_count = block_tags.size;
+  node->block_tags = stackCopy(block_tags);
 
   tokens = current;
   node->type = ASTType::BLOCK;
@@ -481,11 +882,212 @@ Block* block(Token*& tokens) {
   return node;
 }
 
-Literal* literal(Token*& tokens) {
+// A block, block tag or if or while statement blockPredictive is parsing
+struct BlockLevel {
+  ParserRule rule;
+  ASTNode* node;
+  // Children parsed so far, a block in braces counts its tags from 2
+  int step;
+  // Where the part of the shared lists of a block starts
+  int declarations;
+  int block_tags;
+};
+
+/*
+ * Parses blocks nested in block tags, if and while statements without
+ * recursing through block, blockTag and statement, so nesting is bounded by
+ * memory instead of the thread stack. Open nodes are levels of an explicit
+ * list and statements that do not nest are parsed by statement. Builds the
+ * same nodes as the recursive rules. Any part that does not parse fails the
+ * outermost block, as a failing tag fails its enclosing block there.
+ */
+Block* blockPredictive(Token*& tokens) {
+  void* stack_reset = stack->current;
+  Token* current = tokens;
+
+  ScratchList<BlockLevel, 16> levels;
+  ScratchList<Declaration*, 16> declarations;
+  ScratchList<BlockTag*, 16> block_tags;
+
+  // The level to open at current, COUNT to continue the innermost level
+  ParserRule open = ParserRule::BLOCK;
+  // The node last finished, a child of the innermost level
+  ASTNode* child = nullptr;
+
+  while (true) {
+    if (open == ParserRule::STATEMENT && !check(current, TokenType::IF) && !check(current, TokenType::WHILE)) {
+      child = (ASTNode*) statement(current);
+      if (child == nullptr) return (Block*) resetStack(stack_reset);
+    }
+    else if (open != ParserRule::COUNT) {
+      size_t size = open == ParserRule::BLOCK ? sizeof(Block) : open == ParserRule::BLOCK_TAG ? sizeof(BlockTag) : sizeof(Statement);
+      ASTNode* node = (ASTNode*) stackPush(stack, size);
+      node->start = current;
+
+      if (levels.size > 0) PROFILE_ATTEMPT(open);
+      levels.push({open, node, 0, declarations.size, block_tags.size});
+      child = nullptr;
+    }
+    open = ParserRule::COUNT;
+
+    BlockLevel& level = levels.back();
+    int step = level.step++;
+
+    switch (level.rule) {
+      case ParserRule::BLOCK: {
+        Block* node = (Block*) level.node;
+
+        if (step == 0 && !check(current, TokenType::LEFT_BRACE)) {
+          open = ParserRule::STATEMENT;
+          break;
+        }
+
+        if (step == 1) {
+          node->statement = (Statement*) child;
+          node->type = ASTType::BLOCK;
+          node->end = current;
+          DEBUG("Match Single Statement Block", node->start, node->end);
+          break;
+        }
+
+        if (step == 0) {
+          current++;
+
+          if (check(current, TokenType::COLON)) {
+            node->namespace_ = identifier(++current);
+            if (node->namespace_ == nullptr) return (Block*) resetStack(stack_reset);
+
+            if (!check(current, TokenType::SEMI)) return (Block*) resetStack(stack_reset);
+          }
+
+          for (Declaration* item = declaration(current); item != nullptr; item = declaration(current)) {
+            declarations.push(item);
+          }
+          level.step = 2;
+        }
+        else {
+          block_tags.push((BlockTag*) child);
+        }
+
+        // A tag that does not parse where '}' is expected fails the block
+        if (!check(current, TokenType::RIGHT_BRACE)) {
+          open = ParserRule::BLOCK_TAG;
+          break;
+        }
+        current++;
+
+        node->declarations_count = declarations.size - level.declarations;
+        node->declarations = stackCopy(&declarations[level.declarations], node->declarations_count);
+        declarations.size = level.declarations;
+
+        node->block_tags_count = block_tags.size - level.block_tags;
+        node->block_tags = stackCopy(&block_tags[level.block_tags], node->block_tags_count);
+        block_tags.size = level.block_tags;
+
+        node->type = ASTType::BLOCK;
+        node->end = current;
+        DEBUG("Match Block", node->start, node->end);
+        break;
+      }
+
+      case ParserRule::BLOCK_TAG: {
+        BlockTag* node = (BlockTag*) level.node;
+
+        if (step == 0) {
+          open = check(current, TokenType::LEFT_BRACE) ? ParserRule::BLOCK : ParserRule::STATEMENT;
+          break;
+        }
+
+        node->end = current;
+        if (check(node->start, TokenType::LEFT_BRACE)) {
+          node->type = ASTType::BLOCK_TAG_BLOCK;
+          node->block = (Block*) child;
+          DEBUG("Match Block Tag Block", node->start, node->end);
+        }
+        else {
+          node->type = ASTType::BLOCK_TAG_STATEMENT;
+          node->statement = (Statement*) child;
+          DEBUG("Match Block Tag Statement", node->start, node->end);
+        }
+        break;
+      }
+
+      // Only if and while, the other statements do not nest
+      default: {
+        Statement* node = (Statement*) level.node;
+
+        if (step == 0) {
+          Expr* condition;
+          if (check(current, TokenType::IF)) {
+            node->type = ASTType::STATEMENT_CONDITION;
+            node->conditional = (Conditional*) stackPush(stack, sizeof(Conditional));
+            node->conditional->start = current++;
+            condition = node->conditional->condition = expr(current);
+          }
+          else {
+            node->type = ASTType::STATEMENT_WHILE;
+            node->while_ = (While*) stackPush(stack, sizeof(While));
+            node->while_->start = current++;
+            condition = node->while_->condition = expr(current);
+          }
+          if (condition == nullptr) return (Block*) resetStack(stack_reset);
+
+          open = ParserRule::BLOCK;
+          break;
+        }
+
+        if (node->type == ASTType::STATEMENT_CONDITION) {
+          Conditional* conditional = node->conditional;
+
+          if (step == 1) {
+            conditional->block = (Block*) child;
+            if (check(current++, TokenType::ELSE)) {
+              open = ParserRule::BLOCK;
+              break;
+            }
+          }
+          else {
+            conditional->other = (Block*) child;
+          }
+
+          conditional->type = ASTType::CONDITIONAL;
+          conditional->end = current;
+          DEBUG("Match Conditional", conditional->start, conditional->end);
+
+          node->end = current;
+          DEBUG("Match Conditional Statement", node->start, node->end);
+          break;
+        }
+
+        node->while_->block = (Block*) child;
+        node->while_->type = ASTType::WHILE;
+        node->while_->end = current;
+        DEBUG("Match While", node->while_->start, node->while_->end);
+
+        node->end = current;
+        DEBUG("Match While Statement", node->start, node->end);
+        break;
+      }
+    }
+
+    if (open != ParserRule::COUNT) continue;
+
+    // The innermost level is finished
+    child = level.node;
+    if (levels.size > 1) PROFILE_SUCCESS(level.rule);
+    levels.pop();
+
+    if (levels.size == 0) {
+      tokens = current;
+      return (Block*) child;
+    }
+  }
+}
+
+Literal* literalRule(Token*& tokens) {
   Literal* node = (Literal*) stackPush(stack, sizeof(Literal));
   node->start = tokens;
 
-  // TODO: parse the actual literal
   switch (tokens->type) {
     case TokenType::STRING_LITERAL:
       node->type = ASTType::LITERAL_STRING;
@@ -494,11 +1096,13 @@ Literal* literal(Token*& tokens) {
       return node;
     case TokenType::INT_LITERAL:
       node->type = ASTType::LITERAL_INT;
+      node->int_ = tokens->int_value;
       node->end = ++tokens;
       DEBUG("Match Literal Int", node->start, node->end);
       return node;
     case TokenType::FLOAT_LITERAL:
       node->type = ASTType::LITERAL_FLOAT;
+      node->float_ = tokens->float_value;
       node->end = ++tokens;
       DEBUG("Match Literal Float", node->start, node->end);
       return node;
@@ -519,33 +1123,28 @@ Literal* literal(Token*& tokens) {
   }
 }
 
-Call* call(Token*& tokens) {
+Call* callRule(Token*& tokens) {
   Call* node = (Call*) stackPush(stack, sizeof(Call));
   Token* current = tokens;
 
-  unsigned byte_count;
-  Expr** args_buffer = (Expr**) stackPush(buffer_pool, MAX_BUFFER_COUNT * sizeof(Expr*));
+  ScratchList<Expr*, 8> arguments;
 
   node->start = tokens;
 
   node->identifier = identifier(current);
-  if (node->identifier == nullptr) return (Call*) resetStacks(node, args_buffer);
+  if (node->identifier == nullptr) return (Call*) resetStack(node);
 
-  if (!check(current++, TokenType::LEFT_PAREN)) return (Call*) resetStacks(node, args_buffer);
+  if (!check(current++, TokenType::LEFT_PAREN)) return (Call*) resetStack(node);
 
-  args_buffer[node->arguments_count] = expr(current);
-  while (args_buffer[node->arguments_count] != nullptr) {
+  for (Expr* item = expr(current); item != nullptr; item = expr(current)) {
+    arguments.push(item);
     if (check(current, TokenType::COMMA)) current++;
-    args_buffer[++node->arguments_count] = expr(current);
   }
   
-  if (!check(current++, TokenType::RIGHT_PAREN)) return (Call*) resetStacks(node, args_buffer);
+  if (!check(current++, TokenType::RIGHT_PAREN)) return (Call*) resetStack(node);
 
-  byte_count = node->arguments_count * sizeof(Expr*);
-  node->arguments = (Expr**) stackPush(stack, byte_count); 
-  memcpy(node->arguments, args_buffer, byte_count);
-
-  resetBufferPool(args_buffer);
+  node->arguments_count = arguments.size;
+  node->arguments = stackCopy(arguments);
 
   tokens = current;
   node->type = ASTType::CALL;
@@ -554,7 +1153,7 @@ Call* call(Token*& tokens) {
   return node;
 }
 
-Unary* unary(Token*& tokens) {
+Unary* unaryRule(Token*& tokens) {
   Unary* node = (Unary*) stackPush(stack, sizeof(Unary));
   Token* current = tokens;
 
@@ -583,11 +1182,6 @@ Unary* unary(Token*& tokens) {
 }
 
 Expr* makeBinaryExpr(Token* start, Token* end, Expr* first, Expr* second, ASTType type) {
-  /*
-   * WARNING: Make sure you understand how binary() works before changing this.
-   * binary() depends on this allocating the Binary before the Expr.
-   */
-
   Expr* node;
   Binary* binary;
 
@@ -607,142 +1201,108 @@ Expr* makeBinaryExpr(Token* start, Token* end, Expr* first, Expr* second, ASTTyp
   return node;
 }
 
-Binary* binary(Token*& tokens) {
-  Binary* node = (Binary*) stackPush(stack, sizeof(Binary));
-  Token* current = tokens;
-  ASTType type; 
-  
-  unsigned expr_count = 0;
-  Expr** expr_buffer = (Expr**) stackPush(buffer_pool, MAX_BUFFER_COUNT * sizeof(Expr*));
-  unsigned op_count = 0;
-  ASTType* op_buffer = (ASTType*) stackPush(buffer_pool, MAX_BUFFER_COUNT * sizeof(ASTType));
+ASTType binaryOperator(TokenType type) {
+  switch(type) {
+    case TokenType::MUL:
+      return ASTType::BINARY_MUL;
 
-  expr_buffer[expr_count] = expr(current, false);
-  if (expr_buffer[expr_count++] == nullptr) return (Binary*) resetStacks(node, expr_buffer);
+    case TokenType::DIV:
+      return ASTType::BINARY_DIV;
 
-  bool is_binary_expr = false;
-  do {
-    Expr* expr_ptr;
-    ASTType op;
+    case TokenType::MOD:
+      return ASTType::BINARY_MOD;
 
-    switch(current->type) {
-      case TokenType::MUL:
-        op = ASTType::BINARY_MUL;
-        break;
+    case TokenType::ADD:
+      return ASTType::BINARY_ADD;
 
-      case TokenType::DIV:
-        op = ASTType::BINARY_DIV;
-        break;
+    case TokenType::SUB:
+      return ASTType::BINARY_SUB;
 
-      case TokenType::MOD:
-        op = ASTType::BINARY_MOD;
-        break;
+    case TokenType::LT:
+      return ASTType::BINARY_LT;
 
-      case TokenType::ADD:
-        op = ASTType::BINARY_ADD;
-        break;
+    case TokenType::GT:
+      return ASTType::BINARY_GT;
 
-      case TokenType::SUB:
-        op = ASTType::BINARY_SUB;
-        break;
+    case TokenType::LE:
+      return ASTType::BINARY_LE;
 
-      case TokenType::LT:
-        op = ASTType::BINARY_LT;
-        break;
+    case TokenType::GE:
+      return ASTType::BINARY_GE;
 
-      case TokenType::GT:
-        op = ASTType::BINARY_GT;
-        break;
+    case TokenType::EQ:
+      return ASTType::BINARY_EQ;
 
-      case TokenType::LE:
-        op = ASTType::BINARY_LE;
-        break;
+    case TokenType::NE:
+      return ASTType::BINARY_NE;
 
-      case TokenType::GE:
-        op = ASTType::BINARY_GE;
-        break;
+    case TokenType::AND:
+      return ASTType::BINARY_AND;
 
-      case TokenType::EQ:
-        op = ASTType::BINARY_EQ;
-        break;
+    case TokenType::OR:
+      return ASTType::BINARY_OR;
 
-      case TokenType::NE:
-        op = ASTType::BINARY_NE;
-        break;
+    case TokenType::XOR:
+      return ASTType::BINARY_XOR;
 
-      case TokenType::AND:
-        op = ASTType::BINARY_AND;
-        break;
+    default:
+      return ASTType::NONE;
+  }
+}
 
-      case TokenType::OR:
-        op = ASTType::BINARY_OR;
-        break;
+/*
+ * Pratt parser driven by binary_operator_precidence, lower values bind tighter.
+ * Extends left with every operator that binds tighter than limit. Operators of
+ * equal precedence associate to the left. Returns nullptr if an operator is not
+ * followed by an operand.
+ */
+Expr* binaryExpr(Token*& tokens, Expr* left, int limit) {
+  Token* current = tokens;
 
-      case TokenType::XOR:
-        op = ASTType::BINARY_XOR;
-        break;
+  ASTType op = binaryOperator(current->type);
+  while (op != ASTType::NONE && getBinaryPrecidence(op) < limit) {
+    int precidence = getBinaryPrecidence(op);
 
-      default:
-        op = ASTType::NONE;
-    }
-    
-    if (op == ASTType::NONE) break;
+    Expr* right = expr(++current, false);
+    if (right == nullptr) return nullptr;
 
-    current++;
-    is_binary_expr = true;
-    expr_ptr = expr(current, false);
-    if (expr_ptr == nullptr) break; 
-
-    while (op_count > 0 && getBinaryPrecidence(op) > getBinaryPrecidence(op_buffer[op_count - 1])) {
-      Expr* first = expr_buffer[expr_count - 1];
-      Expr* second = expr_buffer[expr_count - 2];
-      ASTType top_op = op_buffer[op_count - 1];
-
-      expr_buffer[expr_count - 2] = makeBinaryExpr(first->start, second->end, first, second, top_op);
-      expr_count--;
-      op_count--;
+    // Only recurse when the next operator takes right away from op
+    ASTType next = binaryOperator(current->type);
+    if (next != ASTType::NONE && getBinaryPrecidence(next) < precidence) {
+      right = binaryExpr(current, right, precidence);
+      if (right == nullptr) return nullptr;
+      next = binaryOperator(current->type);
     }
 
-    expr_buffer[expr_count++] = expr_ptr;
-    op_buffer[op_count++] = op;
-  } while(true);
-
-  while (op_count > 0) {
-    Expr* first = expr_buffer[expr_count - 1];
-    Expr* second = expr_buffer[expr_count - 2];
-    ASTType top_op = op_buffer[op_count - 1];
-
-    expr_buffer[expr_count - 2] = makeBinaryExpr(first->start, second->end, first, second, top_op);
-    expr_count--;
-    op_count--;
+    left = makeBinaryExpr(left->start, right->end, left, right, op);
+    DEBUG("Match Binary Expression", left->start, left->end);
+    op = next;
   }
 
-  if (!is_binary_expr) return (Binary*) resetStacks(node, expr_buffer);
+  tokens = current;
+  return left;
+}
 
+// Only used by the backtracking path, the Expr wrapping the result is left on the stack
+Binary* binaryRule(Token*& tokens) {
+  void* stack_reset = stack->current;
+  Token* current = tokens;
 
-  /*
-   * WARNING: this is fragile. we know that expr_buffer contains
-   * exprs but we need a binary. If it is a binary expression then 
-   * expr_buffer[0] ends up being a binary expression. Since we always
-   * allocate these with the helper makeBinaryExpr we know that Expr 
-   * is allocated after its binary on the stack so we delete the extra
-   * Expr by poping the stack to it. This leaves its Binary in tact.
-   */
+  Expr* node = expr(current, false);
+  if (node == nullptr || binaryOperator(current->type) == ASTType::NONE) return (Binary*) resetStack(stack_reset);
+
+  node = binaryExpr(current, node, BINARY_PRECIDENCE_NONE);
+  if (node == nullptr) return (Binary*) resetStack(stack_reset);
 
-  node->start = tokens;
   tokens = current;
-  node = expr_buffer[0]->binary;
-  node->end = current;
+  return node->binary;
+}
 
-  stackPop(stack, expr_buffer[0]);
-  stackPop(buffer_pool, op_buffer);
-  stackPop(buffer_pool, expr_buffer);
+Expr* exprPredictive(Token*& tokens, bool check_binary);
 
-  DEBUG("Match Binary Expression", node->start, node->end);
-  return node;
-}
+Expr* exprRule(Token*& tokens, bool check_binary) {
+  if (parser_predictive) return exprPredictive(tokens, check_binary);
 
-Expr* expr(Token*& tokens, bool check_binary) {
   Expr* node;
   Token* current = tokens;
   
@@ -751,7 +1311,7 @@ Expr* expr(Token*& tokens, bool check_binary) {
     current++;
     node = expr(current, check_binary);
     if (node != nullptr) {
-      if (check(current++, TokenType::LEFT_PAREN)) {
+      if (check(current++, TokenType::RIGHT_PAREN)) {
           tokens = current;
           DEBUG("Match Expr Paren", node->start, node->end);
           return node;
@@ -819,11 +1379,184 @@ Expr* expr(Token*& tokens, bool check_binary) {
   return (Expr*) resetStack(node);
 }
 
-Expr* expr(Token*& tokens) {
-  return expr(tokens, true);
+// Operand that does not nest, parentheses and calls are levels of exprPredictive
+Expr* operand(Token*& tokens) {
+  Expr* node = (Expr*) stackPush(stack, sizeof(Expr));
+  Token* current = tokens;
+  node->start = tokens;
+
+  switch (current->type) {
+    case TokenType::IDENTIFIER:
+      node->type = ASTType::EXPRESSION_IDENTIFIER;
+      node->identifier = identifier(current);
+      break;
+
+    case TokenType::NOT:
+    case TokenType::ADD:
+    case TokenType::SUB:
+      node->type = ASTType::EXPRESSION_UNARY;
+      node->unary = unary(current);
+      if (node->unary == nullptr) return (Expr*) resetStack(node);
+      break;
+
+    case TokenType::STRING_LITERAL:
+    case TokenType::INT_LITERAL:
+    case TokenType::FLOAT_LITERAL:
+    case TokenType::TRUE:
+    case TokenType::FALSE:
+      node->type = ASTType::EXPRESSION_LITERAL;
+      node->literal = literal(current);
+      break;
+
+    default:
+      return (Expr*) resetStack(node);
+  }
+
+  tokens = current;
+  node->end = current;
+  DEBUG("Match Expr Operand", node->start, node->end);
+  return node;
 }
 
-FunctionParam* functionParam(Token*& tokens) {
+// An open parenthesis or argument list, the bases are where its part of the shared lists starts
+struct ExprLevel {
+  // The call whose arguments are parsed, nullptr for a parenthesis and the outermost level
+  Expr* call;
+  int operands;
+  int operators;
+  int arguments;
+};
+
+// Combines the operators of level that bind at least as tight as limit
+void reduceLevel(ExprLevel& level, ScratchList<Expr*, 16>& operands, ScratchList<ASTType, 16>& operators, int limit) {
+  while (operators.size > level.operators && getBinaryPrecidence(operators.back()) <= limit) {
+    ASTType op = operators.pop();
+    Expr* right = operands.pop();
+    Expr* left = operands.back();
+
+    operands.back() = makeBinaryExpr(left->start, right->end, left, right, op);
+    DEBUG("Match Binary Expression", operands.back()->start, operands.back()->end);
+  }
+}
+
+/*
+ * Parses without recursing into parentheses and call arguments, so nesting is
+ * bounded by memory instead of the thread stack. Each open parenthesis or
+ * argument list is a level, a level is a binary expression parsed with an
+ * operand and an operator list shared by all levels. Builds the same nodes as
+ * binaryExpr. Any part that does not parse fails the whole expression, as a
+ * failing operand, argument or parenthesis does in the recursive rules.
+ */
+Expr* exprPredictive(Token*& tokens, bool check_binary) {
+  void* stack_reset = stack->current;
+  Token* current = tokens;
+
+  ScratchList<ExprLevel, 8> levels;
+  ScratchList<Expr*, 16> operands;
+  ScratchList<ASTType, 16> operators;
+  ScratchList<Expr*, 16> arguments;
+
+  levels.push({nullptr, 0, 0, 0});
+  bool expect_operand = true;
+
+  while (true) {
+    if (expect_operand) {
+      if (check(current, TokenType::LEFT_PAREN)) {
+        PROFILE_ATTEMPT(ParserRule::EXPR);
+        current++;
+        levels.push({nullptr, operands.size, operators.size, arguments.size});
+        continue;
+      }
+
+      if (check(current, TokenType::IDENTIFIER) && check(skipIdentifier(current), TokenType::LEFT_PAREN)) {
+        PROFILE_ATTEMPT(ParserRule::CALL);
+        Expr* node = (Expr*) stackPush(stack, sizeof(Expr));
+        node->start = current;
+        node->type = ASTType::EXPRESSION_CALL;
+
+        node->call = (Call*) stackPush(stack, sizeof(Call));
+        node->call->start = current;
+        node->call->identifier = identifier(current);
+        if (node->call->identifier == nullptr) return (Expr*) resetStack(stack_reset);
+        if (!check(current++, TokenType::LEFT_PAREN)) return (Expr*) resetStack(stack_reset);
+
+        levels.push({node, operands.size, operators.size, arguments.size});
+        // Without arguments the level is closed right away
+        expect_operand = !check(current, TokenType::RIGHT_PAREN);
+        continue;
+      }
+
+      Expr* node = operand(current);
+      if (node == nullptr) return (Expr*) resetStack(stack_reset);
+
+      operands.push(node);
+      expect_operand = false;
+      continue;
+    }
+
+    ExprLevel level = levels.back();
+    bool has_operand = operands.size > level.operands;
+
+    ASTType op = binaryOperator(current->type);
+    if (op != ASTType::NONE && has_operand && (levels.size > 1 || check_binary)) {
+      reduceLevel(level, operands, operators, getBinaryPrecidence(op));
+      operators.push(op);
+      current++;
+      expect_operand = true;
+      continue;
+    }
+
+    Expr* node = nullptr;
+    if (has_operand) {
+      reduceLevel(level, operands, operators, BINARY_PRECIDENCE_NONE);
+      node = operands.pop();
+    }
+
+    if (levels.size == 1) {
+      tokens = current;
+      return node;
+    }
+
+    if (level.call == nullptr) {
+      if (!check(current++, TokenType::RIGHT_PAREN)) return (Expr*) resetStack(stack_reset);
+
+      PROFILE_SUCCESS(ParserRule::EXPR);
+      DEBUG("Match Expr Paren", node->start, node->end);
+      levels.pop();
+      operands.push(node);
+      continue;
+    }
+
+    if (node != nullptr) {
+      arguments.push(node);
+      if (check(current, TokenType::COMMA)) current++;
+
+      // The next argument, a missing ')' fails when it does not parse as one
+      if (!check(current, TokenType::RIGHT_PAREN)) {
+        expect_operand = true;
+        continue;
+      }
+    }
+    current++;
+
+    Call* call = level.call->call;
+    call->arguments_count = arguments.size - level.arguments;
+    call->arguments = stackCopy(&arguments[level.arguments], call->arguments_count);
+    arguments.size = level.arguments;
+
+    call->type = ASTType::CALL;
+    call->end = current;
+    PROFILE_SUCCESS(ParserRule::CALL);
+    DEBUG("Match Call", call->start, call->end);
+
+    level.call->end = current;
+    DEBUG("Match Expr Operand", level.call->start, level.call->end);
+    levels.pop();
+    operands.push(level.call);
+  }
+}
+
+FunctionParam* functionParamRule(Token*& tokens) {
   FunctionParam* node = (FunctionParam*) stackPush(stack, sizeof(FunctionParam));
 
   Token* current = tokens;
@@ -849,8 +1582,7 @@ FunctionParam* functionParam(Token*& tokens) {
 FunctionHeader* functionHeader(Token*& tokens) {
   FunctionHeader* node = (FunctionHeader*) stackPush(stack, sizeof(FunctionHeader));
 
-  unsigned byte_count;
-  FunctionParam** param_buffer = (FunctionParam**) stackPush(buffer_pool, MAX_BUFFER_COUNT * sizeof(FunctionParam*));
+  ScratchList<FunctionParam*, 8> parameters;
 
   Token* current = tokens;
   node->start = tokens;
@@ -860,30 +1592,26 @@ FunctionHeader* functionHeader(Token*& tokens) {
     current++;
   }
 
-  if (!check(current++, TokenType::FUNC)) return (FunctionHeader*) resetStacks(node, param_buffer);
+  if (!check(current++, TokenType::FUNC)) return (FunctionHeader*) resetStack(node);
 
   node->identifier = identifier(current);
-  if (node->identifier == nullptr) return (FunctionHeader*) resetStacks(node, param_buffer);
+  if (node->identifier == nullptr) return (FunctionHeader*) resetStack(node);
 
-  if(!check(current++, TokenType::LEFT_PAREN)) return (FunctionHeader*) resetStacks(node, param_buffer);
+  if(!check(current++, TokenType::LEFT_PAREN)) return (FunctionHeader*) resetStack(node);
 
-  param_buffer[node->parameter_count] = functionParam(current);
-  while(param_buffer[node->parameter_count] != nullptr) {
+  for (FunctionParam* item = functionParam(current); item != nullptr; item = functionParam(current)) {
+    parameters.push(item);
     if (check(current, TokenType::COMMA)) current++;
-    param_buffer[++node->parameter_count] = functionParam(current);
   }
 
-  if(!check(current++, TokenType::RIGHT_PAREN)) return (FunctionHeader*) resetStacks(node, param_buffer);
-  if(!check(current++, TokenType::COLON)) return (FunctionHeader*) resetStacks(node, param_buffer);
+  if(!check(current++, TokenType::RIGHT_PAREN)) return (FunctionHeader*) resetStack(node);
+  if(!check(current++, TokenType::COLON)) return (FunctionHeader*) resetStack(node);
 
   node->return_type = type(current);
-  if (node->return_type == nullptr) return (FunctionHeader*) resetStacks(node, param_buffer);
-
-  byte_count = node->parameter_count * sizeof(FunctionParam*);
-  node->parameter_list = (FunctionParam**) stackPush(stack, byte_count); 
-  memcpy(node->parameter_list, param_buffer, byte_count);
+  if (node->return_type == nullptr) return (FunctionHeader*) resetStack(node);
 
-  resetBufferPool(param_buffer);
+  node->parameter_count = parameters.size;
+  node->parameter_list = stackCopy(parameters);
 
   tokens = current;
   node->type = ASTType::FUNC_HEADER;
@@ -892,7 +1620,97 @@ FunctionHeader* functionHeader(Token*& tokens) {
   return node;
 }
 
-Function* function(Token*& tokens) {
+// Returns the token after the '}' matching the '{' at tokens, or nullptr if it is not closed
+Token* skipBody(Token* tokens) {
+  int depth = 0;
+
+  do {
+    if (tokens->type == TokenType::END) return nullptr;
+    if (tokens->type == TokenType::LEFT_BRACE) depth++;
+    else if (tokens->type == TokenType::RIGHT_BRACE) depth--;
+    tokens++;
+  } while (depth > 0);
+
+  return tokens;
+}
+
+// The body stack of the calling thread, taken from the pool the first time
+BodyStack* threadBodyStack() {
+  BodyStack*& body_stack = parser_body_stack.body_stack;
+  if (body_stack == nullptr) {
+    std::lock_guard<std::mutex> lock(parser_body_mutex);
+
+    if (!parser_free_body_stacks.empty()) {
+      body_stack = parser_free_body_stacks.back();
+      parser_free_body_stacks.pop_back();
+    }
+    else {
+      body_stack = new BodyStack{nullptr, {}};
+      parser_body_stacks.push_back(body_stack);
+    }
+  }
+
+  body_stack->stack = prepareStack(body_stack->stack);
+  return body_stack;
+}
+
+Block* functionBody(Function* node) {
+  BodyState state = node->body_state.load(std::memory_order_acquire);
+  if (state == BodyState::PARSED) return node->block;
+  if (state == BodyState::FAILED) return nullptr;
+
+  BodyState expected = BodyState::PENDING;
+  if (!node->body_state.compare_exchange_strong(expected, BodyState::PARSING, std::memory_order_acquire)) {
+    while (node->body_state.load(std::memory_order_acquire) == BodyState::PARSING) std::this_thread::yield();
+    return node->block;
+  }
+
+  Stack* saved_stack = stack;
+  BodyStack* body_stack = threadBodyStack();
+  stack = body_stack->stack;
+  void* body_mark = stack->current;
+  parser_memo.floor = stack->current;
+  memoReset(node->body_start, node->body_end);
+
+  Token* tokens = node->body_start;
+  Block* body = block(tokens);
+  bool failed = body == nullptr || tokens != node->body_end;
+  if (failed) {
+    stackPop(stack, body_mark);
+    body = nullptr;
+  }
+  else {
+    body_stack->bodies.push_back(node);
+  }
+
+  stack = saved_stack;
+
+  node->block = body;
+  node->body_state.store(failed ? BodyState::FAILED : BodyState::PARSED, std::memory_order_release);
+  return body;
+}
+
+bool functionBodyFailed(Function* node) {
+  return node->body_state.load(std::memory_order_acquire) == BodyState::FAILED;
+}
+
+void functionBodyDrop(Function* node) {
+  if (node->body_state.load(std::memory_order_acquire) != BodyState::PARSED || node->body_start == nullptr) return;
+
+  // Popping anything else would free the bodies parsed after node
+  BodyStack* body_stack = parser_body_stack.body_stack;
+  assert(body_stack != nullptr && !body_stack->bodies.empty() && body_stack->bodies.back() == node &&
+      "functionBodyDrop: not the last body this thread parsed");
+
+  // The Block is the first node blockRule pushes, popping to it frees the body
+  stackPop(body_stack->stack, (void*) node->block);
+  body_stack->bodies.pop_back();
+
+  node->block = nullptr;
+  node->body_state.store(BodyState::PENDING, std::memory_order_release);
+}
+
+Function* functionRule(Token*& tokens) {
   Function* node = (Function*) stackPush(stack, sizeof(Function));
 
   Token* current = tokens;
@@ -901,6 +1719,21 @@ Function* function(Token*& tokens) {
   node->header = functionHeader(current);
   if (node->header == nullptr) return (Function*) resetStack(node);
 
+  if (parser_lazy_bodies && check(current, TokenType::LEFT_BRACE)) {
+    node->body_start = current;
+    current = skipBody(current);
+    if (current == nullptr) return (Function*) resetStack(node);
+
+    node->body_end = current;
+    node->body_state.store(BodyState::PENDING, std::memory_order_relaxed);
+
+    tokens = current;
+    node->type = ASTType::FUNCTION;
+    node->end = current;
+    DEBUG("Match Lazy Function Definition", node->start, node->end);
+    return node;
+  }
+
   if (check(current, TokenType::SEMI)) {
     tokens = ++current;
     node->type = ASTType::FUNC_FORWARD;
@@ -919,35 +1752,30 @@ Function* function(Token*& tokens) {
   return node;
 }
 
-Struct* struct_(Token*& tokens) {
+Struct* struct_Rule(Token*& tokens) {
   Struct* node = (Struct*) stackPush(stack, sizeof(Struct));
 
-  unsigned byte_count;
-  Declaration** decl_buffer = (Declaration**) stackPush(buffer_pool, MAX_BUFFER_COUNT * sizeof(Declaration*));
+  ScratchList<Declaration*, 16> declarations;
 
   Token* current = tokens;
   node->start = tokens;
 
-  if (!check(current++, TokenType::STRUCT)) return (Struct*) resetStacks(node, decl_buffer);
+  if (!check(current++, TokenType::STRUCT)) return (Struct*) resetStack(node);
   
   node->identifier = identifier(current);
   if (node->identifier == nullptr) return (Struct*) resetStack(node);
 
-  if (!check(current++, TokenType::LEFT_BRACE)) return (Struct*) resetStacks(node, decl_buffer);
+  if (!check(current++, TokenType::LEFT_BRACE)) return (Struct*) resetStack(node);
 
-  decl_buffer[node->declarations_count] = declaration(current);
-  while (decl_buffer[node->declarations_count] != nullptr) {
-    decl_buffer[++node->declarations_count] = declaration(current);
+  for (Declaration* item = declaration(current); item != nullptr; item = declaration(current)) {
+    declarations.push(item);
   }
 
-  if (!check(current++, TokenType::RIGHT_BRACE)) return (Struct*) resetStacks(node, decl_buffer);
-  if (!check(current++, TokenType::SEMI)) return (Struct*) resetStacks(node, decl_buffer);
+  if (!check(current++, TokenType::RIGHT_BRACE)) return (Struct*) resetStack(node);
+  if (!check(current++, TokenType::SEMI)) return (Struct*) resetStack(node);
 
-  byte_count = node->declarations_count * sizeof(Declaration*);
-  node->declarations = (Declaration**) stackPush(stack, byte_count); 
-  memcpy(node->declarations, decl_buffer, byte_count);
-
-  resetBufferPool(decl_buffer);
+  node->declarations_count = declarations.size;
+  node->declarations = stackCopy(declarations);
 
   tokens = current;
   node->type = ASTType::STRUCT;
@@ -956,35 +1784,31 @@ Struct* struct_(Token*& tokens) {
   return node;
 }
 
-Enum* enum_(Token*& tokens) {
+Enum* enum_Rule(Token*& tokens) {
   Enum* node = (Enum*) stackPush(stack, sizeof(Enum));
 
-  unsigned byte_count;
-  Token** token_buffer = (Token**) stackPush(buffer_pool, MAX_BUFFER_COUNT * sizeof(Token*));
+  ScratchList<Token*, 16> members;
 
   Token* current = tokens;
   node->start = tokens;
 
-  if (!check(current++, TokenType::ENUM)) return (Enum*) resetStacks(node, token_buffer);
+  if (!check(current++, TokenType::ENUM)) return (Enum*) resetStack(node);
 
   node->identifier = identifier(current);
-  if (node->identifier == nullptr) return (Enum*) resetStacks(node, token_buffer);
+  if (node->identifier == nullptr) return (Enum*) resetStack(node);
 
-  if (!check(current++, TokenType::LEFT_BRACE)) return (Enum*) resetStacks(node, token_buffer);
+  if (!check(current++, TokenType::LEFT_BRACE)) return (Enum*) resetStack(node);
 
   while (check(current, TokenType::IDENTIFIER)) {
-    token_buffer[node->members_count++] = current++;
+    members.push(current++);
     if (check(current, TokenType::COMMA)) current++;
   }
 
-  if (!check(current++, TokenType::RIGHT_BRACE)) return (Enum*) resetStacks(node, token_buffer);
-  if (!check(current++, TokenType::SEMI)) return (Enum*) resetStacks(node, token_buffer);
-
-  byte_count = node->members_count * sizeof(Token*);
-  node->members = (Token**) stackPush(stack, byte_count);
-  memcpy(node->members, token_buffer, byte_count);
+  if (!check(current++, TokenType::RIGHT_BRACE)) return (Enum*) resetStack(node);
+  if (!check(current++, TokenType::SEMI)) return (Enum*) resetStack(node);
 
-  resetBufferPool(token_buffer);
+  node->members_count = members.size;
+  node->members = stackCopy(members);
 
   tokens = current;
   node->type = ASTType::ENUM;
@@ -994,7 +1818,120 @@ Enum* enum_(Token*& tokens) {
 
 }
 
-PrimaryTag* primary_tag(Token*& tokens) {
+Identifier* identifier(Token*& tokens) {
+  return memoize<Identifier>(ParserRule::IDENTIFIER, tokens, identifierRule);
+}
+
+Type* type(Token*& tokens) {
+  return memoize<Type>(ParserRule::TYPE, tokens, typeRule);
+}
+
+Declaration* declaration(Token*& tokens) {
+  return memoize<Declaration>(ParserRule::DECLARATION, tokens, declarationRule);
+}
+
+Assignment* assignment(Token*& tokens) {
+  return memoize<Assignment>(ParserRule::ASSIGNMENT, tokens, assignmentRule);
+}
+
+Statement* statement(Token*& tokens) {
+  return memoize<Statement>(ParserRule::STATEMENT, tokens, statementRule);
+}
+
+BlockTag* blockTag(Token*& tokens) {
+  return memoize<BlockTag>(ParserRule::BLOCK_TAG, tokens, blockTagRule);
+}
+
+Block* block(Token*& tokens) {
+  return memoize<Block>(ParserRule::BLOCK, tokens, blockRule);
+}
+
+Literal* literal(Token*& tokens) {
+  return memoize<Literal>(ParserRule::LITERAL, tokens, literalRule);
+}
+
+Call* call(Token*& tokens) {
+  return memoize<Call>(ParserRule::CALL, tokens, callRule);
+}
+
+Unary* unary(Token*& tokens) {
+  return memoize<Unary>(ParserRule::UNARY, tokens, unaryRule);
+}
+
+Binary* binary(Token*& tokens) {
+  return memoize<Binary>(ParserRule::BINARY, tokens, binaryRule);
+}
+
+FunctionParam* functionParam(Token*& tokens) {
+  return memoize<FunctionParam>(ParserRule::FUNCTION_PARAM, tokens, functionParamRule);
+}
+
+Function* function(Token*& tokens) {
+  return memoize<Function>(ParserRule::FUNCTION, tokens, functionRule);
+}
+
+Struct* struct_(Token*& tokens) {
+  return memoize<Struct>(ParserRule::STRUCT, tokens, struct_Rule);
+}
+
+Enum* enum_(Token*& tokens) {
+  return memoize<Enum>(ParserRule::ENUM, tokens, enum_Rule);
+}
+
+Expr* expr(Token*& tokens, bool check_binary) {
+  if (check_binary) {
+    return memoize<Expr>(ParserRule::EXPR, tokens, [](Token*& tokens) { return exprRule(tokens, true); });
+  }
+  return memoize<Expr>(ParserRule::EXPR_OPERAND, tokens, [](Token*& tokens) { return exprRule(tokens, false); });
+}
+
+PrimaryTag* primaryTagPredictive(Token*& tokens) {
+  PrimaryTag* node = (PrimaryTag*) stackPush(stack, sizeof(PrimaryTag));
+  node->start = tokens;
+
+  switch (tokens->type) {
+    case TokenType::STRUCT:
+      node->type = ASTType::PRIMARY_TAG_STRUCT;
+      node->struct_ = struct_(tokens);
+      break;
+
+    case TokenType::ENUM:
+      node->type = ASTType::PRIMARY_TAG_ENUM;
+      node->enum_ = enum_(tokens);
+      break;
+
+    case TokenType::EXPORT:
+      // export is also a declaration qualifier
+      if (!check(tokens + 1, TokenType::FUNC)) {
+        node->type = ASTType::PRIMARY_TAG_DECL;
+        node->decl = declaration(tokens);
+        break;
+      }
+      // fall through
+    case TokenType::FUNC:
+      node->type = ASTType::PRIMARY_TAG_FUNC;
+      node->func = function(tokens);
+      break;
+
+    default:
+      node->type = ASTType::PRIMARY_TAG_DECL;
+      node->decl = declaration(tokens);
+      break;
+  }
+
+  // All alternatives share the union
+  if (node->decl == nullptr) {
+    resetStack(node);
+    assert(false && "Primary tag");
+  }
+
+  node->end = tokens;
+  return node;
+}
+
+PrimaryTag* primaryTagRule(Token*& tokens) {
+  if (parser_predictive) return primaryTagPredictive(tokens);
+
   PrimaryTag* node = (PrimaryTag*) stackPush(stack, sizeof(PrimaryTag));
   node->start = tokens;
   
@@ -1034,42 +1971,284 @@ PrimaryTag* primary_tag(Token*& tokens) {
   assert(false && "Primary tag");
 }
 
+PrimaryTag* primary_tag(Token*& tokens) {
+  PROFILE_ENTER(ParserRule::PRIMARY_TAG);
+  PrimaryTag* node = primaryTagRule(tokens);
+  PROFILE_EXIT(ParserRule::PRIMARY_TAG, node);
+  return node;
+}
+
 Primary* primary(Token*& tokens) { 
   Primary* node = (Primary*) stackPush(stack, sizeof(Primary));
 
-  unsigned byte_count;
-  PrimaryTag** tag_buffer = (PrimaryTag**) stackPush(buffer_pool, MAX_BUFFER_COUNT * sizeof(PrimaryTag*));
+  ScratchList<PrimaryTag*, 64> tags;
   node->start = tokens;
 
   while (tokens->type != TokenType::END) {
-    PrimaryTag* tag = primary_tag(tokens);
-    tag_buffer[node->primary_tags_count++] = tag;
+    tags.push(primary_tag(tokens));
   }
 
-  byte_count = node->primary_tags_count * sizeof(PrimaryTag*);
-  node->primary_tags = (PrimaryTag**) stackPush(stack, byte_count);
-  memcpy(node->primary_tags, tag_buffer, byte_count);
-
-  resetBufferPool(tag_buffer);
+  node->primary_tags_count = tags.size;
+  node->primary_tags = stackCopy(tags);
 
   node->type = ASTType::PRIMARY;
   node->end = tokens;
   return node;
 }
 
+/*
+ * Counts the tokens of the next top level item without taking any from the lexer.
+ * An item ends at a ';' outside of braces or at the '}' closing its outermost brace,
+ * a ';' directly after that brace is part of the item. Returns -1 if the lexer does
+ * not hold the whole item yet or lexing fails.
+ */
+int peekItem(Lexer* lexer) {
+  int depth = 0;
+
+  for (int offset = 0; true; offset++) {
+    Token* token = lexerPeek(lexer, offset);
+    if (token == nullptr) return -1;
+    if (token->type == TokenType::END) return offset;
+
+    if (token->type == TokenType::LEFT_BRACE) {
+      depth++;
+    }
+    else if (token->type == TokenType::RIGHT_BRACE && --depth == 0) {
+      token = lexerPeek(lexer, offset + 1);
+      if (token == nullptr) return -1;
+      return token->type == TokenType::SEMI ? offset + 2 : offset + 1;
+    }
+    else if (token->type == TokenType::SEMI && depth == 0) {
+      return offset + 1;
+    }
+  }
+}
+
+// Copies count tokens onto the stack followed by an END token, the tree of the item points into these copies
+Token* pullItem(Lexer* lexer, int count) {
+  Token* item = (Token*) stackPush(stack, (count + 1) * sizeof(Token));
+  for (int i = 0; i < count; i++) item[i] = *lexerNext(lexer);
+  item[count].type = TokenType::END;
+  return item;
+}
+
+// The tags of the next item, nullptr and why there is no item in status otherwise
+Primary* primary(Lexer* lexer, ParseStatus& status) {
+  int count = peekItem(lexer);
+  if (count <= 0) {
+    if (count == 0) status = ParseStatus::END;
+    else status = lexer->failed ? ParseStatus::FAILED : ParseStatus::NEED_INPUT;
+    return nullptr;
+  }
+
+  Primary* node = (Primary*) stackPush(stack, sizeof(Primary));
+
+  ScratchList<PrimaryTag*, 64> tags;
+
+  Token* tokens = pullItem(lexer, count);
+  node->start = tokens;
+  memoReset(tokens);
+
+  while (tokens->type != TokenType::END) {
+    tags.push(primary_tag(tokens));
+  }
+
+  node->end = tokens;
+  node->primary_tags_count = tags.size;
+  node->primary_tags = stackCopy(tags);
+
+  node->type = ASTType::PRIMARY;
+  status = ParseStatus::ITEM;
+  return node;
+}
+
+/*
+ * Parallel parsing. Top level items only refer to each other by name, so once
+ * their token ranges are known they parse independently. A pre-pass walks the
+ * tokens by brace depth, with the item rule of pullItem, and cuts them into one
+ * run of whole items per thread. Every thread parses its run into its own stack
+ * and memo table, then the tags are merged into one Primary in source order.
+ */
+
+// Fewer tokens per thread are not worth the thread start up
+#define PARSER_PARALLEL_MIN_TOKENS 16384
+
+struct ParseRun {
+  Token* start;
+  Token* end;
+  Stack* stack;
+  bool memoize;
+
+  PrimaryTag** tags;
+  int tags_count;
+  ParserMemoStats memo_stats;
+#ifdef PARSER_PROFILE
+  ParserProfile profile;
+#endif
+};
+
+// Returns the token after the top level item starting at tokens
+Token* skipItem(Token* tokens) {
+  int depth = 0;
+
+  while (tokens->type != TokenType::END) {
+    TokenType type = (tokens++)->type;
+
+    if (type == TokenType::LEFT_BRACE) {
+      depth++;
+    }
+    else if (type == TokenType::RIGHT_BRACE && --depth == 0) {
+      if (tokens->type == TokenType::SEMI) tokens++;
+      break;
+    }
+    else if (type == TokenType::SEMI && depth == 0) {
+      break;
+    }
+  }
+
+  return tokens;
+}
+
+void parseRun(ParseRun* run) {
+  stack = run->stack;
+  parser_memo.enabled = run->memoize;
+  parser_memo.floor = stack->current;
+  memoReset(run->start, run->end);
+
+  ScratchList<PrimaryTag*, 64> tags;
+  Token* tokens = run->start;
+
+  while (tokens < run->end) {
+    tags.push(primary_tag(tokens));
+  }
+  assert(tokens == run->end && "parseParallel: item parsed past its run");
+
+  run->tags_count = tags.size;
+  run->tags = stackCopy(tags);
+  run->memo_stats = parser_memo.stats;
+#ifdef PARSER_PROFILE
+  run->profile = parser_profile;
+#endif
+}
+
+void parseWorker(ParseRun* run) {
+  parseRun(run);
+  // The memo table dies with the thread
+  free(parser_memo.entries);
+}
+
+Primary* parseParallel(Token* tokens, int thread_count) {
+  if (thread_count <= 0) thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+  Token* end = tokens;
+  while (end->type != TokenType::END) end++;
+
+  size_t token_count = end - tokens;
+  size_t run_count = std::min<size_t>(thread_count, token_count / PARSER_PARALLEL_MIN_TOKENS);
+  if (run_count <= 1) return parse(tokens);
+
+  // Cut after the first item ending at or past each even split
+  std::vector<ParseRun> runs;
+  Token* current = tokens;
+  for (size_t i = 0; i < run_count && current < end; i++) {
+    Token* split = tokens + token_count * (i + 1) / run_count;
+
+    ParseRun run = {};
+    run.start = current;
+    while (current < split) current = skipItem(current);
+    run.end = current;
+    runs.push_back(run);
+  }
+
+  createStack();
+  PROFILE_RESET();
+  Primary* node = (Primary*) stackPush(stack, sizeof(Primary));
+
+  if (parser_worker_stacks.size() < runs.size() - 1) parser_worker_stacks.resize(runs.size() - 1);
+  for (size_t i = 0; i < runs.size(); i++) {
+    if (i > 0) runs[i].stack = parser_worker_stacks[i - 1] = prepareStack(parser_worker_stacks[i - 1]);
+    else runs[i].stack = stack;
+    runs[i].memoize = parser_memo.enabled;
+  }
+
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < runs.size(); i++) {
+    threads.emplace_back(parseWorker, &runs[i]);
+  }
+
+  parseRun(&runs[0]);
+
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  int tags_count = 0;
+  for (ParseRun& run : runs) tags_count += run.tags_count;
+
+  PrimaryTag** tags = (PrimaryTag**) stackPush(stack, tags_count * sizeof(PrimaryTag*));
+  int tag_index = 0;
+  for (ParseRun& run : runs) {
+    memcpy(tags + tag_index, run.tags, run.tags_count * sizeof(PrimaryTag*));
+    tag_index += run.tags_count;
+  }
+
+  // The calling thread counted its own run already
+  for (size_t i = 1; i < runs.size(); i++) {
+    parser_memo.stats.lookups += runs[i].memo_stats.lookups;
+    parser_memo.stats.hits += runs[i].memo_stats.hits;
+#ifdef PARSER_PROFILE
+    profileAdd(runs[i].profile);
+#endif
+  }
+
+  node->start = tokens;
+  node->end = end;
+  node->primary_tags_count = tags_count;
+  node->primary_tags = tags;
+  node->type = ASTType::PRIMARY;
+
+  recordArenaStats();
+  return node;
+}
+
 Primary* parse(Token* tokens) {
   Token* current = tokens;
   Primary* output;
 
-  stack = stackCreate(65536, true);
-  buffer_pool = stackCreate(65536);
+  createStack();
+  memoReset(current);
+  PROFILE_RESET();
 
   output = primary(current);
 
-  stackDestroy(buffer_pool);
+  recordArenaStats();
+  return output;
+}
+
+Primary* parseNext(Lexer* lexer, Primary* previous, ParseStatus* status) {
+  Primary* output;
+  ParseStatus output_status;
+
+  if (previous != nullptr) {
+    stackPop(stack, previous);
+    lexerRelease(lexer);
+  }
+
+  createStack();
+  PROFILE_RESET();
+
+  output = primary(lexer, output_status);
+  if (status != nullptr) *status = output_status;
+
+  recordArenaStats();
   return output;
 }
 
 void parse_destroy() {
-  stackDestroy(stack);
+  stackClear(stack, PARSER_RETAINED_BYTES);
+  for (Stack* worker : parser_worker_stacks) stackClear(worker, PARSER_RETAINED_BYTES);
+  for (BodyStack* body_stack : parser_body_stacks) {
+    stackClear(body_stack->stack, PARSER_RETAINED_BYTES);
+    body_stack->bodies.clear();
+  }
 }
@@ -2,6 +2,77 @@
 #include "lex.h"
 #include "ast_types.h"
 
+#include <cstddef>
+#include <cstdint>
+
 Primary* parse(Token* tokens);
+// Parses runs of top level items on up to thread_count threads, one per
+// hardware thread when thread_count <= 0. Gives the same tree as parse(tokens).
+Primary* parseParallel(Token* tokens, int thread_count = 0);
+enum class ParseStatus {
+  ITEM,
+  END,
+  // A lexer fed with lexerFeed does not hold the whole next item yet, no tokens were taken
+  NEED_INPUT,
+  FAILED,
+};
+
+// Pulls the next top level item from lexer and returns its tags, nullptr at
+// the end of input, if more input has to be fed first or if lexing fails, see
+// status. Passing the item the last call returned as previous frees it with
+// its tokens and their input, so memory follows the largest item rather than
+// the file. Anything parsed on the thread after previous is freed with it.
+Primary* parseNext(Lexer* lexer, Primary* previous = nullptr, ParseStatus* status = nullptr);
 void parse_destroy();
 
+// Picks productions from the next tokens instead of backtracking, on by default.
+// The backtracking parser is kept to test the two against each other.
+void parserSetPredictive(bool enabled);
+
+// function() stops after the header and keeps the body as a token range, off
+// by default. Passes get bodies from functionBody.
+void parserSetLazyBodies(bool enabled);
+
+// Parses a lazy body the first time it is asked for, any thread may ask. The
+// body lives until parse_destroy, which must not run concurrently. Returns
+// nullptr for a function without a body and for a body that does not parse,
+// see functionBodyFailed.
+Block* functionBody(Function* node);
+bool functionBodyFailed(Function* node);
+// Frees a lazy body, it is parsed again when asked for. node must be the last
+// body the calling thread parsed and not dropped yet, which is asserted.
+void functionBodyDrop(Function* node);
+
+struct ParserArenaStats {
+  size_t ast_size;
+  // Peak bytes used, including nodes freed by backtracking
+  size_t ast_high_water;
+  size_t ast_committed;
+};
+
+// Counters as of the end of the last parse. The arena is kept between parses
+// so the high water mark covers earlier parses too. Huge pages apply once the
+// arena is empty.
+ParserArenaStats parserArenaStats();
+void parserSetHugePages(bool enabled);
+
+struct ParserMemoStats {
+  uint64_t lookups;
+  uint64_t hits;
+};
+
+// Packrat memoization of rule results. Faster on inputs that backtrack a lot,
+// but failed attempts are no longer freed from the AST stack.
+void parserSetMemoize(bool enabled);
+ParserMemoStats parserMemoStats();
+void printParserMemoStats();
+
+enum class ParserProfileFormat {
+  TABLE,
+  JSON,
+};
+
+// Attempts, successes, rollbacks and bytes discarded per rule as of the end of
+// the last parse. The counters only exist in builds with PARSER_PROFILE.
+void printParserProfile(ParserProfileFormat format = ParserProfileFormat::TABLE);
+
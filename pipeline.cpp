@@ -0,0 +1,67 @@
+#include "pipeline.h"
+#include "codegen.h"
+#include "defref.h"
+#include "parser.h"
+#include "scope.h"
+#include "symbol.h"
+
+#include <cassert>
+#include <cstdio>
+
+bool pipeline_fused = false;
+
+void pipelineSetFused(bool enabled) {
+  pipeline_fused = enabled;
+}
+
+void reportBodyError(Function* node, LineIndex* lines) {
+  Token* name = node->header->identifier->identifier;
+  if (lines == nullptr) {
+    fprintf(stderr, "PARSE: Error in the body of %.*s\n", (int) (name->end - name->start), name->start);
+    return;
+  }
+
+  SourcePosition position = lineIndexLookup(lines, node->body_start);
+  fprintf(stderr, "PARSE: Error in the body of %.*s at line %u column %u\n", (int) (name->end - name->start),
+      name->start, position.line, position.column);
+}
+
+bool compilePipelined(Token* tokens, LineIndex* lines) {
+  parserSetLazyBodies(true);
+
+  Primary* primary = parse(tokens);
+  assert(primary != nullptr && "compilePipelined: does not parse");
+
+  visitDefRefDeclarations(primary, lines);
+  visitCodeGenDeclarations(primary);
+
+  // Everything created past here belongs to one body
+  size_t scopes_size = stackSize(scopes_stack);
+  size_t symbols_size = stackSize(symbol_stack);
+
+  for (int i = 0; i < primary->primary_tags_count; i++) {
+    PrimaryTag* tag = primary->primary_tags[i];
+    if (tag->type != ASTType::PRIMARY_TAG_FUNC || tag->func->type != ASTType::FUNCTION) continue;
+
+    // Parsed before any pass sees it so a broken body stops the module instead of lowering without it
+    if (functionBody(tag->func) == nullptr && functionBodyFailed(tag->func)) {
+      reportBodyError(tag->func, lines);
+      return false;
+    }
+
+    if (pipeline_fused) {
+      visitCodeGenFunctionFused(tag->func);
+    }
+    else {
+      visitDefRefFunction(tag->func);
+      visitCodeGenFunction(tag->func);
+    }
+
+    functionBodyDrop(tag->func);
+    scopeStackReset(scopes_size);
+    symbolStackReset(symbols_size);
+  }
+
+  visitCodeGenEnd();
+  return true;
+}
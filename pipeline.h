@@ -0,0 +1,22 @@
+#pragma once
+
+#include "lex.h"
+#include "line_index.h"
+
+/* Compiles a file one function at a time.
+ * Top level items are parsed with lazy bodies, every top level name is defined
+ * and every function declared in the module. Then each body is parsed,
+ * checked, lowered and printed, and its nodes, scopes, symbols and
+ * instructions are freed before the next one. Peak memory follows the largest
+ * function rather than the file. The tokens and the top level tree are still
+ * kept for the whole file.
+ */
+
+// Prints the declarations as one module, then each body as a module of its own,
+// see visitCodeGenFunction. Leaves lazy bodies on. Returns false if a function
+// body does not parse, the bodies after it are not printed.
+bool compilePipelined(Token* tokens, LineIndex* lines = nullptr);
+
+// Off by default. When on each body is checked and lowered in one walk by
+// visitCodeGenFunctionFused instead of one walk for each.
+void pipelineSetFused(bool enabled);
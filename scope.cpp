@@ -5,7 +5,9 @@
 #include "vector.h"
 #include <unordered_map>
 
+#ifndef NDEBUG
 #define SCOPE_DEBUG
+#endif
 
 #ifdef SCOPE_DEBUG
 #define SCOPE_DEBUG_ASSERT
@@ -30,23 +32,30 @@ Stack* scopes_stack;
 
 std::unordered_map<void*, Scope*> node_scope_map;
 
-void scopeStackCreate(int capacity) {
+void scopeStackCreate() {
   DEBUG_ASSERT(scopes_stack == nullptr && "scopeStackCreate: scope stack in not nullptr");
-  scopes_stack = stackCreate(capacity * sizeof(Scope));
+  scopes_stack = stackCreate();
   DEBUG_ASSERT(scopes_stack != nullptr && "scopeStackCreate: out of memory");
 }
 
-void scopeStackDestroy() {
+void scopeStackReset(size_t size) {
   DEBUG_ASSERT(scopes_stack != nullptr);
 
-  while (stackSize(scopes_stack) > 0) {
+  while (stackSize(scopes_stack) > size) {
     Scope* current = (Scope*) stackPop(scopes_stack, sizeof(Scope));
 
     DEBUG_ASSERT(current != nullptr);
     DEBUG_ASSERT(current->symbols != nullptr);
 
     htDestroy(current->symbols);
+    node_scope_map.erase(current->node);
   }
+}
+
+void scopeStackDestroy() {
+  DEBUG_ASSERT(scopes_stack != nullptr);
+
+  scopeStackReset(0);
 
   stackDestroy(scopes_stack);
   scopes_stack = nullptr;
@@ -58,6 +67,7 @@ Scope* scopeCreate(Scope* parent, void* node, int capacity) {
   Scope* scope = (Scope*) stackPush(scopes_stack, sizeof(Scope));
   scope->parent = parent;
   scope->symbols = htCreate(capacity);
+  scope->node = node;
 
   node_scope_map[node] = scope;
 
@@ -72,13 +82,13 @@ Scope* scopeGet(void* node) {
 
 void scopeDeclare(Scope* scope, Symbol* symbol) {
   DEBUG_ASSERT(scope != nullptr);
-  htSet(scope->symbols, symbol->start, symbol->end, symbol);
+  htSet(scope->symbols, symbol->id, symbol);
   DEBUG_PRINT("Scope declare: %p\n", scope);
 }
 
-Symbol* scopeResolve(Scope* scope, const char* start, const char* end) {
+Symbol* scopeResolve(Scope* scope, InternId id) {
   DEBUG_ASSERT(scope != nullptr);
-  Symbol* symbol = (Symbol*) htGet(scope->symbols, start, end);
+  Symbol* symbol = (Symbol*) htGet(scope->symbols, id);
   
   if (symbol != nullptr) {
     DEBUG_PRINT("Scope resolve: %p\n", scope);
@@ -86,15 +96,15 @@ Symbol* scopeResolve(Scope* scope, const char* start, const char* end) {
   }
 
   if (scope->parent != nullptr) {
-    return scopeResolve(scope->parent, start, end);
+    return scopeResolve(scope->parent, id);
   }
 
   return nullptr;
 }
 
-Symbol* scopeResolveMember(Scope* scope, const char* start, const char* end) {
+Symbol* scopeResolveMember(Scope* scope, InternId id) {
   DEBUG_ASSERT(scope != nullptr);
-  Symbol* symbol = (Symbol*) htGet(scope->symbols, start, end);
+  Symbol* symbol = (Symbol*) htGet(scope->symbols, id);
   
   if (symbol != nullptr) {
     DEBUG_PRINT("Scope resolve member: %p\n", scope);
@@ -103,9 +113,9 @@ Symbol* scopeResolveMember(Scope* scope, const char* start, const char* end) {
   return nullptr;
 }
 
-bool scopeIsDefined(Scope* scope, const char* start, const char* end) {
+bool scopeIsDefined(Scope* scope, InternId id) {
   DEBUG_ASSERT(scope != nullptr);
-  Symbol* symbol = (Symbol*) htGet(scope->symbols, start, end);
+  Symbol* symbol = (Symbol*) htGet(scope->symbols, id);
   if (symbol != nullptr) {
     return true;
   }
@@ -1,5 +1,6 @@
 #pragma once 
 #include "hash_table.h"
+#include "intern.h"
 #include "stack.h"
 
 extern Stack* scopes_stack;
@@ -9,17 +10,21 @@ struct Symbol;
 struct Scope {
   Scope* parent;
   HashTable* symbols;
+  // Key of the scope in scopeGet
+  void* node;
 };
 
-void scopeStackCreate(int capacity = 4096);
+void scopeStackCreate();
 void scopeStackDestroy();
+// Frees the scopes created since the scope stack had size bytes
+void scopeStackReset(size_t size);
 
 Scope* scopeCreate(Scope* parent, void* node, int capacity = 16);
 Scope* scopeGet(void* index);
 
 void scopeDeclare(Scope* scope, Symbol* symbol);
 
-Symbol* scopeResolve(Scope* scope, const char* start, const char* end);
-Symbol* scopeResolveMember(Scope* scope, const char* start, const char* end);
+Symbol* scopeResolve(Scope* scope, InternId id);
+Symbol* scopeResolveMember(Scope* scope, InternId id);
 
-bool scopeIsDefined(Scope* scope, const char* start, const char* end);
+bool scopeIsDefined(Scope* scope, InternId id);
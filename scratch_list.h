@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdlib>
+#include <cstring>
+
+/* A list for collecting items whose count is not known up front.
+ * The first N items are stored inline so short lists never allocate. Longer
+ * lists move to the heap and double in size. Items are copied with memcpy,
+ * T must be trivially copyable.
+ */
+template <typename T, int N>
+struct ScratchList {
+  T* data;
+  int size;
+  int capacity;
+  T inline_items[N];
+
+  ScratchList() : data(inline_items), size(0), capacity(N) {}
+
+  ~ScratchList() {
+    if (data != inline_items) free(data);
+  }
+
+  ScratchList(const ScratchList&) = delete;
+  ScratchList& operator=(const ScratchList&) = delete;
+
+  T& operator[](int index) {
+    return data[index];
+  }
+
+  void push(T item) {
+    if (size == capacity) grow();
+    data[size++] = item;
+  }
+
+  T pop() {
+    return data[--size];
+  }
+
+  T& back() {
+    return data[size - 1];
+  }
+
+  void grow() {
+    int new_capacity = capacity * 2;
+    T* new_data = (T*) malloc(new_capacity * sizeof(T));
+    memcpy(new_data, data, size * sizeof(T));
+
+    if (data != inline_items) free(data);
+    data = new_data;
+    capacity = new_capacity;
+  }
+};
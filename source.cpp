@@ -0,0 +1,60 @@
+#include "source.h"
+
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef SOURCE_DEBUG
+#include <cstdio>
+#define DEBUG_PRINT(...) fprintf(stderr, __VA_ARGS__)
+#else
+#define DEBUG_PRINT(...)
+#endif
+
+Source* sourceOpen(const char* path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return nullptr;
+
+  struct stat info;
+  if (fstat(fd, &info) != 0) {
+    close(fd);
+    return nullptr;
+  }
+
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  size_t size = info.st_size;
+  size_t file_pages = (size + page_size - 1) / page_size * page_size;
+  size_t padding = (SOURCE_PADDING + page_size - 1) / page_size * page_size;
+
+  // Reserve the whole range as zero pages, then map the file over the front.
+  // The kernel zero fills the tail of the last file page.
+  void* mapping = mmap(nullptr, file_pages + padding, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapping == MAP_FAILED) {
+    close(fd);
+    return nullptr;
+  }
+
+  if (size > 0 && mmap(mapping, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+    munmap(mapping, file_pages + padding);
+    close(fd);
+    return nullptr;
+  }
+
+  close(fd);
+
+  Source* source = (Source*) malloc(sizeof(Source));
+  source->data = (const char*) mapping;
+  source->size = size;
+  source->mapping = mapping;
+  source->mapping_size = file_pages + padding;
+
+  DEBUG_PRINT("sourceOpen: %s size = %zu mapping = %p\n", path, size, mapping);
+  return source;
+}
+
+void sourceClose(Source* source) {
+  munmap(source->mapping, source->mapping_size);
+  free(source);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+
+/* A read only source buffer.
+ * Files are mapped with PROT_READ and followed by at least one page of zero
+ * bytes, so data is '\0' terminated and the lexer can read past the end of any
+ * token without bounds checks. Nothing downstream may write to data, a Source
+ * can be shared by any number of compilations.
+ */
+
+#define SOURCE_PADDING 4096
+
+struct Source {
+  const char* data;
+  size_t size;
+
+  void* mapping;
+  size_t mapping_size;
+};
+
+// Returns nullptr if the file can not be opened or mapped
+Source* sourceOpen(const char* path);
+void sourceClose(Source* source);
@@ -2,6 +2,7 @@
 
 #include <cstdlib>
 #include <cstring>
+#include <sys/mman.h>
 
 #define STACK_DEBUG_ASSERT
 
@@ -25,16 +26,56 @@
 #endif
 
 
-Stack* stackCreate(int capacity, bool zero_initalize) {
+#define STACK_COMMIT_GRANULARITY 65536
+#define STACK_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+#define STACK_MAP_FLAGS (MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE)
+
+size_t alignUp(size_t value, size_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+void adviseHugePages(void* start, size_t size) {
+#ifdef MADV_HUGEPAGE
+  madvise(start, size, MADV_HUGEPAGE);
+#endif
+}
+
+Stack* stackCreate(size_t reserve, bool zero_initalize, bool huge_pages) {
   Stack* output = (Stack*) malloc(sizeof(Stack));
-  output->base = (uint8_t*) malloc(capacity);
-  
-  DEBUG_ASSERT(output->base != nullptr && "stackCreate out of memory");
+  if (output == nullptr) {
+    DEBUG_ASSERT(false && "stackCreate out of memory");
+    abort();
+  }
+  output->commit_granularity = huge_pages ? STACK_HUGE_PAGE_SIZE : STACK_COMMIT_GRANULARITY;
+  output->reserved = alignUp(reserve, output->commit_granularity);
+
+  // PROT_NONE pages only take address space. Huge pages need an aligned range,
+  // so over reserve by one huge page and trim both ends.
+  size_t slop = huge_pages ? STACK_HUGE_PAGE_SIZE : 0;
+  void* mapping = mmap(nullptr, output->reserved + slop, PROT_NONE, STACK_MAP_FLAGS, -1, 0);
+  if (mapping == MAP_FAILED) {
+    DEBUG_ASSERT(false && "stackCreate out of address space");
+    abort();
+  }
+
+  uint8_t* base = (uint8_t*) mapping;
+  if (slop > 0) {
+    base = (uint8_t*) alignUp((uintptr_t) mapping, STACK_HUGE_PAGE_SIZE);
+    uint8_t* mapping_end = (uint8_t*) mapping + output->reserved + slop;
+    if (base > (uint8_t*) mapping) munmap(mapping, base - (uint8_t*) mapping);
+    if (mapping_end > base + output->reserved) munmap(base + output->reserved, mapping_end - (base + output->reserved));
+    adviseHugePages(base, output->reserved);
+  }
 
-  output->current = output->base;
-  output->capacity = capacity;
+  output->base = base;
+  output->current = base;
+  output->committed = base;
+  output->dirty = base;
+  output->high_water = base;
   output->zero_initialize = zero_initalize;
-  DEBUG_PRINT("stackCreate: capacity = %i\n", capacity);
+  output->huge_pages = huge_pages;
+  DEBUG_PRINT("stackCreate: reserved = %zu\n", output->reserved);
 
   return output;
 }
@@ -42,41 +83,96 @@ Stack* stackCreate(int capacity, bool zero_initalize) {
 void stackDestroy(Stack* stack) {
   DEBUG_ASSERT(stack != nullptr && "stackDestroy nullptr");
 
-  free(stack->base);
+  munmap(stack->base, stack->reserved);
   free(stack);
 
   DEBUG_PRINT("stackDestroy: %p\n", stack);
 }
 
-void* stackPush(Stack* stack, int size) {
-  if (stack->current - stack->base + size >= stack->capacity) {
+// Commits whole granules up to at least end
+__attribute__((noinline))
+void stackCommit(Stack* stack, uint8_t* end) {
+  size_t used = end - stack->base;
+  if (used > stack->reserved) {
+    DEBUG_ASSERT(false && "stackPush out of reserved memory");
+    abort();
+  }
+
+  size_t commit = alignUp(used, stack->commit_granularity);
+  if (commit > stack->reserved) commit = stack->reserved;
 
+  uint8_t* commit_end = stack->base + commit;
+  if (mprotect(stack->committed, commit_end - stack->committed, PROT_READ | PROT_WRITE) != 0) {
+    DEBUG_ASSERT(false && "stackPush out of memory");
+    abort();
   }
 
-  void* output = stack->current;
-  stack->current += size;
+  DEBUG_PRINT("stackCommit: stack: %p committed = %zu\n", stack, commit);
+  stack->committed = commit_end;
+}
+
+void* stackPush(Stack* stack, size_t size) {
+  uint8_t* output = stack->current;
+  uint8_t* end = output + size;
 
-  if (stack->zero_initialize) memset(output, 0, size);
+  if (end > stack->committed) stackCommit(stack, end);
+  stack->current = end;
+
+  // Fresh pages are already zero, only memory that was pushed and popped before is dirty
+  if (end > stack->dirty) {
+    if (stack->zero_initialize && output < stack->dirty) memset(output, 0, stack->dirty - output);
+    stack->dirty = end;
+    if (end > stack->high_water) stack->high_water = end;
+  } else if (stack->zero_initialize) {
+    memset(output, 0, size);
+  }
 
-  DEBUG_PRINT("stackPush: stack: %p size = %i\n", stack, size);
+  DEBUG_PRINT("stackPush: stack: %p size = %zu\n", stack, size);
   return output;
 }
 
-void* stackPop(Stack* stack, int size) {
-  DEBUG_ASSERT(stack->current - size >= stack->base && "stackPop underflow");
+void* stackPop(Stack* stack, size_t size) {
+  DEBUG_ASSERT(size <= (size_t) (stack->current - stack->base) && "stackPop underflow");
   stack->current -= size;
-  DEBUG_PRINT("stackPop: stack: %p size = %i\n", stack, size);
+  DEBUG_PRINT("stackPop: stack: %p size = %zu\n", stack, size);
   return stack->current;
 }
 
 void* stackPop(Stack* stack, void *reset_ptr) {
-  DEBUG_ASSERT(reset_ptr < stack->current && reset_ptr >= stack->base);
+  DEBUG_ASSERT(reset_ptr <= stack->current && reset_ptr >= stack->base && "stackPop reset out of range");
   stack->current = (uint8_t*) reset_ptr;
   DEBUG_PRINT("stackReset: stack: %p reset_ptr = %p\n", stack, reset_ptr);
   return stack->current;
 }
 
-int stackSize(Stack* stack) {
+void stackClear(Stack* stack, size_t retain) {
+  stack->current = stack->base;
+
+  uint8_t* retain_end = stack->base + alignUp(retain, stack->commit_granularity);
+  if (stack->committed <= retain_end) return;
+
+  // Mapping fresh PROT_NONE pages over the tail frees it and makes it zero again
+  size_t size = stack->committed - retain_end;
+  void* mapping = mmap(retain_end, size, PROT_NONE, STACK_MAP_FLAGS | MAP_FIXED, -1, 0);
+  if (mapping == MAP_FAILED) {
+    DEBUG_ASSERT(false && "stackClear failed to decommit");
+    abort();
+  }
+  if (stack->huge_pages) adviseHugePages(retain_end, size);
+
+  stack->committed = retain_end;
+  if (stack->dirty > retain_end) stack->dirty = retain_end;
+  DEBUG_PRINT("stackClear: stack: %p committed = %zu\n", stack, retain_end - stack->base);
+}
+
+size_t stackSize(Stack* stack) {
   return stack->current - stack->base;
 }
 
+size_t stackHighWater(Stack* stack) {
+  return stack->high_water - stack->base;
+}
+
+size_t stackCommitted(Stack* stack) {
+  return stack->committed - stack->base;
+}
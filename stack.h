@@ -1,20 +1,42 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 
+/* A bump allocator over one reserved range of virtual memory.
+ * The whole range is reserved up front and pages are committed as the stack
+ * grows, so pointers into a Stack stay valid until it is popped past them or
+ * destroyed. Committed pages are only given back by stackClear.
+ */
+
+#define STACK_DEFAULT_RESERVE ((size_t) 1 << 32)
+
 struct Stack {
   uint8_t* base;
   uint8_t* current;
-  int capacity;
+  // End of the readable and writable pages
+  uint8_t* committed;
+  // Highest current since the pages were last committed. Memory above it is still zero.
+  uint8_t* dirty;
+  // Highest current since stackCreate, stackClear does not lower it
+  uint8_t* high_water;
+  size_t reserved;
+  size_t commit_granularity;
   bool zero_initialize;
+  bool huge_pages;
 };
 
-Stack* stackCreate(int capacity, bool zero_initalize = false);
+// huge_pages asks for transparent huge pages and commits in huge page steps
+Stack* stackCreate(size_t reserve = STACK_DEFAULT_RESERVE, bool zero_initalize = false, bool huge_pages = false);
 void stackDestroy(Stack* stack);
 
-void* stackPush(Stack* stack, int size);
-void* stackPop(Stack* stack, int size);
+void* stackPush(Stack* stack, size_t size);
+void* stackPop(Stack* stack, size_t size);
 void* stackPop(Stack* stack, void *reset_ptr);
+// Pops everything and decommits all but the first retain bytes
+void stackClear(Stack* stack, size_t retain);
 
-int stackSize(Stack* stack);
-
+size_t stackSize(Stack* stack);
+// Peak size since stackCreate
+size_t stackHighWater(Stack* stack);
+size_t stackCommitted(Stack* stack);
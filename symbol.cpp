@@ -25,16 +25,16 @@ void printSymbol(Symbol* symbol) {
 
 }
 
-void symbolStackCreate(int capacity) {
+void symbolStackCreate() {
   SYMBOL_ASSERT(symbol_stack == nullptr && "symbolStackCreate: symbol stack is not nullptr");
-  symbol_stack = stackCreate(capacity * sizeof(Symbol));
+  symbol_stack = stackCreate();
   SYMBOL_ASSERT(symbol_stack != nullptr && "symbolStackCreate: out of memory");
 }
 
-void symbolStackDestroy() {
+void symbolStackReset(size_t size) {
   SYMBOL_ASSERT(symbol_stack != nullptr);
 
-  while (stackSize(symbol_stack) > 0) {
+  while (stackSize(symbol_stack) > size) {
     Symbol* symbol = (Symbol*) stackPop(symbol_stack, sizeof(Symbol));
     switch (symbol->type) {
       case SymbolType::POINTER:
@@ -53,49 +53,58 @@ void symbolStackDestroy() {
         break;
     }
   }
+}
+
+void symbolStackDestroy() {
+  SYMBOL_ASSERT(symbol_stack != nullptr);
+
+  symbolStackReset(0);
 
   stackDestroy(symbol_stack);
   symbol_stack = nullptr;
 }
 
-Symbol* symbolCreateVariable(SymbolType type, const char* start, const char* end) {
+Symbol* symbolCreateVariable(SymbolType type, const char* start, const char* end, InternId id) {
   SYMBOL_ASSERT(symbol_stack != nullptr);
 
   Symbol* symbol = (Symbol*) stackPush(symbol_stack, sizeof(Symbol));
   symbol->type = type;
   symbol->start = start;
   symbol->end = end;
+  symbol->id = id;
 
   return symbol;
 }
 
-Symbol* symbolCreatePointer(const char* start, const char* end) {
+Symbol* symbolCreatePointer(const char* start, const char* end, InternId id) {
   SYMBOL_ASSERT(symbol_stack != nullptr);
 
   Symbol* symbol = (Symbol*) stackPush(symbol_stack, sizeof(Symbol));
   symbol->type = SymbolType::POINTER;
   symbol->start = start;
   symbol->end = end;
+  symbol->id = id;
 
   // TODO: get actual type of pointer and make linked list
 
   return symbol;
 }
 
-Symbol* symbolCreateEnum(const char* start, const char* end) {
+Symbol* symbolCreateEnum(const char* start, const char* end, InternId id) {
   SYMBOL_ASSERT(symbol_stack != nullptr);
 
   Symbol* symbol = (Symbol*) stackPush(symbol_stack, sizeof(Symbol));
   symbol->type = SymbolType::ENUM;
   symbol->start = start;
   symbol->end = end;
+  symbol->id = id;
 
   symbol->enum_.table = htCreate(ENUM_INITIAL_CAPACITY);
 
   return symbol;
 }
 
-Symbol* symbolCreateEnumInstance(const char* start, const char* end, EnumComponent* enum_decl) {
+Symbol* symbolCreateEnumInstance(const char* start, const char* end, InternId id, EnumComponent* enum_decl) {
   SYMBOL_ASSERT(symbol_stack != nullptr);
   SYMBOL_ASSERT(enum_decl != nullptr);
   SYMBOL_ASSERT(enum_decl->type == SymbolType::ENUM);
@@ -104,19 +113,21 @@ Symbol* symbolCreateEnumInstance(const char* start, const char* end, EnumCompone
   symbol->type = SymbolType::ENUM_INSTANCE;
   symbol->start = start;
   symbol->end = end;
+  symbol->id = id;
 
   symbol->enum_instance.enum_decl = enum_decl;
 
   return symbol;
 }
 
-Symbol* symbolCreateStruct(void* node, const char* start, const char* end, Scope* parent) {
+Symbol* symbolCreateStruct(void* node, const char* start, const char* end, InternId id, Scope* parent) {
   SYMBOL_ASSERT(symbol_stack != nullptr);
 
   Symbol* symbol = (Symbol*) stackPush(symbol_stack, sizeof(Symbol));
   symbol->type = SymbolType::STRUCT;
   symbol->start = start;
   symbol->end = end;
+  symbol->id = id;
 
   symbol->struct_.members_table = scopeCreate(parent, node);
   symbol->struct_.members_vector = vecCreate(STRUCT_INITIAL_CAPACITY, sizeof(Symbol*));
@@ -125,7 +136,7 @@ Symbol* symbolCreateStruct(void* node, const char* start, const char* end, Scope
   return symbol;
 }
 
-Symbol* symbolCreateStructInstance(const char* start, const char* end, StructComponent* struct_decl) {
+Symbol* symbolCreateStructInstance(const char* start, const char* end, InternId id, StructComponent* struct_decl) {
   SYMBOL_ASSERT(symbol_stack != nullptr);
   SYMBOL_ASSERT(struct_decl != nullptr);
   SYMBOL_ASSERT(struct_decl->type == SymbolType::STRUCT);
@@ -134,19 +145,21 @@ Symbol* symbolCreateStructInstance(const char* start, const char* end, StructCom
   symbol->type = SymbolType::STRUCT_INSTANCE;
   symbol->start = start;
   symbol->end = end;
+  symbol->id = id;
 
   symbol->struct_instance.struct_decl = struct_decl;
 
   return symbol;
 }
 
-Symbol* symbolCreateFunction(void* node, const char* start, const char* end, Scope* parent, Symbol return_type) {
+Symbol* symbolCreateFunction(void* node, const char* start, const char* end, InternId id, Scope* parent, Symbol return_type) {
   SYMBOL_ASSERT(symbol_stack != nullptr);
 
   Symbol* symbol = (Symbol*) stackPush(symbol_stack, sizeof(Symbol));
   symbol->type = SymbolType::FUNCTION;
   symbol->start = start;
   symbol->end = end;
+  symbol->id = id;
 
   symbol->function.scope = scopeCreate(parent, node);
   symbol->function.parameter_vector = vecCreate(FUNCTION_PARAM_INITIAL_CAPACITY, sizeof(Symbol*));
@@ -174,19 +187,19 @@ void symbolDestroyStruct(Symbol *symbol) {
   vecDestroy(symbol->struct_.members_vector);
 }
 
-void symbolAddEnumChild(Symbol* symbol, const char* start, const char* end) {
+void symbolAddEnumChild(Symbol* symbol, InternId id) {
   SYMBOL_ASSERT(symbol != nullptr);
   SYMBOL_ASSERT(symbol->type == SymbolType::ENUM);
 
   // TODO: maybe this should hold a value* and a void* which is actually not a pointer
-  htSet(symbol->enum_.table, start, end, (void*) (unsigned long) symbol->enum_.table->length);
+  htSet(symbol->enum_.table, id, (void*) (unsigned long) symbol->enum_.table->length);
 }
 
-unsigned long symbolGetEnumChild(Symbol* symbol, const char* start, const char* end) {
+unsigned long symbolGetEnumChild(Symbol* symbol, InternId id) {
   SYMBOL_ASSERT(symbol != nullptr);
   SYMBOL_ASSERT(symbol->type == SymbolType::ENUM);
 
-  return (unsigned long) htGet(symbol->enum_.table, start, end);
+  return (unsigned long) htGet(symbol->enum_.table, id);
 }
 
 void symbolAddStructChild(Symbol* symbol, const char* start, const char* end, Symbol* child) {
@@ -197,10 +210,10 @@ void symbolAddStructChild(Symbol* symbol, const char* start, const char* end, Sy
   vecPush(symbol->struct_.members_vector, &child);
 }
 
-Symbol* symbolGetStructChild(StructComponent* component, const char* start, const char* end) {
+Symbol* symbolGetStructChild(StructComponent* component, InternId id) {
   SYMBOL_ASSERT(component != nullptr);
 
-  return scopeResolveMember(component->members_table, start, end);
+  return scopeResolveMember(component->members_table, id);
 }
 
 void symbolAddFunctionParamChild(Symbol* symbol, const char* start, const char* end, Symbol* child) {
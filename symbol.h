@@ -1,5 +1,6 @@
 #pragma once 
 #include "hash_table.h"
+#include "intern.h"
 #include "stack.h"
 #include "vector.h"
 
@@ -76,6 +77,7 @@ struct Symbol {
   SymbolType type;
   const char* start;
   const char* end;
+  InternId id;
 
   LLVMTypeRef llvm_type;
   LLVMValueRef llvm_value;
@@ -93,22 +95,24 @@ struct Symbol {
 
 void printSymbol(Symbol* symbol);
 
-void symbolStackCreate(int capacity = 16384);
+void symbolStackCreate();
 void symbolStackDestroy();
-
-Symbol* symbolCreateVariable(SymbolType type, const char* start, const char* end);
-Symbol* symbolCreatePointer(const char* start, const char* end);
-Symbol* symbolCreateEnum(const char* start, const char* end);
-Symbol* symbolCreateEnumInstance(const char* start, const char* end, EnumComponent* enum_decl);
-Symbol* symbolCreateStruct(void* node, const char* start, const char* end, Scope* parent);
-Symbol* symbolCreateStructInstance(const char* start, const char* end, StructComponent* struct_decl);
-Symbol* symbolCreateFunction(void* node, const char* start, const char* end, Scope* parent, Symbol return_type);
-
-void symbolAddEnumChild(Symbol* symbol, const char* start, const char* end);
-unsigned long symbolGetEnumChild(Symbol* symbol, const char* start, const char* end);
+// Frees the symbols created since the symbol stack had size bytes
+void symbolStackReset(size_t size);
+
+Symbol* symbolCreateVariable(SymbolType type, const char* start, const char* end, InternId id);
+Symbol* symbolCreatePointer(const char* start, const char* end, InternId id);
+Symbol* symbolCreateEnum(const char* start, const char* end, InternId id);
+Symbol* symbolCreateEnumInstance(const char* start, const char* end, InternId id, EnumComponent* enum_decl);
+Symbol* symbolCreateStruct(void* node, const char* start, const char* end, InternId id, Scope* parent);
+Symbol* symbolCreateStructInstance(const char* start, const char* end, InternId id, StructComponent* struct_decl);
+Symbol* symbolCreateFunction(void* node, const char* start, const char* end, InternId id, Scope* parent, Symbol return_type);
+
+void symbolAddEnumChild(Symbol* symbol, InternId id);
+unsigned long symbolGetEnumChild(Symbol* symbol, InternId id);
 // This is a little misleading. This adds a start, end pair to structs member_list
 // The assumption is that the structs scope will be pushed when visiting and so
 // the member_table will be set by visiting and not this function.
 void symbolAddStructChild(Symbol* symbol, const char* start, const char* end, Symbol* child);
-Symbol* symbolGetStructChild(StructComponent* component, const char* start, const char* end);
+Symbol* symbolGetStructChild(StructComponent* component, InternId id);
 void symbolAddFunctionParamChild(Symbol* symbol, const char* start, const char* end, Symbol* child);
@@ -0,0 +1,194 @@
+/* Checks that blocks, conditionals, loops, parentheses and calls nested 20k
+ * deep, or as deep as the first argument, go through every pass without
+ * running out of thread stack: the tree passes, compactAstCreate, the compact
+ * passes and the compact passes over the tree loaded back from the AST cache.
+ * Each form has to print the same tree as the tree passes. Codegen only
+ * runs on the inputs without ifs, loops and call results, which it can not
+ * lower yet. The cache file is written to deep_nesting.bin in the working
+ * directory and removed afterwards.
+ *
+ * g++ -std=c++17 -O2 -DNDEBUG -I. -I$(llvm-config --includedir) test/deep_nesting.cpp ast_cache.cpp \
+ *   ast_types.cpp codegen.cpp compact_ast.cpp defref.cpp hash_table.cpp intern.cpp lex.cpp lex_scan.cpp \
+ *   line_index.cpp parser.cpp scope.cpp stack.cpp symbol.cpp token_stream.cpp vector.cpp visit_print.cpp \
+ *   $(llvm-config --ldflags --libs core analysis) -pthread -o deep_nesting_test
+ */
+
+#include "ast_cache.h"
+#include "codegen.h"
+#include "compact_ast.h"
+#include "defref.h"
+#include "lex.h"
+#include "parser.h"
+#include "source.h"
+#include "token_stream.h"
+#include "visit_print.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CACHE_PATH "deep_nesting.bin"
+// The printed trees grow with the square of the depth, so they are compared
+// at this depth and thrown away at the full one
+#define COMPARE_DEPTH 1000
+
+std::string repeat(const char* text, int count) {
+  std::string output;
+  for (int i = 0; i < count; i++) output += text;
+  return output;
+}
+
+struct NestingCase {
+  const char* name;
+  // Statements of the body of f, nested depth deep
+  std::string (*body)(int depth);
+  bool codegen;
+};
+
+const NestingCase nesting_cases[] = {
+  {"blocks", [](int depth) {
+    return std::string(depth, '{') + " c = b; " + std::string(depth, '}') + "\n";
+  }, true},
+  {"parentheses", [](int depth) {
+    return "c = " + repeat("(a + ", depth) + "b" + std::string(depth, ')') + ";\n";
+  }, true},
+  {"calls", [](int depth) {
+    return "c = " + repeat("g(", depth) + "a" + repeat(", b)", depth) + ";\n";
+  }, false},
+  {"conditionals", [](int depth) {
+    return repeat("if a < b { ", depth) + "c = b;" + repeat(" } else { c = a; }", depth) + "\n";
+  }, false},
+  {"loops", [](int depth) {
+    return repeat("while a < b { ", depth) + "c = b;" + repeat(" }", depth) + "\n";
+  }, false},
+};
+
+std::string nestingInput(const NestingCase& nesting_case, int depth) {
+  std::string input = "func g (x : u32, y : u32) : u32 {\n  return x + y;\n}\n\n";
+  input += "func f (a : u32, b : u32) : u32 {\n  c : u32 = a;\n";
+  input += nesting_case.body(depth);
+  input += "  return c;\n}\n";
+
+  // The lexer reads past the end of tokens, like a Source
+  input.append(SOURCE_PADDING, '\0');
+  return input;
+}
+
+// Runs f with stderr, which the passes trace to, sent to /dev/null. If
+// compare is set stdout goes to a temporary file and the hash of what f
+// printed is returned, else it goes to /dev/null too.
+template <typename F>
+uint64_t printed(bool compare, F f) {
+  fflush(stdout);
+  fflush(stderr);
+  int out = dup(1);
+  int err = dup(2);
+  FILE* file = compare ? tmpfile() : nullptr;
+  int null = open("/dev/null", O_WRONLY);
+  dup2(compare ? fileno(file) : null, 1);
+  dup2(null, 2);
+  close(null);
+
+  f();
+
+  fflush(stdout);
+  fflush(stderr);
+  dup2(out, 1);
+  dup2(err, 2);
+  close(out);
+  close(err);
+
+  if (!compare) return 0;
+
+  struct stat info;
+  fstat(fileno(file), &info);
+  uint64_t hash = 0;
+  if (info.st_size > 0) {
+    void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+    hash = astCacheHash((const char*) mapping, info.st_size);
+    munmap(mapping, info.st_size);
+  }
+  fclose(file);
+  return hash;
+}
+
+// Each step is named before it runs, a step that overflows the stack crashes
+// the test after its name
+bool check(const NestingCase& nesting_case, int depth, bool compare) {
+  std::string input = nestingInput(nesting_case, depth);
+  size_t size = input.size() - SOURCE_PADDING;
+  printf("%s %i deep:", nesting_case.name, depth);
+
+  Token* tokens = lex(input.data());
+  Primary* primary = tokens != nullptr ? parse(tokens) : nullptr;
+  if (primary == nullptr) {
+    printf(" does not parse\n");
+    return false;
+  }
+
+  auto step = [](const char* name) {
+    printf(" %s", name);
+    fflush(stdout);
+  };
+
+  step("tree");
+  uint64_t tree = printed(compare, [&] {
+    visitPrint(primary);
+    visitDefRef(primary);
+    defref_destroy();
+  });
+
+  step("compact");
+  TokenStream* stream = tokenStreamCreate(input.data(), tokens);
+  CompactAst* ast = compactAstCreate(primary, tokens, stream);
+  uint64_t compact = printed(compare, [&] {
+    visitPrint(ast);
+    visitDefRef(ast);
+    if (nesting_case.codegen) {
+      visitCodeGen(ast);
+      codegen_destroy();
+    }
+    defref_destroy();
+  });
+
+  step("cache");
+  AstCache* cache = astCacheWrite(CACHE_PATH, ast, size) ? astCacheOpen(CACHE_PATH, input.data(), size) : nullptr;
+  remove(CACHE_PATH);
+  uint64_t cached = 0;
+  if (cache != nullptr) {
+    cached = printed(compare, [&] {
+      visitPrint(&cache->ast);
+      visitDefRef(&cache->ast);
+      defref_destroy();
+    });
+    astCacheClose(cache);
+  }
+
+  bool same = cache != nullptr && (!compare || (tree != 0 && compact == tree && cached == tree));
+  printf(same ? "\n" : " differ\n");
+
+  compactAstDestroy(ast);
+  tokenStreamDestroy(stream);
+  parse_destroy();
+  lex_destroy(tokens);
+  return same;
+}
+
+int main(int argc, char** argv) {
+  int depth = argc > 1 ? atoi(argv[1]) : 20000;
+  int failures = 0;
+  int checks = 0;
+
+  for (const NestingCase& nesting_case : nesting_cases) {
+    failures += !check(nesting_case, COMPARE_DEPTH, true);
+    failures += !check(nesting_case, depth, false);
+    checks += 2;
+  }
+
+  printf("deep nesting: %i of %i checks pass\n", checks - failures, checks);
+  return failures == 0 ? 0 : 1;
+}
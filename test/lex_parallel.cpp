@@ -0,0 +1,136 @@
+/* Checks that lexParallel() returns the same tokens as lex().
+ * Every even split point of the buffer is placed inside, on, or next to a
+ * string literal that contains newlines, for several thread counts.
+ *
+ * g++ -std=c++17 -O2 -DNDEBUG -I. test/lex_parallel.cpp lex.cpp lex_scan.cpp \
+ *   lex_parallel.cpp intern.cpp hash_table.cpp -pthread -o lex_parallel_test
+ */
+
+#include "lex.h"
+#include "lex_parallel.h"
+#include "source.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+// Matches LEX_PARALLEL_MIN_SEGMENT, each segment has to be at least this big to split
+#define SEGMENT_SIZE 65536
+
+const char* filler_lines[] = {
+  "a1 = 12 + b * 3.5;\n",
+  "func f ( x : i32 ) : u8 { return x / 7 - 0.25; }\n",
+  "s = \"one\ntwo\";\n",
+  "if a <= b and c != 4 { while true { break; } }\n",
+  "mut v : f32 = 1.0e3 * w [ 2 ] . y ;\n",
+};
+
+// Whole filler lines, padded with spaces to exactly length bytes
+void appendFiller(std::string& input, size_t length, size_t& line) {
+  size_t end = input.size() + length;
+  while (true) {
+    const char* text = filler_lines[line % (sizeof(filler_lines) / sizeof(filler_lines[0]))];
+    if (input.size() + strlen(text) > end) break;
+    input += text;
+    line++;
+  }
+  input.append(end - input.size(), ' ');
+}
+
+struct SplitCase {
+  const char* name;
+  const char* snippet;
+  // Offset of the split point into the snippet
+  size_t split;
+};
+
+const SplitCase split_cases[] = {
+  {"inside a string",        " \"ab\ncd ef\" ", 3},
+  {"after a string newline", " \"ab\ncd ef\" ", 6},
+  {"on the opening quote",   " \"ab\ncd ef\" ", 1},
+  {"on the closing quote",   " \"ab\ncd ef\" ", 10},
+  {"after the closing quote"," \"ab\ncd ef\" ", 11},
+  {"on a newline before a string", "\n\"x\ny\" ", 0},
+  {"after a newline before a string", "\n\"x\ny\" ", 1},
+};
+
+const int thread_counts[] = {1, 2, 3, 4, 7, 8, 16};
+
+// Builds a buffer of segment_count segments with a snippet at every even split point
+std::string splitInput(int segment_count, const SplitCase& split_case) {
+  size_t size = (size_t) segment_count * SEGMENT_SIZE + 12345;
+  size_t snippet_size = strlen(split_case.snippet);
+
+  std::string input;
+  size_t line = 0;
+  for (int i = 1; i < segment_count; i++) {
+    size_t snippet_start = size * i / segment_count - split_case.split;
+    appendFiller(input, snippet_start - input.size(), line);
+    input += split_case.snippet;
+  }
+  appendFiller(input, size - input.size(), line);
+
+  // The lexer reads past the end of tokens, like a Source
+  input.append(SOURCE_PADDING, '\0');
+  return input;
+}
+
+bool sameTokens(const Token* a, const Token* b) {
+  for (size_t i = 0; ; i++) {
+    if (a[i].type != b[i].type || a[i].start != b[i].start || a[i].end != b[i].end) {
+      fprintf(stderr, "token %zu differs: %s %s\n", i, TokenTypes[(int) a[i].type], TokenTypes[(int) b[i].type]);
+      return false;
+    }
+
+    bool same_value = true;
+    switch (a[i].type) {
+      case TokenType::INT_LITERAL: same_value = a[i].int_value == b[i].int_value; break;
+      case TokenType::FLOAT_LITERAL: same_value = memcmp(&a[i].float_value, &b[i].float_value, sizeof(float)) == 0; break;
+      case TokenType::IDENTIFIER: same_value = a[i].id == b[i].id; break;
+      default: break;
+    }
+    if (!same_value) {
+      fprintf(stderr, "token %zu value differs: %.*s\n", i, (int) (a[i].end - a[i].start), a[i].start);
+      return false;
+    }
+
+    if (a[i].type == TokenType::END) return true;
+  }
+}
+
+bool check(const char* name, const std::string& input, int thread_count) {
+  Token* serial = lex(input.data());
+  Token* parallel = lexParallel(input.data(), thread_count);
+
+  bool same = serial == nullptr || parallel == nullptr
+    ? serial == parallel
+    : sameTokens(serial, parallel);
+  if (!same) fprintf(stderr, "lexParallel differs from lex: %s, %i threads\n", name, thread_count);
+
+  if (serial != nullptr) lex_destroy(serial);
+  if (parallel != nullptr) lex_destroy(parallel);
+  return same;
+}
+
+int main() {
+  int failures = 0;
+  int checks = 0;
+
+  for (const SplitCase& split_case : split_cases) {
+    for (int thread_count : thread_counts) {
+      // More segments than threads only moves the split points lexParallel uses
+      std::string input = splitInput(thread_count, split_case);
+      failures += !check(split_case.name, input, thread_count);
+      checks++;
+    }
+  }
+
+  // The quote parity prepass gives up on an odd number of quotes, lex() has to fail too
+  std::string unterminated = splitInput(4, split_cases[0]);
+  unterminated[unterminated.find('"')] = ' ';
+  failures += !check("unterminated string", unterminated, 4);
+  checks++;
+
+  printf("lexParallel: %i of %i checks match lex\n", checks - failures, checks);
+  return failures == 0 ? 0 : 1;
+}
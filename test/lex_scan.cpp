@@ -0,0 +1,154 @@
+/* Checks that lex() returns the same tokens with every scanner of lex_scan.h
+ * the cpu supports as with the scalar one. Runs of whitespace, identifier,
+ * number and string characters of every length up to a few vectors are lexed
+ * at every alignment: on their own so the buffer ends inside the run, between
+ * other tokens and next to the characters just outside each class. Each is
+ * also lexed with its terminating '\0' as the last byte before an unmapped
+ * page.
+ *
+ * g++ -std=c++17 -O2 -DNDEBUG -I. test/lex_scan.cpp lex.cpp lex_scan.cpp intern.cpp hash_table.cpp \
+ *   -pthread -o lex_scan_test
+ */
+
+#include "lex.h"
+#include "lex_scan.h"
+#include "source.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+// Longer than two AVX2 vectors, so runs start, end and cross blocks at every offset
+#define MAX_RUN 70
+#define ALIGNMENTS 64
+
+const char* mode_names[] = {"auto", "scalar", "sse2", "avx2"};
+
+bool sameTokens(const Token* a, const Token* b) {
+  for (size_t i = 0; ; i++) {
+    if (a[i].type != b[i].type || a[i].start != b[i].start || a[i].end != b[i].end) {
+      fprintf(stderr, "token %zu differs: %s %s\n", i, TokenTypes[(int) a[i].type], TokenTypes[(int) b[i].type]);
+      return false;
+    }
+
+    bool same_value = true;
+    switch (a[i].type) {
+      case TokenType::INT_LITERAL: same_value = a[i].int_value == b[i].int_value; break;
+      case TokenType::FLOAT_LITERAL: same_value = memcmp(&a[i].float_value, &b[i].float_value, sizeof(float)) == 0; break;
+      case TokenType::IDENTIFIER: same_value = a[i].id == b[i].id; break;
+      default: break;
+    }
+    if (!same_value) {
+      fprintf(stderr, "token %zu value differs: %.*s\n", i, (int) (a[i].end - a[i].start), a[i].start);
+      return false;
+    }
+
+    if (a[i].type == TokenType::END) return true;
+  }
+}
+
+// Runs of length characters of each class the scanners look for
+std::vector<std::string> runs(int length) {
+  const char whitespace[] = " \n\t";
+  std::string spaces;
+  std::string identifier = "x";
+  std::string digits = "1";
+  std::string string = "\"";
+  for (int i = 1; i < length; i++) {
+    spaces += whitespace[i % 3];
+    identifier += "aZ9"[i % 3];
+    digits += (char) ('0' + i % 10);
+    // Newlines and bytes >= 0x80 are part of a string literal
+    string += i % 7 == 0 ? '\n' : i % 5 == 0 ? '\xC3' : (char) ('a' + i % 26);
+  }
+
+  std::string number = digits + "." + digits;
+  return {spaces, identifier, digits, number, string + "\"", string};
+}
+
+// Lexes input with each of modes and compares the tokens with those of the first
+bool checkModes(const char* name, const char* input, const std::vector<LexScanMode>& modes) {
+  lexSetScanMode(modes[0]);
+  Token* expected = lex(input);
+
+  bool same = true;
+  for (size_t i = 1; i < modes.size(); i++) {
+    lexSetScanMode(modes[i]);
+    Token* tokens = lex(input);
+
+    bool mode_same = expected == nullptr || tokens == nullptr ? expected == tokens : sameTokens(expected, tokens);
+    if (!mode_same) fprintf(stderr, "%s scanner differs from scalar: %s\n", mode_names[(int) modes[i]], name);
+    same &= mode_same;
+
+    if (tokens != nullptr) lex_destroy(tokens);
+  }
+
+  if (expected != nullptr) lex_destroy(expected);
+  return same;
+}
+
+int main() {
+  // Modes the cpu does not support fall back to scalar and are skipped
+  std::vector<LexScanMode> modes = {LexScanMode::SCALAR};
+  for (LexScanMode mode : {LexScanMode::SSE2, LexScanMode::AVX2}) {
+    if (lexSetScanMode(mode) == mode) modes.push_back(mode);
+    else printf("%s scanner not supported, skipped\n", mode_names[(int) mode]);
+  }
+  LexScanMode default_mode = lexSetScanMode(LexScanMode::AUTO);
+
+  std::vector<std::string> inputs;
+  for (int length = 1; length <= MAX_RUN; length++) {
+    for (const std::string& run : runs(length)) {
+      inputs.push_back(run);
+      inputs.push_back("a = " + run + ";\nb");
+      inputs.push_back("(" + run + ")" + run + "<=" + run);
+      // Characters just outside the ranges of digits and letters
+      inputs.push_back(run + "/" + run + ":" + run + "[" + run + "{" + run);
+    }
+  }
+
+  long page = sysconf(_SC_PAGESIZE);
+  char* buffer = (char*) aligned_alloc(ALIGNMENTS, ALIGNMENTS + page + SOURCE_PADDING);
+  // The first page holds the inputs, the second is unmapped
+  char* pages = (char*) mmap(nullptr, 2 * page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buffer == nullptr || pages == MAP_FAILED || mprotect(pages + page, page, PROT_NONE) != 0) {
+    fprintf(stderr, "can not allocate the test buffers\n");
+    return 1;
+  }
+
+  int failures = 0;
+  int checks = 0;
+  char name[64];
+
+  for (size_t i = 0; i < inputs.size(); i++) {
+    const std::string& input = inputs[i];
+
+    // The lexer reads past the end of tokens, like a Source
+    for (int alignment = 0; alignment < ALIGNMENTS; alignment++) {
+      memset(buffer, 0, ALIGNMENTS + input.size() + SOURCE_PADDING);
+      memcpy(buffer + alignment, input.data(), input.size());
+      snprintf(name, sizeof(name), "input %zu at alignment %i", i, alignment);
+      failures += !checkModes(name, buffer + alignment, modes);
+      checks++;
+    }
+
+    // The scanners only read aligned blocks, which can not cross into the unmapped page
+    char* start = pages + page - input.size() - 1;
+    memcpy(start, input.data(), input.size());
+    start[input.size()] = '\0';
+    snprintf(name, sizeof(name), "input %zu before an unmapped page", i);
+    failures += !checkModes(name, start, modes);
+    checks++;
+  }
+
+  munmap(pages, 2 * page);
+  free(buffer);
+  lexSetScanMode(default_mode);
+
+  printf("lex_scanner: %i of %i checks match scalar with %zu scanners\n", checks - failures, checks, modes.size());
+  return failures == 0 ? 0 : 1;
+}
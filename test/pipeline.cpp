@@ -0,0 +1,275 @@
+/* Checks that compilePipelined, with and without fused bodies, prints modules
+ * that link to the module visitCodeGen prints for the same input. Each
+ * compilation runs in its own child process with stderr, where the IR goes,
+ * sent to a temporary file. The printed modules are parsed back and linked by
+ * LLVM, then every function, global and named type is compared by its printed
+ * form, along with the data layout and target.
+ *
+ * g++ -std=c++17 -O2 -DNDEBUG -I. -I$(llvm-config --includedir) test/pipeline.cpp ast_types.cpp \
+ *   codegen.cpp defref.cpp hash_table.cpp intern.cpp lex.cpp lex_scan.cpp line_index.cpp parser.cpp \
+ *   pipeline.cpp scope.cpp stack.cpp symbol.cpp token_stream.cpp vector.cpp \
+ *   $(llvm-config --ldflags --libs core analysis irreader linker) -pthread -o pipeline_test
+ */
+
+#include "codegen.h"
+#include "defref.h"
+#include "lex.h"
+#include "parser.h"
+#include "pipeline.h"
+#include "source.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <llvm-c/Core.h>
+#include <llvm-c/IRReader.h>
+#include <llvm-c/Linker.h>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+// Codegen can not lower ifs, loops, call results or calls to functions
+// declared later yet, so none of the inputs have them
+const char* sample_input =
+  "enum E {\n  NONE,\n  ONE\n};\n\n"
+  "struct P {\n  x : u32;\n  y : u32;\n};\n\n"
+  "struct Q {\n  p : P;\n  z : u32;\n};\n\n"
+  "func g (x : u32, y : u32) : u32 {\n  return x * y + 3;\n}\n\n"
+  "func f (a : u32, b : u32) : u32 {\n  q : Q;\n  e : E;\n  c : u32 = a * b;\n  g(c, a);\n  return c;\n}\n\n"
+  "func h (a : u32) : u32 {\n  p : P;\n  return a;\n}\n";
+
+// Functions that call earlier ones, with struct types only some bodies use
+std::string generatedInput(int function_count) {
+  std::string input = "struct P {\n  x : u32;\n  y : u32;\n};\n\nstruct Q {\n  p : P;\n  z : f32;\n};\n";
+
+  char line[256];
+  for (int i = 0; i < function_count; i++) {
+    snprintf(line, sizeof(line), "\nfunc step%i (a : u32, b : u32) : u32 {\n", i);
+    input += line;
+    if (i % 2 == 0) input += "  p : P;\n";
+    if (i % 3 == 0) input += "  q : Q;\n";
+    snprintf(line, sizeof(line), "  c : u32 = a * %i + b;\n", i % 97 + 1);
+    input += line;
+    if (i > 0) {
+      snprintf(line, sizeof(line), "  step%i(c, a);\n", i / 2);
+      input += line;
+    }
+    input += "  return c - b;\n}\n";
+  }
+
+  return input;
+}
+
+enum class Mode {
+  WHOLE,
+  PIPELINED,
+  FUSED,
+};
+
+const char* mode_names[] = {"whole", "pipelined", "fused"};
+
+void compile(const char* input, Mode mode) {
+  Token* tokens = lex(input);
+  if (tokens == nullptr) _exit(1);
+
+  if (mode == Mode::WHOLE) {
+    Primary* primary = parse(tokens);
+    if (primary == nullptr) _exit(1);
+    visitDefRef(primary);
+    visitCodeGen(primary);
+    return;
+  }
+
+  pipelineSetFused(mode == Mode::FUSED);
+  if (!compilePipelined(tokens)) _exit(1);
+}
+
+// What the compilation printed to stderr, without the names codegen traces
+// there, which are lines no IR line looks like. Empty if it failed.
+std::string compiled(const std::string& input, Mode mode) {
+  fflush(stdout);
+  fflush(stderr);
+  FILE* file = tmpfile();
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    dup2(fileno(file), 2);
+    compile(input.data(), mode);
+    fflush(stderr);
+    _exit(0);
+  }
+
+  int status = 0;
+  if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    fclose(file);
+    return "";
+  }
+
+  std::string output;
+  char line[4096];
+  rewind(file);
+  while (fgets(line, sizeof(line), file) != nullptr) {
+    size_t length = strcspn(line, "\n");
+    bool name = length > 0 && strspn(line, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_") == length;
+    if (!name) output += line;
+  }
+  fclose(file);
+  return output;
+}
+
+LLVMModuleRef parseModule(LLVMContextRef context, const std::string& text) {
+  LLVMMemoryBufferRef buffer = LLVMCreateMemoryBufferWithMemoryRangeCopy(text.data(), text.size(), "");
+  LLVMModuleRef module = nullptr;
+  char* error = nullptr;
+  // Takes the buffer
+  if (LLVMParseIRInContext(context, buffer, &module, &error)) {
+    fprintf(stderr, "can not parse the printed IR: %s\n", error);
+    LLVMDisposeMessage(error);
+    return nullptr;
+  }
+  return module;
+}
+
+// Every module printed starts with its ModuleID line, they are linked into the first
+LLVMModuleRef linkModules(LLVMContextRef context, const std::string& text) {
+  std::vector<size_t> starts;
+  for (size_t start = text.find("; ModuleID"); start != std::string::npos; start = text.find("\n; ModuleID", start + 1)) {
+    starts.push_back(text[start] == '\n' ? start + 1 : start);
+  }
+  starts.push_back(text.size());
+
+  LLVMModuleRef linked = nullptr;
+  for (size_t i = 0; i + 1 < starts.size(); i++) {
+    LLVMModuleRef module = parseModule(context, text.substr(starts[i], starts[i + 1] - starts[i]));
+    if (module == nullptr) {
+      if (linked != nullptr) LLVMDisposeModule(linked);
+      return nullptr;
+    }
+
+    if (linked == nullptr) {
+      linked = module;
+      continue;
+    }
+    // Takes module
+    if (LLVMLinkModules2(linked, module)) {
+      fprintf(stderr, "can not link the printed modules\n");
+      LLVMDisposeModule(linked);
+      return nullptr;
+    }
+  }
+  return linked;
+}
+
+std::string printed(LLVMValueRef value) {
+  char* text = LLVMPrintValueToString(value);
+  std::string output = text;
+  LLVMDisposeMessage(text);
+  return output;
+}
+
+// The named type definitions of the module, sorted
+std::vector<std::string> typeLines(LLVMModuleRef module) {
+  char* text = LLVMPrintModuleToString(module);
+  std::vector<std::string> lines;
+  for (char* line = strtok(text, "\n"); line != nullptr; line = strtok(nullptr, "\n")) {
+    if (line[0] == '%' && strstr(line, " = type ") != nullptr) lines.push_back(line);
+  }
+  LLVMDisposeMessage(text);
+  std::sort(lines.begin(), lines.end());
+  return lines;
+}
+
+bool sameModule(LLVMModuleRef whole, LLVMModuleRef linked) {
+  if (strcmp(LLVMGetDataLayoutStr(whole), LLVMGetDataLayoutStr(linked)) != 0 ||
+      strcmp(LLVMGetTarget(whole), LLVMGetTarget(linked)) != 0) {
+    fprintf(stderr, "data layout or target differs\n");
+    return false;
+  }
+
+  int count = 0;
+  for (LLVMValueRef function = LLVMGetFirstFunction(linked); function != nullptr; function = LLVMGetNextFunction(function)) count++;
+  for (LLVMValueRef function = LLVMGetFirstFunction(whole); function != nullptr; function = LLVMGetNextFunction(function)) {
+    count--;
+    size_t length = 0;
+    const char* name = LLVMGetValueName2(function, &length);
+    LLVMValueRef other = LLVMGetNamedFunction(linked, name);
+    if (other == nullptr || printed(function) != printed(other)) {
+      fprintf(stderr, "function %s differs\n", name);
+      return false;
+    }
+  }
+
+  for (LLVMValueRef global = LLVMGetFirstGlobal(linked); global != nullptr; global = LLVMGetNextGlobal(global)) count++;
+  for (LLVMValueRef global = LLVMGetFirstGlobal(whole); global != nullptr; global = LLVMGetNextGlobal(global)) {
+    count--;
+    size_t length = 0;
+    const char* name = LLVMGetValueName2(global, &length);
+    LLVMValueRef other = LLVMGetNamedGlobal(linked, name);
+    if (other == nullptr || printed(global) != printed(other)) {
+      fprintf(stderr, "global %s differs\n", name);
+      return false;
+    }
+  }
+
+  if (count != 0) {
+    fprintf(stderr, "the linked module has other functions or globals\n");
+    return false;
+  }
+
+  if (typeLines(whole) != typeLines(linked)) {
+    fprintf(stderr, "named types differ\n");
+    return false;
+  }
+  return true;
+}
+
+bool check(const char* name, std::string input) {
+  // The lexer reads past the end of tokens, like a Source
+  input.append(SOURCE_PADDING, '\0');
+
+  std::string whole_text = compiled(input, Mode::WHOLE);
+  if (whole_text.empty()) {
+    fprintf(stderr, "%s: whole file compilation failed\n", name);
+    return false;
+  }
+
+  // Each form is parsed into its own context, or the types of one would be renamed in the other
+  LLVMContextRef whole_context = LLVMContextCreate();
+  LLVMModuleRef whole = parseModule(whole_context, whole_text);
+  bool same = whole != nullptr;
+
+  for (Mode mode : {Mode::PIPELINED, Mode::FUSED}) {
+    if (!same) break;
+
+    std::string text = compiled(input, mode);
+    LLVMContextRef context = LLVMContextCreate();
+    LLVMModuleRef linked = text.empty() ? nullptr : linkModules(context, text);
+    same = linked != nullptr && sameModule(whole, linked);
+    if (!same) fprintf(stderr, "%s: %s modules do not link to the whole file module\n", name, mode_names[(int) mode]);
+
+    if (linked != nullptr) LLVMDisposeModule(linked);
+    LLVMContextDispose(context);
+  }
+
+  if (whole != nullptr) LLVMDisposeModule(whole);
+  LLVMContextDispose(whole_context);
+  return same;
+}
+
+int main() {
+  int failures = 0;
+  int checks = 0;
+
+  failures += !check("sample", sample_input);
+  checks++;
+
+  for (int function_count : {1, 2, 7, 100}) {
+    std::string name = "generated, " + std::to_string(function_count) + " functions";
+    failures += !check(name.c_str(), generatedInput(function_count));
+    checks++;
+  }
+
+  printf("compilePipelined: %i of %i inputs link to the whole file module\n", checks - failures, checks);
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,255 @@
+#include "token_stream.h"
+#include "lex.h"
+
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+
+#define TOKEN_STREAM_INITIAL_CAPACITY 1024
+
+TokenStream* tokenStreamAllocate(const char* source) {
+  TokenStream* stream = (TokenStream*) calloc(1, sizeof(TokenStream));
+  assert(stream != nullptr && "tokenStreamCreate out of memory");
+
+  stream->source = source;
+  return stream;
+}
+
+void tokenStreamGrow(TokenStream* stream) {
+  uint32_t capacity = stream->capacity == 0 ? TOKEN_STREAM_INITIAL_CAPACITY : 2 * stream->capacity;
+
+  stream->types = (uint8_t*) realloc(stream->types, capacity * sizeof(uint8_t));
+  stream->offsets = (uint32_t*) realloc(stream->offsets, capacity * sizeof(uint32_t));
+  stream->lengths = (uint16_t*) realloc(stream->lengths, capacity * sizeof(uint16_t));
+  assert(stream->types != nullptr && stream->offsets != nullptr && stream->lengths != nullptr
+      && "tokenStreamGrow out of memory");
+
+  stream->capacity = capacity;
+}
+
+void tokenStreamPush(TokenStream* stream, TokenType type, uint32_t offset, uint32_t length) {
+  if (stream->count == stream->capacity) tokenStreamGrow(stream);
+
+  TokenIndex index = stream->count++;
+  stream->types[index] = (uint8_t) type;
+  stream->offsets[index] = offset;
+
+  if (length < TOKEN_LONG_LENGTH) {
+    stream->lengths[index] = length;
+    return;
+  }
+
+  if (stream->long_length_count == stream->long_length_capacity) {
+    stream->long_length_capacity = stream->long_length_capacity == 0 ? 16 : 2 * stream->long_length_capacity;
+    stream->long_lengths = (TokenLongLength*) realloc(stream->long_lengths,
+        stream->long_length_capacity * sizeof(TokenLongLength));
+    assert(stream->long_lengths != nullptr && "tokenStreamPush out of memory");
+  }
+
+  stream->lengths[index] = TOKEN_LONG_LENGTH;
+  stream->long_lengths[stream->long_length_count++] = {index, length};
+}
+
+TokenStream* tokenStreamCreate(const char* source) {
+  TokenStream* stream = tokenStreamAllocate(source);
+  Lexer* lexer = lexerCreate(source);
+
+  Token* token = lexerNext(lexer);
+  while (token != nullptr) {
+    if (token->type == TokenType::END) {
+      tokenStreamPush(stream, TokenType::END, lexer->input - source, 0);
+      break;
+    }
+
+    tokenStreamPush(stream, token->type, token->start - source, token->end - token->start);
+    token = lexerNext(lexer);
+  }
+
+  bool failed = lexer->failed;
+  lexerDestroy(lexer);
+
+  if (failed) {
+    tokenStreamDestroy(stream);
+    return nullptr;
+  }
+  return stream;
+}
+
+TokenStream* tokenStreamCreate(const char* source, const Token* tokens) {
+  TokenStream* stream = tokenStreamAllocate(source);
+
+  const Token* token = tokens;
+  for (; token->type != TokenType::END; token++) {
+    tokenStreamPush(stream, token->type, token->start - source, token->end - token->start);
+  }
+
+  uint32_t end = stream->count > 0 ? stream->offsets[stream->count - 1] + tokenLength(stream, stream->count - 1) : 0;
+  tokenStreamPush(stream, TokenType::END, end, 0);
+  return stream;
+}
+
+void tokenStreamDestroy(TokenStream* stream) {
+  free(stream->types);
+  free(stream->offsets);
+  free(stream->lengths);
+  free(stream->long_lengths);
+  free(stream);
+}
+
+uint32_t tokenLength(const TokenStream* stream, TokenIndex index) {
+  if (stream->lengths[index] != TOKEN_LONG_LENGTH) return stream->lengths[index];
+
+  uint32_t low = 0;
+  uint32_t high = stream->long_length_count;
+  while (low < high) {
+    uint32_t middle = (low + high) / 2;
+    if (stream->long_lengths[middle].index < index) low = middle + 1;
+    else high = middle;
+  }
+
+  assert(low < stream->long_length_count && stream->long_lengths[low].index == index);
+  return stream->long_lengths[low].length;
+}
+
+const char* tokenStart(const TokenStream* stream, TokenIndex index) {
+  return stream->source + stream->offsets[index];
+}
+
+Token tokenGet(const TokenStream* stream, TokenIndex index) {
+  if (tokenType(stream, index) == TokenType::END) return {TokenType::END, nullptr, nullptr};
+
+  const char* start = tokenStart(stream, index);
+  return {tokenType(stream, index), start, start + tokenLength(stream, index)};
+}
+
+void printToken(const TokenStream* stream, TokenIndex index) {
+  printToken(tokenGet(stream, index));
+}
+
+// First token that ends at or after offset. A token ending exactly at an edit can grow into it.
+TokenIndex tokenStreamFind(const TokenStream* stream, uint32_t offset) {
+  uint32_t low = 0;
+  uint32_t high = stream->count - 1;
+  while (low < high) {
+    uint32_t middle = (low + high) / 2;
+    if (stream->offsets[middle] + tokenLength(stream, middle) < offset) low = middle + 1;
+    else high = middle;
+  }
+  return low;
+}
+
+// Replaces the tokens [start, end) of stream with all of the tokens in replacement
+void tokenStreamSplice(TokenStream* stream, TokenIndex start, TokenIndex end, const TokenStream* replacement,
+    int64_t delta) {
+  uint32_t tail = stream->count - end;
+  uint32_t count = start + replacement->count + tail;
+  while (count > stream->capacity) tokenStreamGrow(stream);
+
+  TokenIndex moved = start + replacement->count;
+  memmove(stream->types + moved, stream->types + end, tail * sizeof(uint8_t));
+  memmove(stream->offsets + moved, stream->offsets + end, tail * sizeof(uint32_t));
+  memmove(stream->lengths + moved, stream->lengths + end, tail * sizeof(uint16_t));
+
+  // An empty replacement may have no arrays at all
+  if (replacement->count > 0) {
+    memcpy(stream->types + start, replacement->types, replacement->count * sizeof(uint8_t));
+    memcpy(stream->offsets + start, replacement->offsets, replacement->count * sizeof(uint32_t));
+    memcpy(stream->lengths + start, replacement->lengths, replacement->count * sizeof(uint16_t));
+  }
+
+  for (TokenIndex index = moved; index < count; index++) {
+    stream->offsets[index] += delta;
+  }
+  stream->count = count;
+
+  if (stream->long_length_count == 0 && replacement->long_length_count == 0) return;
+
+  // Entries before start are kept, entries in [start, end) dropped and the rest renumbered
+  uint32_t first = 0;
+  while (first < stream->long_length_count && stream->long_lengths[first].index < start) first++;
+  uint32_t last = first;
+  while (last < stream->long_length_count && stream->long_lengths[last].index < end) last++;
+
+  uint32_t long_tail = stream->long_length_count - last;
+  uint32_t long_count = first + replacement->long_length_count + long_tail;
+  if (long_count > stream->long_length_capacity) {
+    stream->long_length_capacity = long_count;
+    stream->long_lengths = (TokenLongLength*) realloc(stream->long_lengths,
+        stream->long_length_capacity * sizeof(TokenLongLength));
+    assert(stream->long_lengths != nullptr && "tokenStreamSplice out of memory");
+  }
+
+  TokenLongLength* long_moved = stream->long_lengths + first + replacement->long_length_count;
+  memmove(long_moved, stream->long_lengths + last, long_tail * sizeof(TokenLongLength));
+  for (uint32_t i = 0; i < long_tail; i++) {
+    long_moved[i].index = long_moved[i].index - end + moved;
+  }
+  for (uint32_t i = 0; i < replacement->long_length_count; i++) {
+    stream->long_lengths[first + i] = {replacement->long_lengths[i].index + start, replacement->long_lengths[i].length};
+  }
+  stream->long_length_count = long_count;
+}
+
+bool tokenStreamEdit(TokenStream* stream, const char* source, TokenEdit edit, TokenRange* changed) {
+  assert(edit.start <= edit.end && "tokenStreamEdit inverted edit");
+  int64_t delta = (int64_t) edit.length - (edit.end - edit.start);
+
+  /* Bytes before edit.start are unchanged, but a token may have been lexed by looking past its
+   * own end: an INT followed by DOT becomes a FLOAT once a digit follows the DOT. Restarting one
+   * token before the first one that reaches the edit covers that lookahead.
+   */
+  TokenIndex start = tokenStreamFind(stream, edit.start);
+  if (start > 0) start--;
+  uint32_t restart = stream->offsets[start];
+  if (restart > edit.start) restart = 0;
+
+  // Old tokens at or after edit.end only move, the first new token that lines up with one is the sync point
+  TokenIndex old = start;
+  while (old < stream->count - 1 && stream->offsets[old] < edit.end) old++;
+
+  TokenStream* replacement = tokenStreamAllocate(source);
+  Lexer* lexer = lexerCreate(source + restart);
+  TokenIndex end = stream->count;
+
+  Token* token = lexerNext(lexer);
+  while (token != nullptr) {
+    if (token->type == TokenType::END) {
+      tokenStreamPush(replacement, TokenType::END, lexer->input - source, 0);
+      break;
+    }
+
+    uint32_t offset = token->start - source;
+    uint32_t length = token->end - token->start;
+
+    if (offset >= edit.start + edit.length) {
+      while (old < stream->count - 1 && stream->offsets[old] + delta < offset) old++;
+
+      if (old < stream->count - 1 && stream->offsets[old] + delta == offset
+          && tokenType(stream, old) == token->type && tokenLength(stream, old) == length) {
+        end = old;
+        break;
+      }
+    }
+
+    tokenStreamPush(replacement, token->type, offset, length);
+    token = lexerNext(lexer);
+  }
+
+  bool failed = lexer->failed;
+  lexerDestroy(lexer);
+
+  if (failed) {
+    tokenStreamDestroy(replacement);
+    return false;
+  }
+
+  tokenStreamSplice(stream, start, end, replacement, delta);
+  stream->source = source;
+
+  if (changed != nullptr) {
+    *changed = {start, end, start + replacement->count};
+  }
+
+  tokenStreamDestroy(replacement);
+  return true;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "lex.h"
+
+#include <cstdint>
+
+/* Struct of arrays form of a lexed buffer.
+ * A token is a type, a byte offset into source and a length, stored in three
+ * arrays and addressed by 32 bit index. Lengths that do not fit in 16 bits are
+ * stored as TOKEN_LONG_LENGTH and kept in a side table.
+ *
+ * The stream is lexed on its own or built from a Token array and does not
+ * hold decoded values. It is not on the parse path: the parser's lookahead and
+ * the start and end of tree nodes are Token pointers, so parsing reads 24 byte
+ * Tokens either way. The compact AST, the AST cache and incremental re-lexing
+ * address tokens by index.
+ */
+
+typedef uint32_t TokenIndex;
+
+#define TOKEN_LONG_LENGTH 0xFFFF
+
+struct TokenLongLength {
+  TokenIndex index;
+  uint32_t length;
+};
+
+struct TokenStream {
+  const char* source;
+
+  uint8_t* types;
+  uint32_t* offsets;
+  uint16_t* lengths;
+  uint32_t count;
+  uint32_t capacity;
+
+  // Sorted by index
+  TokenLongLength* long_lengths;
+  uint32_t long_length_count;
+  uint32_t long_length_capacity;
+};
+
+// Returns nullptr if lexing fails. The last token is END.
+TokenStream* tokenStreamCreate(const char* source);
+TokenStream* tokenStreamCreate(const char* source, const Token* tokens);
+void tokenStreamDestroy(TokenStream* stream);
+
+/* An edit replaces the bytes [start, end) of the old source with length bytes.
+ * The edited buffer is passed separately, the stream does not own its source.
+ */
+struct TokenEdit {
+  uint32_t start;
+  uint32_t end;
+  uint32_t length;
+};
+
+// Old tokens [start, old_end) were replaced by the new tokens [start, new_end)
+struct TokenRange {
+  TokenIndex start;
+  TokenIndex old_end;
+  TokenIndex new_end;
+};
+
+// Re-lexes the tokens around an edit of stream->source, source is the buffer after the edit.
+// Returns false and leaves the stream unchanged if the edited buffer fails to lex.
+bool tokenStreamEdit(TokenStream* stream, const char* source, TokenEdit edit, TokenRange* changed);
+
+void tokenStreamPush(TokenStream* stream, TokenType type, uint32_t offset, uint32_t length);
+
+inline TokenType tokenType(const TokenStream* stream, TokenIndex index) {
+  return (TokenType) stream->types[index];
+}
+
+uint32_t tokenLength(const TokenStream* stream, TokenIndex index);
+const char* tokenStart(const TokenStream* stream, TokenIndex index);
+Token tokenGet(const TokenStream* stream, TokenIndex index);
+
+void printToken(const TokenStream* stream, TokenIndex index);
@@ -39,12 +39,9 @@ void vecSet(Vector* vector, int index, void* item) {
 }
 
 void vecPush(Vector* vector, void* item) {
-  if (vector->size == vector->capacity) {
-    int byte_count = std::max(1, 2 * vector->capacity * vector->item_size);
-    void* data = malloc(byte_count);
-    memcpy(data, vector->data, vector->capacity * vector->item_size);
-    free(vector->data);
-    vector->data = data;
+  if (vector->size >= vector->capacity) {
+    vector->capacity = std::max(1, 2 * vector->capacity);
+    vector->data = realloc(vector->data, vector->capacity * vector->item_size);
   }
   
   vecSet(vector, vector->size++, item);
@@ -1,432 +1,1234 @@
 #include "ast_types.h"
+#include "ast_visitor.h"
+#include "compact_ast.h"
+#include "compact_visitor.h"
+#include "parser.h"
+#include "scratch_list.h"
+#include "visit_print.h"
 #include <cassert>
 #include <cstdio>
+#include <cstring>
+
+#define PRINT_BUFFER_SIZE (1 << 20)
+
+/*
+ * Output is collected in one buffer kept between dumps and written with one
+ * fwrite whenever it fills up and at the end of a dump. Indentation is copied
+ * from a run of spaces.
+ */
+struct PrintOutput {
+  char data[PRINT_BUFFER_SIZE];
+  size_t size;
+  int tabs;
+  PrintFormat format;
+  // Per open node of a JSON or S-expression dump, whether it has a child yet
+  ScratchList<bool, 64> open;
+};
+
+PrintOutput print_output;
+
+const char print_spaces[] = "                                                                ";
+
+void printFlush() {
+  fwrite(print_output.data, 1, print_output.size, stdout);
+  print_output.size = 0;
+}
 
+void print(const char* text, size_t length) {
+  if (length > PRINT_BUFFER_SIZE - print_output.size) {
+    printFlush();
 
-int tabs = 0;
-#define printTab(...) for (int i = 0; i < tabs; i++) printf("  "); printf(__VA_ARGS__)
-
-#define printPtrTab(start, end) for (int i = 0; i < tabs; i++) printf("  "); while(start != end) printf("%c", *start++); 
-
-#define printPtr(start, end) while(start != end) printf("%c", *start++); 
-
-void simpleType(SimpleType* node) {
-  switch (node->type) {
-    case ASTType::SIMPLE_TYPE_I8:
-      printTab("I8");
-      break;
-    case ASTType::SIMPLE_TYPE_U8:
-      printTab("U8");
-      break;
-    case ASTType::SIMPLE_TYPE_I32:
-      printTab("I32");
-      break;
-    case ASTType::SIMPLE_TYPE_U32:
-      printTab("U32");
-      break;
-    case ASTType::SIMPLE_TYPE_F32:
-      printTab("F32");
-      break;
-    default:
-      assert(false && "Simple Type");
+    if (length > PRINT_BUFFER_SIZE) {
+      fwrite(text, 1, length, stdout);
+      return;
+    }
   }
-}
-    
-void identifier(Identifier* node) {
-  printTab("Identifier: ");
-  tabs++;
-  printPtr(node->identifier->start, node->identifier->end);
-  if (node->next != nullptr) {
-    printf("\n");
-    printTab("DOT:\n");
-    identifier(node->next);
-  }
-  tabs--;
+
+  memcpy(print_output.data + print_output.size, text, length);
+  print_output.size += length;
 }
 
-void type(Type* node) {
-  printTab("Type:\n");
-  tabs++;
-  switch (node->type) {
-    case ASTType::TYPE_SIMPLE: 
-      simpleType(node->simple_type);
-      break;
-    case ASTType::TYPE_ID:
-      identifier(node->identifier);
-      break;
-    default:
-      assert(false && "Type");
-  }
-  printf("\n");
-  tabs--;
+void print(const char* text) {
+  print(text, strlen(text));
 }
 
-void qualifier(Qualifier* node) {
-  switch (node->type) {
-    case ASTType::QUALIFIER_CONST:
-      printTab("Qualifier: const");
-      break;
-    case ASTType::QUALIFIER_EXPORT:
-      printTab("Qualifier: export");
-      break;
-    case ASTType::QUALIFIER_MUT:
-      printTab("Qualifier: mut");
-      break;
-    default:
-      assert(false && "Qualifier");
+void printIndent() {
+  size_t count = 2 * print_output.tabs;
+  while (count > 0) {
+    size_t length = count < sizeof(print_spaces) - 1 ? count : sizeof(print_spaces) - 1;
+    print(print_spaces, length);
+    count -= length;
   }
 }
 
-void expr(Expr* node);
-void block(Block* node);
+void printTab(const char* text) {
+  printIndent();
+  print(text);
+}
+
+void printInt(int value) {
+  char digits[16];
+  int length = snprintf(digits, sizeof(digits), "%i", value);
+  print(digits, length);
+}
 
-void declaration(Declaration* node) {
-  printTab("Declaration:\n");
-  tabs++;
-  
-  identifier(node->identifier);
-  printf("\n");
-  
-  type(node->decl_type);
+// Source text of a token, the token is not changed
+void printText(const Token* token) {
+  print(token->start, token->end - token->start);
+}
 
-  for (int i = 0; i < node->qualifiers_count; i++) {
-    printf("\n");
-    qualifier(node->qualifiers[i]);
+/*
+ * JSON and S-expression dumps have one node per node of the pointer tree,
+ * named by its ASTType, with its children in the order the text form prints
+ * them. A JSON node is {"node": ..., "children": [...]} and an S-expression
+ * node is (NAME :attribute value ... children). Identifiers and enum members
+ * carry their dotted name, literals their source text and function headers
+ * their export flag. Strings are escaped as in JSON in both.
+ */
+
+// Starts a node as the next child of the open node
+void nodeOpen(ASTType type) {
+  if (print_output.open.size > 0) {
+    bool& has_child = print_output.open.back();
+    if (print_output.format == PrintFormat::JSON) print(has_child ? "," : ", \"children\": [");
+    has_child = true;
+
+    print("\n");
+    printIndent();
   }
 
+  print(print_output.format == PrintFormat::JSON ? "{\"node\": \"" : "(");
+  print(ASTTypes[(int) type]);
+  if (print_output.format == PrintFormat::JSON) print("\"");
 
-  if (node->expr != nullptr) {
-    printTab( "\nSet Expr:\n");
-    expr(node->expr);
+  print_output.open.push(false);
+  print_output.tabs++;
+}
+
+void nodeClose() {
+  print_output.tabs--;
+  bool has_child = print_output.open.pop();
+
+  if (print_output.format == PrintFormat::SEXPR) {
+    print(")");
+    return;
   }
 
-  tabs--;
+  if (has_child) {
+    print("\n");
+    printIndent();
+    print("]");
+  }
+  print("}");
+}
 
+// Starts an attribute of the open node, only before its first child
+void nodeAttribute(const char* name) {
+  if (print_output.format == PrintFormat::JSON) {
+    print(", \"");
+    print(name);
+    print("\": ");
+  }
+  else {
+    print(" :");
+    print(name);
+    print(" ");
+  }
 }
 
-void assignment(Assignment* node) {
-  printTab("Assignment:\n");
-  tabs++;
+void printEscaped(const char* start, const char* end) {
+  const char* run = start;
+
+  for (const char* c = start; c != end; c++) {
+    if (*c != '"' && *c != '\\' && (unsigned char) *c >= 0x20) continue;
+
+    print(run, c - run);
+    if (*c == '"' || *c == '\\') {
+      char escaped[2] = {'\\', *c};
+      print(escaped, 2);
+    }
+    else {
+      char escaped[8];
+      print(escaped, snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char) *c));
+    }
+    run = c + 1;
+  }
 
-  identifier(node->identifier);
-  printf("\n");
-  expr(node->expr);
-  printf("\n");
+  print(run, end - run);
+}
 
-  tabs--;
+void printString(const Token* token) {
+  print("\"");
+  printEscaped(token->start, token->end);
+  print("\"");
 }
 
-void conditional(Conditional* node) {
-  printTab("Conditional:\n");
-  tabs++;
+/*
+ * Nodes with a header line and nothing between their children only add pre
+ * and post hooks, the others print themselves.
+ */
+struct Printer : ASTVisitor<Printer> {
+  using ASTVisitor<Printer>::pre;
+  using ASTVisitor<Printer>::post;
+
+  void simpleType(SimpleType* node) {
+    switch (node->type) {
+      case ASTType::SIMPLE_TYPE_I8:
+        printTab("I8");
+        break;
+      case ASTType::SIMPLE_TYPE_U8:
+        printTab("U8");
+        break;
+      case ASTType::SIMPLE_TYPE_I32:
+        printTab("I32");
+        break;
+      case ASTType::SIMPLE_TYPE_U32:
+        printTab("U32");
+        break;
+      case ASTType::SIMPLE_TYPE_F32:
+        printTab("F32");
+        break;
+      default:
+        assert(false && "Simple Type");
+    }
+  }
 
-  expr(node->condition);
-  block(node->block);
+  void identifier(Identifier* node) {
+    printTab("Identifier: ");
+    print_output.tabs++;
+    printText(node->identifier);
+    if (node->next != nullptr) {
+      print("\n");
+      printTab("DOT:\n");
+      identifier(node->next);
+    }
+    print_output.tabs--;
+  }
 
-  if (node->other != nullptr) {
-    printTab("Else:\n");
-    block(node->other);
+  void pre(Type*) {
+    printTab("Type:\n");
+    print_output.tabs++;
   }
-  tabs--;
-}
 
-void while_(While* node) {
-  printTab("While:\n");
-  tabs++;
+  void post(Type*) {
+    print("\n");
+    print_output.tabs--;
+  }
 
-  expr(node->condition);
-  block(node->block);
+  void qualifier(Qualifier* node) {
+    switch (node->type) {
+      case ASTType::QUALIFIER_CONST:
+        printTab("Qualifier: const");
+        break;
+      case ASTType::QUALIFIER_EXPORT:
+        printTab("Qualifier: export");
+        break;
+      case ASTType::QUALIFIER_MUT:
+        printTab("Qualifier: mut");
+        break;
+      default:
+        assert(false && "Qualifier");
+    }
+  }
 
-  tabs--;
-}
+  void declaration(Declaration* node) {
+    printTab("Declaration:\n");
+    print_output.tabs++;
+    
+    identifier(node->identifier);
+    print("\n");
+    
+    type(node->decl_type);
 
-void break_(Break* node) {
-  printTab("Break\n");
-}
+    for (int i = 0; i < node->qualifiers_count; i++) {
+      print("\n");
+      qualifier(node->qualifiers[i]);
+    }
 
-void continue_(Continue* node) {
-  printTab("Continue\n");
-}
 
-void return_(Return* node) {
-  printTab("Return\n");
+    if (node->expr != nullptr) {
+      printTab( "\nSet Expr:\n");
+      expr(node->expr);
+    }
+
+    print_output.tabs--;
 
-  if (node->expr != nullptr) {
-    tabs++;
+  }
+
+  void assignment(Assignment* node) {
+    printTab("Assignment:\n");
+    print_output.tabs++;
+
+    identifier(node->identifier);
+    print("\n");
     expr(node->expr);
-    tabs--;
+    print("\n");
+
+    print_output.tabs--;
   }
-}
 
-void statement(Statement* node) {
-  printTab("Statement:\n");
-  tabs++;
-  switch (node->type) {
-    case ASTType::STATEMENT_CONDITION:
-      conditional(node->conditional);
-      break;
-    case ASTType::STATEMENT_WHILE:
-      while_(node->while_);
-      break;
-    case ASTType::STATEMENT_BREAK:
-      break_(node->break_);
-      break;
-    case ASTType::STATEMENT_CONTINUE:
-      continue_(node->continue_);
-      break;
-    case ASTType::STATEMENT_RETURN:
-      return_(node->return_);
-      break;
-    case ASTType::STATEMENT_ASSIGN:
-      assignment(node->assignment);
-      break;
-    case ASTType::STATEMENT_EXPR:
-      expr(node->expr);
-      break;
-    default:
-      assert(false && "Statement");
+  Block* conditional(Conditional* node, int step, WalkState&, WalkNone) {
+    switch (step) {
+      case 0:
+        printTab("Conditional:\n");
+        print_output.tabs++;
+
+        expr(node->condition);
+        return node->block;
+
+      case 1:
+        if (node->other != nullptr) {
+          printTab("Else:\n");
+          return node->other;
+        }
+        print_output.tabs--;
+        return nullptr;
+
+      default:
+        print_output.tabs--;
+        return nullptr;
+    }
   }
-  tabs--;
-}
 
-void blockTag(BlockTag* node) {
-  printTab("Block Tag:\n");
-  tabs++;
+  void pre(While*) {
+    printTab("While:\n");
+    print_output.tabs++;
+  }
 
-  switch (node->type) {
-    case ASTType::BLOCK_TAG_BLOCK:
-      block(node->block);
-      break;
-    case ASTType::BLOCK_TAG_STATEMENT:
-      statement(node->statement);
-      break;
-    default:
-      assert(false && "Block Tag");
+  void post(While*) {
+    print_output.tabs--;
   }
 
-  tabs--;
-}
+  void pre(Break*) {
+    printTab("Break\n");
+  }
 
-void block(Block* node) {
-  printTab("Block:\n");
-  tabs++;
+  void pre(Continue*) {
+    printTab("Continue\n");
+  }
 
-  if (node->namespace_ != nullptr) {
-    identifier(node->namespace_);
+  void pre(Return*) {
+    printTab("Return\n");
+    print_output.tabs++;
   }
 
-  if (node->statement != nullptr) {
-    statement(node->statement);
+  void post(Return*) {
+    print_output.tabs--;
   }
 
-  for (int i = 0; i < node->declarations_count; i++) {
-    declaration(node->declarations[i]);
+  void pre(Statement*) {
+    printTab("Statement:\n");
+    print_output.tabs++;
   }
 
-  for (int i = 0; i < node->block_tags_count; i++) {
-    blockTag(node->block_tags[i]);
+  void post(Statement*) {
+    print_output.tabs--;
   }
-  tabs--;
-}
 
-void literal(Literal* node) {
-  // TODO: implement
-  switch (node->type) {
-    case ASTType::LITERAL_STRING:
-      break;
-    case ASTType::LITERAL_INT:
-      break;
-    case ASTType::LITERAL_FLOAT:
-      break;
-    case ASTType::LITERAL_BOOL:
-      break;
-    default:
-      assert(false && "Literal");
+  void pre(BlockTag*) {
+    printTab("Block Tag:\n");
+    print_output.tabs++;
   }
-}
 
-void call(Call* node) {
-  printTab("Call:\n");
-  tabs++;
-  
-  identifier(node->identifier);
-  
-  for (int i = 0; i < node->arguments_count; i++) {
-    expr(node->arguments[i]);
+  void post(BlockTag*) {
+    print_output.tabs--;
   }
 
-  tabs--;
-}
+  void pre(Block*) {
+    printTab("Block:\n");
+    print_output.tabs++;
+  }
 
-void unary(Unary* node) {
-  printTab("Unary:\n");
-  tabs++;
-  
-  switch (node->type) {
-    case ASTType::UNARY_NOT:
-      printTab("Operator : NOT\n");
-      break;
-    case ASTType::UNARY_PLUS:
-      printTab("Operator : PLUS\n");
-      break;
-    case ASTType::UNARY_MINUS:
-      printTab("Operator : MINUS\n");
-      break;
-    default:
-      assert(false && "Unary");
-  }
-
-  expr(node->expr);
-
-  tabs--;
-}
+  void post(Block*) {
+    print_output.tabs--;
+  }
 
-void binary(Binary* node) {
-  printTab("Binary:\n");
-  tabs++;
+  void literal(Literal* node) {
+    // TODO: implement
+    switch (node->type) {
+      case ASTType::LITERAL_STRING:
+        break;
+      case ASTType::LITERAL_INT:
+        break;
+      case ASTType::LITERAL_FLOAT:
+        break;
+      case ASTType::LITERAL_BOOL:
+        break;
+      default:
+        assert(false && "Literal");
+    }
+  }
 
-  printTab("Operator: %s\n", ASTTypes[(int)node->type]);
+  void pre(Call*) {
+    printTab("Call:\n");
+    print_output.tabs++;
+  }
 
-  expr(node->first);
-  expr(node->second);
+  void post(Call*) {
+    print_output.tabs--;
+  }
 
-  tabs--;
-}
+  void pre(Unary* node) {
+    printTab("Unary:\n");
+    print_output.tabs++;
+    
+    switch (node->type) {
+      case ASTType::UNARY_NOT:
+        printTab("Operator : NOT\n");
+        break;
+      case ASTType::UNARY_PLUS:
+        printTab("Operator : PLUS\n");
+        break;
+      case ASTType::UNARY_MINUS:
+        printTab("Operator : MINUS\n");
+        break;
+      default:
+        assert(false && "Unary");
+    }
+  }
 
-void expr(Expr* node) {
-  printTab("Expr:\n");
-  tabs++;
-
-  switch (node->type) {
-    case ASTType::EXPRESSION_CALL:
-      call(node->call);
-      break;
-    case ASTType::EXPRESSION_UNARY:
-      unary(node->unary);
-      break;
-    case ASTType::EXPRESSION_BINARY:
-      binary(node->binary);
-      break;
-    case ASTType::EXPRESSION_IDENTIFIER:
-      identifier(node->identifier);
-      break;
-    case ASTType::EXPRESSION_LITERAL:
-      literal(node->literal);
-      break;
-    default:
-      assert(false && "Expr");
-  }
-  printf("\n");
-
-  tabs--;
-}
+  void post(Unary*) {
+    print_output.tabs--;
+  }
 
-void functionParam(FunctionParam* node) {
-  printTab("Param:\n");
-  tabs++;
-  identifier(node->identifier);
-  printf("\n");
-  type(node->decl_type);
-  tabs--;
-}
+  void pre(Binary* node) {
+    printTab("Binary:\n");
+    print_output.tabs++;
 
-void functionHeader(FunctionHeader* node) {
-  printTab("Function Header:\n");
-  tabs++;
-  identifier(node->identifier);
-  printf("\n");
+    printTab("Operator: ");
+    print(ASTTypes[(int)node->type]);
+    print("\n");
+  }
 
-  printTab("Export: %i\n", node->export_);
+  void post(Binary*) {
+    print_output.tabs--;
+  }
 
-  printTab("Return Type:\n");
-  type(node->return_type);
+  void pre(Expr*) {
+    printTab("Expr:\n");
+    print_output.tabs++;
+  }
 
-  for (int i = 0; i < node->parameter_count; i++) {
-    functionParam(node->parameter_list[i]);
+  void post(Expr*) {
+    print("\n");
+    print_output.tabs--;
   }
-  tabs--;
-}
 
-void function(Function* node) {
-  printTab("Function:\n");
-  tabs++;
+  void functionParam(FunctionParam* node) {
+    printTab("Param:\n");
+    print_output.tabs++;
+    identifier(node->identifier);
+    print("\n");
+    type(node->decl_type);
+    print_output.tabs--;
+  }
 
-  functionHeader(node->header);
+  void functionHeader(FunctionHeader* node) {
+    printTab("Function Header:\n");
+    print_output.tabs++;
+    identifier(node->identifier);
+    print("\n");
 
-  if (node->expr != nullptr) {
-    expr(node->expr);
+    printTab("Export: ");
+    printInt(node->export_);
+    print("\n");
+
+    printTab("Return Type:\n");
+    type(node->return_type);
+
+    for (int i = 0; i < node->parameter_count; i++) {
+      functionParam(node->parameter_list[i]);
+    }
+    print_output.tabs--;
   }
 
-  if (node->block != nullptr) {
-    block(node->block);
+  void pre(Function*) {
+    printTab("Function:\n");
+    print_output.tabs++;
   }
 
-  tabs--;
-}
+  void post(Function*) {
+    print_output.tabs--;
+  }
+
+  void struct_(Struct* node) {
+    printTab("Struct:\n");
+    print_output.tabs++;
 
-void struct_(Struct* node) {
-  printTab("Struct:\n");
-  tabs++;
+    identifier(node->identifier);
 
-  identifier(node->identifier);
+    for (int i = 0; i < node->declarations_count; i++) {
+      print("\n");
+      declaration(node->declarations[i]);
+    }
 
-  for (int i = 0; i < node->declarations_count; i++) {
-    printf("\n");
-    declaration(node->declarations[i]);
+    print("\n");
+
+    print_output.tabs--;
   }
 
-  printf("\n");
+  void enum_(Enum* node) {
+    printTab("Enum:\n");
+    print_output.tabs++;
 
-  tabs--;
-}
+    identifier(node->identifier);
+    
+    for (int i = 0; i < node->members_count; i++) {
+      printIndent();
+      printText(node->members[i]);
+      print("\n");
+    }
+    print("\n");
+    print_output.tabs--;
+  }
 
-void enum_(Enum* node) {
-  printTab("Enum:\n");
-  tabs++;
+  void pre(PrimaryTag*) {
+    printTab("Primary Tag:\n");
+    print_output.tabs++;
+  }
 
-  identifier(node->identifier);
-  
-  for (int i = 0; i < node->members_count; i++) {
-    printPtrTab(node->members[i]->start, node->members[i]->end);
-    printf("\n");
+  void post(PrimaryTag*) {
+    print_output.tabs--;
   }
-  printf("\n");
-  tabs--;
-}
 
-void primaryTag(PrimaryTag* node) {
-  printTab("Primary Tag:\n");
-  tabs++;
-  switch (node->type) {
-    case ASTType::PRIMARY_TAG_DECL:
-      declaration(node->decl);
-      break;
-    case ASTType::PRIMARY_TAG_ENUM:
-      enum_(node->enum_);
-      break;
-    case ASTType::PRIMARY_TAG_FUNC:
-      function(node->func);
-      break;
-    case ASTType::PRIMARY_TAG_STRUCT:
-      struct_(node->struct_);
-      break;
-    default:
-      assert(false && "Primary Tag");
-  }
-  tabs--;
-}
+  void pre(Primary*) {
+    printTab("Primary:\n");
+    print_output.tabs++;
+  }
+
+  void post(Primary*) {
+    print_output.tabs--;
+  }
+};
+
+// Every node opens in pre and closes in post, the nodes with attributes print themselves
+struct TreePrinter : ASTVisitor<TreePrinter> {
+  template <typename Node>
+  void pre(Node* node) {
+    nodeOpen(node->type);
+  }
+
+  template <typename Node>
+  void post(Node*) {
+    nodeClose();
+  }
+
+  void pre(FunctionHeader* node) {
+    nodeOpen(node->type);
+    nodeAttribute("export");
+    print(node->export_ ? "true" : "false");
+  }
+
+  void identifier(Identifier* node) {
+    nodeOpen(ASTType::IDENTIFIER);
+    nodeAttribute("name");
+
+    print("\"");
+    for (Identifier* part = node; part != nullptr; part = part->next) {
+      if (part != node) print(".");
+      printEscaped(part->identifier->start, part->identifier->end);
+    }
+    print("\"");
+
+    nodeClose();
+  }
+
+  void literal(Literal* node) {
+    nodeOpen(node->type);
+    nodeAttribute("value");
+    printString(node->start);
+    nodeClose();
+  }
+
+  void enum_(Enum* node) {
+    nodeOpen(node->type);
+    identifier(node->identifier);
+
+    for (int i = 0; i < node->members_count; i++) {
+      nodeOpen(ASTType::IDENTIFIER);
+      nodeAttribute("name");
+      printString(node->members[i]);
+      nodeClose();
+    }
 
-void primary(Primary* node) {
-  printTab("Primary:\n");
-  tabs++;
-  for (int i = 0; i < node->primary_tags_count; i++) {
-    primaryTag(node->primary_tags[i]);
+    nodeClose();
   }
-  tabs--;
+};
+
+void visitPrint(Primary* node, PrintFormat format) {
+  print_output.format = format;
+
+  if (format == PrintFormat::TEXT) {
+    Printer printer;
+    printer.primary(node);
+  }
+  else {
+    TreePrinter printer;
+    printer.primary(node);
+    print("\n");
+  }
+
+  printFlush();
 }
 
 
-void visitPrint(Primary* node) {
-  primary(node);
+/*
+ * Same output for the compact form. Text is printed from the token stream,
+ * which is never written to. Statements, block tags and expressions use the
+ * walk of CompactVisitor with the same hooks as Printer and TreePrinter.
+ */
+namespace compact {
+
+struct Printer : CompactVisitor<Printer> {
+  void printText(TokenIndex token) {
+    print(compactTokenStart(ast, token), compactTokenLength(ast, token));
+  }
+
+  void simpleType(ASTType type) {
+    switch (type) {
+      case ASTType::SIMPLE_TYPE_I8:
+        printTab("I8");
+        break;
+      case ASTType::SIMPLE_TYPE_U8:
+        printTab("U8");
+        break;
+      case ASTType::SIMPLE_TYPE_I32:
+        printTab("I32");
+        break;
+      case ASTType::SIMPLE_TYPE_U32:
+        printTab("U32");
+        break;
+      case ASTType::SIMPLE_TYPE_F32:
+        printTab("F32");
+        break;
+      default:
+        assert(false && "Simple Type");
+    }
+  }
+
+  void identifier(NodeIndex index) {
+    CompactIdentifier& node = ast->identifiers[index];
+    printTab("Identifier: ");
+    print_output.tabs++;
+    printText(node.token);
+    if (node.rest != 0) {
+      print("\n");
+      printTab("DOT:\n");
+      identifier(index + 1);
+    }
+    print_output.tabs--;
+  }
+
+  void type(NodeIndex index) {
+    CompactType& node = ast->types[index];
+    printTab("Type:\n");
+    print_output.tabs++;
+    switch (node.type) {
+      case ASTType::TYPE_SIMPLE:
+        simpleType(node.simple_type);
+        break;
+      case ASTType::TYPE_ID:
+        identifier(node.identifier);
+        break;
+      default:
+        assert(false && "Type");
+    }
+    print("\n");
+    print_output.tabs--;
+  }
+
+  void qualifier(ASTType type) {
+    switch (type) {
+      case ASTType::QUALIFIER_CONST:
+        printTab("Qualifier: const");
+        break;
+      case ASTType::QUALIFIER_EXPORT:
+        printTab("Qualifier: export");
+        break;
+      case ASTType::QUALIFIER_MUT:
+        printTab("Qualifier: mut");
+        break;
+      default:
+        assert(false && "Qualifier");
+    }
+  }
+
+  void declaration(NodeIndex index) {
+    CompactDeclaration& node = ast->declarations[index];
+    printTab("Declaration:\n");
+    print_output.tabs++;
+
+    identifier(node.identifier);
+    print("\n");
+
+    type(node.decl_type);
+
+    for (uint32_t i = 0; i < node.qualifiers.count; i++) {
+      print("\n");
+      qualifier(ast->qualifiers[node.qualifiers.first + i]);
+    }
+
+    if (node.expr != NODE_NONE) {
+      printTab( "\nSet Expr:\n");
+      expr(node.expr);
+    }
+
+    print_output.tabs--;
+  }
+
+  void assignment(CompactStatement& node) {
+    printTab("Assignment:\n");
+    print_output.tabs++;
+    identifier(node.identifier);
+    print("\n");
+    expr(node.expr);
+    print("\n");
+    print_output.tabs--;
+  }
+
+  NodeIndex conditional(CompactStatement& node, int step, WalkState&, WalkNone) {
+    switch (step) {
+      case 0:
+        printTab("Conditional:\n");
+        print_output.tabs++;
+
+        expr(node.expr);
+        return node.block;
+
+      case 1:
+        if (node.other != NODE_NONE) {
+          printTab("Else:\n");
+          return node.other;
+        }
+        print_output.tabs--;
+        return NODE_NONE;
+
+      default:
+        print_output.tabs--;
+        return NODE_NONE;
+    }
+  }
+
+  NodeIndex while_(CompactStatement& node, int step, WalkState&, WalkNone) {
+    if (step == 0) {
+      printTab("While:\n");
+      print_output.tabs++;
+
+      expr(node.expr);
+      return node.block;
+    }
+
+    print_output.tabs--;
+    return NODE_NONE;
+  }
+
+  void break_(CompactStatement&) {
+    printTab("Break\n");
+  }
+
+  void continue_(CompactStatement&) {
+    printTab("Continue\n");
+  }
+
+  void return_(CompactStatement& node) {
+    printTab("Return\n");
+    if (node.expr != NODE_NONE) {
+      print_output.tabs++;
+      expr(node.expr);
+      print_output.tabs--;
+    }
+  }
+
+  void pre(CompactStatement*) {
+    printTab("Statement:\n");
+    print_output.tabs++;
+  }
+
+  void post(CompactStatement*) {
+    print_output.tabs--;
+  }
+
+  void pre(CompactTag*) {
+    printTab("Block Tag:\n");
+    print_output.tabs++;
+  }
+
+  void post(CompactTag*) {
+    print_output.tabs--;
+  }
+
+  void pre(CompactBlock*) {
+    printTab("Block:\n");
+    print_output.tabs++;
+  }
+
+  void post(CompactBlock*) {
+    print_output.tabs--;
+  }
+
+  void blockEnter(CompactBlock& node) {
+    if (node.namespace_ != NODE_NONE) {
+      identifier(node.namespace_);
+    }
+  }
+
+  void pre(CompactExpr* node) {
+    printTab("Expr:\n");
+    print_output.tabs++;
+
+    switch (node->type) {
+      case ASTType::EXPRESSION_CALL:
+        printTab("Call:\n");
+        print_output.tabs++;
+        break;
+      case ASTType::EXPRESSION_UNARY:
+        printTab("Unary:\n");
+        print_output.tabs++;
+        switch (node->op) {
+          case ASTType::UNARY_NOT:
+            printTab("Operator : NOT\n");
+            break;
+          case ASTType::UNARY_PLUS:
+            printTab("Operator : PLUS\n");
+            break;
+          case ASTType::UNARY_MINUS:
+            printTab("Operator : MINUS\n");
+            break;
+          default:
+            assert(false && "Unary");
+        }
+        break;
+      case ASTType::EXPRESSION_BINARY:
+        printTab("Binary:\n");
+        print_output.tabs++;
+        printTab("Operator: ");
+        print(ASTTypes[(int)node->op]);
+        print("\n");
+        break;
+      default:
+        break;
+    }
+  }
+
+  void post(CompactExpr* node) {
+    switch (node->type) {
+      case ASTType::EXPRESSION_CALL:
+      case ASTType::EXPRESSION_UNARY:
+      case ASTType::EXPRESSION_BINARY:
+        print_output.tabs--;
+        break;
+      default:
+        break;
+    }
+    print("\n");
+    print_output.tabs--;
+  }
+
+  void identifierValue(NodeIndex index) {
+    identifier(index);
+  }
+
+  void literal(CompactExpr&) {
+    // TODO: implement
+  }
+
+  void callee(CompactExpr& node) {
+    identifier(node.identifier);
+  }
+
+  void function(NodeIndex index) {
+    CompactFunction& node = ast->functions[index];
+    printTab("Function:\n");
+    print_output.tabs++;
+
+    printTab("Function Header:\n");
+    print_output.tabs++;
+    identifier(node.identifier);
+    print("\n");
+
+    printTab("Export: ");
+    printInt(node.export_);
+    print("\n");
+
+    printTab("Return Type:\n");
+    type(node.return_type);
+
+    for (uint32_t i = 0; i < node.params.count; i++) {
+      CompactParam& param = ast->params[node.params.first + i];
+      printTab("Param:\n");
+      print_output.tabs++;
+      identifier(param.identifier);
+      print("\n");
+      type(param.decl_type);
+      print_output.tabs--;
+    }
+    print_output.tabs--;
+
+    if (node.block != NODE_NONE) {
+      block(node.block);
+    }
+
+    print_output.tabs--;
+  }
+
+  void struct_(NodeIndex index) {
+    CompactStruct& node = ast->structs[index];
+    printTab("Struct:\n");
+    print_output.tabs++;
+
+    identifier(node.identifier);
+
+    for (uint32_t i = 0; i < node.declarations.count; i++) {
+      print("\n");
+      declaration(node.declarations.first + i);
+    }
+
+    print("\n");
+
+    print_output.tabs--;
+  }
+
+  void enum_(NodeIndex index) {
+    CompactEnum& node = ast->enums[index];
+    printTab("Enum:\n");
+    print_output.tabs++;
+
+    identifier(node.identifier);
+
+    for (uint32_t i = 0; i < node.members.count; i++) {
+      printIndent();
+      printText(ast->identifiers[node.members.first + i].token);
+      print("\n");
+    }
+    print("\n");
+    print_output.tabs--;
+  }
+
+  void primaryTag(CompactTag& node) {
+    printTab("Primary Tag:\n");
+    print_output.tabs++;
+    switch (node.type) {
+      case ASTType::PRIMARY_TAG_DECL:
+        declaration(node.child);
+        break;
+      case ASTType::PRIMARY_TAG_ENUM:
+        enum_(node.child);
+        break;
+      case ASTType::PRIMARY_TAG_FUNC:
+        function(node.child);
+        break;
+      case ASTType::PRIMARY_TAG_STRUCT:
+        struct_(node.child);
+        break;
+      default:
+        assert(false && "Primary Tag");
+    }
+    print_output.tabs--;
+  }
+
+  void primary() {
+    printTab("Primary:\n");
+    print_output.tabs++;
+    for (uint32_t i = 0; i < ast->primary_tags.count; i++) {
+      primaryTag(ast->primary_tags[i]);
+    }
+    print_output.tabs--;
+  }
+};
+
+/*
+ * JSON and S-expression dumps of the compact form, with the nodes the
+ * pointer tree has where the compact form folds them.
+ */
+struct TreePrinter : CompactVisitor<TreePrinter> {
+  void printString(TokenIndex token) {
+    const char* start = compactTokenStart(ast, token);
+    print("\"");
+    printEscaped(start, start + compactTokenLength(ast, token));
+    print("\"");
+  }
+
+  void identifier(NodeIndex index) {
+    nodeOpen(ASTType::IDENTIFIER);
+    nodeAttribute("name");
+
+    print("\"");
+    for (NodeIndex part = index; ; part++) {
+      const char* start = compactTokenStart(ast, ast->identifiers[part].token);
+      if (part != index) print(".");
+      printEscaped(start, start + compactTokenLength(ast, ast->identifiers[part].token));
+      if (ast->identifiers[part].rest == 0) break;
+    }
+    print("\"");
+
+    nodeClose();
+  }
+
+  void type(NodeIndex index) {
+    CompactType& node = ast->types[index];
+    nodeOpen(node.type);
+    switch (node.type) {
+      case ASTType::TYPE_SIMPLE:
+        nodeOpen(node.simple_type);
+        nodeClose();
+        break;
+      case ASTType::TYPE_ID:
+        identifier(node.identifier);
+        break;
+      default:
+        assert(false && "Type");
+    }
+    nodeClose();
+  }
+
+  void declaration(NodeIndex index) {
+    CompactDeclaration& node = ast->declarations[index];
+    nodeOpen(ASTType::DECLARATION);
+
+    identifier(node.identifier);
+    type(node.decl_type);
+
+    for (uint32_t i = 0; i < node.qualifiers.count; i++) {
+      nodeOpen(ast->qualifiers[node.qualifiers.first + i]);
+      nodeClose();
+    }
+
+    if (node.expr != NODE_NONE) {
+      expr(node.expr);
+    }
+
+    nodeClose();
+  }
+
+  void assignment(CompactStatement& node) {
+    nodeOpen(ASTType::ASSIGNMENT);
+    identifier(node.identifier);
+    expr(node.expr);
+    nodeClose();
+  }
+
+  NodeIndex conditional(CompactStatement& node, int step, WalkState&, WalkNone) {
+    switch (step) {
+      case 0:
+        nodeOpen(ASTType::CONDITIONAL);
+        expr(node.expr);
+        return node.block;
+
+      case 1:
+        if (node.other != NODE_NONE) return node.other;
+        nodeClose();
+        return NODE_NONE;
+
+      default:
+        nodeClose();
+        return NODE_NONE;
+    }
+  }
+
+  NodeIndex while_(CompactStatement& node, int step, WalkState&, WalkNone) {
+    if (step == 0) {
+      nodeOpen(ASTType::WHILE);
+      expr(node.expr);
+      return node.block;
+    }
+
+    nodeClose();
+    return NODE_NONE;
+  }
+
+  void break_(CompactStatement&) {
+    nodeOpen(ASTType::BREAK);
+    nodeClose();
+  }
+
+  void continue_(CompactStatement&) {
+    nodeOpen(ASTType::CONTINUE);
+    nodeClose();
+  }
+
+  void return_(CompactStatement& node) {
+    nodeOpen(ASTType::RETURN);
+    if (node.expr != NODE_NONE) {
+      expr(node.expr);
+    }
+    nodeClose();
+  }
+
+  void pre(CompactStatement* node) {
+    nodeOpen(node->type);
+  }
+
+  void post(CompactStatement*) {
+    nodeClose();
+  }
+
+  void pre(CompactTag* node) {
+    nodeOpen(node->type);
+  }
+
+  void post(CompactTag*) {
+    nodeClose();
+  }
+
+  void pre(CompactBlock*) {
+    nodeOpen(ASTType::BLOCK);
+  }
+
+  void post(CompactBlock*) {
+    nodeClose();
+  }
+
+  void blockEnter(CompactBlock& node) {
+    if (node.namespace_ != NODE_NONE) {
+      identifier(node.namespace_);
+    }
+  }
+
+  void pre(CompactExpr* node) {
+    nodeOpen(node->type);
+
+    switch (node->type) {
+      case ASTType::EXPRESSION_CALL:
+        nodeOpen(ASTType::CALL);
+        break;
+      case ASTType::EXPRESSION_UNARY:
+      case ASTType::EXPRESSION_BINARY:
+        nodeOpen(node->op);
+        break;
+      default:
+        break;
+    }
+  }
+
+  void post(CompactExpr* node) {
+    switch (node->type) {
+      case ASTType::EXPRESSION_CALL:
+      case ASTType::EXPRESSION_UNARY:
+      case ASTType::EXPRESSION_BINARY:
+        nodeClose();
+        break;
+      default:
+        break;
+    }
+    nodeClose();
+  }
+
+  void identifierValue(NodeIndex index) {
+    identifier(index);
+  }
+
+  void literal(CompactExpr& node) {
+    nodeOpen(node.op);
+    nodeAttribute("value");
+    printString(node.start);
+    nodeClose();
+  }
+
+  void callee(CompactExpr& node) {
+    identifier(node.identifier);
+  }
+
+  void function(NodeIndex index) {
+    CompactFunction& node = ast->functions[index];
+    nodeOpen(node.type);
+
+    nodeOpen(ASTType::FUNC_HEADER);
+    nodeAttribute("export");
+    print(node.export_ ? "true" : "false");
+
+    identifier(node.identifier);
+    type(node.return_type);
+
+    for (uint32_t i = 0; i < node.params.count; i++) {
+      CompactParam& param = ast->params[node.params.first + i];
+      nodeOpen(ASTType::FUNC_PARAM);
+      identifier(param.identifier);
+      type(param.decl_type);
+      nodeClose();
+    }
+    nodeClose();
+
+    if (node.block != NODE_NONE) {
+      block(node.block);
+    }
+
+    nodeClose();
+  }
+
+  void struct_(NodeIndex index) {
+    CompactStruct& node = ast->structs[index];
+    nodeOpen(ASTType::STRUCT);
+
+    identifier(node.identifier);
+
+    for (uint32_t i = 0; i < node.declarations.count; i++) {
+      declaration(node.declarations.first + i);
+    }
+
+    nodeClose();
+  }
+
+  void enum_(NodeIndex index) {
+    CompactEnum& node = ast->enums[index];
+    nodeOpen(ASTType::ENUM);
+
+    identifier(node.identifier);
+
+    for (uint32_t i = 0; i < node.members.count; i++) {
+      nodeOpen(ASTType::IDENTIFIER);
+      nodeAttribute("name");
+      printString(ast->identifiers[node.members.first + i].token);
+      nodeClose();
+    }
+
+    nodeClose();
+  }
+
+  void primary() {
+    nodeOpen(ASTType::PRIMARY);
+
+    for (uint32_t i = 0; i < ast->primary_tags.count; i++) {
+      CompactTag& tag = ast->primary_tags[i];
+      nodeOpen(tag.type);
+      switch (tag.type) {
+        case ASTType::PRIMARY_TAG_DECL:
+          declaration(tag.child);
+          break;
+        case ASTType::PRIMARY_TAG_ENUM:
+          enum_(tag.child);
+          break;
+        case ASTType::PRIMARY_TAG_FUNC:
+          function(tag.child);
+          break;
+        case ASTType::PRIMARY_TAG_STRUCT:
+          struct_(tag.child);
+          break;
+        default:
+          assert(false && "Primary Tag");
+      }
+      nodeClose();
+    }
+
+    nodeClose();
+  }
+};
+
 }
 
+void visitPrint(CompactAst* ast, PrintFormat format) {
+  print_output.format = format;
+
+  if (format == PrintFormat::TEXT) {
+    compact::Printer printer;
+    printer.ast = ast;
+    printer.primary();
+  }
+  else {
+    compact::TreePrinter printer;
+    printer.ast = ast;
+    printer.primary();
+    print("\n");
+  }
+
+  printFlush();
+}
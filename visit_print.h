@@ -1,5 +1,15 @@
 #pragma once
 
 #include "ast_types.h"
+#include "compact_ast.h"
 
-void visitPrint(Primary* node);
+enum class PrintFormat {
+  TEXT,
+  JSON,
+  // S-expressions
+  SEXPR,
+};
+
+// Prints to stdout, a tree printed as JSON is one JSON value
+void visitPrint(Primary* node, PrintFormat format = PrintFormat::TEXT);
+void visitPrint(CompactAst* ast, PrintFormat format = PrintFormat::TEXT);